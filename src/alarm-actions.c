@@ -9,38 +9,21 @@
 #include "alarm-actions.h"
 #include "alarm-applet.h"
 #include "alarm-list-window.h"
+#include "trace.h"
 
 #define GET_ACTION(map, name) G_SIMPLE_ACTION(g_action_map_lookup_action(G_ACTION_MAP(map), (name)))
 
 /**
- * Initialize the various actions
+ * Initialize the global actions
  */
 void alarm_applet_actions_init(AlarmApplet* applet)
 {
-    GtkBuilder* builder = applet->ui;
-
-    // Actions on one alarm
-    const GActionEntry win_action_entries[] = {
-        { "alarm_new", alarm_action_new },
-        { "alarm_edit", alarm_action_edit },
-        { "alarm_delete", alarm_action_delete },
-        { "alarm_stop", alarm_action_stop },
-        { "alarm_snooze", alarm_action_snooze },
-        { "alarm_enable", alarm_action_enable, NULL, "false" },
-    };
-    g_action_map_add_action_entries(G_ACTION_MAP(applet->list_window->window), win_action_entries, G_N_ELEMENTS(win_action_entries), applet);
-
-    applet->action_edit = GET_ACTION(applet->list_window->window, "alarm_edit");
-    applet->action_delete = GET_ACTION(applet->list_window->window, "alarm_delete");
-    applet->action_enable = GET_ACTION(applet->list_window->window, "alarm_enable");
-    applet->action_stop = GET_ACTION(applet->list_window->window, "alarm_stop");
-    applet->action_snooze = GET_ACTION(applet->list_window->window, "alarm_snooze");
-
     // Global actions
     const GActionEntry app_action_entries[] = {
         { "snooze_all", alarm_action_snooze_all },
         { "stop_all", alarm_action_stop_all },
         { "quit", alarm_action_quit },
+        { "dump_trace", alarm_action_dump_trace },
         { "show_alarms_list", alarm_action_toggle_list_win },
         { "autostart", alarm_action_toggle_autostart, NULL, "false" },
         { "show_countdown", alarm_action_toggle_show_label, NULL, "false" },
@@ -64,6 +47,32 @@ void alarm_applet_actions_init(AlarmApplet* applet)
     alarm_applet_actions_update_sensitive(applet);
 }
 
+/**
+ * Initialize the actions on one alarm, once the list window exists
+ */
+void alarm_applet_actions_win_init(AlarmApplet* applet)
+{
+    const GActionEntry win_action_entries[] = {
+        { "alarm_new", alarm_action_new },
+        { "alarm_edit", alarm_action_edit },
+        { "alarm_delete", alarm_action_delete },
+        { "alarm_stop", alarm_action_stop },
+        { "alarm_snooze", alarm_action_snooze },
+        { "alarm_enable", alarm_action_enable, NULL, "false" },
+    };
+    g_action_map_add_action_entries(G_ACTION_MAP(applet->list_window->window), win_action_entries, G_N_ELEMENTS(win_action_entries), applet);
+
+    applet->action_edit = GET_ACTION(applet->list_window->window, "alarm_edit");
+    applet->action_delete = GET_ACTION(applet->list_window->window, "alarm_delete");
+    applet->action_enable = GET_ACTION(applet->list_window->window, "alarm_enable");
+    applet->action_stop = GET_ACTION(applet->list_window->window, "alarm_stop");
+    applet->action_snooze = GET_ACTION(applet->list_window->window, "alarm_snooze");
+
+    // Update actions
+    alarm_applet_actions_update_sensitive(applet);
+    alarm_action_update_enabled(applet);
+}
+
 
 //
 // SINGLE ALARM ACTIONS:
@@ -89,7 +98,7 @@ void alarm_action_edit(GSimpleAction* action, GVariant* parameter, gpointer data
     alarm_clear(a);
 
     // Show settings dialog for alarm
-    alarm_settings_dialog_show(applet->settings_dialog, a);
+    alarm_settings_dialog_show(alarm_applet_settings_dialog_get(applet), a);
     g_object_unref(a);
 }
 
@@ -160,6 +169,9 @@ void alarm_action_enable(GSimpleAction* action, GVariant* parameter, gpointer da
  */
 void alarm_action_update_enabled(AlarmApplet* applet)
 {
+    if(!applet->list_window)
+        return;
+
     Alarm* a = alarm_list_window_get_selected_alarm(applet->list_window);
     if(!a)
         return;
@@ -236,7 +248,7 @@ void alarm_action_new(GSimpleAction* action, GVariant* parameter, gpointer data)
     g_debug("AlarmAction: new");
 
     // Create new alarm, will fall back to defaults.
-    alarm = alarm_new(applet, applet->settings_global, -1);
+    alarm = alarm_new(applet->settings_global, -1);
 
     // Set first sound / app in list
     if(applet->sounds != NULL) {
@@ -262,7 +274,7 @@ void alarm_action_new(GSimpleAction* action, GVariant* parameter, gpointer data)
     alarm_update_gsettings_alarm_list(applet->settings_global, applet->alarms);
 
     // Show edit alarm dialog
-    alarm_settings_dialog_show(applet->settings_dialog, alarm);
+    alarm_settings_dialog_show(alarm_applet_settings_dialog_get(applet), alarm);
 }
 
 /**
@@ -295,7 +307,7 @@ void alarm_action_snooze_all(GSimpleAction* action, GVariant* parameter, gpointe
 void alarm_action_toggle_list_win(GSimpleAction* action, GVariant* parameter, gpointer data)
 {
     AlarmApplet* applet = (AlarmApplet*)data;
-    AlarmListWindow* list_window = applet->list_window;
+    AlarmListWindow* list_window = alarm_applet_list_window_get(applet);
     gboolean active = !gtk_widget_get_mapped(GTK_WIDGET(list_window->window));
 
     g_debug("AlarmAction: toggle list window");
@@ -326,6 +338,23 @@ void alarm_action_quit(GSimpleAction* action, GVariant* parameter, gpointer data
     g_application_quit(G_APPLICATION(applet->application));
 }
 
+/*
+ * Dump trace action, for use over D-Bus through org.gtk.Actions
+ */
+void alarm_action_dump_trace(GSimpleAction* action, GVariant* parameter, gpointer data)
+{
+    GError* error = NULL;
+    gchar* path = trace_dump_to_file(&error);
+
+    if(path) {
+        g_debug("AlarmAction: Trace written to %s", path);
+        g_free(path);
+    } else {
+        g_warning("AlarmAction: Could not write trace: %s", error->message);
+        g_error_free(error);
+    }
+}
+
 /*
  * Toggle autostart action
  */
@@ -376,10 +405,23 @@ void alarm_action_toggle_show_label(GSimpleAction* action, GVariant* parameter,
  */
 void alarm_applet_actions_update_sensitive(AlarmApplet* applet)
 {
+    //
+    // Update global actions
+    //
+
+    // If there are alarms triggered, snooze_all and stop_all should be sensitive
+    g_simple_action_set_enabled(GET_ACTION(applet->application, "stop_all"), applet->n_triggered > 0);
+    g_simple_action_set_enabled(GET_ACTION(applet->application, "snooze_all"), applet->n_triggered > 0);
+
+
     //
     // Update single alarm actions:
     //
 
+    // These live on the list window, which may not have been built yet
+    if(!applet->list_window)
+        return;
+
     // Determine whether there is a selected alarm
     Alarm* a = alarm_list_window_get_selected_alarm(applet->list_window);
     gboolean selected = (a != NULL);
@@ -390,15 +432,6 @@ void alarm_applet_actions_update_sensitive(AlarmApplet* applet)
     g_simple_action_set_enabled(applet->action_stop, selected && a->triggered);
     g_simple_action_set_enabled(applet->action_snooze, selected && a->triggered);
 
-
-    //
-    // Update global actions
-    //
-
-    // If there are alarms triggered, snooze_all and stop_all should be sensitive
-    g_simple_action_set_enabled(GET_ACTION(applet->application, "stop_all"), applet->n_triggered > 0);
-    g_simple_action_set_enabled(GET_ACTION(applet->application, "snooze_all"), applet->n_triggered > 0);
-
     // Perhaps not the best place for this (as it's not an action)
     // This is needed because the action being disabled does not affect the GtkMenuButton
     gtk_widget_set_sensitive(applet->list_window->snooze_button, selected && a->triggered);
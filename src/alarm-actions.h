@@ -13,6 +13,8 @@
 
 void alarm_applet_actions_init(AlarmApplet* applet);
 
+void alarm_applet_actions_win_init(AlarmApplet* applet);
+
 void alarm_applet_actions_update_sensitive(AlarmApplet* applet);
 
 void alarm_action_update_enabled(AlarmApplet* applet);
@@ -37,6 +39,8 @@ void alarm_action_toggle_list_win(GSimpleAction* action, GVariant* parameter, gp
 
 void alarm_action_quit(GSimpleAction* action, GVariant* parameter, gpointer data);
 
+void alarm_action_dump_trace(GSimpleAction* action, GVariant* parameter, gpointer data);
+
 void alarm_action_toggle_autostart(GSimpleAction* action, GVariant* parameter, gpointer data);
 
 void alarm_action_toggle_show_label(GSimpleAction* action, GVariant* parameter, gpointer data);
@@ -7,26 +7,21 @@
  */
 
 #include <stdlib.h>
+#include <glib/gstdio.h>
 
 #include "alarm-applet.h"
 
 #include "alarm.h"
+#include "alarm-service.h"
 #include "alarm-settings.h"
-
-/*
- * DEFINTIIONS {{
- */
-
-static const gchar* supported_sound_mime_types[] = {
-    "audio",
-    "video",
-    "application/ogg",
-    NULL,
-};
-
-/*
- * }} DEFINTIIONS
- */
+#include "calendar-sync.h"
+#include "metrics.h"
+#include "sound-cache.h"
+#include "sound-index.h"
+#include "source-stats.h"
+#include "trace.h"
+#include "watchdog.h"
+#include "startup-profile.h"
 
 /*
  * Snooze any triggered alarms.
@@ -129,76 +124,31 @@ void alarm_applet_alarm_stop(AlarmApplet* applet, Alarm* alarm)
  * Sounds list {{
  */
 
-// Must be NULL terminated
-static const gchar* const sound_notification_paths[] = {
-    "sounds/mate/default/alerts",
-    "sounds/gnome/default/alerts",
-    "sounds/ubuntu/notifications",
-    NULL
-};
-
-static const gchar* const freedesktop_sound_path[] = {
-    "sounds/freedesktop/stereo",
-    NULL
-};
-
-static const gchar* const freedesktop_sound_ignore[] = {
-    "audio-channel",
-    "network",
-    "phone",
-    "device",
-    "trash",
-    "suspend",
-    "dialog",
-    "power",
-    "screen-capture",
-    "window-question",
-    "onboard",
-    NULL
-};
-
-// Load sounds into list
-// TODO: Refactor to use a GHashTable with string hash
-GList* add_sound_dir_to_list(GList* sounds, const gchar* const* sound_paths, const gchar* const* ignore)
-{
-    const gchar* const* sysdirs = g_get_system_data_dirs();
-    for(gint i = 0; sysdirs[i] != NULL; i++) {
-        for(gint j = 0; sound_paths[j] != NULL; j++) {
-            gchar* tmp = g_build_filename(sysdirs[i], sound_paths[j], NULL);
-            if(g_file_test(tmp, G_FILE_TEST_IS_DIR)) {
-                // Load stock sounds
-                g_debug("AlarmApplet: sounds_load: Found %s!", tmp);
-                gchar* sounds_dir = g_strdup_printf("file://%s", tmp);
-                sounds = alarm_list_entry_list_new(sounds, sounds_dir, supported_sound_mime_types, ignore);
-                g_free(sounds_dir);
-            }
-            g_free(tmp);
-        }
-    }
-    return sounds;
-}
-
+/*
+ * Rebuild the sounds list: stock sounds first, followed by the custom sounds
+ * of all alarms. Custom sounds that are not in the index yet are probed in
+ * the background and show up once alarm_applet_sounds_changed() runs.
+ */
 void alarm_applet_sounds_load(AlarmApplet* applet)
 {
     // Free old list
     if(applet->sounds != NULL)
         alarm_list_entry_list_free(&(applet->sounds));
 
-    // Locate gnome/ubuntu sounds
-    applet->sounds = add_sound_dir_to_list(applet->sounds, sound_notification_paths, NULL);
+    // Stock sounds, as last seen by the index
+    for(const GList* l = sound_index_get_stock(); l != NULL; l = l->next)
+        applet->sounds = g_list_prepend(applet->sounds, alarm_list_entry_copy(l->data));
 
-    // If none of the preferred sound directories were found, try to load the freedesktop ones
-    if(!applet->sounds)
-        applet->sounds = add_sound_dir_to_list(applet->sounds, freedesktop_sound_path, freedesktop_sound_ignore);
-
-    if(!applet->sounds)
-        g_warning("AlarmApplet: Could not locate sounds!");
+    applet->sounds = g_list_reverse(applet->sounds);
 
     // Load custom sounds from alarms
     for(GList* l = applet->alarms; l != NULL; l = l->next) {
         Alarm* alarm = ALARM(l->data);
         gboolean found = FALSE;
-        AlarmListEntry* entry;
+        const AlarmListEntry* entry;
+
+        // Keep a local copy of sounds that live on remote filesystems
+        sound_cache_prefetch(alarm->sound_file);
         for(GList* l2 = applet->sounds; l2 != NULL; l2 = l2->next) {
             entry = (AlarmListEntry*)l2->data;
             if(strcmp(alarm->sound_file, entry->data) == 0) {
@@ -210,12 +160,48 @@ void alarm_applet_sounds_load(AlarmApplet* applet)
 
         if(!found) {
             // Add to list
-            entry = alarm_list_entry_new_file(alarm->sound_file, NULL, NULL);
-            if(entry) {
-                applet->sounds = g_list_append(applet->sounds, entry);
-            }
+            entry = sound_index_lookup(alarm->sound_file);
+            if(entry)
+                applet->sounds = g_list_append(applet->sounds, alarm_list_entry_copy(entry));
+            else
+                sound_index_probe(alarm->sound_file);
         }
     }
+
+    alarm_applet_sounds_model_update(applet);
+
+    if(applet->settings_dialog)
+        alarm_settings_dialog_sounds_changed(applet->settings_dialog);
+}
+
+/*
+ * The sound index has been updated by a scan or probe
+ */
+static void alarm_applet_sounds_changed(gpointer data)
+{
+    AlarmApplet* applet = (AlarmApplet*)data;
+
+    alarm_applet_sounds_load(applet);
+}
+
+/*
+ * Show the indexed sounds right away and revalidate them in the background
+ */
+static void alarm_applet_sounds_init(AlarmApplet* applet)
+{
+    GPtrArray* uris = g_ptr_array_new();
+
+    sound_index_init(alarm_applet_sounds_changed, applet);
+
+    alarm_applet_sounds_load(applet);
+
+    for(GList* l = applet->alarms; l != NULL; l = l->next)
+        g_ptr_array_add(uris, ALARM(l->data)->sound_file);
+    g_ptr_array_add(uris, NULL);
+
+    sound_index_revalidate((const gchar* const*)uris->pdata);
+
+    g_ptr_array_free(uris, TRUE);
 }
 
 // Notify callback for changes to an alarm's sound_file
@@ -263,10 +249,82 @@ static inline gboolean alarm_applet_app_info_command_exists(const AlarmApplet* a
 }
 #define ALARM_APPLET_GET_APP_INFO_COMMAND_EXISTS(x) alarm_applet_app_info_command_exists(applet, x)
 
-static inline gboolean command_exists_in_system(const gchar* cmd)
+/*
+ * The apps list is built on first use by a worker thread, and rebuilt when
+ * the installed applications change. Looking programs up in $PATH is the
+ * slow part, so the results are kept until a $PATH directory is modified.
+ */
+
+static GMutex path_cache_lock;
+static GHashTable* path_cache = NULL;  // program -> whether it was found, protected by path_cache_lock
+static gchar* path_cache_stamp = NULL; // mtimes of the $PATH directories the cache is valid for
+
+/*
+ * Describe the current state of the $PATH directories
+ */
+static gchar* path_stamp_new(void)
+{
+    GString* stamp = g_string_new(NULL);
+    gchar** dirs = g_strsplit(g_getenv("PATH") ? g_getenv("PATH") : "", G_SEARCHPATH_SEPARATOR_S, -1);
+
+    for(gchar** d = dirs; *d; d++) {
+        GStatBuf st;
+
+        if(**d && g_stat(*d, &st) == 0)
+            g_string_append_printf(stamp, "%s=%" G_GINT64_FORMAT ";", *d, (gint64)st.st_mtime);
+        else
+            g_string_append_printf(stamp, "%s=-;", *d);
+    }
+
+    g_strfreev(dirs);
+
+    return g_string_free(stamp, FALSE);
+}
+
+static gboolean program_exists_in_path(const gchar* program, const gchar* stamp)
+{
+    gpointer cached;
+    gboolean found;
+
+    g_mutex_lock(&path_cache_lock);
+
+    if(!path_cache || g_strcmp0(stamp, path_cache_stamp) != 0) {
+        if(path_cache)
+            g_debug("PATH changed, forgetting %u lookups", g_hash_table_size(path_cache));
+        else
+            path_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+        g_hash_table_remove_all(path_cache);
+        g_free(path_cache_stamp);
+        path_cache_stamp = g_strdup(stamp);
+    }
+
+    if(g_hash_table_lookup_extended(path_cache, program, NULL, &cached)) {
+        found = GPOINTER_TO_INT(cached);
+    } else {
+        gchar* path = g_find_program_in_path(program);
+
+        if(path)
+            g_debug("located %s at %s", program, path);
+        else
+            g_debug("Could not locate %s in PATH", program);
+
+        found = path != NULL;
+        g_hash_table_insert(path_cache, g_strdup(program), GINT_TO_POINTER(found));
+        g_free(path);
+    }
+
+    g_mutex_unlock(&path_cache_lock);
+
+    return found;
+}
+
+static inline gboolean command_exists_in_system(const gchar* cmd, const gchar* stamp)
 {
     int argcp;
     char** argvp;
+    gboolean found;
+
     if(!g_shell_parse_argv(cmd, &argcp, &argvp, NULL))
         return FALSE;
 
@@ -276,19 +334,10 @@ static inline gboolean command_exists_in_system(const gchar* cmd)
         array if this function returns successfully.
     */
 
-    gchar* found = g_find_program_in_path(argvp[0]);
-    if(!found) {
-        g_debug("Could not locate %s in PATH", argvp[0]);
-        g_strfreev(argvp);
-        return FALSE;
-    }
-
-    g_debug("located %s at %s", argvp[0], found);
-    g_free(found);
-    found = NULL;
+    found = program_exists_in_path(argvp[0], stamp);
 
     g_strfreev(argvp);
-    return TRUE;
+    return found;
 }
 
 static const char* const app_list_content_type = "audio/x-vorbis+ogg";
@@ -301,16 +350,25 @@ static gint g_app_info_same_executable(GAppInfo* appinfo1, GAppInfo* appinfo2)
     return strcmp(first, second);
 }
 
-// Load stock apps into list
-void alarm_applet_apps_load(AlarmApplet* applet)
+static void app_list_free(gpointer data)
+{
+    g_list_free_full(data, g_object_unref);
+}
+
+/*
+ * Build the apps list. Runs in a worker thread, and only reads the
+ * app_command_map of the applet.
+ */
+static void alarm_applet_apps_load_thread(GTask* task, gpointer source_object, gpointer task_data, GCancellable* cancellable)
 {
-    // Free the list if it exists already
-    g_list_free_full(g_steal_pointer(&applet->apps), g_object_unref);
+    const AlarmApplet* const applet = task_data;
+    gchar* stamp;
 
     // Get all supported apps
     GList* app_list = g_app_info_get_recommended_for_type(app_list_content_type);
     if(!app_list) {
         g_debug("Could not find any recommended applications for %s", app_list_content_type);
+        g_task_return_pointer(task, NULL, NULL);
         return;
     }
 
@@ -340,6 +398,8 @@ void alarm_applet_apps_load(AlarmApplet* applet)
         g_debug("Could not get default application for %s", app_list_content_type);
     }
 
+    stamp = path_stamp_new();
+
     // Finally, remove any unknown apps
     for(GList* l = app_list; l;) {
         GAppInfo* cur = G_APP_INFO(l->data);
@@ -349,7 +409,7 @@ void alarm_applet_apps_load(AlarmApplet* applet)
 
         const gboolean exists = ALARM_APPLET_GET_APP_INFO_COMMAND_EXISTS(cur);
         const char* app_cmd = NULL;
-        if(exists && command_exists_in_system((app_cmd = ALARM_APPLET_GET_APP_INFO_COMMAND(cur)))) {
+        if(exists && command_exists_in_system((app_cmd = ALARM_APPLET_GET_APP_INFO_COMMAND(cur)), stamp)) {
             l = g_list_next(l);
             continue;
         } else if(exists) {
@@ -360,17 +420,94 @@ void alarm_applet_apps_load(AlarmApplet* applet)
 
         GList* to_remove = l;
         l = g_list_next(l);
+        g_object_unref(to_remove->data);
         app_list = g_list_delete_link(app_list, to_remove);
     }
 
-    applet->apps = app_list;
+    g_free(stamp);
+
+    g_task_return_pointer(task, app_list, app_list_free);
+}
+
+static void alarm_applet_apps_load_done(GObject* source_object, GAsyncResult* res, gpointer data)
+{
+    AlarmApplet* applet = (AlarmApplet*)data;
+    GList* apps;
+
+    // Superseded by a newer load, or invalidated
+    if(g_task_get_cancellable(G_TASK(res)) != applet->apps_loading)
+        return;
+
+    apps = g_task_propagate_pointer(G_TASK(res), NULL);
+
+    g_clear_object(&applet->apps_loading);
+
+    g_list_free_full(applet->apps, g_object_unref);
+    applet->apps = apps;
+    applet->apps_valid = TRUE;
+
+    g_debug("AlarmApplet: Loaded %u apps", g_list_length(apps));
+
+    alarm_applet_apps_model_update(applet);
+
+    if(applet->settings_dialog)
+        alarm_settings_dialog_apps_changed(applet->settings_dialog);
+}
+
+// The installed applications have changed
+static void alarm_applet_apps_changed(GAppInfoMonitor* monitor, gpointer data)
+{
+    AlarmApplet* applet = (AlarmApplet*)data;
+
+    g_debug("AlarmApplet: Applications changed");
+
+    applet->apps_valid = FALSE;
+
+    if(applet->apps_loading) {
+        g_cancellable_cancel(applet->apps_loading);
+        g_clear_object(&applet->apps_loading);
+    }
+
+    // Rebuild right away if the list is being looked at, otherwise on next use
+    if(applet->settings_dialog && applet->settings_dialog->alarm)
+        alarm_applet_apps_request(applet);
+}
+
+// Load stock apps into list in the background, unless already loaded
+void alarm_applet_apps_request(AlarmApplet* applet)
+{
+    GTask* task;
+
+    if(applet->apps_valid || applet->apps_loading)
+        return;
+
+    if(!applet->apps_monitor) {
+        applet->apps_monitor = g_app_info_monitor_get();
+        g_signal_connect(applet->apps_monitor, "changed", G_CALLBACK(alarm_applet_apps_changed), applet);
+    }
+
+    applet->apps_loading = g_cancellable_new();
+
+    task = g_task_new(NULL, applet->apps_loading, alarm_applet_apps_load_done, applet);
+    g_task_set_task_data(task, applet, NULL);
+    g_task_run_in_thread(task, alarm_applet_apps_load_thread);
+    g_object_unref(task);
 }
 
+/*
+ * }} Apps list
+ */
+
 /*
  * Alarms list {{
  */
 
-// TODO: Refactor to use a GHashTable instead?
+// Ask for a resize when a property has changed that might require more space
+static void alarm_repeat_changed(GObject* object, GParamSpec* param, gpointer data)
+{
+    alarm_applet_request_resize(data);
+}
+
 void alarm_applet_alarms_load(AlarmApplet* applet)
 {
     GList* list = NULL;
@@ -384,23 +521,31 @@ void alarm_applet_alarms_load(AlarmApplet* applet)
 
         // Free list
         g_list_free(applet->alarms);
+        g_hash_table_remove_all(applet->alarm_links);
     }
 
     // Fetch list of alarms and add them
     applet->alarms = NULL;
-    list = alarm_get_list(applet, applet->settings_global);
+    applet->alarms_tail = NULL;
+    list = alarm_get_list(applet->settings_global);
 
     for(l = list; l != NULL; l = l->next) {
         alarm_applet_alarms_add(applet, ALARM(l->data));
     }
+
+    g_list_free(list);
 }
 
 void alarm_applet_alarms_add(AlarmApplet* applet, Alarm* alarm)
 {
-    applet->alarms = g_list_append(applet->alarms, alarm);
+    if(!applet->alarm_links)
+        applet->alarm_links = g_hash_table_new(NULL, NULL);
+
+    applet->alarms = alarm_list_append(applet->alarms, &applet->alarms_tail, applet->alarm_links, alarm);
 
     g_signal_connect(alarm, "notify", G_CALLBACK(alarm_applet_alarm_changed), applet);
     g_signal_connect(alarm, "notify::sound-file", G_CALLBACK(alarm_sound_file_changed), applet);
+    g_signal_connect(alarm, "notify::repeat", G_CALLBACK(alarm_repeat_changed), applet);
 
     g_signal_connect(alarm, "alarm", G_CALLBACK(alarm_applet_alarm_triggered), applet);
     g_signal_connect(alarm, "cleared", G_CALLBACK(alarm_applet_alarm_cleared), applet);
@@ -416,14 +561,14 @@ void alarm_applet_alarms_remove_and_delete(AlarmApplet* applet, Alarm* alarm)
     AlarmSettingsDialog* sdialog = applet->settings_dialog;
 
     // If there's a settings dialog open for this alarm, close it.
-    if(sdialog->alarm == alarm) {
+    if(sdialog && sdialog->alarm == alarm) {
         alarm_settings_dialog_close(sdialog);
     }
 
     alarm_delete(alarm);
 
     // Remove from list
-    applet->alarms = g_list_remove(applet->alarms, alarm);
+    applet->alarms = alarm_list_remove(applet->alarms, &applet->alarms_tail, applet->alarm_links, alarm);
 
     // Clear list store. This will decrease the refcount of our alarms by 1.
     /*if (applet->list_alarms_store)
@@ -443,6 +588,34 @@ void alarm_applet_alarms_remove_and_delete(AlarmApplet* applet, Alarm* alarm)
     alarm_unref(alarm);
 }
 
+static GList* alarm_applet_service_get_alarms(gpointer data)
+{
+    return ((AlarmApplet*)data)->alarms;
+}
+
+static void alarm_applet_service_add(Alarm* alarm, gpointer data)
+{
+    alarm_applet_alarms_add(data, alarm);
+}
+
+static void alarm_applet_service_remove(Alarm* alarm, gpointer data)
+{
+    alarm_disable(alarm);
+    alarm_clear(alarm);
+    alarm_applet_alarms_remove_and_delete(data, alarm);
+}
+
+static const AlarmServiceFuncs alarm_applet_service_funcs = {
+    alarm_applet_service_get_alarms,
+    alarm_applet_service_add,
+    alarm_applet_service_remove,
+};
+
+void alarm_applet_alarms_sync(AlarmApplet* applet)
+{
+    alarm_service_sync_list(applet->settings_global, &alarm_applet_service_funcs, applet);
+}
+
 /*
  * }} Alarms list
  */
@@ -527,6 +700,28 @@ static inline void alarm_applet_init_app_command_map(AlarmApplet* applet)
     g_hash_table_insert(applet->app_command_map, "mpv", "playerctl -p mpv play #Needs mpv-mpris");
 }
 
+static guint alarm_applet_count_active(gpointer data)
+{
+    AlarmApplet* applet = data;
+    guint count = 0;
+
+    for(GList* l = applet->alarms; l; l = l->next) {
+        if(ALARM(l->data)->active)
+            count++;
+    }
+
+    return count;
+}
+
+static gboolean alarm_applet_startup_profile_idle(gpointer user_data)
+{
+    AlarmApplet* applet = user_data;
+
+    startup_profile_finish("first idle", g_list_length(applet->alarms));
+
+    return G_SOURCE_REMOVE;
+}
+
 void alarm_applet_activate(GtkApplication* app, gpointer user_data)
 {
     AlarmApplet* applet = user_data;
@@ -544,119 +739,57 @@ void alarm_applet_activate(GtkApplication* app, gpointer user_data)
         g_spawn_command_line_sync("./gconf-migration/alarm-clock-applet-gconf-migration", NULL, NULL, NULL, NULL);
 #endif
 
+    startup_profile_mark("application startup");
+
+    // Dump scheduling events on SIGUSR1
+    trace_init();
+
     // TODO: Add to gsettings
     applet->snooze_mins = 5;
 
     // Initialize gsettings
     alarm_applet_gsettings_init(applet);
+    metrics_init(applet->settings_global, alarm_applet_count_active, applet);
+
+    // Keep an eye on anything that blocks the main loop, if asked to
+    watchdog_init(applet->settings_global);
+    startup_profile_mark("gsettings");
+
+    // Initialize the local cache for remote sounds
+    sound_cache_init();
+    startup_profile_mark("sound cache");
 
     // Load alarms
     alarm_applet_alarms_load(applet);
+    startup_profile_mark("alarms");
 
-    // Load sounds from alarms
-    alarm_applet_sounds_load(applet);
+    // Let scripts manage alarms over D-Bus
+    alarm_service_register(g_application_get_dbus_connection(G_APPLICATION(app)), applet->settings_global, &alarm_applet_service_funcs, applet);
+
+    // Alarms for the reminders of a calendar
+    calendar_sync_init(applet->settings_global, &alarm_applet_service_funcs, applet);
+
+    // Load sounds from the index and alarms
+    alarm_applet_sounds_init(applet);
+    startup_profile_mark("sounds");
 
     // Initialise map for app commands
     alarm_applet_init_app_command_map(applet);
-
-    // Load apps for alarms
-    alarm_applet_apps_load(applet);
+    startup_profile_mark("app commands");
 
     // Set up applet UI
     alarm_applet_ui_init(applet);
+    startup_profile_mark("ui");
 
     // Show alarms window, unless --hidden
-    if(!applet->hidden)
+    if(!applet->hidden) {
         g_action_activate(G_ACTION(applet->action_toggle_list_win), NULL);
-}
-
-/**
- * Cleanup
- */
-static void alarm_applet_quit(AlarmApplet* applet)
-{
-    g_debug("AlarmApplet: Quitting...");
-}
-
-static gint handle_local_options(GApplication* application, GVariantDict* options, gpointer user_data)
-{
-    guint32 count;
-    if(g_variant_dict_lookup(options, "version", "b", &count)) {
-        g_print(PACKAGE_NAME " " VERSION "\n");
-        return 0;
+        startup_profile_mark("list window");
     }
 
-    return -1;
-}
-
-static gint handle_command_line(GApplication* application, GApplicationCommandLine* cmdline, gpointer user_data)
-{
-    AlarmApplet* applet = user_data;
-    gboolean stop_all = FALSE;
-    gboolean snooze_all = FALSE;
-
-    GVariantDict* options = g_application_command_line_get_options_dict(cmdline);
-
-    if(g_variant_dict_lookup(options, "stop-all", "b", &stop_all))
-        g_action_activate(G_ACTION(applet->action_stop_all), NULL);
-
-    if(g_variant_dict_lookup(options, "snooze-all", "b", &snooze_all))
-        g_action_activate(G_ACTION(applet->action_snooze_all), NULL);
-
-    if(!(stop_all || snooze_all))
-        g_application_activate(G_APPLICATION(application));
-
-    return 0;
-}
-
-/**
- * Alarm Clock main()
- */
-int main(int argc, char* argv[])
-{
-    AlarmApplet* applet = NULL;
-
-    // Internationalization
-    bindtextdomain(GETTEXT_PACKAGE, ALARM_CLOCK_DATADIR "/locale");
-    bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
-    textdomain(GETTEXT_PACKAGE);
-
-    // Terminate on critical errors
-    // g_log_set_always_fatal (G_LOG_LEVEL_CRITICAL);
-
-    // Initialize GTK+
-    GtkApplication* application = gtk_application_new("io.github.alarm-clock-applet", G_APPLICATION_HANDLES_COMMAND_LINE);
-
-    // Initialize applet struct
-    applet = g_new0(AlarmApplet, 1);
-    applet->application = application;
-
-    g_signal_connect(application, "activate", G_CALLBACK(alarm_applet_activate), applet);
-
-    // Command line options
-    applet->hidden = FALSE; // Start hidden
-
-    GOptionEntry entries[] = {
-        { "hidden", 'h', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &applet->hidden, _("Start hidden"), NULL },
-        { "stop-all", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Stop all alarms"), NULL },
-        { "snooze-all", 'z', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Snooze all alarms"), NULL },
-        { "version", 'v', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Display version information"), NULL },
-        { NULL }
-    };
-    g_application_add_main_option_entries(G_APPLICATION(application), entries);
-
-    g_signal_connect(application, "handle-local-options", G_CALLBACK(handle_local_options), NULL);
-    g_signal_connect(application, "command-line", G_CALLBACK(handle_command_line), applet);
-
-    // Run the main loop
-    gint ret = g_application_run(G_APPLICATION(application), argc, argv);
-
-    // Clean up
-    // FIXME: check for null?
-    alarm_applet_quit(applet);
-    g_object_unref(application);
-
-    return ret;
+    // Startup is over once the main loop gets to idle, i.e. after drawing
+    if(startup_profile_enabled())
+        source_stats_idle_add("startup-profile", G_PRIORITY_DEFAULT_IDLE, alarm_applet_startup_profile_idle, applet);
 }
 
 /*
@@ -665,7 +798,8 @@ int main(int argc, char* argv[])
 
 void alarm_applet_request_resize(AlarmApplet* applet)
 {
+    // Nothing to resize until the list window has been shown
     if(!applet->list_window)
-        g_error("list_window is NULL in alarm_applet_request_resize()");
+        return;
     alarm_list_request_resize(applet->list_window);
 }
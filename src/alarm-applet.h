@@ -43,7 +43,6 @@ void alarm_applet_clear_alarms(AlarmApplet* applet);
 #define ALARM_ICON       "io.github.alarm-clock-applet.clock"
 #define TIMER_ICON       "io.github.alarm-clock-applet.timer"
 #define TRIGGERED_ICON   "io.github.alarm-clock-applet.clock-triggered"
-#define ALARM_STD_SNOOZE 9
 
 typedef enum {
     LABEL_TYPE_INVALID = 0,
@@ -60,7 +59,7 @@ struct _AlarmApplet {
     /* Gtk App */
     GtkApplication* application;
 
-    /* User Interface */
+    /* User Interface (status menu only, each window has its own builder) */
     GtkBuilder* ui;
 
     /* App Indicator */
@@ -71,23 +70,43 @@ struct _AlarmApplet {
 
     /* Alarms */
     GList* alarms;
+    GList* alarms_tail;      // Last link of alarms
+    GHashTable* alarm_links; // Alarm ID -> link in alarms
     guint n_triggered; // Number of triggered alarms
 
+    /* Notifications */
+    guint32 notify_id;           // Server's ID of the notification, replaced on every trigger
+    guint notify_closed_id;      // NotificationClosed subscription
+    GPtrArray* notify_messages;  // First few messages since the notification was last closed
+    guint notify_count;          // Number of alarms since the notification was last closed
+    gboolean notify_timers_only; // Whether all of them were timers
+    guint notify_batch_id;       // Pending batch timeout
+    gboolean notify_in_flight;   // A Notify call is waiting for its reply
+    gboolean notify_dirty;       // More alarms arrived while in flight
+
     /* Sounds & apps list */
     GList* sounds;
+    GtkListStore* sounds_model; // Shared by the combo boxes, see ui.c
+    GtkListStore* apps_model;
     GList* apps;
+    gboolean apps_valid;          // Whether apps is up to date
+    GCancellable* apps_loading;   // Load in progress, if any
+    GAppInfoMonitor* apps_monitor;
     GHashTable* app_command_map;
 
-    /* List-alarms UI */
+    /* List-alarms UI, NULL until first shown */
     AlarmListWindow* list_window;
 
-    /* Alarm settings dialog */
+    /* Alarm settings dialog, NULL until first shown */
     AlarmSettingsDialog* settings_dialog;
 
     /* Preferences */
-    GtkDialog* prefs_dialog;
+    GtkDialog* prefs_dialog; // NULL until first shown
     GtkWidget* prefs_autostart_check;
 
+    /* About dialog */
+    GtkAboutDialog* about_dialog;
+
     guint snooze_mins;
 
     GSimpleAction* action_edit;
@@ -115,7 +134,7 @@ void alarm_applet_sounds_load(AlarmApplet* applet);
 const gchar* alarm_applet_get_app_info_command(const AlarmApplet* applet, GAppInfo* app);
 #define ALARM_APPLET_GET_APP_INFO_COMMAND(x) alarm_applet_get_app_info_command(applet, x)
 
-void alarm_applet_apps_load(AlarmApplet* applet);
+void alarm_applet_apps_request(AlarmApplet* applet);
 
 void alarm_applet_alarms_load(AlarmApplet* applet);
 
@@ -123,6 +142,8 @@ void alarm_applet_alarms_add(AlarmApplet* applet, Alarm* alarm);
 
 void alarm_applet_alarms_remove_and_delete(AlarmApplet* applet, Alarm* alarm);
 
+void alarm_applet_alarms_sync(AlarmApplet* applet);
+
 guint alarm_applet_alarms_snooze(AlarmApplet* applet);
 
 guint alarm_applet_alarms_stop(AlarmApplet* applet);
@@ -135,6 +156,8 @@ void alarm_applet_destroy(AlarmApplet* applet);
 
 void alarm_applet_request_resize(AlarmApplet* applet);
 
+void alarm_applet_activate(GtkApplication* app, gpointer user_data);
+
 G_END_DECLS
 
 #endif /*ALARMAPPLET_H_*/
@@ -0,0 +1,379 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * alarm-daemon.c -- Headless alarm scheduling daemon
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <signal.h>
+#include <string.h>
+#include <glib-unix.h>
+
+#include <config.h>
+#include "alarm-daemon.h"
+
+#include "alarm.h"
+#include "alarm-service.h"
+#include "calendar-sync.h"
+#include "command-executor.h"
+#include "metrics.h"
+#include "sound-cache.h"
+#include "source-stats.h"
+#include "startup-profile.h"
+#include "trace.h"
+#include "watchdog.h"
+
+/*
+ * Everything in here must stay clear of GTK, so that the daemon can run on a
+ * server without a display. The alarms list is kept in sync with GSettings
+ * by alarm_service_sync_list(), like the applet's.
+ */
+
+#define DAEMON_SNOOZE_MINS 5
+
+typedef struct {
+    GApplication* application;
+    GSettings* settings;
+    GList* alarms;
+    GList* alarms_tail;      // Last link of alarms
+    GHashTable* alarm_links; // Alarm ID -> link in alarms
+} AlarmDaemon;
+
+/*
+ * Alarms list {{
+ */
+
+static void alarm_daemon_alarm_triggered(Alarm* alarm, gpointer data)
+{
+    g_print("Alarm #%d triggered: %s\n", alarm->id, alarm->message ? alarm->message : "");
+}
+
+static void alarm_daemon_alarms_add(AlarmDaemon* daemon, Alarm* alarm)
+{
+    if(!daemon->alarm_links)
+        daemon->alarm_links = g_hash_table_new(NULL, NULL);
+
+    daemon->alarms = alarm_list_append(daemon->alarms, &daemon->alarms_tail, daemon->alarm_links, alarm);
+
+    g_signal_connect(alarm, "alarm", G_CALLBACK(alarm_daemon_alarm_triggered), daemon);
+}
+
+static void alarm_daemon_alarms_remove_and_delete(AlarmDaemon* daemon, Alarm* alarm)
+{
+    alarm_disable(alarm);
+    alarm_clear(alarm);
+    alarm_delete(alarm);
+
+    daemon->alarms = alarm_list_remove(daemon->alarms, &daemon->alarms_tail, daemon->alarm_links, alarm);
+
+    g_signal_handlers_disconnect_matched(alarm, 0, 0, 0, NULL, NULL, NULL);
+
+    alarm_unref(alarm);
+}
+
+static guint alarm_daemon_count_active(gpointer data)
+{
+    AlarmDaemon* daemon = data;
+    guint count = 0;
+
+    for(GList* l = daemon->alarms; l; l = l->next) {
+        if(ALARM(l->data)->active)
+            count++;
+    }
+
+    return count;
+}
+
+static GList* alarm_daemon_service_get_alarms(gpointer data)
+{
+    return ((AlarmDaemon*)data)->alarms;
+}
+
+static void alarm_daemon_service_add(Alarm* alarm, gpointer data)
+{
+    alarm_daemon_alarms_add(data, alarm);
+}
+
+static void alarm_daemon_service_remove(Alarm* alarm, gpointer data)
+{
+    alarm_daemon_alarms_remove_and_delete(data, alarm);
+}
+
+static const AlarmServiceFuncs alarm_daemon_service_funcs = {
+    alarm_daemon_service_get_alarms,
+    alarm_daemon_service_add,
+    alarm_daemon_service_remove,
+};
+
+static void alarm_daemon_list_changed(GSettings* settings, gchar* key, gpointer user_data)
+{
+    g_debug("AlarmDaemon: alarms changed");
+
+    alarm_service_sync_list(settings, &alarm_daemon_service_funcs, user_data);
+}
+
+/*
+ * }} Alarms list
+ */
+
+/*
+ * Actions {{
+ */
+
+static guint alarm_daemon_stop_all(AlarmDaemon* daemon)
+{
+    guint n_stopped = 0;
+
+    for(GList* l = daemon->alarms; l; l = l->next) {
+        Alarm* a = ALARM(l->data);
+
+        if(a->triggered) {
+            alarm_clear(a);
+            n_stopped++;
+        }
+    }
+
+    return n_stopped;
+}
+
+static guint alarm_daemon_snooze_all(AlarmDaemon* daemon)
+{
+    guint n_snoozed = 0;
+
+    for(GList* l = daemon->alarms; l; l = l->next) {
+        Alarm* a = ALARM(l->data);
+
+        if(a->triggered) {
+            alarm_snooze(a, (a->type == ALARM_TYPE_CLOCK ? ALARM_STD_SNOOZE : DAEMON_SNOOZE_MINS) * 60);
+            n_snoozed++;
+        }
+    }
+
+    return n_snoozed;
+}
+
+static void alarm_daemon_action_stop_all(GSimpleAction* action, GVariant* parameter, gpointer data)
+{
+    g_debug("AlarmDaemon: stopped %u alarms", alarm_daemon_stop_all(data));
+}
+
+static void alarm_daemon_action_snooze_all(GSimpleAction* action, GVariant* parameter, gpointer data)
+{
+    g_debug("AlarmDaemon: snoozed %u alarms", alarm_daemon_snooze_all(data));
+}
+
+/*
+ * }} Actions
+ */
+
+/*
+ * Application {{
+ */
+
+static gboolean alarm_daemon_quit(gpointer data)
+{
+    AlarmDaemon* daemon = data;
+
+    g_debug("AlarmDaemon: Quitting...");
+
+    g_application_quit(daemon->application);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void alarm_daemon_startup(GApplication* application, gpointer user_data)
+{
+    AlarmDaemon* daemon = user_data;
+    const GActionEntry action_entries[] = {
+        { "snooze_all", alarm_daemon_action_snooze_all },
+        { "stop_all", alarm_daemon_action_stop_all },
+    };
+
+    startup_profile_mark("application startup");
+
+    trace_init();
+
+    // Shut down cleanly when stopped by a service manager or ^C
+    g_source_set_name_by_id(g_unix_signal_add(SIGTERM, alarm_daemon_quit, daemon), "daemon-sigterm");
+    g_source_set_name_by_id(g_unix_signal_add(SIGINT, alarm_daemon_quit, daemon), "daemon-sigint");
+
+    g_action_map_add_action_entries(G_ACTION_MAP(application), action_entries, G_N_ELEMENTS(action_entries), daemon);
+
+    daemon->settings = g_settings_new("io.github.alarm-clock-applet");
+    g_signal_connect(daemon->settings, "changed::alarms", G_CALLBACK(alarm_daemon_list_changed), daemon);
+    command_executor_init(daemon->settings);
+    metrics_init(daemon->settings, alarm_daemon_count_active, daemon);
+    watchdog_init(daemon->settings);
+    startup_profile_mark("gsettings");
+
+    sound_cache_init();
+    startup_profile_mark("sound cache");
+
+    for(GList* l = alarm_get_list(daemon->settings), *next; l; l = next) {
+        next = l->next;
+        alarm_daemon_alarms_add(daemon, ALARM(l->data));
+        g_list_free_1(l);
+    }
+    startup_profile_mark("alarms");
+
+    alarm_service_register(g_application_get_dbus_connection(application), daemon->settings, &alarm_daemon_service_funcs, daemon);
+    calendar_sync_init(daemon->settings, &alarm_daemon_service_funcs, daemon);
+
+    startup_profile_finish("daemon ready", g_list_length(daemon->alarms));
+
+    // There are no windows to keep the application alive
+    g_application_hold(application);
+}
+
+static void alarm_daemon_shutdown(GApplication* application, gpointer user_data)
+{
+    AlarmDaemon* daemon = user_data;
+
+    calendar_sync_shutdown();
+    alarm_service_unregister();
+
+    // Stop any sounds that are still playing
+    alarm_daemon_stop_all(daemon);
+
+    for(GList* l = daemon->alarms; l; l = l->next)
+        g_signal_handlers_disconnect_matched(l->data, 0, 0, 0, NULL, NULL, NULL);
+
+    g_list_free_full(daemon->alarms, g_object_unref);
+    daemon->alarms = NULL;
+    daemon->alarms_tail = NULL;
+    g_clear_pointer(&daemon->alarm_links, g_hash_table_destroy);
+}
+
+static gint alarm_daemon_handle_local_options(GApplication* application, GVariantDict* options, gpointer user_data)
+{
+    GError* error = NULL;
+
+    if(g_variant_dict_contains(options, "version")) {
+        g_print(PACKAGE_NAME " " VERSION "\n");
+        return 0;
+    }
+
+    if(g_variant_dict_contains(options, "profile-startup"))
+        startup_profile_enable();
+
+    if(!g_application_register(application, NULL, &error)) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    // Don't let the applet think it was asked to show itself
+    if(g_application_get_is_remote(application) && !(g_variant_dict_contains(options, "stop-all") || g_variant_dict_contains(options, "snooze-all") ||
+                                                     g_variant_dict_contains(options, "stats") || g_variant_dict_contains(options, "dump-trace") ||
+                                                     g_variant_dict_contains(options, "timer"))) {
+        g_printerr(_("Alarm Clock is already running\n"));
+        return 1;
+    }
+
+    return -1;
+}
+
+static gint alarm_daemon_handle_command_line(GApplication* application, GApplicationCommandLine* cmdline, gpointer user_data)
+{
+    AlarmDaemon* daemon = user_data;
+    GVariantDict* options = g_application_command_line_get_options_dict(cmdline);
+    gboolean handled = FALSE;
+    gint status = 0;
+
+    // Also when starting up, as in --daemon --timer 5m
+    if(alarm_service_command_line_timer(cmdline, &status))
+        handled = TRUE;
+
+    // This is the daemon itself starting up
+    if(!g_application_command_line_get_is_remote(cmdline))
+        return status;
+
+    if(g_variant_dict_contains(options, "stats")) {
+        gchar* dump = source_stats_dump();
+        g_application_command_line_print(cmdline, "%s", dump);
+        g_free(dump);
+        handled = TRUE;
+    }
+
+    if(g_variant_dict_contains(options, "dump-trace")) {
+        GError* error = NULL;
+        gchar* path = trace_dump_to_file(&error);
+
+        if(path) {
+            g_application_command_line_print(cmdline, "%s\n", path);
+            g_free(path);
+        } else {
+            g_application_command_line_printerr(cmdline, "%s\n", error->message);
+            g_error_free(error);
+        }
+        handled = TRUE;
+    }
+
+    if(g_variant_dict_contains(options, "stop-all")) {
+        alarm_daemon_stop_all(daemon);
+        handled = TRUE;
+    }
+
+    if(g_variant_dict_contains(options, "snooze-all")) {
+        alarm_daemon_snooze_all(daemon);
+        handled = TRUE;
+    }
+
+    // Someone tried to start the applet, or a second daemon
+    if(!handled) {
+        g_application_command_line_printerr(cmdline, _("The alarm daemon is already running\n"));
+        return 1;
+    }
+
+    return status;
+}
+
+gboolean alarm_daemon_requested(int argc, char* argv[])
+{
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--") == 0)
+            break;
+        if(strcmp(argv[i], "--daemon") == 0)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+gint alarm_daemon_run(int argc, char* argv[])
+{
+    AlarmDaemon daemon = { 0 };
+    gint ret;
+
+    GOptionEntry entries[] = {
+        { "daemon", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Run the alarms without any user interface"), NULL },
+        { "stop-all", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Stop all alarms"), NULL },
+        { "snooze-all", 'z', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Snooze all alarms"), NULL },
+        { "version", 'v', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Display version information"), NULL },
+        { "stats", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Print wakeups and CPU time per event source of the running instance"), NULL },
+        { "dump-trace", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Save the recent scheduling events of the running instance as a trace"), NULL },
+        { "profile-startup", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Print where startup time goes and save it as JSON"), NULL },
+        { "timer", 't', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, NULL, _("Start a timer that is not saved, followed by an optional message"), _("DURATION") },
+        { NULL }
+    };
+
+    // Same ID as the applet, so that the two never fire the same alarms twice
+    daemon.application = g_application_new("io.github.alarm-clock-applet", G_APPLICATION_HANDLES_COMMAND_LINE);
+    g_application_add_main_option_entries(daemon.application, entries);
+
+    g_signal_connect(daemon.application, "startup", G_CALLBACK(alarm_daemon_startup), &daemon);
+    g_signal_connect(daemon.application, "shutdown", G_CALLBACK(alarm_daemon_shutdown), &daemon);
+    g_signal_connect(daemon.application, "handle-local-options", G_CALLBACK(alarm_daemon_handle_local_options), &daemon);
+    g_signal_connect(daemon.application, "command-line", G_CALLBACK(alarm_daemon_handle_command_line), &daemon);
+
+    ret = g_application_run(daemon.application, argc, argv);
+
+    g_clear_object(&daemon.settings);
+    g_object_unref(daemon.application);
+
+    return ret;
+}
+
+/*
+ * }} Application
+ */
@@ -0,0 +1,34 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * alarm-daemon.h -- Headless alarm scheduling daemon
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef ALARM_DAEMON_H_
+#define ALARM_DAEMON_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Whether --daemon was passed. Checked before anything else is initialized.
+ */
+gboolean alarm_daemon_requested(int argc, char* argv[]);
+
+/**
+ * Run the alarms from the same GSettings store as the applet, without
+ * initializing GTK or the indicator.
+ *
+ * Sounds are played and commands run as usual, triggered alarms are printed
+ * on stdout. Only one of the daemon and the applet can run at a time, since
+ * both register the same application ID.
+ *
+ * Returns the exit status.
+ */
+gint alarm_daemon_run(int argc, char* argv[]);
+
+G_END_DECLS
+
+#endif /*ALARM_DAEMON_H_*/
@@ -19,6 +19,8 @@ void alarm_applet_gsettings_init(AlarmApplet* applet);
 
 void alarm_applet_gsettings_load(AlarmApplet* applet);
 
+void alarm_list_changed(GSettings* self, gchar* key, gpointer user_data);
+
 G_END_DECLS
 
 #endif /*ALARM_GCONF_H_*/
@@ -0,0 +1,511 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * alarm-io.c -- Streaming import and export of alarms
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib-unix.h>
+#include <gio/gunixinputstream.h>
+#include <gio/gunixoutputstream.h>
+
+#include <config.h>
+#include "alarm-io.h"
+
+#include "alarm.h"
+
+/*
+ * Alarms are written as the same a{sv} that the D-Bus interface uses, printed
+ * as GVariant text, one alarm per line:
+ *
+ *   {'id': <uint32 0>, 'type': <'clock'>, 'time': <int64 25200>, ...}
+ *
+ * Both directions work on the settings directly rather than on Alarm
+ * instances, which would be scheduled as soon as they are active. Memory use is
+ * bounded by the chunk size apart from the list of IDs.
+ */
+
+#define ALARM_IO_SCHEMA "io.github.alarm-clock-applet.alarm"
+
+// Lines between writes of the alarms list
+#define ALARM_IMPORT_CHUNK 1000
+
+static GSettings* alarm_io_settings_new(guint32 id)
+{
+    gchar* path = g_strdup_printf(ALARM_G_SETTINGS_BASE_DIR ALARM_G_SETTINGS_DIR_PREFIX "%" G_GUINT32_FORMAT "/", id);
+    GSettings* settings = g_settings_new_with_path(ALARM_IO_SCHEMA, path);
+
+    g_free(path);
+
+    return settings;
+}
+
+/*
+ * Export {{
+ */
+
+gboolean alarm_export(GSettings* settings, GOutputStream* out, GCancellable* cancellable, GError** error)
+{
+    GVariant* var = g_settings_get_value(settings, "alarms");
+    gsize count = 0;
+    const guint32* values = g_variant_get_fixed_array(var, &count, sizeof(guint32));
+    gboolean ok;
+
+    ok = g_output_stream_printf(out, NULL, cancellable, error, "# " PACKAGE_NAME " " VERSION " alarms, one per line\n");
+
+    for(gsize i = 0; ok && i < count; i++) {
+        GSettings* alarm_settings = alarm_io_settings_new(values[i]);
+        GVariant* dict = g_variant_ref_sink(alarm_settings_to_variant(alarm_settings, values[i]));
+        gchar* text = g_variant_print(dict, TRUE);
+
+        ok = g_output_stream_printf(out, NULL, cancellable, error, "%s\n", text);
+
+        g_free(text);
+        g_variant_unref(dict);
+        g_object_unref(alarm_settings);
+    }
+
+    g_variant_unref(var);
+
+    return ok && g_output_stream_flush(out, cancellable, error);
+}
+
+/*
+ * }} Export
+ */
+
+/*
+ * Import {{
+ */
+
+typedef struct {
+    GSettings* settings;
+    gboolean dry_run;
+    GHashTable* used;    // IDs in the list, including the imported ones
+    GArray* ids;         // The alarms list, in order
+    guint32 next_id;     // No ID below this one is free
+    guint pending;       // Alarms created since the list was last written
+    GHashTable* changes; // ID -> delayed GSettings of this chunk
+} AlarmImport;
+
+/*
+ * Same IDs that alarm_gen_ids() would hand out
+ */
+static guint32 alarm_import_gen_id(AlarmImport* import)
+{
+    while(g_hash_table_contains(import->used, GUINT_TO_POINTER(import->next_id)))
+        import->next_id++;
+
+    return import->next_id;
+}
+
+/*
+ * The settings of the alarms in this chunk are kept back until here, so that
+ * they are applied back to back together with the list. GSettings can't write
+ * several paths in one transaction, but dconf merges changes that are queued
+ * while one is in flight, so the chunk goes out as a single write in practice.
+ */
+static void alarm_import_commit(AlarmImport* import)
+{
+    GHashTableIter iter;
+    GSettings* alarm_settings;
+
+    g_hash_table_iter_init(&iter, import->changes);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer*)&alarm_settings)) {
+        if(import->dry_run)
+            g_settings_revert(alarm_settings);
+        else
+            g_settings_apply(alarm_settings);
+    }
+    g_hash_table_remove_all(import->changes);
+
+    if(!import->pending)
+        return;
+
+    if(!import->dry_run)
+        g_settings_set_value(import->settings, "alarms", g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32, import->ids->data, import->ids->len, sizeof(guint32)));
+
+    import->pending = 0;
+}
+
+/*
+ * The same alarm may show up more than once in a chunk, and later lines must
+ * see the changes of earlier ones
+ */
+static GSettings* alarm_import_settings(AlarmImport* import, guint32 id)
+{
+    GSettings* alarm_settings = g_hash_table_lookup(import->changes, GUINT_TO_POINTER(id));
+
+    if(!alarm_settings) {
+        alarm_settings = alarm_io_settings_new(id);
+        g_settings_delay(alarm_settings);
+        g_hash_table_insert(import->changes, GUINT_TO_POINTER(id), alarm_settings);
+    }
+
+    return alarm_settings;
+}
+
+/*
+ * Fields that only describe the state of the exporting instance. The
+ * timestamp is worked out again for active alarms.
+ */
+static const gchar* const alarm_import_state_fields[] = { "id", "timestamp", "triggered" };
+
+/*
+ * Changes to these move the timestamp of an active alarm, as they would
+ * through alarm_set_enabled()
+ */
+static const gchar* const alarm_import_rearm_fields[] = { "type", "time", "repeat", "active", NULL };
+
+static AlarmImportAction alarm_import_line(AlarmImport* import, const gchar* line, guint32* id, GString* changed, GError** error)
+{
+    GVariant* dict;
+    GVariant* id_value;
+    GVariant* fields;
+    GVariantDict builder;
+    GVariantIter iter;
+    GSettings* alarm_settings;
+    const gchar* key;
+    GVariant* value;
+    gboolean exists = FALSE;
+    gboolean rearm = FALSE;
+
+    dict = g_variant_parse(G_VARIANT_TYPE_VARDICT, line, NULL, NULL, error);
+    if(!dict)
+        return ALARM_IMPORT_INVALID;
+
+    id_value = g_variant_lookup_value(dict, "id", NULL);
+    if(id_value && (!g_variant_is_of_type(id_value, G_VARIANT_TYPE_UINT32) || ALARM_ID_IS_EPHEMERAL(g_variant_get_uint32(id_value)))) {
+        g_set_error(error, ALARM_ERROR, ALARM_ERROR_INVALID, "Invalid id");
+        g_variant_unref(id_value);
+        g_variant_unref(dict);
+        return ALARM_IMPORT_INVALID;
+    }
+
+    g_variant_dict_init(&builder, dict);
+    for(guint i = 0; i < G_N_ELEMENTS(alarm_import_state_fields); i++)
+        g_variant_dict_remove(&builder, alarm_import_state_fields[i]);
+    fields = g_variant_ref_sink(g_variant_dict_end(&builder));
+    g_variant_unref(dict);
+
+    if(!alarm_variant_check(fields, error)) {
+        if(id_value)
+            g_variant_unref(id_value);
+        g_variant_unref(fields);
+        return ALARM_IMPORT_INVALID;
+    }
+
+    if(id_value) {
+        *id = g_variant_get_uint32(id_value);
+        exists = g_hash_table_contains(import->used, GUINT_TO_POINTER(*id));
+        g_variant_unref(id_value);
+    } else {
+        *id = alarm_import_gen_id(import);
+    }
+
+    alarm_settings = alarm_import_settings(import, *id);
+
+    g_variant_iter_init(&iter, fields);
+    while(g_variant_iter_next(&iter, "{&sv}", &key, &value)) {
+        GVariant* current = g_settings_get_value(alarm_settings, key);
+
+        if(!g_variant_equal(current, value)) {
+            g_settings_set_value(alarm_settings, key, value);
+            g_string_append_printf(changed, "%s%s", changed->len ? ", " : "", key);
+            rearm |= g_strv_contains(alarm_import_rearm_fields, key);
+        }
+
+        g_variant_unref(current);
+        g_variant_unref(value);
+    }
+
+    g_variant_unref(fields);
+
+    if((rearm || !exists) && g_settings_get_boolean(alarm_settings, "active")) {
+        time_t timestamp = alarm_next_timestamp(g_settings_get_enum(alarm_settings, "type"), g_settings_get_int64(alarm_settings, "time"), g_settings_get_flags(alarm_settings, "repeat"));
+        g_settings_set_int64(alarm_settings, "timestamp", timestamp);
+    }
+
+    if(!exists) {
+        g_hash_table_add(import->used, GUINT_TO_POINTER(*id));
+        g_array_append_val(import->ids, *id);
+        import->pending++;
+        return ALARM_IMPORT_CREATE;
+    }
+
+    return changed->len ? ALARM_IMPORT_UPDATE : ALARM_IMPORT_UNCHANGED;
+}
+
+gboolean alarm_import(GSettings* settings, GInputStream* in, gboolean dry_run, AlarmImportFunc func, gpointer data, GCancellable* cancellable, GError** error)
+{
+    GDataInputStream* lines = g_data_input_stream_new(in);
+    AlarmImport import = { settings, dry_run };
+    GString* changed = g_string_new(NULL);
+    GError* err = NULL;
+    GVariant* var;
+    gsize count = 0;
+    const guint32* values;
+    guint line_no = 0;
+    guint chunk = 0;
+    gchar* line;
+
+    var = g_settings_get_value(settings, "alarms");
+    values = g_variant_get_fixed_array(var, &count, sizeof(guint32));
+
+    import.used = g_hash_table_new(NULL, NULL);
+    import.changes = g_hash_table_new_full(NULL, NULL, NULL, g_object_unref);
+    import.ids = g_array_sized_new(FALSE, FALSE, sizeof(guint32), count);
+    g_array_append_vals(import.ids, values, count);
+    for(gsize i = 0; i < count; i++)
+        g_hash_table_add(import.used, GUINT_TO_POINTER(values[i]));
+
+    g_variant_unref(var);
+
+    while((line = g_data_input_stream_read_line_utf8(lines, NULL, cancellable, &err))) {
+        const gchar* text = g_strstrip(line);
+        AlarmImportAction action;
+        GError* line_error = NULL;
+        guint32 id = 0;
+
+        line_no++;
+
+        // Blank lines and comments
+        if(*text == '\0' || *text == '#') {
+            g_free(line);
+            continue;
+        }
+
+        g_string_truncate(changed, 0);
+        action = alarm_import_line(&import, text, &id, changed, &line_error);
+
+        if(action == ALARM_IMPORT_INVALID) {
+            func(line_no, 0, action, line_error->message, data);
+            g_error_free(line_error);
+        } else {
+            func(line_no, id, action, changed->str, data);
+        }
+
+        g_free(line);
+
+        if(++chunk == ALARM_IMPORT_CHUNK) {
+            alarm_import_commit(&import);
+            chunk = 0;
+        }
+
+        if(g_cancellable_set_error_if_cancelled(cancellable, &err))
+            break;
+    }
+
+    // Also when stopping early, so that no written alarm is left out
+    alarm_import_commit(&import);
+    g_settings_sync();
+
+    g_string_free(changed, TRUE);
+    g_array_free(import.ids, TRUE);
+    g_hash_table_destroy(import.used);
+    g_hash_table_destroy(import.changes);
+    g_object_unref(lines);
+
+    if(err) {
+        g_propagate_error(error, err);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * }} Import
+ */
+
+/*
+ * Command line {{
+ */
+
+typedef struct {
+    gboolean dry_run;
+    guint count[ALARM_IMPORT_INVALID + 1];
+} AlarmImportReport;
+
+static void alarm_io_report(guint line, guint32 id, AlarmImportAction action, const gchar* detail, gpointer data)
+{
+    AlarmImportReport* report = data;
+
+    report->count[action]++;
+
+    switch(action) {
+    case ALARM_IMPORT_INVALID:
+        g_printerr(_("Line %u: %s\n"), line, detail);
+        break;
+    case ALARM_IMPORT_CREATE:
+        if(report->dry_run)
+            g_print(_("Line %u: create #%" G_GUINT32_FORMAT "\n"), line, id);
+        break;
+    case ALARM_IMPORT_UPDATE:
+        if(report->dry_run)
+            g_print(_("Line %u: update #%" G_GUINT32_FORMAT ": %s\n"), line, id, detail);
+        break;
+    case ALARM_IMPORT_UNCHANGED:
+        break;
+    }
+}
+
+typedef struct {
+    GSettings* settings;
+    GInputStream* in;
+    AlarmImportReport* report;
+} AlarmImportJob;
+
+static void alarm_io_import_thread(GTask* task, gpointer source_object, gpointer task_data, GCancellable* cancellable)
+{
+    AlarmImportJob* job = task_data;
+    GError* error = NULL;
+
+    if(alarm_import(job->settings, job->in, job->report->dry_run, alarm_io_report, job->report, cancellable, &error))
+        g_task_return_boolean(task, TRUE);
+    else
+        g_task_return_error(task, error);
+}
+
+static void alarm_io_import_done(GObject* source_object, GAsyncResult* res, gpointer data)
+{
+    g_main_loop_quit(data);
+}
+
+static gboolean alarm_io_cancel(gpointer data)
+{
+    g_cancellable_cancel(data);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean alarm_io_export_path(GSettings* settings, const gchar* path, GError** error)
+{
+    GOutputStream* out;
+    GOutputStream* buffered;
+    gboolean ok;
+
+    if(strcmp(path, "-") == 0) {
+        out = g_unix_output_stream_new(STDOUT_FILENO, FALSE);
+    } else {
+        GFile* file = g_file_new_for_commandline_arg(path);
+        out = (GOutputStream*)g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error);
+        g_object_unref(file);
+
+        if(!out)
+            return FALSE;
+    }
+
+    buffered = g_buffered_output_stream_new(out);
+    ok = alarm_export(settings, buffered, NULL, error) && g_output_stream_close(buffered, NULL, error);
+
+    g_object_unref(buffered);
+    g_object_unref(out);
+
+    return ok;
+}
+
+static gboolean alarm_io_import_path(GSettings* settings, const gchar* path, gboolean dry_run, GError** error)
+{
+    AlarmImportReport report = { dry_run };
+    AlarmImportJob job = { settings, NULL, &report };
+    GCancellable* cancellable;
+    GMainLoop* loop;
+    GInputStream* in;
+    GTask* task;
+    guint sigint_id;
+    gboolean ok;
+
+    if(strcmp(path, "-") == 0) {
+        in = g_unix_input_stream_new(STDIN_FILENO, FALSE);
+    } else {
+        GFile* file = g_file_new_for_commandline_arg(path);
+        in = (GInputStream*)g_file_read(file, NULL, error);
+        g_object_unref(file);
+
+        if(!in)
+            return FALSE;
+    }
+
+    /*
+     * The import runs in a worker so that the main loop is free to deliver the
+     * change notifications and ^C. Cancelling interrupts a blocking read of
+     * standard input right away, and the alarms list is still written for
+     * everything imported so far.
+     */
+    job.in = in;
+    cancellable = g_cancellable_new();
+    loop = g_main_loop_new(NULL, FALSE);
+    sigint_id = g_unix_signal_add(SIGINT, alarm_io_cancel, cancellable);
+
+    task = g_task_new(NULL, cancellable, alarm_io_import_done, loop);
+    g_task_set_task_data(task, &job, NULL);
+    g_task_run_in_thread(task, alarm_io_import_thread);
+
+    g_main_loop_run(loop);
+
+    ok = g_task_propagate_boolean(task, error);
+
+    g_object_unref(task);
+    g_source_remove(sigint_id);
+    g_main_loop_unref(loop);
+    g_object_unref(cancellable);
+    g_object_unref(in);
+
+    g_print(dry_run ? _("Would create %u, update %u and leave %u alarms unchanged, %u invalid\n") : _("Created %u, updated %u and left %u alarms unchanged, %u invalid\n"),
+            report.count[ALARM_IMPORT_CREATE], report.count[ALARM_IMPORT_UPDATE], report.count[ALARM_IMPORT_UNCHANGED], report.count[ALARM_IMPORT_INVALID]);
+
+    return ok && report.count[ALARM_IMPORT_INVALID] == 0;
+}
+
+gboolean alarm_io_handle_options(GVariantDict* options, gint* status)
+{
+    const gchar* export_path = NULL;
+    const gchar* import_path = NULL;
+    const gboolean dry_run = g_variant_dict_contains(options, "dry-run");
+    GSettings* settings;
+    GError* error = NULL;
+    gboolean ok;
+
+    g_variant_dict_lookup(options, "export", "^&ay", &export_path);
+    g_variant_dict_lookup(options, "import", "^&ay", &import_path);
+
+    if(!export_path && !import_path && !dry_run)
+        return FALSE;
+
+    if(!import_path && dry_run) {
+        g_printerr(_("--dry-run only works with --import\n"));
+        *status = 1;
+        return TRUE;
+    }
+
+    if(export_path && import_path) {
+        g_printerr(_("--export and --import can't be used together\n"));
+        *status = 1;
+        return TRUE;
+    }
+
+    settings = g_settings_new("io.github.alarm-clock-applet");
+
+    if(export_path)
+        ok = alarm_io_export_path(settings, export_path, &error);
+    else
+        ok = alarm_io_import_path(settings, import_path, dry_run, &error);
+
+    if(error) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+    }
+
+    g_object_unref(settings);
+
+    *status = ok ? 0 : 1;
+    return TRUE;
+}
+
+/*
+ * }} Command line
+ */
@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * alarm-io.h -- Streaming import and export of alarms
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef ALARM_IO_H_
+#define ALARM_IO_H_
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    ALARM_IMPORT_CREATE,
+    ALARM_IMPORT_UPDATE,
+    ALARM_IMPORT_UNCHANGED,
+    ALARM_IMPORT_INVALID,
+} AlarmImportAction;
+
+/*
+ * Called for every alarm line. detail is the comma separated list of changed
+ * fields, or the error message of an invalid line.
+ */
+typedef void (*AlarmImportFunc)(guint line, guint32 id, AlarmImportAction action, const gchar* detail, gpointer data);
+
+/**
+ * Write all saved alarms to out, one a{sv} in GVariant text format per line.
+ */
+gboolean alarm_export(GSettings* settings, GOutputStream* out, GCancellable* cancellable, GError** error);
+
+/**
+ * Read alarms in the format of alarm_export() from in, one line at a time.
+ *
+ * Lines with an id update that alarm, or create it if it doesn't exist, and
+ * lines without one create a new alarm. Invalid lines are reported and
+ * skipped. The alarms of a chunk of lines are written together with the
+ * alarms list rather than one by one, and the list is up to date with
+ * everything imported so far when returning early because of an error or
+ * cancellable. Blocks on in, so it's best called from a worker thread.
+ *
+ * With dry_run, nothing is written but func is still told what would change.
+ */
+gboolean alarm_import(GSettings* settings, GInputStream* in, gboolean dry_run, AlarmImportFunc func, gpointer data, GCancellable* cancellable, GError** error);
+
+/**
+ * Handle --export, --import and --dry-run without starting the application.
+ *
+ * Returns TRUE and sets status if any of them was given.
+ */
+gboolean alarm_io_handle_options(GVariantDict* options, gint* status);
+
+G_END_DECLS
+
+#endif /*ALARM_IO_H_*/
@@ -11,6 +11,7 @@
 #include "alarm-list-window.h"
 #include "alarm-settings.h"
 #include "alarm-actions.h"
+#include "source-stats.h"
 
 gboolean alarm_list_window_delete_event(GtkWidget* window, GdkEvent* event, gpointer data);
 
@@ -40,7 +41,7 @@ static void alarm_list_window_row_activated(GtkTreeView* self, GtkTreePath* path
 AlarmListWindow* alarm_list_window_new(AlarmApplet* applet)
 {
     AlarmListWindow* list_window;
-    GtkBuilder* builder = applet->ui;
+    GtkBuilder* builder;
     GtkTreeSelection* selection;
     GtkTreeSortable* sortable;
 
@@ -48,6 +49,7 @@ AlarmListWindow* alarm_list_window_new(AlarmApplet* applet)
     list_window = g_new0(AlarmListWindow, 1);
 
     list_window->applet = applet;
+    list_window->builder = builder = alarm_applet_ui_load("alarm-list-window.ui", applet);
 
     // Widgets
     list_window->window = GTK_WINDOW(gtk_builder_get_object(builder, "alarm-list-window"));
@@ -78,7 +80,7 @@ AlarmListWindow* alarm_list_window_new(AlarmApplet* applet)
     g_signal_connect(list_window->tree_view, "row-activated", G_CALLBACK(alarm_list_window_row_activated), applet);
 
     // Update view every half a second for pretty countdowns
-    g_timeout_add(500, (GSourceFunc)alarm_list_window_update_timer, applet);
+    source_stats_timeout_add("alarm-list-window-update", 500, (GSourceFunc)alarm_list_window_update_timer, applet);
 
     // Set up sorting
     sortable = GTK_TREE_SORTABLE(list_window->model);
@@ -302,16 +304,26 @@ void alarm_list_window_alarms_add(AlarmListWindow* list_window, GList* alarms)
 static gboolean alarm_list_window_update_timer(gpointer data)
 {
     AlarmApplet* applet = (AlarmApplet*)data;
-    GtkTreeModel* model = GTK_TREE_MODEL(applet->list_window->model);
+
+    // Don't attempt to update if the window is not mapped
+    if(gtk_widget_get_mapped(GTK_WIDGET(applet->list_window->window)))
+        alarm_list_window_refresh(applet->list_window);
+
+    // Keep updating
+    return TRUE;
+}
+
+/**
+ * Update the rows of active, triggered and changed alarms
+ */
+void alarm_list_window_refresh(AlarmListWindow* list_window)
+{
+    GtkTreeModel* model = GTK_TREE_MODEL(list_window->model);
     GtkTreeIter iter;
     Alarm* a;
     gboolean show_icon;
     gboolean valid;
 
-    // Don't attempt to update if the window is not mapped
-    if(!gtk_widget_get_mapped(GTK_WIDGET(applet->list_window->window)))
-        return TRUE;
-
     valid = gtk_tree_model_get_iter_first(model, &iter);
 
     while(valid) {
@@ -319,7 +331,7 @@ static gboolean alarm_list_window_update_timer(gpointer data)
 
         // Always update active alarms regardless of the changed state
         if(a->active || a->triggered || a->changed) {
-            alarm_list_window_update_row(applet->list_window, &iter);
+            alarm_list_window_update_row(list_window, &iter);
 
             // Blink icon on triggered alarms
             if(a->triggered) {
@@ -331,9 +343,6 @@ static gboolean alarm_list_window_update_timer(gpointer data)
         valid = gtk_tree_model_iter_next(model, &iter);
         g_object_unref(a);
     }
-
-    // Keep updating
-    return TRUE;
 }
 
 /**
@@ -589,8 +598,8 @@ void alarm_list_window_snooze_menu_custom_activated(GtkMenuItem* menuitem, gpoin
 
     g_debug("AlarmListWindow: snooze-menu custom activated");
 
-    dialog = GTK_WIDGET(gtk_builder_get_object(applet->ui, "snooze-dialog"));
-    spin = GTK_WIDGET(gtk_builder_get_object(applet->ui, "snooze-spin"));
+    dialog = GTK_WIDGET(gtk_builder_get_object(list_window->builder, "snooze-dialog"));
+    spin = GTK_WIDGET(gtk_builder_get_object(list_window->builder, "snooze-spin"));
 
     // Run dialog, hide for later use
     response = gtk_dialog_run(GTK_DIALOG(dialog));
@@ -38,6 +38,7 @@ struct _AlarmListWindow {
     gboolean reordered; // Indicates that rows have just been reordered
     gboolean toggled;   // Indicates that an alarm has just been toggled
 
+    GtkBuilder* builder; // Also holds the snooze dialog
     GtkWindow* window;
     GtkListStore* model;
     GtkTreeView* tree_view;
@@ -85,6 +86,8 @@ void alarm_list_window_alarm_remove(AlarmListWindow* list_window, Alarm* alarm);
 
 void alarm_list_window_alarms_add(AlarmListWindow* list_window, GList* alarms);
 
+void alarm_list_window_refresh(AlarmListWindow* list_window);
+
 gboolean alarm_list_window_find_alarm(GtkTreeModel* model, Alarm* alarm, GtkTreeIter* iter);
 
 gboolean alarm_list_window_contains(AlarmListWindow* list_window, Alarm* alarm);
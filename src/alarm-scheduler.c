@@ -0,0 +1,351 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * alarm-scheduler.c -- Deadline tracking for active alarms
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <time.h>
+
+#include "alarm-scheduler.h"
+#include "metrics.h"
+#include "source-stats.h"
+#include "trace.h"
+#include "sound-cache.h"
+#include "sound-index.h"
+#include "wallclock.h"
+
+/*
+ * Active alarms are watched by a scheduler thread, so that a busy main loop
+ * never delays them. When an alarm is due, the scheduler thread starts its
+ * sound or command right away and then queues the trigger for the main
+ * thread, which takes care of the notification, the list window and the
+ * repeat logic.
+ *
+ * The scheduler works on a snapshot of each alarm and never touches the Alarm
+ * object itself. Snapshots are kept ordered by deadline, and the scheduler
+ * thread sleeps until the earliest one.
+ *
+ * A deadline that has passed is always delivered, since its sound or command
+ * has already been started. A fired snapshot stays around until its trigger
+ * has been dispatched, so that changes made in the meantime don't arm the
+ * same deadline a second time, and only disarming the alarm discards it.
+ */
+
+// The wall clock may jump, so never sleep longer than this while alarms are armed
+#define ALARM_SCHEDULER_MAX_SLEEP (5 * G_USEC_PER_SEC)
+
+typedef struct {
+    gint ref_count;
+    GWeakRef alarm;
+    guint serial;
+    gint id; // For tracing only
+
+    time_t timestamp;
+    AlarmNotifyType notify_type;
+    gchar* sound_file;
+    gboolean sound_loop;
+    gboolean sound_verified; // Known to play fine, so the segment seek can be skipped
+    gchar* command;
+    gchar** command_argv;
+
+    GSequenceIter* queue_iter; // Position in scheduler_queue, NULL once fired
+    gboolean fired;            // Trigger not dispatched yet
+    gboolean disarmed;         // Removed while the trigger was on its way, protected by scheduler_lock
+} AlarmSchedulerEntry;
+
+typedef struct {
+    AlarmSchedulerEntry* entry;
+    MediaPlayer* player; // Player started by the scheduler thread, if any
+    GError* error;       // Error from starting the sound or command, if any
+} AlarmSchedulerEvent;
+
+static GMutex scheduler_lock;
+static GCond scheduler_cond;
+static GHashTable* scheduler_entries = NULL; // Alarm* -> AlarmSchedulerEntry, protected by scheduler_lock
+static GSequence* scheduler_queue = NULL;    // Entries that haven't fired by deadline, protected by scheduler_lock
+static GHashTable* scheduler_armed = NULL;   // Alarm*, main thread only
+static guint scheduler_next_serial = 0;      // Main thread only, orders equal deadlines
+
+static AlarmSchedulerEntry* alarm_scheduler_entry_ref(AlarmSchedulerEntry* entry)
+{
+    g_atomic_int_inc(&entry->ref_count);
+
+    return entry;
+}
+
+static void alarm_scheduler_entry_unref(AlarmSchedulerEntry* entry)
+{
+    if(!g_atomic_int_dec_and_test(&entry->ref_count))
+        return;
+
+    g_weak_ref_clear(&entry->alarm);
+    g_free(entry->sound_file);
+    g_free(entry->command);
+    g_strfreev(entry->command_argv);
+    g_free(entry);
+}
+
+/*
+ * Drop an entry from scheduler_entries. Called with scheduler_lock held.
+ */
+static void alarm_scheduler_entry_release(AlarmSchedulerEntry* entry)
+{
+    if(entry->queue_iter)
+        g_sequence_remove(entry->queue_iter);
+
+    alarm_scheduler_entry_unref(entry);
+}
+
+static gint alarm_scheduler_entry_compare(gconstpointer a, gconstpointer b, gpointer data)
+{
+    const AlarmSchedulerEntry* ea = a;
+    const AlarmSchedulerEntry* eb = b;
+
+    if(ea->timestamp != eb->timestamp)
+        return ea->timestamp < eb->timestamp ? -1 : 1;
+
+    return ea->serial < eb->serial ? -1 : ea->serial > eb->serial;
+}
+
+static void alarm_scheduler_event_free(gpointer data)
+{
+    AlarmSchedulerEvent* event = (AlarmSchedulerEvent*)data;
+
+    if(event->player)
+        media_player_free(event->player);
+
+    g_clear_error(&event->error);
+    alarm_scheduler_entry_unref(event->entry);
+    g_free(event);
+}
+
+/*
+ * Main thread {{
+ */
+
+static gboolean alarm_scheduler_dispatch(gpointer data)
+{
+    AlarmSchedulerEvent* event = (AlarmSchedulerEvent*)data;
+    Alarm* alarm = g_weak_ref_get(&event->entry->alarm);
+    gboolean disarmed;
+
+    if(!alarm)
+        return G_SOURCE_REMOVE;
+
+    // Only the main thread drops references, so the alarm stays alive until we return
+    g_object_unref(alarm);
+
+    // The alarm may be armed again from now on
+    g_mutex_lock(&scheduler_lock);
+    disarmed = event->entry->disarmed;
+    if(g_hash_table_lookup(scheduler_entries, alarm) == event->entry)
+        g_hash_table_remove(scheduler_entries, alarm);
+    g_mutex_unlock(&scheduler_lock);
+
+    // Changes that only moved the deadline still get the trigger that already went off
+    if(disarmed) {
+        g_debug("Alarm(%p) #%d: Discarding trigger of a disarmed alarm", alarm, alarm->id);
+        return G_SOURCE_REMOVE;
+    }
+
+    alarm_trigger_started(alarm, event->entry->timestamp, event->player, event->error);
+    event->player = NULL;
+
+    return G_SOURCE_REMOVE;
+}
+
+static void alarm_scheduler_command_finished(const gchar* command, const CommandResult* result, gpointer data)
+{
+    AlarmSchedulerEntry* entry = (AlarmSchedulerEntry*)data;
+    Alarm* alarm = g_weak_ref_get(&entry->alarm);
+
+    if(!alarm)
+        return;
+
+    g_object_unref(alarm);
+
+    alarm_command_report(alarm, command, result);
+}
+
+/*
+ * }} Main thread
+ */
+
+/*
+ * Scheduler thread {{
+ */
+
+static void alarm_scheduler_fire(gpointer data)
+{
+    AlarmSchedulerEntry* entry = (AlarmSchedulerEntry*)data;
+    AlarmSchedulerEvent* event = g_new0(AlarmSchedulerEvent, 1);
+    const gint64 due = (gint64)entry->timestamp * G_USEC_PER_SEC;
+
+    event->entry = entry;
+
+    trace_event(TRACE_ALARM_FIRE, entry->id, entry->timestamp);
+    metrics_observe(METRICS_TRIGGER_LATENCY, wallclock_now_us() - due);
+
+    switch(entry->notify_type) {
+    case ALARM_NOTIFY_SOUND:
+    {
+        // Prefer the local copy of sounds on remote filesystems
+        gchar* cached_uri = sound_cache_lookup(entry->sound_file);
+        const gchar* uri = cached_uri ? cached_uri : entry->sound_file;
+
+        event->player = media_player_new(uri, entry->sound_loop, NULL, NULL, NULL, NULL);
+        if(event->player) {
+            media_player_set_skip_seek(event->player, entry->sound_verified);
+            media_player_set_deadline(event->player, due);
+            media_player_start(event->player);
+        } else {
+            event->error = g_error_new_literal(ALARM_ERROR, ALARM_ERROR_PLAY, _("Could not create player! Please check your sound settings."));
+        }
+
+        g_free(cached_uri);
+        break;
+    }
+    case ALARM_NOTIFY_COMMAND:
+        // Failures are reported once the command has finished
+        command_executor_run(entry->id, entry->command, (const gchar* const*)entry->command_argv, due, alarm_scheduler_command_finished, alarm_scheduler_entry_ref(entry), (GDestroyNotify)alarm_scheduler_entry_unref);
+        break;
+    default:
+        break;
+    }
+
+    source_stats_invoke(NULL, "alarm-scheduler-dispatch", G_PRIORITY_HIGH, alarm_scheduler_dispatch, event, alarm_scheduler_event_free);
+}
+
+static gpointer alarm_scheduler_thread(gpointer data)
+{
+    gint64 begin = source_stats_begin();
+
+    g_mutex_lock(&scheduler_lock);
+
+    for(;;) {
+        const gint64 now_us = wallclock_now_us();
+        const time_t now = now_us / G_USEC_PER_SEC;
+        GSequenceIter* iter;
+        AlarmSchedulerEntry* entry = NULL;
+        GList* due = NULL;
+
+        while(!g_sequence_iter_is_end(iter = g_sequence_get_begin_iter(scheduler_queue))) {
+            entry = g_sequence_get(iter);
+
+            if(now < entry->timestamp)
+                break;
+
+            g_sequence_remove(iter);
+            entry->queue_iter = NULL;
+            entry->fired = TRUE;
+            due = g_list_prepend(due, alarm_scheduler_entry_ref(entry));
+            entry = NULL;
+        }
+
+        if(due) {
+            // Starting players and commands may take a while
+            g_mutex_unlock(&scheduler_lock);
+            g_list_free_full(due, alarm_scheduler_fire);
+            g_mutex_lock(&scheduler_lock);
+            continue;
+        }
+
+        source_stats_end("alarm-scheduler", begin);
+
+        // Sleep until the earliest deadline. Arming an alarm or moving a virtual clock wakes us up.
+        if(entry)
+            g_cond_wait_until(&scheduler_cond, &scheduler_lock, g_get_monotonic_time() + MIN((gint64)entry->timestamp * G_USEC_PER_SEC - now_us, ALARM_SCHEDULER_MAX_SLEEP));
+        else
+            g_cond_wait(&scheduler_cond, &scheduler_lock);
+        begin = source_stats_begin();
+    }
+
+    return NULL;
+}
+
+/*
+ * }} Scheduler thread
+ */
+
+static void alarm_scheduler_clock_changed(gpointer data)
+{
+    g_mutex_lock(&scheduler_lock);
+    g_cond_signal(&scheduler_cond);
+    g_mutex_unlock(&scheduler_lock);
+}
+
+static void alarm_scheduler_init(void)
+{
+    if(scheduler_armed)
+        return;
+
+    wallclock_add_notify(alarm_scheduler_clock_changed, NULL);
+
+    scheduler_armed = g_hash_table_new(NULL, NULL);
+    scheduler_entries = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)alarm_scheduler_entry_release);
+    scheduler_queue = g_sequence_new(NULL);
+
+    g_thread_unref(g_thread_new("scheduler", alarm_scheduler_thread, NULL));
+}
+
+void alarm_scheduler_add(Alarm* alarm)
+{
+    AlarmSchedulerEntry* current;
+    AlarmSchedulerEntry* entry;
+
+    alarm_scheduler_init();
+
+    entry = g_new0(AlarmSchedulerEntry, 1);
+    entry->ref_count = 1;
+    g_weak_ref_init(&entry->alarm, alarm);
+    entry->serial = scheduler_next_serial++;
+    entry->id = alarm->id;
+    entry->timestamp = alarm->timestamp;
+    entry->notify_type = alarm->notify_type;
+    entry->sound_file = g_strdup(alarm->sound_file);
+    entry->sound_loop = alarm->sound_loop;
+    entry->sound_verified = alarm_sound_is_verified(alarm);
+    entry->command = g_strdup(alarm->command);
+    entry->command_argv = g_strdupv((gchar**)alarm_get_command_argv(alarm));
+
+    g_mutex_lock(&scheduler_lock);
+
+    // Changes that arrive while the trigger is on its way must not fire the same deadline again
+    current = g_hash_table_lookup(scheduler_entries, alarm);
+    if(current && current->fired && entry->timestamp <= wallclock_now()) {
+        g_mutex_unlock(&scheduler_lock);
+        g_debug("Alarm(%p) #%d: Not rearming while the trigger is pending", alarm, alarm->id);
+        alarm_scheduler_entry_unref(entry);
+        return;
+    }
+
+    entry->queue_iter = g_sequence_insert_sorted(scheduler_queue, entry, alarm_scheduler_entry_compare, NULL);
+    g_hash_table_insert(scheduler_entries, alarm, entry);
+
+    // Only a new earliest deadline changes how long the scheduler sleeps
+    if(g_sequence_iter_is_begin(entry->queue_iter))
+        g_cond_signal(&scheduler_cond);
+
+    g_mutex_unlock(&scheduler_lock);
+
+    trace_event(g_hash_table_add(scheduler_armed, alarm) ? TRACE_ALARM_ARM : TRACE_ALARM_REARM, alarm->id, alarm->timestamp);
+}
+
+void alarm_scheduler_remove(Alarm* alarm)
+{
+    AlarmSchedulerEntry* current;
+
+    if(!scheduler_armed)
+        return;
+
+    if(g_hash_table_remove(scheduler_armed, alarm))
+        trace_event(TRACE_ALARM_DISARM, alarm->id, 0);
+
+    g_mutex_lock(&scheduler_lock);
+    current = g_hash_table_lookup(scheduler_entries, alarm);
+    if(current && current->fired)
+        current->disarmed = TRUE;
+    g_hash_table_remove(scheduler_entries, alarm);
+    g_mutex_unlock(&scheduler_lock);
+}
@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * alarm-scheduler.h -- Deadline tracking for active alarms
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef ALARM_SCHEDULER_H_
+#define ALARM_SCHEDULER_H_
+
+#include <glib.h>
+
+#include "alarm.h"
+
+G_BEGIN_DECLS
+
+/**
+ * Schedule an alarm, or update the schedule of an already scheduled alarm.
+ *
+ * The scheduler keeps a snapshot of the alarm, so this has to be called
+ * whenever any of its timestamp or notification settings change.
+ */
+void alarm_scheduler_add(Alarm* alarm);
+
+/**
+ * Remove an alarm from the schedule.
+ *
+ * A trigger that is already on its way to the main thread is discarded. Just
+ * moving the deadline with alarm_scheduler_add() doesn't do that.
+ */
+void alarm_scheduler_remove(Alarm* alarm);
+
+G_END_DECLS
+
+#endif /*ALARM_SCHEDULER_H_*/
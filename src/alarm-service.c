@@ -0,0 +1,627 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * alarm-service.c -- D-Bus interface for managing alarms in batches
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include "alarm-service.h"
+#include "remote.h"
+#include "util.h"
+#include "sound-index.h"
+#include "source-stats.h"
+
+/*
+ * Scripts used to create alarms by writing each alarm's keys and appending to
+ * the alarms list, which makes the owner reconcile its whole list once per
+ * alarm. Here the alarms are created on the owner's list directly, written
+ * with one settings write each, and the list is written once at the end. The
+ * resulting changed::alarms finds every alarm already in place.
+ *
+ * Alarms are described as a{sv} by alarm_to_variant(), with enums as nicks
+ * and the repeat flags as a list of day nicks.
+ *
+ * Timers created with CreateTimers or --timer are ephemeral: they only exist
+ * in memory, never show up in the alarms list and are dropped as soon as they
+ * have run out and been stopped.
+ */
+
+static const gchar alarm_service_xml[] =
+    "<node>"
+    "  <interface name='" ALARM_SERVICE_INTERFACE "'>"
+    "    <method name='CreateAlarms'>"
+    "      <arg type='aa{sv}' name='alarms' direction='in'/>"
+    "      <arg type='au' name='ids' direction='out'/>"
+    "    </method>"
+    "    <method name='UpdateAlarms'>"
+    "      <arg type='a(ua{sv})' name='changes' direction='in'/>"
+    "    </method>"
+    "    <method name='DeleteAlarms'>"
+    "      <arg type='au' name='ids' direction='in'/>"
+    "    </method>"
+    "    <method name='SetEnabled'>"
+    "      <arg type='au' name='ids' direction='in'/>"
+    "      <arg type='b' name='enabled' direction='in'/>"
+    "    </method>"
+    "    <method name='CreateTimers'>"
+    "      <arg type='a(xsa{sv})' name='timers' direction='in'/>"
+    "      <arg type='au' name='ids' direction='out'/>"
+    "    </method>"
+    "    <method name='ListAlarms'>"
+    "      <arg type='as' name='fields' direction='in'/>"
+    "      <arg type='aa{sv}' name='alarms' direction='out'/>"
+    "    </method>"
+    "  </interface>"
+    "</node>";
+
+static GDBusConnection* service_connection = NULL;
+static guint service_id = 0;
+static GSettings* service_settings = NULL;
+static const AlarmServiceFuncs* service_funcs = NULL;
+static gpointer service_data = NULL;
+static guint service_reap_id = 0;
+
+/*
+ * id -> Alarm of the owner's current list
+ */
+static GHashTable* alarm_service_index(void)
+{
+    GHashTable* index = g_hash_table_new(NULL, NULL);
+
+    for(GList* l = service_funcs->get_alarms(service_data); l; l = l->next)
+        g_hash_table_insert(index, GINT_TO_POINTER(ALARM(l->data)->id), l->data);
+
+    return index;
+}
+
+/*
+ * Look up all ids before anything is changed, so that a bad id fails the
+ * whole call. Returns a new array of the alarms, or NULL with error set.
+ */
+static GPtrArray* alarm_service_lookup(GHashTable* index, GVariantIter* ids, GError** error)
+{
+    GPtrArray* alarms = g_ptr_array_new();
+    guint32 id;
+
+    while(g_variant_iter_next(ids, "u", &id)) {
+        Alarm* alarm;
+
+        if(!g_hash_table_lookup_extended(index, GINT_TO_POINTER(id), NULL, (gpointer*)&alarm)) {
+            g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "No alarm #%" G_GUINT32_FORMAT, id);
+            g_ptr_array_free(alarms, TRUE);
+            return NULL;
+        }
+
+        // Already seen
+        if(!alarm)
+            continue;
+
+        g_ptr_array_add(alarms, alarm);
+        g_hash_table_insert(index, GINT_TO_POINTER(id), NULL);
+    }
+
+    return alarms;
+}
+
+static void alarm_service_list_commit(void)
+{
+    alarm_update_gsettings_alarm_list(service_settings, service_funcs->get_alarms(service_data));
+}
+
+void alarm_service_sync_list(GSettings* settings, const AlarmServiceFuncs* funcs, gpointer data)
+{
+    GVariant* var = g_settings_get_value(settings, "alarms");
+    gsize count = 0;
+    const guint32* values = g_variant_get_fixed_array(var, &count, sizeof(guint32));
+    GHashTable* ids = g_hash_table_new(NULL, NULL);
+    GHashTable* present = g_hash_table_new(NULL, NULL);
+
+    for(GList* l = funcs->get_alarms(data); l; l = l->next)
+        g_hash_table_add(present, GINT_TO_POINTER(ALARM(l->data)->id));
+
+    // First, add the alarms that are new
+    for(gsize i = 0; i < count; i++) {
+        g_hash_table_add(ids, GUINT_TO_POINTER(values[i]));
+
+        if(!g_hash_table_contains(present, GUINT_TO_POINTER(values[i]))) {
+            g_debug("AlarmService: ADD alarm #%" G_GUINT32_FORMAT, values[i]);
+            funcs->add(alarm_new(settings, values[i]), data);
+        }
+    }
+
+    // Then drop the ones that are gone
+    for(GList* l = funcs->get_alarms(data); l;) {
+        Alarm* a = ALARM(l->data);
+
+        // Removing only frees this link
+        l = l->next;
+
+        // Ephemeral alarms are never in the list
+        if(!alarm_is_ephemeral(a) && !g_hash_table_contains(ids, GUINT_TO_POINTER(a->id))) {
+            g_debug("AlarmService: DELETE alarm #%d", a->id);
+            funcs->remove(a, data);
+        }
+    }
+
+    g_hash_table_destroy(present);
+    g_hash_table_destroy(ids);
+    g_variant_unref(var);
+}
+
+/*
+ * Ephemeral timers {{
+ */
+
+/*
+ * A timer is done once it is no longer counting down and nothing is ringing.
+ * Commands are handed off to the executor, so there is nothing to stop.
+ */
+static gboolean alarm_service_timer_done(Alarm* alarm)
+{
+    return !alarm->active && (!alarm->triggered || alarm->notify_type == ALARM_NOTIFY_COMMAND);
+}
+
+static gboolean alarm_service_reap(gpointer data)
+{
+    GPtrArray* done = g_ptr_array_new();
+
+    service_reap_id = 0;
+
+    for(GList* l = service_funcs->get_alarms(service_data); l; l = l->next) {
+        Alarm* alarm = ALARM(l->data);
+
+        if(alarm_is_ephemeral(alarm) && alarm_service_timer_done(alarm))
+            g_ptr_array_add(done, alarm);
+    }
+
+    // Not in the alarms list, so there is nothing to write
+    for(guint i = 0; i < done->len; i++)
+        service_funcs->remove(done->pdata[i], service_data);
+
+    g_debug("AlarmService: Dropped %u timers", done->len);
+
+    g_ptr_array_free(done, TRUE);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Deferred, as snoozing clears the alarm before it starts counting down again
+ */
+static void alarm_service_reap_queue(void)
+{
+    if(!service_reap_id)
+        service_reap_id = source_stats_idle_add("alarm-service-reap", G_PRIORITY_DEFAULT_IDLE, alarm_service_reap, NULL);
+}
+
+static void alarm_service_timer_active_changed(GObject* object, GParamSpec* pspec, gpointer data)
+{
+    alarm_service_reap_queue();
+}
+
+static void alarm_service_timer_cleared(Alarm* alarm, gpointer data)
+{
+    alarm_service_reap_queue();
+}
+
+Alarm* alarm_service_new_ephemeral(void)
+{
+    const GList* stock = sound_index_get_stock();
+    Alarm* alarm;
+
+    g_return_val_if_fail(service_funcs != NULL, NULL);
+
+    alarm = alarm_new_ephemeral();
+
+    // Same default as a new alarm in the list window
+    if(stock)
+        g_object_set(alarm, "sound-file", ((AlarmListEntry*)stock->data)->data, NULL);
+
+    service_funcs->add(alarm, service_data);
+
+    g_signal_connect(alarm, "notify::active", G_CALLBACK(alarm_service_timer_active_changed), NULL);
+    g_signal_connect(alarm, "cleared", G_CALLBACK(alarm_service_timer_cleared), NULL);
+
+    return alarm;
+}
+
+/*
+ * Create and start a timer. fields, if any, must have passed alarm_variant_check().
+ */
+static Alarm* alarm_service_timer_new(gint64 seconds, const gchar* message, GVariant* fields)
+{
+    Alarm* alarm = alarm_service_new_ephemeral();
+
+    alarm_begin_update(alarm);
+
+    if(fields)
+        alarm_set_from_variant(alarm, fields, NULL);
+
+    g_object_set(alarm, "type", ALARM_TYPE_TIMER, "time", seconds, "repeat", ALARM_REPEAT_NONE, NULL);
+    if(message && *message)
+        g_object_set(alarm, "message", message, NULL);
+
+    alarm_set_enabled(alarm, TRUE);
+    alarm_end_update(alarm);
+
+    return alarm;
+}
+
+Alarm* alarm_service_add_timer(gint64 seconds, const gchar* message)
+{
+    Alarm* alarm;
+
+    g_return_val_if_fail(service_funcs != NULL, NULL);
+    g_return_val_if_fail(seconds > 0, NULL);
+
+    alarm = alarm_service_timer_new(seconds, message, NULL);
+
+    g_debug("AlarmService: Timer #%d for %" G_GINT64_FORMAT "s", alarm->id, seconds);
+
+    return alarm;
+}
+
+gboolean alarm_service_command_line_timer(GApplicationCommandLine* cmdline, gint* status)
+{
+    GVariantDict* options = g_application_command_line_get_options_dict(cmdline);
+    const gchar* duration;
+    gchar** argv;
+    gchar* message;
+    gint argc;
+    gint64 seconds;
+    Alarm* alarm;
+
+    if(!g_variant_dict_lookup(options, "timer", "&s", &duration))
+        return FALSE;
+
+    if(!parse_duration(duration, &seconds)) {
+        g_application_command_line_printerr(cmdline, _("Invalid duration '%s', expected e.g. 90s, 5m or 1h30m\n"), duration);
+        *status = 1;
+        return TRUE;
+    }
+
+    // Option parsing leaves only the words of the message
+    argv = g_application_command_line_get_arguments(cmdline, &argc);
+    message = argc > 1 ? g_strjoinv(" ", argv + 1) : NULL;
+
+    alarm = alarm_service_add_timer(seconds, message);
+    g_application_command_line_print(cmdline, "%d\n", alarm->id);
+
+    g_free(message);
+    g_strfreev(argv);
+
+    *status = 0;
+    return TRUE;
+}
+
+/*
+ * }} Ephemeral timers
+ */
+
+/*
+ * Methods {{
+ */
+
+static GVariant* alarm_service_create(GVariant* params, GError** error)
+{
+    GVariant* dicts = g_variant_get_child_value(params, 0);
+    const gsize n = g_variant_n_children(dicts);
+    guint32* ids;
+    GVariant* ret;
+
+    for(gsize i = 0; i < n; i++) {
+        GVariant* dict = g_variant_get_child_value(dicts, i);
+        GError* err = NULL;
+
+        if(!alarm_variant_check(dict, &err)) {
+            g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Alarm %" G_GSIZE_FORMAT ": %s", i, err->message);
+            g_error_free(err);
+            g_variant_unref(dict);
+            g_variant_unref(dicts);
+            return NULL;
+        }
+
+        g_variant_unref(dict);
+    }
+
+    ids = g_new(guint32, n);
+    alarm_gen_ids(service_settings, ids, n);
+
+    for(gsize i = 0; i < n; i++) {
+        GVariant* dict = g_variant_get_child_value(dicts, i);
+        Alarm* alarm = alarm_new(service_settings, ids[i]);
+
+        alarm_set_from_variant(alarm, dict, NULL);
+        service_funcs->add(alarm, service_data);
+
+        g_variant_unref(dict);
+    }
+
+    if(n > 0)
+        alarm_service_list_commit();
+
+    g_debug("AlarmService: Created %" G_GSIZE_FORMAT " alarms", n);
+
+    ret = g_variant_new("(@au)", g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32, ids, n, sizeof(guint32)));
+
+    g_free(ids);
+    g_variant_unref(dicts);
+
+    return ret;
+}
+
+static GVariant* alarm_service_update(GVariant* params, GError** error)
+{
+    GHashTable* index = alarm_service_index();
+    GVariantIter* iter;
+    GVariant* dict;
+    GPtrArray* alarms = g_ptr_array_new();
+    GPtrArray* dicts = g_ptr_array_new_with_free_func((GDestroyNotify)g_variant_unref);
+    gboolean ok;
+    guint32 id;
+
+    g_variant_get(params, "(a(ua{sv}))", &iter);
+
+    while(g_variant_iter_next(iter, "(u@a{sv})", &id, &dict)) {
+        Alarm* alarm = g_hash_table_lookup(index, GINT_TO_POINTER(id));
+        GError* err = NULL;
+
+        g_ptr_array_add(dicts, dict);
+
+        if(!alarm) {
+            g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "No alarm #%" G_GUINT32_FORMAT, id);
+            break;
+        }
+
+        if(!alarm_variant_check(dict, &err)) {
+            g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Alarm #%" G_GUINT32_FORMAT ": %s", id, err->message);
+            g_error_free(err);
+            break;
+        }
+
+        g_ptr_array_add(alarms, alarm);
+    }
+
+    // Only apply once everything checked out
+    ok = alarms->len == dicts->len;
+    if(ok) {
+        for(guint i = 0; i < alarms->len; i++)
+            alarm_set_from_variant(alarms->pdata[i], dicts->pdata[i], NULL);
+
+        g_debug("AlarmService: Updated %u alarms", alarms->len);
+    }
+
+    g_variant_iter_free(iter);
+    g_ptr_array_free(dicts, TRUE);
+    g_ptr_array_free(alarms, TRUE);
+    g_hash_table_destroy(index);
+
+    return ok ? g_variant_new("()") : NULL;
+}
+
+static GVariant* alarm_service_delete(GVariant* params, GError** error)
+{
+    GHashTable* index = alarm_service_index();
+    GVariantIter* iter;
+    GPtrArray* alarms;
+
+    g_variant_get(params, "(au)", &iter);
+    alarms = alarm_service_lookup(index, iter, error);
+    g_variant_iter_free(iter);
+    g_hash_table_destroy(index);
+
+    if(!alarms)
+        return NULL;
+
+    for(guint i = 0; i < alarms->len; i++)
+        service_funcs->remove(alarms->pdata[i], service_data);
+
+    if(alarms->len > 0)
+        alarm_service_list_commit();
+
+    g_debug("AlarmService: Deleted %u alarms", alarms->len);
+
+    g_ptr_array_free(alarms, TRUE);
+
+    return g_variant_new("()");
+}
+
+static GVariant* alarm_service_set_enabled(GVariant* params, GError** error)
+{
+    GHashTable* index = alarm_service_index();
+    GVariantIter* iter;
+    GPtrArray* alarms;
+    gboolean enabled;
+
+    g_variant_get(params, "(aub)", &iter, &enabled);
+    alarms = alarm_service_lookup(index, iter, error);
+    g_variant_iter_free(iter);
+    g_hash_table_destroy(index);
+
+    if(!alarms)
+        return NULL;
+
+    for(guint i = 0; i < alarms->len; i++) {
+        Alarm* alarm = alarms->pdata[i];
+
+        // Timestamp and active flag in one write
+        alarm_begin_update(alarm);
+        alarm_set_enabled(alarm, enabled);
+        alarm_end_update(alarm);
+    }
+
+    g_debug("AlarmService: %s %u alarms", enabled ? "Enabled" : "Disabled", alarms->len);
+
+    g_ptr_array_free(alarms, TRUE);
+
+    return g_variant_new("()");
+}
+
+static GVariant* alarm_service_create_timers(GVariant* params, GError** error)
+{
+    GVariant* timers = g_variant_get_child_value(params, 0);
+    const gsize n = g_variant_n_children(timers);
+    gboolean ok = TRUE;
+    guint32* ids;
+    GVariant* ret;
+
+    for(gsize i = 0; ok && i < n; i++) {
+        GVariant* fields;
+        GError* err = NULL;
+        gint64 seconds;
+
+        g_variant_get_child(timers, i, "(x&s@a{sv})", &seconds, NULL, &fields);
+
+        if(seconds <= 0 || seconds > G_MAXINT32) {
+            g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Timer %" G_GSIZE_FORMAT ": Invalid duration %" G_GINT64_FORMAT, i, seconds);
+            ok = FALSE;
+        } else if(!alarm_variant_check(fields, &err)) {
+            g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "Timer %" G_GSIZE_FORMAT ": %s", i, err->message);
+            g_error_free(err);
+            ok = FALSE;
+        }
+
+        g_variant_unref(fields);
+    }
+
+    if(!ok) {
+        g_variant_unref(timers);
+        return NULL;
+    }
+
+    ids = g_new(guint32, n);
+
+    for(gsize i = 0; i < n; i++) {
+        GVariant* fields;
+        const gchar* message;
+        gint64 seconds;
+
+        g_variant_get_child(timers, i, "(x&s@a{sv})", &seconds, &message, &fields);
+        ids[i] = alarm_service_timer_new(seconds, message, fields)->id;
+        g_variant_unref(fields);
+    }
+
+    g_debug("AlarmService: Created %" G_GSIZE_FORMAT " timers", n);
+
+    ret = g_variant_new("(@au)", g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32, ids, n, sizeof(guint32)));
+
+    g_free(ids);
+    g_variant_unref(timers);
+
+    return ret;
+}
+
+static GVariant* alarm_service_list(GVariant* params, GError** error)
+{
+    GVariantBuilder builder;
+    const gchar** fields;
+
+    g_variant_get(params, "(^a&s)", &fields);
+
+    if(!alarm_variant_check_fields(fields, error)) {
+        g_free(fields);
+        return NULL;
+    }
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("aa{sv}"));
+
+    for(GList* l = service_funcs->get_alarms(service_data); l; l = l->next)
+        g_variant_builder_add_value(&builder, alarm_to_variant(ALARM(l->data), fields));
+
+    g_free(fields);
+
+    return g_variant_new("(@aa{sv})", g_variant_builder_end(&builder));
+}
+
+static const struct {
+    const gchar* name;
+    GVariant* (*func)(GVariant* params, GError** error);
+} alarm_service_methods[] = {
+    { "CreateAlarms", alarm_service_create },
+    { "UpdateAlarms", alarm_service_update },
+    { "DeleteAlarms", alarm_service_delete },
+    { "SetEnabled", alarm_service_set_enabled },
+    { "CreateTimers", alarm_service_create_timers },
+    { "ListAlarms", alarm_service_list },
+};
+
+static void alarm_service_method_call(GDBusConnection* connection, const gchar* sender, const gchar* object_path, const gchar* interface_name, const gchar* method_name, GVariant* parameters,
+                                      GDBusMethodInvocation* invocation, gpointer user_data)
+{
+    for(guint i = 0; i < G_N_ELEMENTS(alarm_service_methods); i++) {
+        GError* error = NULL;
+        GVariant* ret;
+
+        if(g_strcmp0(method_name, alarm_service_methods[i].name) != 0)
+            continue;
+
+        ret = alarm_service_methods[i].func(parameters, &error);
+
+        if(ret) {
+            g_dbus_method_invocation_return_value(invocation, ret);
+        } else {
+            g_debug("AlarmService: %s failed: %s", method_name, error->message);
+            g_dbus_method_invocation_return_gerror(invocation, error);
+            g_error_free(error);
+        }
+        return;
+    }
+
+    g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD, "Unknown method %s", method_name);
+}
+
+/*
+ * }} Methods
+ */
+
+static const GDBusInterfaceVTable alarm_service_vtable = {
+    alarm_service_method_call,
+    NULL,
+    NULL,
+};
+
+void alarm_service_register(GDBusConnection* connection, GSettings* settings, const AlarmServiceFuncs* funcs, gpointer data)
+{
+    GDBusNodeInfo* info;
+    GError* error = NULL;
+
+    if(service_id)
+        return;
+
+    // Also used by timers from the command line
+    service_settings = settings;
+    service_funcs = funcs;
+    service_data = data;
+
+    // Not on a bus, nobody to serve
+    if(!connection)
+        return;
+
+    info = g_dbus_node_info_new_for_xml(alarm_service_xml, NULL);
+    g_assert(info != NULL);
+
+    service_id = g_dbus_connection_register_object(connection, REMOTE_OBJECT_PATH, info->interfaces[0], &alarm_service_vtable, NULL, NULL, &error);
+    if(service_id) {
+        service_connection = g_object_ref(connection);
+    } else {
+        g_warning("AlarmService: Could not export %s: %s", ALARM_SERVICE_INTERFACE, error->message);
+        g_error_free(error);
+    }
+
+    g_dbus_node_info_unref(info);
+}
+
+void alarm_service_unregister(void)
+{
+    if(service_reap_id) {
+        g_source_remove(service_reap_id);
+        service_reap_id = 0;
+    }
+
+    if(!service_id)
+        return;
+
+    g_dbus_connection_unregister_object(service_connection, service_id);
+    g_clear_object(&service_connection);
+    service_id = 0;
+}
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * alarm-service.h -- D-Bus interface for managing alarms in batches
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef ALARM_SERVICE_H_
+#define ALARM_SERVICE_H_
+
+#include <gio/gio.h>
+
+#include "alarm.h"
+
+G_BEGIN_DECLS
+
+#define ALARM_SERVICE_INTERFACE "io.github.alarm_clock_applet.Alarms"
+
+/*
+ * Lets the service work on the alarms list of whoever owns it, the applet or
+ * the daemon.
+ */
+typedef struct {
+    GList* (*get_alarms)(gpointer data);
+    void (*add)(Alarm* alarm, gpointer data);    // Take ownership of a new alarm
+    void (*remove)(Alarm* alarm, gpointer data); // Disable, delete and drop an alarm
+} AlarmServiceFuncs;
+
+/**
+ * Export the ALARM_SERVICE_INTERFACE on the application's object path.
+ *
+ * Every method call is applied as a single transaction: each alarm is written
+ * to the settings once, and the alarms list at most once, so the owner only
+ * reconciles its list once per call.
+ */
+void alarm_service_register(GDBusConnection* connection, GSettings* settings, const AlarmServiceFuncs* funcs, gpointer data);
+
+void alarm_service_unregister(void);
+
+/**
+ * Bring the owner's list in line with the alarms list in settings, in O(n).
+ *
+ * Alarms that are new in settings are created and handed to funcs->add, and
+ * those that are gone to funcs->remove. Ephemeral alarms are left alone. The
+ * applet and the daemon both call this on changed::alarms.
+ */
+void alarm_service_sync_list(GSettings* settings, const AlarmServiceFuncs* funcs, gpointer data);
+
+/**
+ * Add a new ephemeral alarm to the owner's list, with the same defaults as a
+ * new alarm in the list window. It is dropped again once it is no longer
+ * active and has been stopped.
+ */
+Alarm* alarm_service_new_ephemeral(void);
+
+/**
+ * Start an ephemeral timer that goes off in the given number of seconds. It
+ * lives only in memory and is dropped once it has gone off and been stopped.
+ */
+Alarm* alarm_service_add_timer(gint64 seconds, const gchar* message);
+
+/**
+ * Start the timer requested with --timer DURATION [MESSAGE...] and print its
+ * ID on the command line.
+ *
+ * Returns TRUE and sets status if the command line had a --timer option.
+ */
+gboolean alarm_service_command_line_timer(GApplicationCommandLine* cmdline, gint* status);
+
+G_END_DECLS
+
+#endif /*ALARM_SERVICE_H_*/
@@ -194,34 +194,37 @@ static void alarm_settings_update_notify_type(AlarmSettingsDialog* dialog)
     }
 }
 
+/*
+ * Select the alarm's sound in the shared sounds list
+ */
+static void alarm_settings_fill_sounds(AlarmSettingsDialog* dialog)
+{
+    GtkComboBox* combo = GTK_COMBO_BOX(dialog->notify_sound_combo);
+    GtkTreeIter iter;
+
+    if(combo_model_find(gtk_combo_box_get_model(combo), dialog->alarm->sound_file, &iter))
+        gtk_combo_box_set_active_iter(combo, &iter);
+    else
+        gtk_combo_box_set_active(combo, -1);
+}
+
 static void alarm_settings_update_sound(AlarmSettingsDialog* dialog)
 {
-    AlarmListEntry* item;
-    GList* l;
-    gint pos;
+    gchar* key;
 
-    pos = gtk_combo_box_get_active(GTK_COMBO_BOX(dialog->notify_sound_combo));
-    item = g_list_nth_data(dialog->applet->sounds, pos);
+    combo_box_get_active_row(GTK_COMBO_BOX(dialog->notify_sound_combo), &key);
 
-    if(item && g_strcmp0(item->data, dialog->alarm->sound_file) == 0) {
+    if(g_strcmp0(key, dialog->alarm->sound_file) == 0) {
         // No change
+        g_free(key);
         return;
     }
 
-    g_debug("AlarmSettingsDialog: update_sound()");
+    g_free(key);
 
-    /* Fill sounds list */
-    fill_combo_box_custom_list(GTK_COMBO_BOX(dialog->notify_sound_combo), dialog->applet->sounds, _("Select sound file..."));
+    g_debug("AlarmSettingsDialog: update_sound()");
 
-    // Look for the selected sound file
-    for(l = dialog->applet->sounds, pos = 0; l != NULL; l = l->next, pos++) {
-        item = (AlarmListEntry*)l->data;
-        if(strcmp(item->data, dialog->alarm->sound_file) == 0) {
-            // Match!
-            gtk_combo_box_set_active(GTK_COMBO_BOX(dialog->notify_sound_combo), pos);
-            break;
-        }
-    }
+    alarm_settings_fill_sounds(dialog);
 }
 
 static void alarm_settings_update_sound_repeat(AlarmSettingsDialog* dialog)
@@ -236,53 +239,48 @@ static void alarm_settings_update_sound_repeat(AlarmSettingsDialog* dialog)
     g_object_set(dialog->notify_sound_loop_check, "active", dialog->alarm->sound_loop, NULL);
 }
 
-static void alarm_settings_update_app(AlarmSettingsDialog* dialog)
+/*
+ * Select the alarm's command in the shared apps list
+ */
+static void alarm_settings_fill_apps(AlarmSettingsDialog* dialog)
 {
-    GList* l;
-    guint pos, len;
+    GtkComboBox* combo = GTK_COMBO_BOX(dialog->notify_app_combo);
+    GtkTreeModel* model = gtk_combo_box_get_model(combo);
     gboolean custom = FALSE;
-
-    pos = gtk_combo_box_get_active(GTK_COMBO_BOX(dialog->notify_app_combo));
-    GAppInfo* item = G_APP_INFO(g_list_nth_data(dialog->applet->apps, pos));
-
-    const AlarmApplet* const applet = dialog->applet;
-    if(item && g_strcmp0(ALARM_APPLET_GET_APP_INFO_COMMAND(item), dialog->alarm->command) == 0) {
-        // No change
-        return;
-    }
-
-    g_debug("AlarmSettingsDialog: update_app()");
-
-    //	g_debug ("alarm_settings_update_app (%p): app_combo: %p, applet: %p, apps: %p", dialog, dialog->notify_app_combo, dialog->applet,
-    // dialog->applet->apps); 	g_debug ("alarm_settings_update_app setting entry to %s", dialog->alarm->command);
-
-    /* Fill apps list */
-    fill_combo_box(GTK_COMBO_BOX(dialog->notify_app_combo), dialog->applet->apps, _("Custom command..."));
+    GtkTreeIter iter;
 
     // Look for the selected command
-    len = g_list_length(dialog->applet->apps);
-    for(l = dialog->applet->apps, pos = 0; l != NULL; l = l->next, pos++) {
-        item = G_APP_INFO(l->data);
-        if(strcmp(ALARM_APPLET_GET_APP_INFO_COMMAND(item), dialog->alarm->command) == 0) {
-            // Match!
-            break;
-        }
+    if(!combo_model_find(model, dialog->alarm->command, &iter)) {
+        // Custom command, the last row
+        gtk_tree_model_iter_nth_child(model, &iter, NULL, gtk_tree_model_iter_n_children(model, NULL) - 1);
+        custom = TRUE;
     }
 
     /* Only change sensitivity of the command entry if user
      * isn't typing a custom command there already. */
-    if(pos >= len) {
-        // Custom command
-        pos += 1;
-        custom = TRUE;
-    }
-
     g_debug("CMD ENTRY HAS FOCUS? %d", gtk_widget_has_focus(dialog->notify_app_command_entry));
 
     if(!gtk_widget_has_focus(dialog->notify_app_command_entry))
         g_object_set(dialog->notify_app_command_entry, "sensitive", custom, NULL);
 
-    gtk_combo_box_set_active(GTK_COMBO_BOX(dialog->notify_app_combo), pos);
+    gtk_combo_box_set_active_iter(combo, &iter);
+}
+
+static void alarm_settings_update_app(AlarmSettingsDialog* dialog)
+{
+    gchar* key;
+
+    if(combo_box_get_active_row(GTK_COMBO_BOX(dialog->notify_app_combo), &key) == COMBO_ROW_ITEM && g_strcmp0(key, dialog->alarm->command) == 0) {
+        // No change
+        g_free(key);
+        return;
+    }
+
+    g_free(key);
+
+    g_debug("AlarmSettingsDialog: update_app()");
+
+    alarm_settings_fill_apps(dialog);
 }
 
 static void alarm_settings_update_app_command(AlarmSettingsDialog* dialog)
@@ -369,6 +367,29 @@ static void alarm_changed(GObject* object, GParamSpec* param, gpointer data)
         */
 }
 
+/*
+ * The applet's sounds list has been rebuilt
+ */
+void alarm_settings_dialog_sounds_changed(AlarmSettingsDialog* dialog)
+{
+    if(dialog->alarm == NULL)
+        return;
+
+    // The alarm's sound may only now have made it into the list
+    alarm_settings_fill_sounds(dialog);
+}
+
+/*
+ * The applet's apps list has been (re)loaded
+ */
+void alarm_settings_dialog_apps_changed(AlarmSettingsDialog* dialog)
+{
+    if(dialog->alarm == NULL)
+        return;
+
+    alarm_settings_fill_apps(dialog);
+}
+
 /*
  * GUI utils
  */
@@ -616,28 +637,24 @@ void alarm_settings_changed_sound(GtkComboBox* combo, gpointer data)
 
     g_assert(dialog->alarm != NULL);
 
-    AlarmListEntry* item;
-    guint current_index, len;
-
-    current_index = gtk_combo_box_get_active(combo);
-    len = g_list_length(dialog->applet->sounds);
-
-    g_debug("Current index: %d, n sounds: %d", current_index, len);
-
-    if(current_index < 0)
-        // None selected
-        return;
+    gchar* key;
 
-    if(current_index >= len) {
+    switch(combo_box_get_active_row(combo, &key)) {
+    case COMBO_ROW_ITEM:
+        // Valid file selected, update alarm
+        g_object_set(dialog->alarm, "sound_file", key, NULL);
+        break;
+    case COMBO_ROW_CUSTOM:
         // Select sound file
         g_debug("Open SOUND file chooser...");
         open_sound_file_chooser(dialog);
-        return;
+        break;
+    default:
+        // None selected
+        break;
     }
 
-    // Valid file selected, update alarm
-    item = (AlarmListEntry*)g_list_nth_data(dialog->applet->sounds, current_index);
-    g_object_set(dialog->alarm, "sound_file", item->data, NULL);
+    g_free(key);
 }
 
 void alarm_settings_changed_sound_repeat(GtkToggleButton* togglebutton, gpointer data)
@@ -653,7 +670,7 @@ void alarm_settings_changed_sound_repeat(GtkToggleButton* togglebutton, gpointer
 
     if(dialog->player && dialog->player->state == MEDIA_PLAYER_PLAYING) {
         // Update preview player
-        dialog->player->loop = gtk_toggle_button_get_active(togglebutton);
+        media_player_set_loop(dialog->player, gtk_toggle_button_get_active(togglebutton));
     }
 }
 
@@ -671,29 +688,26 @@ void alarm_settings_changed_app(GtkComboBox* combo, gpointer data)
         return;
     }
 
-    guint current_index, len;
-
-    current_index = gtk_combo_box_get_active(combo);
-    len = g_list_length(dialog->applet->apps);
-
-    if(current_index < 0)
-        // None selected
-        return;
+    gchar* key;
 
-    if(current_index >= len) {
+    switch(combo_box_get_active_row(combo, &key)) {
+    case COMBO_ROW_ITEM:
+        g_object_set(dialog->notify_app_command_entry, "sensitive", FALSE, NULL);
+        g_object_set(dialog->alarm, "command", key, NULL);
+        break;
+    case COMBO_ROW_CUSTOM:
         // Custom command
         g_debug("CUSTOM command selected...");
 
         g_object_set(dialog->notify_app_command_entry, "sensitive", TRUE, NULL);
         gtk_widget_grab_focus(dialog->notify_app_command_entry);
-        return;
+        break;
+    default:
+        // None selected
+        break;
     }
 
-    g_object_set(dialog->notify_app_command_entry, "sensitive", FALSE, NULL);
-
-
-    GAppInfo* item = G_APP_INFO(g_list_nth_data(dialog->applet->apps, current_index));
-    g_object_set(dialog->alarm, "command", ALARM_APPLET_GET_APP_INFO_COMMAND(item), NULL);
+    g_free(key);
 }
 
 void alarm_settings_changed_command(GtkEditable* editable, gpointer data)
@@ -861,7 +875,7 @@ AlarmSettingsDialog* alarm_settings_dialog_new(AlarmApplet* applet)
     AlarmRepeat r;
     gint i;
 
-    GtkBuilder* builder = applet->ui;
+    GtkBuilder* builder = alarm_applet_ui_load("alarm-settings-dialog.ui", applet);
 
     // Initialize struct
     dialog = g_new0(AlarmSettingsDialog, 1);
@@ -906,15 +920,21 @@ AlarmSettingsDialog* alarm_settings_dialog_new(AlarmApplet* applet)
     dialog->notify_app_command_box = GTK_WIDGET(gtk_builder_get_object(builder, "app-command-box"));
     dialog->notify_app_command_entry = GTK_WIDGET(gtk_builder_get_object(builder, "app-command-entry"));
 
+    // Both combo boxes show the applet's shared lists
+    combo_box_set_shared_model(GTK_COMBO_BOX(dialog->notify_sound_combo), alarm_applet_sounds_model_get(applet));
+    combo_box_set_shared_model(GTK_COMBO_BOX(dialog->notify_app_combo), alarm_applet_apps_model_get(applet));
 
-    // Load apps list
-    alarm_applet_apps_load(applet);
+    // The dialog keeps its widgets alive
+    g_object_unref(builder);
 
     return dialog;
 }
 
 void alarm_settings_dialog_show(AlarmSettingsDialog* dialog, Alarm* alarm)
 {
+    // The apps list is only loaded once it is needed
+    alarm_applet_apps_request(dialog->applet);
+
     alarm_settings_dialog_set_alarm(dialog, alarm);
 
     gtk_widget_show_all(dialog->dialog);
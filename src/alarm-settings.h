@@ -58,6 +58,10 @@ void display_edit_alarm_dialog(AlarmApplet* applet, Alarm* alarm);
 
 void alarm_settings_dialog_close(AlarmSettingsDialog* dialog);
 
+void alarm_settings_dialog_sounds_changed(AlarmSettingsDialog* dialog);
+
+void alarm_settings_dialog_apps_changed(AlarmSettingsDialog* dialog);
+
 gboolean alarm_settings_output_time(GtkSpinButton* spin, gpointer data);
 
 void alarm_settings_sound_preview(GtkButton* button, gpointer data);
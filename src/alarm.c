@@ -12,18 +12,37 @@
 
 #include "alarm.h"
 #include "alarm-glib-enums.h"
+#include "alarm-scheduler.h"
+#include "metrics.h"
+#include "source-stats.h"
+#include "sound-cache.h"
+#include "sound-index.h"
+#include "trace.h"
+#include "wallclock.h"
 #include <gio/gio.h>
 
-extern void alarm_applet_request_resize(struct _AlarmApplet* applet);
+#define G_SETTINGS_ENABLE_BACKEND
+#include <gio/gsettingsbackend.h>
 
 typedef struct _AlarmPrivate AlarmPrivate;
 
 struct _AlarmPrivate {
     GSettings* settings;
     guint gconf_listener;
-    guint timer_id;
+    gboolean scheduled;
     MediaPlayer* player;
     guint player_timer_id;
+    gchar** command_argv; // Parsed command, NULL if it doesn't parse
+
+    /* Set while emitting a trigger from the scheduler */
+    gboolean trigger_started;
+    time_t trigger_timestamp; // Deadline the scheduler fired at
+    MediaPlayer* trigger_player;
+    const GError* trigger_error;
+
+    gint64 trigger_due; // Real time in µs at which the current trigger was due
+
+    guint update_depth; // Nested alarm_begin_update() calls, settings are written once it drops to 0
 };
 
 #ifdef __GNUC__
@@ -47,8 +66,10 @@ static void alarm_gsettings_connect(Alarm* alarm);
 static void alarm_timer_start(Alarm* alarm);
 static void alarm_timer_remove(Alarm* alarm);
 static gboolean alarm_timer_is_started(Alarm* alarm);
+static void alarm_timer_sync(Alarm* alarm);
 
 static void alarm_player_start(Alarm* alarm);
+static void alarm_player_adopt(Alarm* alarm, MediaPlayer* player);
 static void alarm_player_stop(Alarm* alarm);
 static void alarm_command_run(Alarm* alarm);
 
@@ -266,11 +287,43 @@ static void alarm_class_init(AlarmClass* class)
                                                1, G_TYPE_UINT);
 }
 
+/*
+ * Write out the changes to the settings, unless in the middle of an update
+ */
+static void alarm_settings_commit(Alarm* alarm)
+{
+    AlarmPrivate* priv = ALARM_PRIVATE(alarm);
+
+    if(priv->settings && priv->update_depth == 0)
+        g_settings_apply(priv->settings);
+}
+
+static void alarm_settings_notify(GObject* object, GParamSpec* pspec, gpointer user_data)
+{
+    alarm_settings_commit(ALARM(object));
+}
+
 static void alarm_init(Alarm* self)
 {
     AlarmPrivate* priv = ALARM_PRIVATE(self);
 
     self->id = -1;
+
+    // After the settings bindings have picked up the change
+    g_signal_connect_after(self, "notify", G_CALLBACK(alarm_settings_notify), NULL);
+}
+
+/*
+ * Shared by all ephemeral alarms, whose IDs keep their paths apart
+ */
+static GSettingsBackend* alarm_ephemeral_backend(void)
+{
+    static GSettingsBackend* backend = NULL;
+
+    if(!backend)
+        backend = g_memory_settings_backend_new();
+
+    return backend;
 }
 
 /* set an Alarm property */
@@ -302,9 +355,15 @@ static void alarm_set_property(GObject* object, guint prop_id, const GValue* val
         alarm->id = d;
 
         gchar* gsettings_dir = alarm_gsettings_get_dir(alarm);
-        priv->settings = g_settings_new_with_path("io.github.alarm-clock-applet.alarm", gsettings_dir);
+        if(ALARM_ID_IS_EPHEMERAL(d))
+            priv->settings = g_settings_new_with_backend_and_path("io.github.alarm-clock-applet.alarm", alarm_ephemeral_backend(), gsettings_dir);
+        else
+            priv->settings = g_settings_new_with_path("io.github.alarm-clock-applet.alarm", gsettings_dir);
         g_free(gsettings_dir);
 
+        // Written out by alarm_settings_commit(), so that batched changes are one write
+        g_settings_delay(priv->settings);
+
         alarm_gsettings_connect(alarm);
         break;
     }
@@ -333,6 +392,7 @@ static void alarm_set_property(GObject* object, guint prop_id, const GValue* val
         break;
     case PROP_TIMESTAMP:
         alarm->timestamp = g_value_get_int64(value);
+        alarm_timer_sync(alarm);
         break;
     case PROP_ACTIVE:
         alarm->active = g_value_get_boolean(value);
@@ -359,17 +419,28 @@ static void alarm_set_property(GObject* object, guint prop_id, const GValue* val
         break;
     case PROP_NOTIFY_TYPE:
         alarm->notify_type = g_value_get_enum(value);
+        alarm_timer_sync(alarm);
         break;
     case PROP_SOUND_FILE:
         g_free(alarm->sound_file);
         alarm->sound_file = g_strdup(g_value_get_string(value));
+        alarm_timer_sync(alarm);
         break;
     case PROP_SOUND_LOOP:
         alarm->sound_loop = g_value_get_boolean(value);
+        alarm_timer_sync(alarm);
         break;
     case PROP_COMMAND:
         g_free(alarm->command);
         alarm->command = g_strdup(g_value_get_string(value));
+
+        // Parse once here instead of on every trigger
+        g_strfreev(priv->command_argv);
+        priv->command_argv = NULL;
+        if(alarm->command && !g_shell_parse_argv(alarm->command, NULL, &priv->command_argv, NULL))
+            priv->command_argv = NULL;
+
+        alarm_timer_sync(alarm);
         break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
@@ -436,6 +507,17 @@ GQuark alarm_error_quark(void)
 static void alarm_error(Alarm* alarm, GError* err)
 {
     g_critical("Alarm(%p) #%d: alarm_error: #%d: %s", alarm, alarm->id, err->code, err->message);
+
+    switch(err->code) {
+    case ALARM_ERROR_PLAY:
+        metrics_count(METRICS_PLAYER_ERRORS);
+        break;
+    case ALARM_ERROR_COMMAND:
+        metrics_count(METRICS_COMMAND_FAILURES);
+        break;
+    default:
+        break;
+    }
 }
 
 void alarm_error_trigger(Alarm* alarm, AlarmErrorCode code, const gchar* msg)
@@ -472,22 +554,55 @@ static inline void alarm_set_triggered(Alarm* alarm, const gboolean triggered)
 
 static void alarm_alarm(Alarm* alarm)
 {
+    AlarmPrivate* priv = ALARM_PRIVATE(alarm);
+    // The alarm may have been moved to a later deadline since the scheduler fired
+    const time_t due = priv->trigger_started ? priv->trigger_timestamp : alarm->timestamp;
+
     g_debug("Alarm(%p) #%d: alarm() DING!", alarm, alarm->id);
 
+    // The timestamp moves on below if the alarm repeats
+    priv->trigger_due = (gint64)due * G_USEC_PER_SEC;
+
+    metrics_count(METRICS_TRIGGERS);
+
+    // The scheduler thread records its own, earlier trigger time
+    if(!priv->trigger_started)
+        metrics_observe(METRICS_TRIGGER_LATENCY, wallclock_now_us() - priv->trigger_due);
+
     // Clear first, if needed
     alarm_clear(alarm);
 
     // Update triggered flag
     alarm_set_triggered(alarm, TRUE);
 
-    // Do we want to repeat this alarm?
-    if(alarm_should_repeat(alarm)) {
+    // Do we want to repeat this alarm? A deadline set in the meantime stands either way.
+    if(alarm->timestamp != due) {
+        g_debug("Alarm(%p) #%d: alarm() Keeping the new deadline", alarm, alarm->id);
+    } else if(alarm_should_repeat(alarm)) {
         g_debug("Alarm(%p) #%d: alarm() Repeating...", alarm, alarm->id);
         alarm_update_timestamp(alarm);
     } else {
         alarm_disable(alarm);
     }
 
+    if(priv->trigger_started) {
+        // The scheduler has already started the sound or command
+        priv->trigger_started = FALSE;
+
+        if(priv->trigger_error) {
+            g_critical("%s", priv->trigger_error->message);
+            alarm_error_trigger(alarm, priv->trigger_error->code, priv->trigger_error->message);
+        }
+
+        if(priv->trigger_player) {
+            g_debug("Alarm(%p) #%d: alarm() Adopt player", alarm, alarm->id);
+            alarm_player_adopt(alarm, priv->trigger_player);
+            priv->trigger_player = NULL;
+        }
+
+        return;
+    }
+
     switch(alarm->notify_type) {
     case ALARM_NOTIFY_SOUND:
         // Start sound playback
@@ -509,6 +624,30 @@ void alarm_trigger(Alarm* alarm)
     g_signal_emit(alarm, alarm_signal[SIGNAL_ALARM], 0, NULL);
 }
 
+/*
+ * Trigger an alarm whose sound or command has already been started by the
+ * scheduler thread at the deadline due. Takes ownership of player.
+ */
+void alarm_trigger_started(Alarm* alarm, time_t due, MediaPlayer* player, const GError* error)
+{
+    AlarmPrivate* priv = ALARM_PRIVATE(alarm);
+
+    priv->trigger_started = TRUE;
+    priv->trigger_timestamp = due;
+    priv->trigger_player = player;
+    priv->trigger_error = error;
+
+    g_signal_emit(alarm, alarm_signal[SIGNAL_ALARM], 0, NULL);
+
+    // In case the default handler didn't run
+    if(priv->trigger_player)
+        media_player_free(priv->trigger_player);
+
+    priv->trigger_started = FALSE;
+    priv->trigger_player = NULL;
+    priv->trigger_error = NULL;
+}
+
 /*
  * Convenience functions for enabling/disabling the alarm.
  *
@@ -551,6 +690,8 @@ void alarm_delete(Alarm* alarm)
     g_settings_reset(priv->settings, PROP_NAME_SOUND_FILE);
     g_settings_reset(priv->settings, PROP_NAME_SOUND_LOOP);
     g_settings_reset(priv->settings, PROP_NAME_COMMAND);
+
+    alarm_settings_commit(alarm);
 }
 
 void alarm_unref(Alarm* alarm)
@@ -560,6 +701,388 @@ void alarm_unref(Alarm* alarm)
     g_object_unref(alarm);
 }
 
+/*
+ * Collect the settings writes of all property changes until the matching
+ * alarm_end_update(), and write them out at once. Calls may be nested.
+ */
+void alarm_begin_update(Alarm* alarm)
+{
+    AlarmPrivate* priv = ALARM_PRIVATE(alarm);
+
+    priv->update_depth++;
+}
+
+void alarm_end_update(Alarm* alarm)
+{
+    AlarmPrivate* priv = ALARM_PRIVATE(alarm);
+
+    g_return_if_fail(priv->update_depth > 0);
+
+    priv->update_depth--;
+    alarm_settings_commit(alarm);
+}
+
+/*
+ * Variant conversion {{
+ */
+
+/*
+ * Properties that can be read as a variant. Only the ones that live in the
+ * settings can be written.
+ */
+static const struct {
+    const gchar* name;
+    gboolean writable;
+} alarm_variant_props[] = {
+    { PROP_NAME_ID, FALSE },
+    { PROP_NAME_TYPE, TRUE },
+    { PROP_NAME_TIME, TRUE },
+    { PROP_NAME_TIMESTAMP, FALSE },
+    { PROP_NAME_ACTIVE, TRUE },
+    { PROP_NAME_MESSAGE, TRUE },
+    { PROP_NAME_REPEAT, TRUE },
+    { PROP_NAME_NOTIFY_TYPE, TRUE },
+    { PROP_NAME_SOUND_FILE, TRUE },
+    { PROP_NAME_SOUND_LOOP, TRUE },
+    { PROP_NAME_COMMAND, TRUE },
+    { PROP_NAME_TRIGGERED, FALSE },
+};
+
+static gint alarm_variant_prop_find(const gchar* name)
+{
+    for(guint i = 0; i < G_N_ELEMENTS(alarm_variant_props); i++) {
+        if(strcmp(alarm_variant_props[i].name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Enums are stored by nick and flags as a list of nicks, like GSettings does
+ */
+static GVariant* alarm_value_to_variant(const GValue* value)
+{
+    switch(G_TYPE_FUNDAMENTAL(G_VALUE_TYPE(value))) {
+    case G_TYPE_BOOLEAN:
+        return g_variant_new_boolean(g_value_get_boolean(value));
+    case G_TYPE_INT:
+        return g_variant_new_int32(g_value_get_int(value));
+    case G_TYPE_UINT:
+        return g_variant_new_uint32(g_value_get_uint(value));
+    case G_TYPE_INT64:
+        return g_variant_new_int64(g_value_get_int64(value));
+    case G_TYPE_STRING:
+        return g_variant_new_string(g_value_get_string(value) ? g_value_get_string(value) : "");
+    case G_TYPE_ENUM:
+    {
+        GEnumClass* klass = g_type_class_ref(G_VALUE_TYPE(value));
+        GEnumValue* ev = g_enum_get_value(klass, g_value_get_enum(value));
+        GVariant* ret = g_variant_new_string(ev ? ev->value_nick : "");
+        g_type_class_unref(klass);
+        return ret;
+    }
+    case G_TYPE_FLAGS:
+    {
+        GFlagsClass* klass = g_type_class_ref(G_VALUE_TYPE(value));
+        const guint flags = g_value_get_flags(value);
+        GVariantBuilder builder;
+
+        g_variant_builder_init(&builder, G_VARIANT_TYPE_STRING_ARRAY);
+        for(guint i = 0; i < klass->n_values; i++) {
+            if(klass->values[i].value && (flags & klass->values[i].value) == klass->values[i].value)
+                g_variant_builder_add(&builder, "s", klass->values[i].value_nick);
+        }
+        g_type_class_unref(klass);
+        return g_variant_builder_end(&builder);
+    }
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static gboolean alarm_variant_to_value(GParamSpec* pspec, GVariant* variant, GValue* value, GError** error)
+{
+    const GType type = G_PARAM_SPEC_VALUE_TYPE(pspec);
+    const GVariantType* expected;
+
+    switch(G_TYPE_FUNDAMENTAL(type)) {
+    case G_TYPE_BOOLEAN:
+        expected = G_VARIANT_TYPE_BOOLEAN;
+        break;
+    case G_TYPE_INT64:
+        expected = G_VARIANT_TYPE_INT64;
+        break;
+    case G_TYPE_STRING:
+    case G_TYPE_ENUM:
+        expected = G_VARIANT_TYPE_STRING;
+        break;
+    case G_TYPE_FLAGS:
+        expected = G_VARIANT_TYPE_STRING_ARRAY;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    if(!g_variant_is_of_type(variant, expected)) {
+        g_set_error(error, ALARM_ERROR, ALARM_ERROR_INVALID, "%s must be of type %.*s, not %s", pspec->name, (int)g_variant_type_get_string_length(expected),
+                    g_variant_type_peek_string(expected), g_variant_get_type_string(variant));
+        return FALSE;
+    }
+
+    g_value_init(value, type);
+
+    switch(G_TYPE_FUNDAMENTAL(type)) {
+    case G_TYPE_BOOLEAN:
+        g_value_set_boolean(value, g_variant_get_boolean(variant));
+        break;
+    case G_TYPE_INT64:
+        g_value_set_int64(value, g_variant_get_int64(variant));
+        break;
+    case G_TYPE_STRING:
+        g_value_set_string(value, g_variant_get_string(variant, NULL));
+        break;
+    case G_TYPE_ENUM:
+    {
+        GEnumClass* klass = g_type_class_ref(type);
+        GEnumValue* ev = g_enum_get_value_by_nick(klass, g_variant_get_string(variant, NULL));
+
+        // The zero value of each enum is INVALID
+        if(ev && ev->value != 0)
+            g_value_set_enum(value, ev->value);
+        else
+            g_set_error(error, ALARM_ERROR, ALARM_ERROR_INVALID, "Unknown %s: %s", pspec->name, g_variant_get_string(variant, NULL));
+
+        g_type_class_unref(klass);
+        break;
+    }
+    case G_TYPE_FLAGS:
+    {
+        GFlagsClass* klass = g_type_class_ref(type);
+        GVariantIter iter;
+        const gchar* nick;
+        guint flags = 0;
+
+        g_variant_iter_init(&iter, variant);
+        while(g_variant_iter_next(&iter, "&s", &nick)) {
+            GFlagsValue* fv = g_flags_get_value_by_nick(klass, nick);
+
+            if(!fv) {
+                g_set_error(error, ALARM_ERROR, ALARM_ERROR_INVALID, "Unknown %s: %s", pspec->name, nick);
+                break;
+            }
+            flags |= fv->value;
+        }
+        g_value_set_flags(value, flags);
+
+        g_type_class_unref(klass);
+        break;
+    }
+    }
+
+    if(error && *error) {
+        g_value_unset(value);
+        return FALSE;
+    }
+
+    // g_object_set_property() would only log and skip values out of range, such as a negative time
+    if(g_param_value_validate(pspec, value)) {
+        g_set_error(error, ALARM_ERROR, ALARM_ERROR_INVALID, "%s is out of range", pspec->name);
+        g_value_unset(value);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Convert all entries of an a{sv} to property values, in the same order
+ */
+static GValue* alarm_variant_to_values(GVariant* dict, GParamSpec*** pspecs, guint* n_values, GError** error)
+{
+    GObjectClass* klass = g_type_class_ref(TYPE_ALARM);
+    const gsize n = g_variant_n_children(dict);
+    GValue* values = g_new0(GValue, n);
+    GParamSpec** specs = g_new0(GParamSpec*, n);
+    gsize i;
+
+    for(i = 0; i < n; i++) {
+        const gchar* name;
+        GVariant* variant;
+        gint prop;
+        gboolean ok;
+
+        g_variant_get_child(dict, i, "{&sv}", &name, &variant);
+
+        prop = alarm_variant_prop_find(name);
+        if(prop < 0 || !alarm_variant_props[prop].writable) {
+            g_set_error(error, ALARM_ERROR, ALARM_ERROR_INVALID, prop < 0 ? "Unknown field %s" : "Field %s is read-only", name);
+            g_variant_unref(variant);
+            break;
+        }
+
+        specs[i] = g_object_class_find_property(klass, name);
+        ok = alarm_variant_to_value(specs[i], variant, &values[i], error);
+        g_variant_unref(variant);
+
+        if(!ok)
+            break;
+    }
+
+    g_type_class_unref(klass);
+
+    if(i < n) {
+        for(gsize j = 0; j < i; j++)
+            g_value_unset(&values[j]);
+        g_free(values);
+        g_free(specs);
+        return NULL;
+    }
+
+    *pspecs = specs;
+    *n_values = n;
+
+    return values;
+}
+
+/*
+ * Check that a list of fields can be read with alarm_to_variant()
+ */
+gboolean alarm_variant_check_fields(const gchar* const* fields, GError** error)
+{
+    for(; fields && *fields; fields++) {
+        if(alarm_variant_prop_find(*fields) < 0) {
+            g_set_error(error, ALARM_ERROR, ALARM_ERROR_INVALID, "Unknown field %s", *fields);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ * Check that an a{sv} can be applied with alarm_set_from_variant()
+ */
+gboolean alarm_variant_check(GVariant* dict, GError** error)
+{
+    GParamSpec** pspecs;
+    GValue* values;
+    guint n;
+
+    if(!(values = alarm_variant_to_values(dict, &pspecs, &n, error)))
+        return FALSE;
+
+    for(guint i = 0; i < n; i++)
+        g_value_unset(&values[i]);
+    g_free(values);
+    g_free(pspecs);
+
+    return TRUE;
+}
+
+/*
+ * Get the alarm as an a{sv}, with only the given fields, or all of them if
+ * fields is NULL or empty. Unknown fields are skipped.
+ */
+GVariant* alarm_to_variant(Alarm* alarm, const gchar* const* fields)
+{
+    GVariantBuilder builder;
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+
+    for(guint i = 0; i < G_N_ELEMENTS(alarm_variant_props); i++) {
+        const gchar* name = alarm_variant_props[i].name;
+        GValue value = G_VALUE_INIT;
+
+        if(fields && *fields && !g_strv_contains(fields, name))
+            continue;
+
+        g_value_init(&value, G_PARAM_SPEC_VALUE_TYPE(g_object_class_find_property(G_OBJECT_GET_CLASS(alarm), name)));
+        g_object_get_property(G_OBJECT(alarm), name, &value);
+
+        g_variant_builder_add(&builder, "{sv}", name, alarm_value_to_variant(&value));
+
+        g_value_unset(&value);
+    }
+
+    return g_variant_builder_end(&builder);
+}
+
+/*
+ * Apply an a{sv} of fields to the alarm, as a single settings write. Nothing
+ * is changed if any of the fields is invalid.
+ *
+ * Enabling goes through alarm_set_enabled(), so the timestamp is brought up
+ * to date after the other fields have been set.
+ */
+gboolean alarm_set_from_variant(Alarm* alarm, GVariant* dict, GError** error)
+{
+    GParamSpec** pspecs;
+    GValue* values;
+    gint active = -1;
+    guint n;
+
+    if(!(values = alarm_variant_to_values(dict, &pspecs, &n, error)))
+        return FALSE;
+
+    alarm_begin_update(alarm);
+
+    for(guint i = 0; i < n; i++) {
+        if(strcmp(pspecs[i]->name, PROP_NAME_ACTIVE) == 0)
+            active = g_value_get_boolean(&values[i]);
+        else
+            g_object_set_property(G_OBJECT(alarm), pspecs[i]->name, &values[i]);
+
+        g_value_unset(&values[i]);
+    }
+
+    if(active >= 0)
+        alarm_set_enabled(alarm, active);
+
+    alarm_end_update(alarm);
+
+    g_free(values);
+    g_free(pspecs);
+
+    return TRUE;
+}
+
+/*
+ * Read an alarm straight from its settings in the form of alarm_to_variant(),
+ * without creating an Alarm that would get scheduled. Fields that are not
+ * saved, such as triggered, are left out.
+ */
+GVariant* alarm_settings_to_variant(GSettings* settings, guint32 id)
+{
+    GSettingsSchema* schema;
+    GVariantBuilder builder;
+
+    g_object_get(settings, "settings-schema", &schema, NULL);
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+    g_variant_builder_add(&builder, "{sv}", PROP_NAME_ID, g_variant_new_uint32(id));
+
+    for(guint i = 0; i < G_N_ELEMENTS(alarm_variant_props); i++) {
+        const gchar* name = alarm_variant_props[i].name;
+        GVariant* value;
+
+        if(!g_settings_schema_has_key(schema, name))
+            continue;
+
+        // Enums and flags are already stored as nicks
+        value = g_settings_get_value(settings, name);
+        g_variant_builder_add(&builder, "{sv}", name, value);
+        g_variant_unref(value);
+    }
+
+    g_settings_schema_unref(schema);
+
+    return g_variant_builder_end(&builder);
+}
+
+/*
+ * }} Variant conversion
+ */
+
 /*
  * Snooze the alarm for a number of seconds.
  */
@@ -569,11 +1092,14 @@ void alarm_snooze(Alarm* alarm, guint seconds)
 
     g_debug("Alarm(%p) #%d: snooze() for %d minutes", alarm, alarm->id, seconds / 60);
 
+    metrics_count(METRICS_SNOOZES);
+    trace_event(TRACE_ALARM_SNOOZE, alarm->id, seconds);
+
     // Silence!
     alarm_clear(alarm);
 
     // Remind later
-    time_t now = time(NULL);
+    time_t now = wallclock_now();
 
     g_object_set(alarm, "timestamp", now + seconds, "active", TRUE, NULL);
 
@@ -587,6 +1113,8 @@ static void alarm_cleared(Alarm* alarm)
 {
     g_debug("Alarm(%p) #%d: cleared()", alarm, alarm->id);
 
+    trace_event(TRACE_ALARM_CLEAR, alarm->id, 0);
+
     // Update triggered flag
     alarm_set_triggered(alarm, FALSE);
 
@@ -616,43 +1144,32 @@ gboolean alarm_is_playing(Alarm* a)
 }
 
 
-static gboolean alarm_timer_update(Alarm* alarm)
-{
-    time_t now;
-
-    time(&now);
-
-    if(now >= alarm->timestamp) {
-        alarm_trigger(alarm);
-
-        // Remove callback only if we don't intend to repeat the alarm
-        return alarm_should_repeat(alarm);
-    } else if(alarm->timestamp - now <= 10) {
-        g_debug("Alarm(%p) #%d: -%2d...", alarm, alarm->id, (int)(alarm->timestamp - now));
-    }
-
-    // Keep callback
-    return TRUE;
-}
-
 static void alarm_timer_start(Alarm* alarm)
 {
     AlarmPrivate* priv = ALARM_PRIVATE(alarm);
 
     g_debug("Alarm(%p) #%d: timer_start()", alarm, alarm->id);
 
-    // Remove old timer, if any
-    alarm_timer_remove(alarm);
+    // Hand the alarm over to the scheduler thread
+    alarm_scheduler_add(alarm);
 
-    // Keep us updated every 1 second
-    priv->timer_id = g_timeout_add_seconds(1, (GSourceFunc)alarm_timer_update, alarm);
+    priv->scheduled = TRUE;
 }
 
 static gboolean alarm_timer_is_started(Alarm* alarm)
 {
     AlarmPrivate* priv = ALARM_PRIVATE(alarm);
 
-    return priv->timer_id > 0;
+    return priv->scheduled;
+}
+
+/*
+ * Update the scheduler's copy of the alarm after a property change
+ */
+static void alarm_timer_sync(Alarm* alarm)
+{
+    if(alarm_timer_is_started(alarm))
+        alarm_scheduler_add(alarm);
 }
 
 static void alarm_timer_remove(Alarm* alarm)
@@ -662,9 +1179,9 @@ static void alarm_timer_remove(Alarm* alarm)
     if(alarm_timer_is_started(alarm)) {
         g_debug("Alarm(%p) #%d: timer_remove", alarm, alarm->id);
 
-        g_source_remove(priv->timer_id);
+        alarm_scheduler_remove(alarm);
 
-        priv->timer_id = 0;
+        priv->scheduled = FALSE;
     }
 }
 
@@ -700,10 +1217,13 @@ static void alarm_dispose(GObject* object)
     if(parent->dispose)
         parent->dispose(object);
 
+    // Don't lose the changes of an update that was never ended
+    g_settings_apply(priv->settings);
     g_object_unref(priv->settings);
     alarm_timer_remove(alarm);
     alarm_clear(alarm);
     g_free(alarm->command);
+    g_strfreev(priv->command_argv);
     g_free(alarm->sound_file);
     g_free(alarm->message);
 }
@@ -714,9 +1234,14 @@ void alarm_update_gsettings_alarm_list(GSettings* settings, GList* alarms)
     guint32* newvalues = malloc(((size_t)g_list_length(alarms)) * sizeof(guint32));
     gsize i;
     GList* l;
-    for(i = 0, l = alarms; l; i++, l = l->next) {
+    for(i = 0, l = alarms; l; l = l->next) {
         const Alarm* a = ALARM(l->data);
-        newvalues[i] = a->id;
+
+        // Those only live in memory
+        if(ALARM_ID_IS_EPHEMERAL(a->id))
+            continue;
+
+        newvalues[i++] = a->id;
     }
 
     GVariant* v = g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32, newvalues, i, sizeof(guint32));
@@ -724,51 +1249,102 @@ void alarm_update_gsettings_alarm_list(GSettings* settings, GList* alarms)
     free(newvalues);
 }
 
-static void prop_repeat_notify(GObject* self, GParamSpec* pspec, gpointer user_data)
+GList* alarm_list_append(GList* list, GList** tail, GHashTable* links, Alarm* alarm)
+{
+    GList* link = g_list_alloc();
+
+    link->data = alarm;
+    link->prev = *tail;
+    link->next = NULL;
+
+    if(*tail)
+        (*tail)->next = link;
+    else
+        list = link;
+
+    *tail = link;
+    g_hash_table_insert(links, GINT_TO_POINTER(alarm->id), link);
+
+    return list;
+}
+
+GList* alarm_list_remove(GList* list, GList** tail, GHashTable* links, Alarm* alarm)
 {
-    alarm_applet_request_resize(user_data);
+    GList* link = g_hash_table_lookup(links, GINT_TO_POINTER(alarm->id));
+
+    g_return_val_if_fail(link && link->data == alarm, list);
+
+    if(link == *tail)
+        *tail = link->prev;
+
+    g_hash_table_remove(links, GINT_TO_POINTER(alarm->id));
+
+    return g_list_delete_link(list, link);
 }
 
 /*
  * Convenience function for creating a new alarm instance.
  * Passing -1 as the id will generate a new ID with alarm_gen_id
  */
-Alarm* alarm_new(struct _AlarmApplet* applet, GSettings* settings, gint id)
+Alarm* alarm_new(GSettings* settings, gint id)
 {
     if(id < 0)
         id = alarm_gen_id(settings);
 
-    Alarm* alarm = g_object_new(TYPE_ALARM, "id", id, NULL);
+    return g_object_new(TYPE_ALARM, "id", id, NULL);
+}
+
+/*
+ * Create an alarm that is only kept in memory, for timers that are not worth
+ * storing. IDs are handed out in order and never reused within a process.
+ */
+Alarm* alarm_new_ephemeral(void)
+{
+    static guint32 next_id = ALARM_EPHEMERAL_ID_BASE;
 
-    // Ask for a resize when a property has changed that might require more space
-    g_signal_connect(alarm, "notify::" PROP_NAME_REPEAT, G_CALLBACK(prop_repeat_notify), applet);
+    g_assert(next_id < G_MAXINT32);
 
-    return alarm;
+    return g_object_new(TYPE_ALARM, "id", next_id++, NULL);
 }
 
-static inline gboolean in_alarm_array(const guint32* values, const gsize count, const guint32 val)
+gboolean alarm_is_ephemeral(Alarm* alarm)
 {
-    for(gsize i = 0; i < count; i++)
-        if(values[i] == val)
-            return TRUE;
-    return FALSE;
+    return ALARM_ID_IS_EPHEMERAL(alarm->id);
 }
 
-guint alarm_gen_id(GSettings* settings)
+/*
+ * Find the n lowest IDs that are not in use
+ */
+void alarm_gen_ids(GSettings* settings, guint32* ids, guint n)
 {
     GVariant* var = g_settings_get_value(settings, "alarms");
     gsize count = 0;
     const guint32* values = g_variant_get_fixed_array(var, &count, sizeof(guint32));
-    guint32 i = 0;
-    if(values) {
-        for(i = 0; i < G_MAXUINT32; i++)
-            if(!in_alarm_array(values, count, i))
-                break;
-    }
+    GHashTable* used = g_hash_table_new(NULL, NULL);
+    guint32 id = 0;
+
+    for(gsize i = 0; i < count; i++)
+        g_hash_table_add(used, GUINT_TO_POINTER(values[i]));
     g_variant_unref(var);
 
-    g_assert(i != G_MAXUINT32);
-    return i;
+    for(guint i = 0; i < n; i++, id++) {
+        while(g_hash_table_contains(used, GUINT_TO_POINTER(id)))
+            id++;
+
+        g_assert(id < G_MAXINT32);
+        ids[i] = id;
+    }
+
+    g_hash_table_destroy(used);
+}
+
+guint alarm_gen_id(GSettings* settings)
+{
+    guint32 id;
+
+    alarm_gen_ids(settings, &id, 1);
+
+    return id;
 }
 
 gchar* alarm_gsettings_get_dir(Alarm* alarm)
@@ -796,7 +1372,7 @@ static gint alarm_list_item_compare(gconstpointer a, gconstpointer b)
 /*
  * Get list of alarms in gsettings
  */
-GList* alarm_get_list(struct _AlarmApplet* applet, GSettings* settings)
+GList* alarm_get_list(GSettings* settings)
 {
     GList* ret = NULL;
 
@@ -809,14 +1385,17 @@ GList* alarm_get_list(struct _AlarmApplet* applet, GSettings* settings)
             const guint32 id = values[i];
             g_debug("Alarm: get_list() found #%" G_GUINT32_FORMAT, id);
 
-            Alarm* alarm = alarm_new(applet, settings, id);
+            Alarm* alarm = alarm_new(settings, id);
             //			g_debug ("\tref = %d", G_OBJECT (alarm)->ref_count);
-            ret = g_list_insert_sorted(ret, alarm, alarm_list_item_compare);
+            ret = g_list_prepend(ret, alarm);
             //			g_debug ("\tappend ref = %d", G_OBJECT (alarm)->ref_count);
         }
     }
     g_variant_unref(var);
 
+    // Sorting once is stable like inserting in order, without being quadratic
+    ret = g_list_sort(g_list_reverse(ret), alarm_list_item_compare);
+
     return ret;
 }
 
@@ -866,6 +1445,8 @@ static void alarm_player_state_cb(MediaPlayer* player, MediaPlayerState state, g
     Alarm* alarm = ALARM(data);
     AlarmPrivate* priv = ALARM_PRIVATE(alarm);
 
+    trace_event(TRACE_PLAYER_STATE, alarm->id, state);
+
     if(state != prev_state) {
         // Emit player_changed signal
         g_signal_emit(alarm, alarm_signal[SIGNAL_PLAYER], 0, state, NULL);
@@ -899,17 +1480,26 @@ static void alarm_player_start(Alarm* alarm)
 {
     AlarmPrivate* priv = ALARM_PRIVATE(alarm);
 
+    // Prefer the local copy of sounds on remote filesystems
+    gchar* cached_uri = sound_cache_lookup(alarm->sound_file);
+    const gchar* uri = cached_uri ? cached_uri : alarm->sound_file;
+
     if(priv->player == NULL) {
-        priv->player = media_player_new(alarm->sound_file, alarm->sound_loop, alarm_player_state_cb, alarm, alarm_player_error_cb, alarm);
+        priv->player = media_player_new(uri, alarm->sound_loop, alarm_player_state_cb, alarm, alarm_player_error_cb, alarm);
         if(priv->player == NULL) {
             // Unable to create player
             alarm_error_trigger(alarm, ALARM_ERROR_PLAY, _("Could not create player! Please check your sound settings."));
+            g_free(cached_uri);
             return;
         }
     } else {
-        media_player_set_uri(priv->player, alarm->sound_file);
+        media_player_set_uri(priv->player, uri);
     }
 
+    g_free(cached_uri);
+
+    media_player_set_skip_seek(priv->player, alarm_sound_is_verified(alarm));
+    media_player_set_deadline(priv->player, priv->trigger_due);
     media_player_start(priv->player);
 
     g_debug("Alarm(%p) #%d: player_start...", alarm, alarm->id);
@@ -917,7 +1507,27 @@ static void alarm_player_start(Alarm* alarm)
     /*
      * Add stop timeout
      */
-    priv->player_timer_id = g_timeout_add_seconds(ALARM_SOUND_TIMEOUT, alarm_player_timeout, alarm);
+    priv->player_timer_id = source_stats_timeout_add_seconds("alarm-player-timeout", ALARM_SOUND_TIMEOUT, alarm_player_timeout, alarm);
+}
+
+/**
+ * Take over a player that has been started by the scheduler
+ */
+static void alarm_player_adopt(Alarm* alarm, MediaPlayer* player)
+{
+    AlarmPrivate* priv = ALARM_PRIVATE(alarm);
+
+    priv->player = player;
+
+    // This notifies us of the current state, which may free the player right away
+    media_player_set_callbacks(player, alarm_player_state_cb, alarm, alarm_player_error_cb, alarm);
+
+    if(priv->player != NULL) {
+        /*
+         * Add stop timeout
+         */
+        priv->player_timer_id = source_stats_timeout_add_seconds("alarm-player-timeout", ALARM_SOUND_TIMEOUT, alarm_player_timeout, alarm);
+    }
 }
 
 /**
@@ -938,27 +1548,74 @@ static void alarm_player_stop(Alarm* alarm)
 }
 
 /*
- * Run Command
+ * Get the parsed command, or NULL if it can't be parsed
  */
-static void alarm_command_run(Alarm* alarm)
+const gchar* const* alarm_get_command_argv(Alarm* alarm)
 {
-    GError* err = NULL;
-    gchar* msg;
+    AlarmPrivate* priv = ALARM_PRIVATE(alarm);
+
+    return (const gchar* const*)priv->command_argv;
+}
 
-    if(!g_spawn_command_line_async(alarm->command, &err)) {
+/*
+ * Whether the sound file is known to play fine
+ */
+gboolean alarm_sound_is_verified(Alarm* alarm)
+{
+    const AlarmListEntry* entry = sound_index_lookup(alarm->sound_file);
 
-        msg = g_strdup_printf("Could not launch `%s': %s", alarm->command, err->message);
+    return entry && entry->playable == ALARM_LIST_ENTRY_PLAYABLE;
+}
 
+/*
+ * Emit an error if a command run failed
+ */
+void alarm_command_report(Alarm* alarm, const gchar* command, const CommandResult* result)
+{
+    gchar* msg = command_result_to_error_message(command, result);
+
+    if(msg) {
         g_critical("%s", msg);
 
         /* Emit error signal */
         alarm_error_trigger(alarm, ALARM_ERROR_COMMAND, msg);
 
         g_free(msg);
-        g_error_free(err);
     }
 }
 
+static void alarm_command_finished(const gchar* command, const CommandResult* result, gpointer data)
+{
+    Alarm* alarm = g_weak_ref_get((GWeakRef*)data);
+
+    if(!alarm)
+        return;
+
+    // Only the main thread drops references, so the alarm stays alive until we return
+    g_object_unref(alarm);
+
+    alarm_command_report(alarm, command, result);
+}
+
+static void alarm_command_weak_ref_free(gpointer data)
+{
+    g_weak_ref_clear((GWeakRef*)data);
+    g_free(data);
+}
+
+/*
+ * Run Command
+ */
+static void alarm_command_run(Alarm* alarm)
+{
+    AlarmPrivate* priv = ALARM_PRIVATE(alarm);
+    GWeakRef* ref = g_new(GWeakRef, 1);
+
+    g_weak_ref_init(ref, alarm);
+
+    command_executor_run(alarm->id, alarm->command, alarm_get_command_argv(alarm), priv->trigger_due, alarm_command_finished, ref, alarm_command_weak_ref_free);
+}
+
 
 /*
  * Set time according to hour, min, sec
@@ -991,28 +1648,26 @@ static gboolean alarm_time_is_future(struct tm* tm, guint hour, guint minute, gu
 
 
 /*
- * Set time according to hour, min, sec and alarm->repeat
+ * Get the next timestamp for hour, min, sec and repeat
  */
-static void alarm_set_timestamp(Alarm* alarm, guint hour, guint minute, guint second)
+static time_t alarm_timestamp_next(AlarmRepeat repeat, guint hour, guint minute, guint second)
 {
     time_t now, new;
     gint i, d, wday;
     AlarmRepeat rep;
     struct tm tm;
 
-    g_debug("Alarm(%p) #%d: set_timestamp (%d, %d, %d)", alarm, alarm->id, hour, minute, second);
-
-    time(&now);
+    now = wallclock_now();
     tzset();
     if(!localtime_r(&now, &tm)) {
         memset(&tm, 0, sizeof(tm));
-        g_critical("Alarm #%d: localtime failed", alarm->id);
+        g_critical("Alarm: localtime failed");
     }
 
     // Automatically detect Daylight Savings Time (DST)
     tm.tm_isdst = -1;
 
-    if(alarm->repeat == ALARM_REPEAT_NONE) {
+    if(repeat == ALARM_REPEAT_NONE) {
         // Check if the alarm is for tomorrow
         if(!alarm_time_is_future(&tm, hour, minute, second)) {
             g_debug("\tAlarm is for tomorrow.");
@@ -1027,7 +1682,7 @@ static void alarm_set_timestamp(Alarm* alarm, guint hour, guint minute, guint se
         // Try finding a day in this week
         for(; i < 7; i++) {
             rep = 1 << i;
-            if(alarm->repeat & rep) {
+            if(repeat & rep) {
                 if(i == tm.tm_wday && !alarm_time_is_future(&tm, hour, minute, second))
                     continue;
                 wday = i;
@@ -1039,7 +1694,7 @@ static void alarm_set_timestamp(Alarm* alarm, guint hour, guint minute, guint se
         if(wday == -1) {
             for(i = 0; i <= tm.tm_wday; i++) {
                 rep = 1 << i;
-                if(alarm->repeat & rep) {
+                if(repeat & rep) {
                     wday = i;
                     break;
                 }
@@ -1070,7 +1725,27 @@ static void alarm_set_timestamp(Alarm* alarm, guint hour, guint minute, guint se
 
     new = mktime(&tm);
     g_debug("\tSetting to %d", (gint) new);
-    g_object_set(alarm, "timestamp", new, NULL);
+
+    return new;
+}
+
+/*
+ * Get the timestamp that an alarm with these settings would get when enabled
+ * now, for code that works on the settings rather than an Alarm.
+ */
+time_t alarm_next_timestamp(AlarmType type, time_t time, AlarmRepeat repeat)
+{
+    struct tm tm;
+
+    if(type == ALARM_TYPE_TIMER)
+        return wallclock_now() + time;
+
+    if(!gmtime_r(&time, &tm)) {
+        memset(&tm, 0, sizeof(struct tm));
+        g_critical("Alarm: gmtime failed");
+    }
+
+    return alarm_timestamp_next(repeat, tm.tm_hour, tm.tm_min, tm.tm_sec);
 }
 
 /*
@@ -1083,11 +1758,13 @@ void alarm_update_timestamp(Alarm* alarm)
         struct tm tm;
         alarm_get_time(alarm, &tm);
         g_debug("Alarm(%p) #%d: update_timestamp_full: %d:%d:%d", alarm, alarm->id, tm.tm_hour, tm.tm_min, tm.tm_sec);
-        alarm_set_timestamp(alarm, tm.tm_hour, tm.tm_min, tm.tm_sec);
+        g_object_set(alarm, "timestamp", alarm_timestamp_next(alarm->repeat, tm.tm_hour, tm.tm_min, tm.tm_sec), NULL);
     } else {
         /* ALARM_TYPE_TIMER */
-        g_object_set(alarm, "timestamp", time(NULL) + alarm->time, NULL);
+        g_object_set(alarm, "timestamp", wallclock_now() + alarm->time, NULL);
     }
+
+    trace_event(TRACE_ALARM_TIMESTAMP, alarm->id, alarm->timestamp);
 }
 
 /*
@@ -1110,7 +1787,7 @@ void alarm_get_remain(Alarm* alarm, struct tm* res)
 {
     g_assert(res != NULL);
 
-    const time_t now = time(NULL);
+    const time_t now = wallclock_now();
     res->tm_sec = alarm->timestamp - now;
 
     res->tm_min = res->tm_sec / 60;
@@ -1125,7 +1802,7 @@ void alarm_get_remain(Alarm* alarm, struct tm* res)
  */
 time_t alarm_get_remain_seconds(Alarm* alarm)
 {
-    time_t now = time(NULL);
+    time_t now = wallclock_now();
 
     return alarm->timestamp - now;
 }
@@ -15,11 +15,10 @@
 #include <gio/gio.h>
 
 #include "player.h"
+#include "command-executor.h"
 
 G_BEGIN_DECLS
 
-struct _AlarmApplet;
-
 /*
  * Utility macros
  */
@@ -91,6 +90,7 @@ typedef enum {
     ALARM_ERROR_NONE,
     ALARM_ERROR_PLAY,    /* Error playing sound */
     ALARM_ERROR_COMMAND, /* Error launching command */
+    ALARM_ERROR_INVALID, /* Invalid field in a variant */
 } AlarmErrorCode;
 
 
@@ -117,12 +117,23 @@ typedef enum {
 #define ALARM_G_SETTINGS_DIR_PREFIX "alarm-"
 #define ALARM_G_SETTINGS_BASE_DIR   "/io/github/alarm-clock-applet/"
 
+/*
+ * Alarms with IDs from here on are only kept in memory. They are never part
+ * of the alarms list and their settings never reach dconf.
+ */
+#define ALARM_EPHEMERAL_ID_BASE (1 << 30)
+
+#define ALARM_ID_IS_EPHEMERAL(id) ((guint32)(id) >= ALARM_EPHEMERAL_ID_BASE)
+
 /*
  * Player backoff timeout.
  * We will stop the player automatically after 20 minutes.
  */
 #define ALARM_SOUND_TIMEOUT (60 * 20)
 
+// Clocks always snooze for this many minutes
+#define ALARM_STD_SNOOZE 9
+
 /*
  * Function prototypes.
  */
@@ -130,10 +141,16 @@ typedef enum {
 /* used by ALARM_TYPE */
 GType alarm_get_type(void);
 
-Alarm* alarm_new(struct _AlarmApplet* applet, GSettings* settings, gint id);
+Alarm* alarm_new(GSettings* settings, gint id);
+
+Alarm* alarm_new_ephemeral(void);
+
+gboolean alarm_is_ephemeral(Alarm* alarm);
 
 guint alarm_gen_id(GSettings* settings);
 
+void alarm_gen_ids(GSettings* settings, guint32* ids, guint n);
+
 gchar* alarm_gsettings_get_dir(Alarm* alarm);
 
 const gchar* alarm_type_to_string(AlarmType type);
@@ -145,12 +162,20 @@ const gchar* alarm_notify_type_to_string(AlarmNotifyType type);
 
 AlarmNotifyType alarm_notify_type_from_string(const gchar* type);
 
-GList* alarm_get_list(struct _AlarmApplet* applet, GSettings* settings);
+GList* alarm_get_list(GSettings* settings);
 
 void alarm_signal_connect_list(GList* instances, const gchar* detailed_signal, GCallback c_handler, gpointer data);
 
 void alarm_trigger(Alarm* alarm);
 
+void alarm_trigger_started(Alarm* alarm, time_t due, MediaPlayer* player, const GError* error);
+
+const gchar* const* alarm_get_command_argv(Alarm* alarm);
+
+gboolean alarm_sound_is_verified(Alarm* alarm);
+
+void alarm_command_report(Alarm* alarm, const gchar* command, const CommandResult* result);
+
 void alarm_set_enabled(Alarm* alarm, gboolean enabled);
 
 void alarm_enable(Alarm* alarm);
@@ -163,16 +188,46 @@ void alarm_delete(Alarm* alarm);
 
 void alarm_unref(Alarm* alarm);
 
+void alarm_begin_update(Alarm* alarm);
+
+void alarm_end_update(Alarm* alarm);
+
+gboolean alarm_variant_check_fields(const gchar* const* fields, GError** error);
+
+gboolean alarm_variant_check(GVariant* dict, GError** error);
+
+GVariant* alarm_to_variant(Alarm* alarm, const gchar* const* fields);
+
+gboolean alarm_set_from_variant(Alarm* alarm, GVariant* dict, GError** error);
+
+GVariant* alarm_settings_to_variant(GSettings* settings, guint32 id);
+
 void alarm_snooze(Alarm* alarm, guint seconds);
 
 gboolean alarm_is_playing(Alarm* alarm);
 
 void alarm_update_gsettings_alarm_list(GSettings* settings, GList* alarms);
 
+/**
+ * Append alarm to list in O(1) and return the new start of the list.
+ *
+ * tail points to the last link of list, and links maps the ID of each alarm
+ * in the list to its link. Both are kept up to date.
+ */
+GList* alarm_list_append(GList* list, GList** tail, GHashTable* links, Alarm* alarm);
+
+/**
+ * Remove alarm from a list built by alarm_list_append() in O(1) and return the
+ * new start of the list.
+ */
+GList* alarm_list_remove(GList* list, GList** tail, GHashTable* links, Alarm* alarm);
+
 void alarm_set_time(Alarm* alarm, guint hour, guint minute, guint second);
 
 void alarm_update_timestamp(Alarm* alarm);
 
+time_t alarm_next_timestamp(AlarmType type, time_t time, AlarmRepeat repeat);
+
 void alarm_update_timestamp_full(Alarm* alarm, gboolean include_today);
 
 GQuark alarm_error_quark(void);
@@ -0,0 +1,503 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * alarm-bench.c -- Benchmarks for the alarm core
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib/gstdio.h>
+
+#include "alarm-applet.h"
+#include "alarm-list-window.h"
+#include "bench-util.h"
+#include "sound-index.h"
+#include "wallclock.h"
+
+/*
+ * Every case is run against 10 up to 100k alarms stored in the in-memory
+ * GSettings backend, and repeated until it has taken at least BENCH_MIN_TIME.
+ * The wall clock is frozen, so timestamps come out the same on every run.
+ *
+ * Results are written as JSON, one result per line, and can be compared
+ * against an earlier run to catch regressions. The list window case needs a
+ * display and is skipped without one.
+ *
+ * The sound index cases scan as many empty sound files as there are alarms,
+ * spread over BENCH_SOUND_DIRS data directories that are put in front of
+ * XDG_DATA_DIRS, once with a worker per directory and once with a single one.
+ * Every scan starts from scratch, but the page cache is warm after the first.
+ */
+
+#define BENCH_MIN_TIME   (G_USEC_PER_SEC / 5)
+#define BENCH_EPOCH      G_GINT64_CONSTANT(1654041600) // 2022-06-01 00:00:00 UTC
+#define BENCH_TOLERANCE  25                            // Percent
+#define BENCH_SOUND_DIRS 16
+#define BENCH_SOUND_PATH "sounds/gnome/default/alerts" // One of the stock directories of sound-index.c
+
+typedef struct {
+    AlarmApplet* applet;
+    GSettings* settings;
+    guint n_alarms;
+    gboolean shifted; // Whether the first alarm was replaced by alarm_list_changed()
+    AlarmListWindow* list_window;
+} BenchContext;
+
+typedef gint64 (*BenchFunc)(BenchContext* ctx);
+
+typedef struct {
+    const gchar* name;
+    BenchFunc func;
+    gboolean needs_display;
+    gboolean needs_sounds;
+} BenchCase;
+
+typedef struct {
+    const gchar* name;
+    guint n_alarms;
+    gdouble usec; // Mean time of one iteration
+    guint iterations;
+} BenchResult;
+
+static const guint bench_sizes[] = { 10, 1000, 10000, 100000 };
+
+static gchar* opt_output = NULL;
+static gchar* opt_baseline = NULL;
+static gint opt_tolerance = BENCH_TOLERANCE;
+static gint opt_max_alarms = 100000;
+
+static gchar* bench_sound_root = NULL;
+static gchar* bench_sound_dirs[BENCH_SOUND_DIRS];
+
+/*
+ * Alarms list {{
+ */
+
+static void bench_set_alarm_ids(GSettings* settings, guint first, guint count)
+{
+    guint32* ids = g_new(guint32, count);
+
+    for(guint i = 0; i < count; i++)
+        ids[i] = first + i;
+
+    g_settings_set_value(settings, "alarms", g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32, ids, count, sizeof(guint32)));
+    g_free(ids);
+}
+
+static void bench_alarms_free(GList* alarms)
+{
+    for(GList* l = alarms; l; l = l->next) {
+        Alarm* a = ALARM(l->data);
+
+        g_signal_handlers_disconnect_matched(a, 0, 0, 0, NULL, NULL, NULL);
+        alarm_disable(a);
+        g_object_unref(a);
+    }
+
+    g_list_free(alarms);
+}
+
+/*
+ * }} Alarms list
+ */
+
+/*
+ * Sound tree {{
+ */
+
+/*
+ * Has to run before anything calls g_get_system_data_dirs(), which caches
+ * the directories
+ */
+static gboolean bench_sound_tree_new(void)
+{
+    GError* error = NULL;
+    GString* data_dirs;
+    const gchar* system_dirs = g_getenv("XDG_DATA_DIRS");
+
+    bench_sound_root = g_dir_make_tmp("alarm-clock-bench-XXXXXX", &error);
+    if(!bench_sound_root) {
+        fprintf(stderr, "Could not create the sound tree: %s\n", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    data_dirs = g_string_new(NULL);
+
+    for(guint i = 0; i < BENCH_SOUND_DIRS; i++) {
+        gchar* data_dir = g_strdup_printf("%s/share-%u", bench_sound_root, i);
+
+        bench_sound_dirs[i] = g_build_filename(data_dir, BENCH_SOUND_PATH, NULL);
+        g_mkdir_with_parents(bench_sound_dirs[i], 0700);
+        g_string_append_printf(data_dirs, "%s:", data_dir);
+
+        g_free(data_dir);
+    }
+
+    // The shared MIME database is still needed to tell the sounds apart
+    g_string_append(data_dirs, system_dirs && *system_dirs ? system_dirs : "/usr/local/share/:/usr/share/");
+    g_setenv("XDG_DATA_DIRS", data_dirs->str, TRUE);
+    g_string_free(data_dirs, TRUE);
+
+    return TRUE;
+}
+
+static gchar* bench_sound_path(guint i)
+{
+    return g_strdup_printf("%s/sound-%06u.oga", bench_sound_dirs[i % BENCH_SOUND_DIRS], i);
+}
+
+static void bench_sound_tree_fill(guint n_sounds)
+{
+    for(guint i = 0; i < n_sounds; i++) {
+        gchar* path = bench_sound_path(i);
+
+        if(!g_file_set_contents(path, "", 0, NULL))
+            fprintf(stderr, "Could not create %s\n", path);
+
+        g_free(path);
+    }
+}
+
+static void bench_sound_tree_clear(guint n_sounds)
+{
+    for(guint i = 0; i < n_sounds; i++) {
+        gchar* path = bench_sound_path(i);
+
+        g_remove(path);
+        g_free(path);
+    }
+}
+
+static void bench_sound_tree_free(void)
+{
+    bench_remove_tree(bench_sound_root);
+
+    for(guint i = 0; i < BENCH_SOUND_DIRS; i++)
+        g_clear_pointer(&bench_sound_dirs[i], g_free);
+    g_clear_pointer(&bench_sound_root, g_free);
+}
+
+/*
+ * }} Sound tree
+ */
+
+/*
+ * Cases {{
+ */
+
+static gint64 bench_get_list(BenchContext* ctx)
+{
+    const gint64 begin = g_get_monotonic_time();
+    GList* alarms = alarm_get_list(ctx->settings);
+    const gint64 elapsed = g_get_monotonic_time() - begin;
+
+    bench_alarms_free(alarms);
+
+    return elapsed;
+}
+
+static gint64 bench_list_changed(BenchContext* ctx)
+{
+    gint64 begin;
+
+    // Alternate between dropping the first alarm and adding one at the end, and the other way round
+    ctx->shifted = !ctx->shifted;
+    bench_set_alarm_ids(ctx->settings, ctx->shifted ? 1 : 0, ctx->n_alarms);
+
+    begin = g_get_monotonic_time();
+    alarm_list_changed(ctx->settings, "alarms", ctx->applet);
+
+    return g_get_monotonic_time() - begin;
+}
+
+static gint64 bench_gen_id(BenchContext* ctx)
+{
+    const gint64 begin = g_get_monotonic_time();
+
+    alarm_gen_id(ctx->settings);
+
+    return g_get_monotonic_time() - begin;
+}
+
+static gint64 bench_update_timestamp(BenchContext* ctx)
+{
+    const gint64 begin = g_get_monotonic_time();
+
+    for(GList* l = ctx->applet->alarms; l; l = l->next)
+        alarm_update_timestamp(ALARM(l->data));
+
+    return g_get_monotonic_time() - begin;
+}
+
+static gint64 bench_label_get(BenchContext* ctx)
+{
+    const gint64 begin = g_get_monotonic_time();
+
+    g_free(alarm_applet_label_get(ctx->applet));
+
+    return g_get_monotonic_time() - begin;
+}
+
+static gint64 bench_list_window_refresh(BenchContext* ctx)
+{
+    const gint64 begin = g_get_monotonic_time();
+
+    alarm_list_window_refresh(ctx->list_window);
+
+    return g_get_monotonic_time() - begin;
+}
+
+static gint64 bench_sound_scan_parallel(BenchContext* ctx)
+{
+    const gint64 begin = g_get_monotonic_time();
+
+    sound_index_scan_sync(FALSE);
+
+    return g_get_monotonic_time() - begin;
+}
+
+static gint64 bench_sound_scan_serial(BenchContext* ctx)
+{
+    const gint64 begin = g_get_monotonic_time();
+
+    sound_index_scan_sync(TRUE);
+
+    return g_get_monotonic_time() - begin;
+}
+
+static const BenchCase bench_cases[] = {
+    { "alarm_get_list", bench_get_list, FALSE },
+    { "alarm_list_changed", bench_list_changed, FALSE },
+    { "alarm_gen_id", bench_gen_id, FALSE },
+    { "alarm_update_timestamp", bench_update_timestamp, FALSE },
+    { "alarm_applet_label_get", bench_label_get, FALSE },
+    { "alarm_list_window_refresh", bench_list_window_refresh, TRUE },
+    { "sound_index_scan_parallel", bench_sound_scan_parallel, FALSE, TRUE },
+    { "sound_index_scan_serial", bench_sound_scan_serial, FALSE, TRUE },
+};
+
+/*
+ * }} Cases
+ */
+
+static BenchResult bench_run(const BenchCase* bc, BenchContext* ctx)
+{
+    BenchResult result = { bc->name, ctx->n_alarms, 0, 0 };
+    gint64 total = 0;
+
+    // Slow cases at large sizes still run at least once
+    do {
+        total += bc->func(ctx);
+        result.iterations++;
+    } while(total < BENCH_MIN_TIME);
+
+    result.usec = total / (gdouble)result.iterations;
+
+    return result;
+}
+
+static void bench_run_size(GArray* results, guint n_alarms, gboolean have_display)
+{
+    BenchContext ctx = { 0 };
+    AlarmApplet applet = { 0 };
+
+    applet.snooze_mins = 5;
+    applet.settings_global = g_settings_new("io.github.alarm-clock-applet");
+
+    ctx.applet = &applet;
+    ctx.settings = applet.settings_global;
+    ctx.n_alarms = n_alarms;
+
+    bench_set_alarm_ids(ctx.settings, 0, n_alarms);
+
+    // Loaded and enabled once, for the cases that work on the applet's alarms
+    applet.alarms = alarm_get_list(ctx.settings);
+    for(GList* l = applet.alarms; l; l = l->next)
+        alarm_enable(ALARM(l->data));
+
+    if(have_display)
+        ctx.list_window = alarm_list_window_new(&applet);
+
+    if(bench_sound_root)
+        bench_sound_tree_fill(n_alarms);
+
+    for(guint i = 0; i < G_N_ELEMENTS(bench_cases); i++) {
+        BenchResult result;
+
+        if((bench_cases[i].needs_display && !ctx.list_window) || (bench_cases[i].needs_sounds && !bench_sound_root))
+            continue;
+
+        result = bench_run(&bench_cases[i], &ctx);
+        g_array_append_val(results, result);
+
+        fprintf(stderr, "%-28s %8u alarms %14.3f us (%u iterations)\n", result.name, result.n_alarms, result.usec, result.iterations);
+    }
+
+    if(ctx.list_window)
+        gtk_widget_destroy(GTK_WIDGET(ctx.list_window->window));
+
+    if(bench_sound_root)
+        bench_sound_tree_clear(n_alarms);
+
+    bench_alarms_free(applet.alarms);
+    g_object_unref(applet.settings_global);
+}
+
+/*
+ * JSON {{
+ */
+
+static gchar* bench_results_to_json(GArray* results)
+{
+    GString* json = g_string_new("{\"version\":\"" VERSION "\",\"results\":[\n");
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    for(guint i = 0; i < results->len; i++) {
+        const BenchResult* r = &g_array_index(results, BenchResult, i);
+
+        g_string_append_printf(json, "{\"name\":\"%s\",\"alarms\":%u,\"usec\":%s,\"iterations\":%u}%s\n", r->name, r->n_alarms,
+                               g_ascii_formatd(buf, sizeof(buf), "%.3f", r->usec), r->iterations, i + 1 < results->len ? "," : "");
+    }
+
+    g_string_append(json, "]}\n");
+
+    return g_string_free(json, FALSE);
+}
+
+/*
+ * Compare against a file written by an earlier run. Returns the number of
+ * regressions, or -1 if the baseline could not be read.
+ */
+static gint bench_compare(GArray* results, const gchar* path, gint tolerance)
+{
+    GError* error = NULL;
+    GMatchInfo* match;
+    GRegex* regex;
+    gchar* contents;
+    gint regressions = 0;
+
+    if(!g_file_get_contents(path, &contents, NULL, &error)) {
+        fprintf(stderr, "Not comparing, could not read baseline: %s\n", error->message);
+        g_error_free(error);
+        return -1;
+    }
+
+    // Only our own output is expected here, so no need for a full JSON parser
+    regex = g_regex_new("\"name\":\"([^\"]+)\",\"alarms\":([0-9]+),\"usec\":([0-9.]+)", 0, 0, NULL);
+    g_regex_match(regex, contents, 0, &match);
+
+    fprintf(stderr, "\n%-28s %8s %14s %14s %8s\n", "Case", "Alarms", "Baseline us", "Now us", "Change");
+
+    while(g_match_info_matches(match)) {
+        gchar* name = g_match_info_fetch(match, 1);
+        gchar* alarms = g_match_info_fetch(match, 2);
+        gchar* usec = g_match_info_fetch(match, 3);
+        const guint n_alarms = (guint)g_ascii_strtoull(alarms, NULL, 10);
+        const gdouble base = g_ascii_strtod(usec, NULL);
+
+        for(guint i = 0; i < results->len; i++) {
+            const BenchResult* r = &g_array_index(results, BenchResult, i);
+            gdouble change;
+
+            if(r->n_alarms != n_alarms || g_strcmp0(r->name, name) != 0)
+                continue;
+
+            change = base > 0 ? (r->usec - base) * 100 / base : 0;
+
+            fprintf(stderr, "%-28s %8u %14.3f %14.3f %+7.1f%%%s\n", name, n_alarms, base, r->usec, change, change > tolerance ? " REGRESSION" : "");
+
+            if(change > tolerance)
+                regressions++;
+            break;
+        }
+
+        g_free(usec);
+        g_free(alarms);
+        g_free(name);
+        g_match_info_next(match, NULL);
+    }
+
+    g_match_info_free(match);
+    g_regex_unref(regex);
+    g_free(contents);
+
+    return regressions;
+}
+
+/*
+ * }} JSON
+ */
+
+int main(int argc, char* argv[])
+{
+    GError* error = NULL;
+    GOptionContext* context;
+    GArray* results;
+    gboolean have_display;
+    gchar* ui_file;
+    gchar* json;
+    gint ret = EXIT_SUCCESS;
+
+    GOptionEntry entries[] = {
+        { "output", 'o', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &opt_output, "Write the results to FILE instead of stdout", "FILE" },
+        { "baseline", 'b', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &opt_baseline, "Compare the results against an earlier run", "FILE" },
+        { "tolerance", 't', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &opt_tolerance, "Slowdown in percent that counts as a regression", "PERCENT" },
+        { "max-alarms", 'm', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &opt_max_alarms, "Skip sizes larger than N", "N" },
+        { NULL }
+    };
+
+    context = g_option_context_new("- benchmark the alarm core");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if(!g_option_context_parse(context, &argc, &argv, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    // Never touch the user's alarms
+    g_setenv("GSETTINGS_BACKEND", "memory", TRUE);
+    g_setenv("GSETTINGS_SCHEMA_DIR", BENCH_SCHEMA_DIR, FALSE);
+
+    // Triggers would only add noise
+    wallclock_set_virtual(BENCH_EPOCH * G_USEC_PER_SEC);
+
+    if(!bench_sound_tree_new())
+        fprintf(stderr, "Skipping the sound index cases\n");
+
+    ui_file = alarm_applet_get_data_path("alarm-list-window.ui");
+    have_display = gtk_init_check(&argc, &argv) && ui_file;
+    g_free(ui_file);
+
+    if(!have_display)
+        fprintf(stderr, "No display or UI file, skipping the list window\n");
+
+    results = g_array_new(FALSE, FALSE, sizeof(BenchResult));
+
+    for(guint i = 0; i < G_N_ELEMENTS(bench_sizes); i++) {
+        if(bench_sizes[i] <= (guint)opt_max_alarms)
+            bench_run_size(results, bench_sizes[i], have_display);
+    }
+
+    json = bench_results_to_json(results);
+
+    if(!opt_output) {
+        fputs(json, stdout);
+    } else if(!g_file_set_contents(opt_output, json, -1, &error)) {
+        fprintf(stderr, "Could not write %s: %s\n", opt_output, error->message);
+        g_clear_error(&error);
+        ret = EXIT_FAILURE;
+    }
+
+    if(opt_baseline && bench_compare(results, opt_baseline, opt_tolerance) > 0)
+        ret = EXIT_FAILURE;
+
+    if(bench_sound_root)
+        bench_sound_tree_free();
+
+    g_free(json);
+    g_array_free(results, TRUE);
+
+    return ret;
+}
@@ -0,0 +1,319 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * alarm-harness.c -- Headless end-to-end alarm trigger harness
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <config.h>
+
+#include "alarm.h"
+#include "bench-util.h"
+#include "command-executor.h"
+#include "metrics.h"
+#include "player.h"
+#include "sound-cache.h"
+
+/*
+ * Runs the alarm core without any windows: alarms live in the in-memory
+ * GSettings backend, sounds go to a fakesink and notifications to a stub that
+ * only records when they arrived. A handful of timers, alternating between a
+ * sound and a command, are scheduled a second apart and the harness waits for
+ * all of them to go off.
+ *
+ * The latencies are then checked against limits, so that a bare box without a
+ * desktop session can catch regressions in alarm delivery. Exits with 1 if any
+ * limit was exceeded or an alarm never went off.
+ */
+
+#define HARNESS_FIRST_DELAY 2  // Seconds until the first alarm
+#define HARNESS_GRACE       10 // Seconds to wait after the last alarm was due
+#define HARNESS_COMMAND     "true"
+
+typedef struct {
+    Alarm* alarm;
+    gint64 due;      // µs, wall clock
+    gint64 notified; // µs, wall clock, 0 until the notification arrived
+} HarnessAlarm;
+
+typedef struct {
+    GMainLoop* loop;
+    HarnessAlarm* alarms;
+    guint n_alarms;
+    guint n_sounds;
+    guint n_commands;
+    guint n_notified;
+} Harness;
+
+typedef struct {
+    const gchar* name;
+    MetricsHistogram histogram;
+    gint* limit; // ms
+} HarnessCheck;
+
+static gint opt_alarms = 6;
+static gint opt_max_trigger = 100;
+static gint opt_max_audio = 1000;
+static gint opt_max_command = 200;
+static gint opt_max_notify = 200;
+static gchar* opt_output = NULL;
+
+static const HarnessCheck harness_checks[] = {
+    { "trigger", METRICS_TRIGGER_LATENCY, &opt_max_trigger },
+    { "first_audio", METRICS_FIRST_AUDIO_LATENCY, &opt_max_audio },
+    { "command_start", METRICS_COMMAND_START_LATENCY, &opt_max_command },
+};
+
+/*
+ * Half a second of silence as an 8 bit mono WAV, so that no sound files are
+ * needed
+ */
+static gboolean harness_write_silence(const gchar* path, GError** error)
+{
+    const guint32 rate = 8000;
+    const guint32 size = rate / 2;
+    guint8* wav = g_malloc(44 + size);
+    guint32 v32;
+    guint16 v16;
+    gboolean ret;
+
+#define PUT32(offset, value) (v32 = GUINT32_TO_LE(value), memcpy(wav + (offset), &v32, 4))
+#define PUT16(offset, value) (v16 = GUINT16_TO_LE(value), memcpy(wav + (offset), &v16, 2))
+
+    memcpy(wav, "RIFF", 4);
+    PUT32(4, 36 + size);
+    memcpy(wav + 8, "WAVEfmt ", 8);
+    PUT32(16, 16);   // Format chunk size
+    PUT16(20, 1);    // PCM
+    PUT16(22, 1);    // Channels
+    PUT32(24, rate); // Sample rate
+    PUT32(28, rate); // Byte rate
+    PUT16(32, 1);    // Block align
+    PUT16(34, 8);    // Bits per sample
+    memcpy(wav + 36, "data", 4);
+    PUT32(40, size);
+    memset(wav + 44, 0x80, size);
+
+#undef PUT16
+#undef PUT32
+
+    ret = g_file_set_contents(path, (const gchar*)wav, 44 + size, error);
+    g_free(wav);
+
+    return ret;
+}
+
+/*
+ * Stands in for the desktop notification
+ */
+static void harness_notification_stub(Alarm* alarm, gpointer data)
+{
+    Harness* harness = (Harness*)data;
+
+    for(guint i = 0; i < harness->n_alarms; i++) {
+        HarnessAlarm* ha = &harness->alarms[i];
+
+        if(ha->alarm == alarm && !ha->notified) {
+            ha->notified = g_get_real_time();
+            harness->n_notified++;
+        }
+    }
+}
+
+static gboolean harness_check_done(gpointer data)
+{
+    Harness* harness = (Harness*)data;
+
+    if(harness->n_notified == harness->n_alarms && metrics_get_count(METRICS_FIRST_AUDIO_LATENCY) >= harness->n_sounds &&
+       metrics_get_count(METRICS_COMMAND_START_LATENCY) >= harness->n_commands) {
+        g_main_loop_quit(harness->loop);
+        return G_SOURCE_REMOVE;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean harness_timeout(gpointer data)
+{
+    Harness* harness = (Harness*)data;
+
+    fprintf(stderr, "Timed out waiting for the alarms\n");
+    g_main_loop_quit(harness->loop);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void harness_schedule(Harness* harness, GSettings* settings, const gchar* sound_uri)
+{
+    GList* list = NULL;
+
+    harness->alarms = g_new0(HarnessAlarm, harness->n_alarms);
+
+    for(guint i = 0; i < harness->n_alarms; i++) {
+        HarnessAlarm* ha = &harness->alarms[i];
+        const gboolean sound = i % 2 == 0;
+
+        ha->alarm = alarm_new(settings, -1);
+
+        // Reserve the ID before generating the next one
+        list = g_list_append(list, ha->alarm);
+        alarm_update_gsettings_alarm_list(settings, list);
+
+        g_object_set(ha->alarm, "type", ALARM_TYPE_TIMER, "time", (gint64)(HARNESS_FIRST_DELAY + i), "notify-type", sound ? ALARM_NOTIFY_SOUND : ALARM_NOTIFY_COMMAND,
+                     "sound-file", sound_uri, "sound-repeat", FALSE, "command", HARNESS_COMMAND, NULL);
+
+        g_signal_connect_after(ha->alarm, "alarm", G_CALLBACK(harness_notification_stub), harness);
+
+        alarm_enable(ha->alarm);
+        ha->due = (gint64)ha->alarm->timestamp * G_USEC_PER_SEC;
+
+        if(sound)
+            harness->n_sounds++;
+        else
+            harness->n_commands++;
+    }
+
+    g_list_free(list);
+}
+
+static gint harness_report(Harness* harness)
+{
+    GString* json = g_string_new("{\"version\":\"" VERSION "\",\"results\":[\n");
+    gchar p50_buf[G_ASCII_DTOSTR_BUF_SIZE], max_buf[G_ASCII_DTOSTR_BUF_SIZE];
+    gint64 notify_max = 0;
+    gint failures = 0;
+
+    fprintf(stderr, "\n%-14s %8s %12s %12s %10s\n", "Latency", "Count", "p50 ms", "Max ms", "Limit ms");
+
+    for(guint i = 0; i < G_N_ELEMENTS(harness_checks); i++) {
+        const HarnessCheck* check = &harness_checks[i];
+        const guint64 count = metrics_get_count(check->histogram);
+        const gint64 p50 = metrics_get_quantile(check->histogram, 0.5);
+        const gint64 max = metrics_get_quantile(check->histogram, 1.0);
+        const gboolean failed = count == 0 || max > *check->limit * 1000;
+
+        fprintf(stderr, "%-14s %8" G_GUINT64_FORMAT " %12.3f %12.3f %10d%s\n", check->name, count, p50 / 1000.0, max / 1000.0, *check->limit, failed ? " FAIL" : "");
+        g_string_append_printf(json, "{\"name\":\"%s\",\"count\":%" G_GUINT64_FORMAT ",\"p50_ms\":%s,\"max_ms\":%s},\n", check->name, count,
+                               g_ascii_formatd(p50_buf, sizeof(p50_buf), "%.3f", p50 / 1000.0), g_ascii_formatd(max_buf, sizeof(max_buf), "%.3f", max / 1000.0));
+
+        if(failed)
+            failures++;
+    }
+
+    for(guint i = 0; i < harness->n_alarms; i++) {
+        if(harness->alarms[i].notified)
+            notify_max = MAX(notify_max, harness->alarms[i].notified - harness->alarms[i].due);
+    }
+
+    fprintf(stderr, "%-14s %8u %12s %12.3f %10d%s\n", "notification", harness->n_notified, "-", notify_max / 1000.0, opt_max_notify,
+            harness->n_notified < harness->n_alarms || notify_max > opt_max_notify * 1000 ? " FAIL" : "");
+    g_string_append_printf(json, "{\"name\":\"notification\",\"count\":%u,\"max_ms\":%s}\n]}\n", harness->n_notified,
+                           g_ascii_formatd(max_buf, sizeof(max_buf), "%.3f", notify_max / 1000.0));
+
+    if(harness->n_notified < harness->n_alarms || notify_max > opt_max_notify * 1000)
+        failures++;
+
+    if(!opt_output) {
+        fputs(json->str, stdout);
+    } else if(!g_file_set_contents(opt_output, json->str, -1, NULL)) {
+        fprintf(stderr, "Could not write %s\n", opt_output);
+        failures++;
+    }
+
+    g_string_free(json, TRUE);
+
+    return failures;
+}
+
+int main(int argc, char* argv[])
+{
+    GError* error = NULL;
+    GOptionContext* context;
+    GSettings* settings;
+    Harness harness = { 0 };
+    gchar *tmp_dir, *sound_path, *sound_uri;
+    gint failures;
+
+    GOptionEntry entries[] = {
+        { "alarms", 'n', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &opt_alarms, "Number of alarms to schedule, a second apart", "N" },
+        { "max-trigger", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &opt_max_trigger, "Highest allowed trigger latency", "MS" },
+        { "max-audio", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &opt_max_audio, "Highest allowed latency until the sound plays", "MS" },
+        { "max-command", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &opt_max_command, "Highest allowed latency until the command starts", "MS" },
+        { "max-notify", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &opt_max_notify, "Highest allowed latency until the notification", "MS" },
+        { "output", 'o', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &opt_output, "Write the results to FILE instead of stdout", "FILE" },
+        { NULL }
+    };
+
+    context = g_option_context_new("- check alarm delivery latencies without a desktop");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if(!g_option_context_parse(context, &argc, &argv, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if(opt_alarms < 1) {
+        fprintf(stderr, "At least one alarm is needed\n");
+        return EXIT_FAILURE;
+    }
+
+    // Keep away from the user's alarms and sound cache
+    tmp_dir = g_dir_make_tmp("alarm-clock-harness-XXXXXX", &error);
+    if(!tmp_dir) {
+        fprintf(stderr, "%s\n", error->message);
+        return EXIT_FAILURE;
+    }
+
+    g_setenv("XDG_CACHE_HOME", tmp_dir, TRUE);
+    g_setenv("GSETTINGS_BACKEND", "memory", TRUE);
+    g_setenv("GSETTINGS_SCHEMA_DIR", BENCH_SCHEMA_DIR, FALSE);
+
+    sound_path = g_build_filename(tmp_dir, "silence.wav", NULL);
+    if(!harness_write_silence(sound_path, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        bench_remove_tree(tmp_dir);
+        return EXIT_FAILURE;
+    }
+    sound_uri = g_filename_to_uri(sound_path, NULL, NULL);
+
+    media_player_set_audio_sink("fakesink");
+    sound_cache_init();
+
+    settings = g_settings_new("io.github.alarm-clock-applet");
+    command_executor_init(settings);
+
+    harness.loop = g_main_loop_new(NULL, FALSE);
+    harness.n_alarms = opt_alarms;
+
+    harness_schedule(&harness, settings, sound_uri);
+
+    g_timeout_add(100, harness_check_done, &harness);
+    g_timeout_add_seconds(HARNESS_FIRST_DELAY + harness.n_alarms + HARNESS_GRACE, harness_timeout, &harness);
+
+    fprintf(stderr, "Waiting for %u alarms...\n", harness.n_alarms);
+    g_main_loop_run(harness.loop);
+
+    failures = harness_report(&harness);
+
+    for(guint i = 0; i < harness.n_alarms; i++) {
+        alarm_clear(harness.alarms[i].alarm);
+        alarm_disable(harness.alarms[i].alarm);
+        g_object_unref(harness.alarms[i].alarm);
+    }
+
+    // The sound and the sound cache
+    bench_remove_tree(tmp_dir);
+
+    g_free(harness.alarms);
+    g_main_loop_unref(harness.loop);
+    g_object_unref(settings);
+    g_free(sound_uri);
+    g_free(sound_path);
+    g_free(tmp_dir);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
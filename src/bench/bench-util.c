@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * bench-util.c -- Helpers shared by the benchmarks and the harness
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <stdio.h>
+#include <glib/gstdio.h>
+
+#include "bench-util.h"
+
+void bench_remove_tree(const gchar* path)
+{
+    GDir* dir;
+    const gchar* name;
+
+    if(g_file_test(path, G_FILE_TEST_IS_DIR) && !g_file_test(path, G_FILE_TEST_IS_SYMLINK) && (dir = g_dir_open(path, 0, NULL))) {
+        while((name = g_dir_read_name(dir))) {
+            gchar* child = g_build_filename(path, name, NULL);
+
+            bench_remove_tree(child);
+            g_free(child);
+        }
+
+        g_dir_close(dir);
+    }
+
+    if(g_remove(path) != 0)
+        fprintf(stderr, "Could not remove %s\n", path);
+}
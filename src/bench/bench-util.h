@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * bench-util.h -- Helpers shared by the benchmarks and the harness
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef BENCH_UTIL_H_
+#define BENCH_UTIL_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Remove path and everything below it. Symlinks are removed, not followed.
+ */
+void bench_remove_tree(const gchar* path);
+
+G_END_DECLS
+
+#endif /*BENCH_UTIL_H_*/
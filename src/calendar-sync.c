@@ -0,0 +1,858 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * calendar-sync.c -- Alarms from the reminders of an iCalendar file
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <config.h>
+#include "calendar-sync.h"
+#include "source-stats.h"
+#include "wallclock.h"
+
+/*
+ * Every VALARM of a VEVENT becomes an ephemeral alarm that goes off at the
+ * time of the reminder. The file is parsed one line at a time on a worker
+ * thread, which compares each reminder with what the previous parse found
+ * for the same UID. Only the reminders that were added, changed or removed
+ * are handed back to the main thread, so an edit that touches three events
+ * costs three alarm updates, however large the calendar is.
+ *
+ * Recurrence rules are not expanded. Only the first occurrence of an event,
+ * and any overridden occurrences with their own RECURRENCE-ID, get alarms.
+ * TZID is looked up as a system time zone, VTIMEZONE definitions are not
+ * parsed.
+ */
+
+// Give the writer a moment to finish before reading the file
+#define CALENDAR_SYNC_DELAY 500
+
+/*
+ * iCalendar parser {{
+ */
+
+typedef struct {
+    gboolean has_trigger;
+    gboolean absolute;    // at is a point in time, rather than an offset
+    gboolean related_end; // The offset is from the end of the event
+    gint64 at;
+    gboolean audible; // Not an EMAIL or PROCEDURE
+} IcalAlarm;
+
+typedef struct {
+    gchar* uid;
+    gchar* recurrence_id;
+    gchar* summary;
+    gboolean cancelled;
+    gboolean has_start;
+    gint64 start;
+    gboolean has_end;
+    gint64 end;
+    gint64 duration;
+    GArray* alarms; // IcalAlarm
+} IcalEvent;
+
+typedef void (*IcalEventFunc)(const IcalEvent* event, gpointer data);
+
+typedef struct {
+    IcalEventFunc func;
+    gpointer data;
+    IcalEvent event;
+    IcalAlarm alarm;
+    gboolean in_event;
+    gboolean in_alarm;
+    guint skip_depth; // Components within the event that aren't alarms
+    gboolean complete;
+} IcalParser;
+
+static void ical_event_clear(IcalEvent* event)
+{
+    GArray* alarms = event->alarms;
+
+    g_free(event->uid);
+    g_free(event->recurrence_id);
+    g_free(event->summary);
+
+    memset(event, 0, sizeof(IcalEvent));
+
+    event->alarms = alarms;
+    g_array_set_size(event->alarms, 0);
+}
+
+/*
+ * Split "NAME;PARAM=x;PARAM=y:VALUE" in place
+ */
+static gboolean ical_split(gchar* line, const gchar** name, const gchar** params, const gchar** value)
+{
+    gboolean quoted = FALSE;
+    gchar* p;
+
+    for(p = line; *p && *p != ';' && *p != ':'; p++)
+        ;
+
+    if(!*p)
+        return FALSE;
+
+    *name = line;
+    *params = NULL;
+
+    if(*p == ';') {
+        *p++ = '\0';
+        *params = p;
+
+        // Quoted parameter values may contain colons
+        for(; *p && (quoted || *p != ':'); p++) {
+            if(*p == '"')
+                quoted = !quoted;
+        }
+
+        if(!*p)
+            return FALSE;
+    }
+
+    *p++ = '\0';
+    *value = p;
+
+    return TRUE;
+}
+
+static gchar* ical_param(const gchar* params, const gchar* name)
+{
+    gchar** list;
+    gchar* ret = NULL;
+    const gsize name_len = strlen(name);
+
+    if(!params)
+        return NULL;
+
+    list = g_strsplit(params, ";", -1);
+
+    for(gchar** p = list; *p && !ret; p++) {
+        if(g_ascii_strncasecmp(*p, name, name_len) == 0 && (*p)[name_len] == '=') {
+            const gchar* value = *p + name_len + 1;
+            gsize len = strlen(value);
+
+            if(len >= 2 && value[0] == '"' && value[len - 1] == '"')
+                ret = g_strndup(value + 1, len - 2);
+            else
+                ret = g_strdup(value);
+        }
+    }
+
+    g_strfreev(list);
+
+    return ret;
+}
+
+static void ical_unescape(gchar* text)
+{
+    gchar* out = text;
+
+    for(const gchar* in = text; *in; in++) {
+        if(*in == '\\' && in[1]) {
+            in++;
+            *out++ = (*in == 'n' || *in == 'N') ? '\n' : *in;
+        } else {
+            *out++ = *in;
+        }
+    }
+
+    *out = '\0';
+}
+
+static GTimeZone* ical_time_zone_new(const gchar* tzid)
+{
+#if GLIB_CHECK_VERSION(2, 68, 0)
+    GTimeZone* tz = g_time_zone_new_identifier(tzid);
+
+    return tz ? tz : g_time_zone_new_local();
+#else
+    return g_time_zone_new(tzid);
+#endif
+}
+
+/*
+ * DATE or DATE-TIME, in UTC, the given TZID, or floating local time
+ */
+static gboolean ical_parse_time(const gchar* value, const gchar* params, gint64* out)
+{
+    const gsize len = strlen(value);
+    gint year, month, day, hour = 0, minute = 0, second = 0;
+    GTimeZone* tz;
+    GDateTime* dt;
+    gchar* tzid;
+
+    if(len == 8) {
+        if(sscanf(value, "%4d%2d%2d", &year, &month, &day) != 3)
+            return FALSE;
+    } else if(len >= 15 && value[8] == 'T') {
+        if(sscanf(value, "%4d%2d%2dT%2d%2d%2d", &year, &month, &day, &hour, &minute, &second) != 6)
+            return FALSE;
+    } else {
+        return FALSE;
+    }
+
+    if(value[len - 1] == 'Z') {
+        tz = g_time_zone_new_utc();
+    } else if((tzid = ical_param(params, "TZID"))) {
+        tz = ical_time_zone_new(tzid);
+        g_free(tzid);
+    } else {
+        tz = g_time_zone_new_local();
+    }
+
+    dt = g_date_time_new(tz, year, month, day, hour, minute, second);
+    g_time_zone_unref(tz);
+
+    if(!dt)
+        return FALSE;
+
+    *out = g_date_time_to_unix(dt);
+    g_date_time_unref(dt);
+
+    return TRUE;
+}
+
+/*
+ * [+-]P[nW][nD][T[nH][nM][nS]]
+ */
+static gboolean ical_parse_duration(const gchar* value, gint64* out)
+{
+    gboolean time = FALSE;
+    gint64 total = 0;
+    gint sign = 1;
+
+    if(*value == '+' || *value == '-')
+        sign = *value++ == '-' ? -1 : 1;
+
+    if(*value++ != 'P' || !*value)
+        return FALSE;
+
+    while(*value) {
+        gchar* end;
+        guint64 n;
+
+        if(*value == 'T') {
+            time = TRUE;
+            value++;
+            continue;
+        }
+
+        if(!g_ascii_isdigit(*value))
+            return FALSE;
+
+        n = g_ascii_strtoull(value, &end, 10);
+        if(n > G_MAXINT32)
+            return FALSE;
+
+        switch(*end) {
+        case 'W':
+            total += n * 7 * 24 * 60 * 60;
+            break;
+        case 'D':
+            total += n * 24 * 60 * 60;
+            break;
+        case 'H':
+            total += n * 60 * 60;
+            break;
+        case 'M':
+            total += n * 60;
+            break;
+        case 'S':
+            total += n;
+            break;
+        default:
+            return FALSE;
+        }
+
+        // Hours, minutes and seconds only come after the T
+        if(time != (*end == 'H' || *end == 'M' || *end == 'S'))
+            return FALSE;
+
+        value = end + 1;
+    }
+
+    *out = sign * total;
+
+    return TRUE;
+}
+
+static void ical_parser_alarm_prop(IcalAlarm* alarm, const gchar* name, const gchar* params, const gchar* value)
+{
+    if(g_ascii_strcasecmp(name, "TRIGGER") == 0) {
+        gchar* type = ical_param(params, "VALUE");
+        gchar* related = ical_param(params, "RELATED");
+
+        alarm->absolute = type && g_ascii_strcasecmp(type, "DATE-TIME") == 0;
+        alarm->related_end = related && g_ascii_strcasecmp(related, "END") == 0;
+
+        if(alarm->absolute)
+            alarm->has_trigger = ical_parse_time(value, params, &alarm->at);
+        else
+            alarm->has_trigger = ical_parse_duration(value, &alarm->at);
+
+        g_free(type);
+        g_free(related);
+    } else if(g_ascii_strcasecmp(name, "ACTION") == 0) {
+        alarm->audible = g_ascii_strcasecmp(value, "AUDIO") == 0 || g_ascii_strcasecmp(value, "DISPLAY") == 0;
+    }
+}
+
+static void ical_parser_event_prop(IcalEvent* event, const gchar* name, const gchar* params, const gchar* value)
+{
+    if(g_ascii_strcasecmp(name, "UID") == 0) {
+        g_free(event->uid);
+        event->uid = g_strdup(value);
+    } else if(g_ascii_strcasecmp(name, "RECURRENCE-ID") == 0) {
+        g_free(event->recurrence_id);
+        event->recurrence_id = g_strdup(value);
+    } else if(g_ascii_strcasecmp(name, "SUMMARY") == 0) {
+        g_free(event->summary);
+        event->summary = g_utf8_make_valid(value, -1);
+        ical_unescape(event->summary);
+    } else if(g_ascii_strcasecmp(name, "STATUS") == 0) {
+        event->cancelled = g_ascii_strcasecmp(value, "CANCELLED") == 0;
+    } else if(g_ascii_strcasecmp(name, "DTSTART") == 0) {
+        event->has_start = ical_parse_time(value, params, &event->start);
+    } else if(g_ascii_strcasecmp(name, "DTEND") == 0) {
+        event->has_end = ical_parse_time(value, params, &event->end);
+    } else if(g_ascii_strcasecmp(name, "DURATION") == 0) {
+        ical_parse_duration(value, &event->duration);
+    }
+}
+
+static void ical_parser_line(IcalParser* parser, gchar* line)
+{
+    const gchar* name;
+    const gchar* params;
+    const gchar* value;
+
+    if(!ical_split(line, &name, &params, &value))
+        return;
+
+    if(g_ascii_strcasecmp(name, "BEGIN") == 0) {
+        if(!parser->in_event) {
+            if(g_ascii_strcasecmp(value, "VEVENT") == 0) {
+                ical_event_clear(&parser->event);
+                parser->in_event = TRUE;
+            }
+        } else if(!parser->in_alarm && !parser->skip_depth && g_ascii_strcasecmp(value, "VALARM") == 0) {
+            memset(&parser->alarm, 0, sizeof(IcalAlarm));
+            parser->alarm.audible = TRUE;
+            parser->in_alarm = TRUE;
+        } else {
+            parser->skip_depth++;
+        }
+        return;
+    }
+
+    if(g_ascii_strcasecmp(name, "END") == 0) {
+        if(parser->skip_depth) {
+            parser->skip_depth--;
+        } else if(parser->in_alarm) {
+            g_array_append_val(parser->event.alarms, parser->alarm);
+            parser->in_alarm = FALSE;
+        } else if(parser->in_event) {
+            parser->func(&parser->event, parser->data);
+            parser->in_event = FALSE;
+        } else if(g_ascii_strcasecmp(value, "VCALENDAR") == 0) {
+            parser->complete = TRUE;
+        }
+        return;
+    }
+
+    if(!parser->in_event || parser->skip_depth)
+        return;
+
+    if(parser->in_alarm)
+        ical_parser_alarm_prop(&parser->alarm, name, params, value);
+    else
+        ical_parser_event_prop(&parser->event, name, params, value);
+}
+
+/*
+ * Call func for every VEVENT in the stream. Only the event being read is kept
+ * in memory. complete is set if the calendar was read up to its end.
+ */
+static gboolean ical_parse(GInputStream* in, IcalEventFunc func, gpointer data, gboolean* complete, GCancellable* cancellable, GError** error)
+{
+    GDataInputStream* lines = g_data_input_stream_new(in);
+    GString* logical = g_string_new(NULL);
+    IcalParser parser = { func, data };
+    GError* err = NULL;
+    gchar* line;
+    gsize len;
+
+    parser.event.alarms = g_array_new(FALSE, FALSE, sizeof(IcalAlarm));
+    g_buffered_input_stream_set_buffer_size(G_BUFFERED_INPUT_STREAM(lines), 64 * 1024);
+
+    while((line = g_data_input_stream_read_line(lines, &len, cancellable, &err))) {
+        if(len && line[len - 1] == '\r')
+            line[--len] = '\0';
+
+        // Lines starting with whitespace continue the previous one
+        if(line[0] == ' ' || line[0] == '\t') {
+            g_string_append_len(logical, line + 1, len - 1);
+        } else {
+            if(logical->len)
+                ical_parser_line(&parser, logical->str);
+            g_string_assign(logical, line);
+        }
+
+        g_free(line);
+    }
+
+    if(!err && logical->len)
+        ical_parser_line(&parser, logical->str);
+
+    *complete = !err && parser.complete;
+
+    ical_event_clear(&parser.event);
+    g_array_free(parser.event.alarms, TRUE);
+    g_string_free(logical, TRUE);
+    g_object_unref(lines);
+
+    if(err) {
+        g_propagate_error(error, err);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * }} iCalendar parser
+ */
+
+/*
+ * Sync {{
+ */
+
+typedef struct {
+    gint64 at;
+    gchar* message;
+    guint32 id; // The alarm, or 0 if there is none
+    guint generation;
+} CalendarEntry;
+
+typedef struct {
+    CalendarEntry* entry; // Create or update the alarm of this entry
+    guint32 id;           // Otherwise, remove this alarm
+} CalendarOp;
+
+typedef struct {
+    GFile* file;
+    gint64 now;
+    guint generation;
+    GArray* ops; // CalendarOp
+    guint n_reminders;
+} CalendarSync;
+
+static GSettings* calendar_settings = NULL;
+static const AlarmServiceFuncs* calendar_funcs = NULL;
+static gpointer calendar_data = NULL;
+static GFile* calendar_file = NULL;
+static GFileMonitor* calendar_monitor = NULL;
+static GCancellable* calendar_cancellable = NULL;
+static guint calendar_sync_id = 0;
+static guint calendar_generation = 0;
+static gboolean calendar_syncing = FALSE; // A worker owns calendar_entries
+static gboolean calendar_dirty = FALSE;   // The file changed during a sync
+static gboolean calendar_reset = FALSE;   // The setting changed during a sync
+
+// UID, RECURRENCE-ID and VALARM index -> CalendarEntry, as of the last sync
+static GHashTable* calendar_entries = NULL;
+
+static void calendar_sync_settings_changed(GSettings* settings, gchar* key, gpointer user_data);
+
+static void calendar_entry_free(CalendarEntry* entry)
+{
+    g_free(entry->message);
+    g_free(entry);
+}
+
+static void calendar_sync_free(CalendarSync* sync)
+{
+    g_object_unref(sync->file);
+    g_array_free(sync->ops, TRUE);
+    g_free(sync);
+}
+
+/*
+ * Runs on the worker, compares the reminders of an event with the last sync
+ */
+static void calendar_sync_event(const IcalEvent* event, gpointer data)
+{
+    CalendarSync* sync = data;
+    const gchar* message;
+    gint64 end;
+
+    if(!event->uid || !event->has_start || event->cancelled)
+        return;
+
+    end = event->has_end ? event->end : event->start + event->duration;
+    message = event->summary && *event->summary ? event->summary : _("Calendar event");
+
+    for(guint i = 0; i < event->alarms->len; i++) {
+        const IcalAlarm* alarm = &g_array_index(event->alarms, IcalAlarm, i);
+        CalendarEntry* entry;
+        gchar* key;
+        gint64 at;
+
+        if(!alarm->has_trigger || !alarm->audible)
+            continue;
+
+        at = alarm->absolute ? alarm->at : (alarm->related_end ? end : event->start) + alarm->at;
+        sync->n_reminders++;
+
+        key = g_strdup_printf("%s\x1f%s\x1f%u", event->uid, event->recurrence_id ? event->recurrence_id : "", i);
+        entry = g_hash_table_lookup(calendar_entries, key);
+
+        if(entry) {
+            g_free(key);
+        } else {
+            entry = g_new0(CalendarEntry, 1);
+            entry->at = G_MININT64;
+            g_hash_table_insert(calendar_entries, key, entry);
+        }
+
+        entry->generation = sync->generation;
+
+        if(entry->at == at && g_strcmp0(entry->message, message) == 0)
+            continue;
+
+        entry->at = at;
+        g_free(entry->message);
+        entry->message = g_strdup(message);
+
+        if(at > sync->now) {
+            CalendarOp op = { entry, 0 };
+            g_array_append_val(sync->ops, op);
+        } else if(entry->id) {
+            // Moved into the past
+            CalendarOp op = { NULL, entry->id };
+            g_array_append_val(sync->ops, op);
+            entry->id = 0;
+        }
+    }
+}
+
+/*
+ * Runs on the worker, drops the reminders that weren't seen this time
+ */
+static void calendar_sync_sweep(CalendarSync* sync)
+{
+    GHashTableIter iter;
+    CalendarEntry* entry;
+
+    g_hash_table_iter_init(&iter, calendar_entries);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer*)&entry)) {
+        if(entry->generation == sync->generation)
+            continue;
+
+        if(entry->id) {
+            CalendarOp op = { NULL, entry->id };
+            g_array_append_val(sync->ops, op);
+        }
+
+        g_hash_table_iter_remove(&iter);
+    }
+}
+
+static void calendar_sync_thread(GTask* task, gpointer source, gpointer task_data, GCancellable* cancellable)
+{
+    CalendarSync* sync = task_data;
+    GError* error = NULL;
+    gboolean complete = FALSE;
+    GInputStream* in;
+
+    in = (GInputStream*)g_file_read(sync->file, cancellable, &error);
+    if(in) {
+        ical_parse(in, calendar_sync_event, sync, &complete, cancellable, &error);
+        g_object_unref(in);
+    }
+
+    // A missing or truncated file says nothing about the events that weren't seen
+    if(complete)
+        calendar_sync_sweep(sync);
+
+    if(error)
+        g_task_return_error(task, error);
+    else
+        g_task_return_boolean(task, TRUE);
+}
+
+/*
+ * id -> Alarm of the owner's current list
+ */
+static GHashTable* calendar_sync_index(void)
+{
+    GHashTable* index = g_hash_table_new(NULL, NULL);
+
+    for(GList* l = calendar_funcs->get_alarms(calendar_data); l; l = l->next)
+        g_hash_table_insert(index, GINT_TO_POINTER(ALARM(l->data)->id), l->data);
+
+    return index;
+}
+
+static void calendar_sync_alarm_set(Alarm* alarm, CalendarEntry* entry)
+{
+    alarm_begin_update(alarm);
+
+    g_object_set(alarm, "type", ALARM_TYPE_TIMER, "time", MAX(entry->at - (gint64)wallclock_now(), 1), "message", entry->message, "repeat", ALARM_REPEAT_NONE, NULL);
+    alarm_set_enabled(alarm, TRUE);
+
+    alarm_end_update(alarm);
+}
+
+static void calendar_sync_apply(CalendarSync* sync)
+{
+    guint created = 0, updated = 0, removed = 0;
+    GHashTable* index;
+
+    if(!sync->ops->len)
+        return;
+
+    index = calendar_sync_index();
+
+    for(guint i = 0; i < sync->ops->len; i++) {
+        CalendarOp* op = &g_array_index(sync->ops, CalendarOp, i);
+        const guint32 id = op->entry ? op->entry->id : op->id;
+        Alarm* alarm = id ? g_hash_table_lookup(index, GUINT_TO_POINTER(id)) : NULL;
+
+        if(!op->entry) {
+            // Already gone if it went off and was stopped
+            if(alarm) {
+                g_hash_table_remove(index, GUINT_TO_POINTER(id));
+                calendar_funcs->remove(alarm, calendar_data);
+                removed++;
+            }
+            continue;
+        }
+
+        if(alarm) {
+            updated++;
+        } else {
+            alarm = alarm_service_new_ephemeral();
+            op->entry->id = alarm->id;
+            g_hash_table_insert(index, GUINT_TO_POINTER(alarm->id), alarm);
+            created++;
+        }
+
+        calendar_sync_alarm_set(alarm, op->entry);
+    }
+
+    g_hash_table_destroy(index);
+
+    g_debug("CalendarSync: Created %u, updated %u and removed %u alarms", created, updated, removed);
+}
+
+/*
+ * Remove every alarm of the calendar
+ */
+static void calendar_sync_clear(void)
+{
+    GHashTableIter iter;
+    CalendarEntry* entry;
+    GHashTable* index;
+
+    if(g_hash_table_size(calendar_entries) == 0)
+        return;
+
+    index = calendar_sync_index();
+
+    g_hash_table_iter_init(&iter, calendar_entries);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer*)&entry)) {
+        Alarm* alarm = entry->id ? g_hash_table_lookup(index, GUINT_TO_POINTER(entry->id)) : NULL;
+
+        if(alarm)
+            calendar_funcs->remove(alarm, calendar_data);
+    }
+
+    g_hash_table_remove_all(calendar_entries);
+    g_hash_table_destroy(index);
+}
+
+static void calendar_sync_start(void);
+
+static void calendar_sync_done(GObject* source, GAsyncResult* res, gpointer data)
+{
+    CalendarSync* sync = g_task_get_task_data(G_TASK(res));
+    GError* error = NULL;
+
+    calendar_syncing = FALSE;
+
+    // Shut down in the meantime, the alarms went with the owner's list
+    if(!calendar_funcs) {
+        g_clear_pointer(&calendar_entries, g_hash_table_destroy);
+        return;
+    }
+
+    // Whatever the worker got through is in the entries already
+    calendar_sync_apply(sync);
+
+    if(g_task_propagate_boolean(G_TASK(res), &error)) {
+        g_debug("CalendarSync: %u reminders in %s", sync->n_reminders, g_file_peek_path(sync->file));
+    } else {
+        if(!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_warning("CalendarSync: Could not read %s: %s", g_file_peek_path(sync->file), error->message);
+        g_error_free(error);
+    }
+
+    if(calendar_reset) {
+        calendar_reset = FALSE;
+        calendar_dirty = FALSE;
+        calendar_sync_settings_changed(calendar_settings, NULL, NULL);
+    } else if(calendar_dirty) {
+        calendar_dirty = FALSE;
+        calendar_sync_start();
+    }
+}
+
+static void calendar_sync_start(void)
+{
+    CalendarSync* sync;
+    GTask* task;
+
+    if(calendar_syncing) {
+        calendar_dirty = TRUE;
+        return;
+    }
+
+    sync = g_new0(CalendarSync, 1);
+    sync->file = g_object_ref(calendar_file);
+    sync->now = wallclock_now();
+    sync->generation = ++calendar_generation;
+    sync->ops = g_array_new(FALSE, FALSE, sizeof(CalendarOp));
+
+    g_cancellable_reset(calendar_cancellable);
+    calendar_syncing = TRUE;
+
+    task = g_task_new(NULL, calendar_cancellable, calendar_sync_done, NULL);
+    g_task_set_priority(task, G_PRIORITY_LOW);
+    g_task_set_task_data(task, sync, (GDestroyNotify)calendar_sync_free);
+    g_task_run_in_thread(task, calendar_sync_thread);
+    g_object_unref(task);
+}
+
+static gboolean calendar_sync_timeout(gpointer data)
+{
+    calendar_sync_id = 0;
+    calendar_sync_start();
+
+    return G_SOURCE_REMOVE;
+}
+
+static void calendar_file_changed(GFileMonitor* monitor, GFile* file, GFile* other_file, GFileMonitorEvent event, gpointer user_data)
+{
+    switch(event) {
+    // Wait for the writer to be done
+    case G_FILE_MONITOR_EVENT_CHANGED:
+    case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+    case G_FILE_MONITOR_EVENT_PRE_UNMOUNT:
+    case G_FILE_MONITOR_EVENT_UNMOUNTED:
+        return;
+    default:
+        break;
+    }
+
+    if(calendar_sync_id)
+        g_source_remove(calendar_sync_id);
+
+    calendar_sync_id = source_stats_timeout_add("calendar-sync", CALENDAR_SYNC_DELAY, calendar_sync_timeout, NULL);
+}
+
+static void calendar_sync_stop(void)
+{
+    if(calendar_sync_id) {
+        g_source_remove(calendar_sync_id);
+        calendar_sync_id = 0;
+    }
+
+    if(calendar_monitor) {
+        g_file_monitor_cancel(calendar_monitor);
+        g_clear_object(&calendar_monitor);
+    }
+
+    g_clear_object(&calendar_file);
+}
+
+static void calendar_sync_settings_changed(GSettings* settings, gchar* key, gpointer user_data)
+{
+    GError* error = NULL;
+    gchar* path;
+
+    // Picked up again once the worker is done with the entries
+    if(calendar_syncing) {
+        calendar_reset = TRUE;
+        g_cancellable_cancel(calendar_cancellable);
+        return;
+    }
+
+    calendar_sync_stop();
+    calendar_sync_clear();
+
+    path = g_settings_get_string(settings, "calendar-file");
+
+    if(path[0] != '\0') {
+        g_debug("CalendarSync: Following %s", path);
+
+        calendar_file = g_file_new_for_path(path);
+
+        calendar_monitor = g_file_monitor_file(calendar_file, G_FILE_MONITOR_WATCH_MOVES, NULL, &error);
+        if(calendar_monitor) {
+            g_signal_connect(calendar_monitor, "changed", G_CALLBACK(calendar_file_changed), NULL);
+        } else {
+            g_warning("CalendarSync: Could not watch %s: %s", path, error->message);
+            g_error_free(error);
+        }
+
+        calendar_sync_start();
+    }
+
+    g_free(path);
+}
+
+void calendar_sync_init(GSettings* settings, const AlarmServiceFuncs* funcs, gpointer data)
+{
+    if(calendar_settings)
+        return;
+
+    calendar_settings = settings;
+    calendar_funcs = funcs;
+    calendar_data = data;
+
+    calendar_entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)calendar_entry_free);
+    calendar_cancellable = g_cancellable_new();
+
+    g_signal_connect(settings, "changed::calendar-file", G_CALLBACK(calendar_sync_settings_changed), NULL);
+
+    calendar_sync_settings_changed(settings, NULL, NULL);
+}
+
+void calendar_sync_shutdown(void)
+{
+    if(!calendar_settings)
+        return;
+
+    g_signal_handlers_disconnect_by_func(calendar_settings, calendar_sync_settings_changed, NULL);
+    calendar_sync_stop();
+
+    g_cancellable_cancel(calendar_cancellable);
+    g_clear_object(&calendar_cancellable);
+
+    // A running worker still uses the entries, they are freed once it is done
+    if(!calendar_syncing)
+        g_clear_pointer(&calendar_entries, g_hash_table_destroy);
+
+    calendar_settings = NULL;
+    calendar_funcs = NULL;
+    calendar_data = NULL;
+}
+
+/*
+ * }} Sync
+ */
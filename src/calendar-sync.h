@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * calendar-sync.h -- Alarms from the reminders of an iCalendar file
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef CALENDAR_SYNC_H_
+#define CALENDAR_SYNC_H_
+
+#include <gio/gio.h>
+
+#include "alarm-service.h"
+
+G_BEGIN_DECLS
+
+/**
+ * Follow the calendar-file setting: watch that file and keep an ephemeral
+ * alarm for every upcoming VALARM of its events.
+ *
+ * Alarms are created through alarm_service_new_ephemeral(), so the service
+ * must already be registered with the same funcs.
+ */
+void calendar_sync_init(GSettings* settings, const AlarmServiceFuncs* funcs, gpointer data);
+
+void calendar_sync_shutdown(void);
+
+G_END_DECLS
+
+#endif /*CALENDAR_SYNC_H_*/
@@ -0,0 +1,357 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * command-executor.c -- Bounded executor for alarm commands
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <gio/gio.h>
+
+#include "command-executor.h"
+#include "metrics.h"
+#include "source-stats.h"
+#include "trace.h"
+#include "wallclock.h"
+
+/*
+ * Commands are spawned through GSubprocess, which uses posix_spawn() where
+ * possible, and are always reaped. At most executor_max_running commands run
+ * at once. Anything beyond that waits in executor_queue until a slot frees
+ * up, so that many alarms going off in the same minute don't cause a fork
+ * storm.
+ *
+ * A slot is held until the command exits, or for COMMAND_EXECUTOR_SLOT_GRACE
+ * seconds at most. Commands often start long-lived programs, which would
+ * otherwise hold on to their slot until they are closed and eventually block
+ * all further commands.
+ *
+ * Runs may be submitted from any thread. Exit tracking and timeouts happen on
+ * the main context.
+ */
+
+typedef struct {
+    gchar* command;
+    gchar** argv;
+
+    CommandExecutorFunc func;
+    gpointer data;
+    GDestroyNotify destroy;
+
+    GSubprocess* proc;
+    guint timeout_id;
+    guint grace_id;
+    gboolean has_slot;
+    gint64 queued_time;
+    gint64 start_time;
+    gint64 deadline; // Wall clock time in µs at which the command was due, 0 if none
+    gint alarm_id;   // For tracing only
+
+    CommandResult result;
+} CommandRun;
+
+static GMutex executor_lock;
+static GQueue executor_queue = G_QUEUE_INIT; // Runs waiting for a free slot
+static guint executor_slots = 0;   // Runs holding a slot
+static guint executor_running = 0; // Launched runs that haven't exited yet
+static guint executor_max_running = COMMAND_EXECUTOR_DEFAULT_MAX_RUNNING;
+static guint executor_timeout = COMMAND_EXECUTOR_DEFAULT_TIMEOUT;
+static guint executor_runs = 0;
+static guint executor_failures = 0;
+static guint executor_timeouts = 0;
+
+static gboolean command_run_spawn(CommandRun* run);
+
+static void command_run_free(CommandRun* run)
+{
+    if(run->destroy)
+        run->destroy(run->data);
+
+    g_clear_error(&run->result.error);
+    g_clear_object(&run->proc);
+    g_strfreev(run->argv);
+    g_free(run->command);
+    g_free(run);
+}
+
+/**
+ * Start as many queued runs as there are free slots.
+ */
+static void command_executor_dequeue(void)
+{
+    CommandRun* run;
+
+    for(;;) {
+        g_mutex_lock(&executor_lock);
+
+        if(executor_slots >= executor_max_running || !(run = g_queue_pop_head(&executor_queue))) {
+            g_mutex_unlock(&executor_lock);
+            return;
+        }
+
+        executor_slots++;
+        g_mutex_unlock(&executor_lock);
+
+        command_run_spawn(run);
+    }
+}
+
+/**
+ * Give the slot of a run back, if it still has one, and start the next run.
+ */
+static void command_run_release(CommandRun* run)
+{
+    if(!run->has_slot)
+        return;
+
+    run->has_slot = FALSE;
+
+    g_mutex_lock(&executor_lock);
+    executor_slots--;
+    g_mutex_unlock(&executor_lock);
+
+    command_executor_dequeue();
+}
+
+/*
+ * Main thread {{
+ */
+
+static void command_run_finish(CommandRun* run)
+{
+    CommandResult* result = &run->result;
+    gchar* msg = command_result_to_error_message(run->command, result);
+
+    g_mutex_lock(&executor_lock);
+    if(run->proc)
+        executor_running--;
+    executor_runs++;
+    if(msg)
+        executor_failures++;
+    if(result->timed_out)
+        executor_timeouts++;
+    g_mutex_unlock(&executor_lock);
+
+    g_debug("CommandExecutor: `%s' done after %" G_GINT64_FORMAT " ms (queued %" G_GINT64_FORMAT " ms): %s", run->command, result->duration / 1000, result->queue_time / 1000, msg ? msg : "OK");
+    g_free(msg);
+
+    if(run->func)
+        run->func(run->command, result, run->data);
+
+    command_run_free(run);
+}
+
+static gboolean command_run_timeout(gpointer data)
+{
+    CommandRun* run = (CommandRun*)data;
+
+    g_debug("CommandExecutor: `%s' timed out, killing it", run->command);
+
+    run->result.timed_out = TRUE;
+    run->timeout_id = 0;
+
+    g_subprocess_force_exit(run->proc);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void command_run_wait_cb(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    CommandRun* run = (CommandRun*)user_data;
+    GSubprocess* proc = G_SUBPROCESS(source_object);
+
+    // This only fails when cancelled, which we never do
+    g_subprocess_wait_finish(proc, res, NULL);
+
+    run->result.duration = g_get_monotonic_time() - run->start_time;
+
+    if(g_subprocess_get_if_exited(proc)) {
+        run->result.exited = TRUE;
+        run->result.exit_status = g_subprocess_get_exit_status(proc);
+    } else if(g_subprocess_get_if_signaled(proc)) {
+        run->result.term_sig = g_subprocess_get_term_sig(proc);
+    }
+
+    trace_event(TRACE_COMMAND_EXIT, run->alarm_id, run->result.exited ? run->result.exit_status : -run->result.term_sig);
+
+    if(run->timeout_id) {
+        g_source_remove(run->timeout_id);
+        run->timeout_id = 0;
+    }
+
+    if(run->grace_id) {
+        g_source_remove(run->grace_id);
+        run->grace_id = 0;
+    }
+
+    command_run_release(run);
+    command_run_finish(run);
+}
+
+static gboolean command_run_grace(gpointer data)
+{
+    CommandRun* run = (CommandRun*)data;
+
+    g_debug("CommandExecutor: `%s' is still running, giving its slot back", run->command);
+
+    run->grace_id = 0;
+    command_run_release(run);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean command_run_watch(gpointer data)
+{
+    CommandRun* run = (CommandRun*)data;
+
+    if(!run->proc) {
+        // Could not launch
+        command_run_finish(run);
+        return G_SOURCE_REMOVE;
+    }
+
+    g_subprocess_wait_async(run->proc, NULL, command_run_wait_cb, run);
+
+    if(run->result.timeout > 0)
+        run->timeout_id = source_stats_timeout_add_seconds("command-timeout", run->result.timeout, command_run_timeout, run);
+
+    run->grace_id = source_stats_timeout_add_seconds("command-slot-grace", COMMAND_EXECUTOR_SLOT_GRACE, command_run_grace, run);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * }} Main thread
+ */
+
+/**
+ * Launch a run that has been given a slot. The slot is given back right away
+ * if the command could not be launched, and otherwise once it exits.
+ *
+ * May be called from any thread. Returns FALSE if the command could not be
+ * launched, in which case the caller has to dequeue the next run.
+ */
+static gboolean command_run_spawn(CommandRun* run)
+{
+    GError* err = NULL;
+
+    run->start_time = g_get_monotonic_time();
+    run->result.queue_time = run->start_time - run->queued_time;
+
+    g_mutex_lock(&executor_lock);
+    run->result.timeout = executor_timeout;
+    g_mutex_unlock(&executor_lock);
+
+    if(!run->argv && !g_shell_parse_argv(run->command, NULL, &run->argv, &err)) {
+        run->result.error = err;
+    } else if(!(run->proc = g_subprocess_newv((const gchar* const*)run->argv, G_SUBPROCESS_FLAGS_NONE, &err))) {
+        run->result.error = err;
+    }
+
+    g_mutex_lock(&executor_lock);
+    if(run->proc) {
+        run->has_slot = TRUE;
+        executor_running++;
+    } else {
+        executor_slots--;
+    }
+    g_mutex_unlock(&executor_lock);
+
+    trace_event(TRACE_COMMAND_SPAWN, run->alarm_id, run->proc ? 0 : -1);
+
+    if(run->proc && run->deadline)
+        metrics_observe(METRICS_COMMAND_START_LATENCY, wallclock_now_us() - run->deadline);
+
+    // Exit tracking happens on the main thread
+    source_stats_invoke(NULL, "command-watch", G_PRIORITY_DEFAULT, command_run_watch, run, NULL);
+
+    return run->proc != NULL;
+}
+
+void command_executor_run(gint alarm_id, const gchar* command, const gchar* const* argv, gint64 deadline, CommandExecutorFunc func, gpointer data, GDestroyNotify destroy)
+{
+    CommandRun* run = g_new0(CommandRun, 1);
+
+    run->command = g_strdup(command);
+    run->argv = g_strdupv((gchar**)argv);
+    run->deadline = deadline;
+    run->alarm_id = alarm_id;
+    run->func = func;
+    run->data = data;
+    run->destroy = destroy;
+    run->queued_time = g_get_monotonic_time();
+
+    g_mutex_lock(&executor_lock);
+
+    if(executor_slots >= executor_max_running) {
+        g_debug("CommandExecutor: %u commands holding a slot, %u running, queueing `%s'", executor_slots, executor_running, command);
+        g_queue_push_tail(&executor_queue, run);
+        g_mutex_unlock(&executor_lock);
+        return;
+    }
+
+    executor_slots++;
+    g_mutex_unlock(&executor_lock);
+
+    // The slot is free again, so runs queued up meanwhile may take it
+    if(!command_run_spawn(run))
+        command_executor_dequeue();
+}
+
+gchar* command_result_to_error_message(const gchar* command, const CommandResult* result)
+{
+    if(result->error)
+        return g_strdup_printf("Could not launch `%s': %s", command, result->error->message);
+
+    if(result->timed_out)
+        return g_strdup_printf("`%s' did not finish within %u seconds and was killed", command, result->timeout);
+
+    if(!result->exited)
+        return g_strdup_printf("`%s' was terminated by signal %d", command, result->term_sig);
+
+    if(result->exit_status != 0)
+        return g_strdup_printf("`%s' exited with status %d", command, result->exit_status);
+
+    return NULL;
+}
+
+void command_executor_get_stats(guint* runs, guint* failures, guint* timeouts)
+{
+    g_mutex_lock(&executor_lock);
+    if(runs)
+        *runs = executor_runs;
+    if(failures)
+        *failures = executor_failures;
+    if(timeouts)
+        *timeouts = executor_timeouts;
+    g_mutex_unlock(&executor_lock);
+}
+
+/*
+ * Settings {{
+ */
+
+static void command_executor_settings_changed(GSettings* settings, gchar* key, gpointer user_data)
+{
+    const guint max_running = g_settings_get_uint(settings, "command-max-running");
+    const guint timeout = g_settings_get_uint(settings, "command-timeout");
+
+    g_mutex_lock(&executor_lock);
+    executor_max_running = MAX(max_running, 1);
+    executor_timeout = timeout;
+    g_mutex_unlock(&executor_lock);
+
+    // The limit may have been raised
+    command_executor_dequeue();
+}
+
+void command_executor_init(GSettings* settings)
+{
+    g_signal_connect(settings, "changed::command-max-running", G_CALLBACK(command_executor_settings_changed), NULL);
+    g_signal_connect(settings, "changed::command-timeout", G_CALLBACK(command_executor_settings_changed), NULL);
+
+    command_executor_settings_changed(settings, NULL, NULL);
+}
+
+/*
+ * }} Settings
+ */
@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * command-executor.h -- Bounded executor for alarm commands
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef COMMAND_EXECUTOR_H_
+#define COMMAND_EXECUTOR_H_
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Failsafe defaults for the command-max-running and command-timeout keys.
+ * A timeout of 0 lets commands run for as long as they like.
+ */
+#define COMMAND_EXECUTOR_DEFAULT_MAX_RUNNING 8
+#define COMMAND_EXECUTOR_DEFAULT_TIMEOUT     0
+
+// Seconds after which a command that is still running gives its slot back
+#define COMMAND_EXECUTOR_SLOT_GRACE 10
+
+typedef struct {
+    GError* error;      // Set if the command could not be launched
+    gboolean exited;    // Whether the command exited normally
+    gint exit_status;   // Exit status, if exited
+    gint term_sig;      // Terminating signal, if not exited
+    gboolean timed_out; // Whether the command was killed after timeout seconds
+    guint timeout;
+    gint64 queue_time;  // Microseconds spent waiting for a free slot
+    gint64 duration;    // Microseconds from launch to exit
+} CommandResult;
+
+/*
+ * Called on the main thread once a command has finished.
+ */
+typedef void (*CommandExecutorFunc)(const gchar* command, const CommandResult* result, gpointer data);
+
+/**
+ * Read the limits from settings and follow any changes.
+ */
+void command_executor_init(GSettings* settings);
+
+/**
+ * Run a command, or queue it if too many commands are running already.
+ *
+ * alarm_id is the alarm the command belongs to, or -1, which is recorded in
+ * the trace. argv is the parsed command line, or NULL to have command parsed.
+ * deadline is the wall clock time in µs at which the command was due, which
+ * is used to record its start latency, or 0. May be called from any thread.
+ * func is called on the main thread with the result.
+ */
+void command_executor_run(gint alarm_id, const gchar* command, const gchar* const* argv, gint64 deadline, CommandExecutorFunc func, gpointer data, GDestroyNotify destroy);
+
+/**
+ * Describe a failed run. Returns NULL if the command succeeded.
+ *
+ * Free with g_free()
+ */
+gchar* command_result_to_error_message(const gchar* command, const CommandResult* result);
+
+/**
+ * Get the number of runs, failed runs and timed out runs since startup.
+ */
+void command_executor_get_stats(guint* runs, guint* failures, guint* timeouts);
+
+G_END_DECLS
+
+#endif /*COMMAND_EXECUTOR_H_*/
@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * daemon-main.c -- Headless alarm daemon entry point
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <locale.h>
+#include <glib/gi18n.h>
+
+#include <config.h>
+#include "alarm-daemon.h"
+#include "remote.h"
+#include "startup-profile.h"
+
+/*
+ * The same daemon as alarm-clock-applet --daemon, in a binary that is only
+ * linked against GIO and GStreamer, so that GTK and the indicator are never
+ * even loaded.
+ */
+int main(int argc, char* argv[])
+{
+    gint ret;
+
+    startup_profile_begin();
+
+    // Hotkeys for stop and snooze shouldn't wait for anything
+    if(remote_try_fast_path(argc, argv, &ret))
+        return ret;
+
+    // Internationalization
+    setlocale(LC_ALL, "");
+    bindtextdomain(GETTEXT_PACKAGE, ALARM_CLOCK_DATADIR "/locale");
+    bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
+    textdomain(GETTEXT_PACKAGE);
+
+    return alarm_daemon_run(argc, argv);
+}
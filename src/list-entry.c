@@ -8,7 +8,6 @@
 
 #include <string.h>
 #include <glib.h>
-#include <gtk/gtk.h>
 
 #include "list-entry.h"
 #include "util.h"
@@ -18,9 +17,43 @@ void alarm_list_entry_free(AlarmListEntry* e)
     g_free(e->data);
     g_free(e->name);
     g_free(e->icon);
+    g_free(e->content_type);
+    g_free(e->codec);
     g_free(e);
 }
 
+AlarmListEntry* alarm_list_entry_copy(const AlarmListEntry* e)
+{
+    AlarmListEntry* copy = g_new0(AlarmListEntry, 1);
+
+    copy->name = g_strdup(e->name);
+    copy->data = g_strdup(e->data);
+    copy->icon = g_strdup(e->icon);
+    copy->content_type = g_strdup(e->content_type);
+    copy->mtime = e->mtime;
+
+    alarm_list_entry_copy_media(copy, e);
+
+    return copy;
+}
+
+/*
+ * Compare the file details of two entries. The media details are ignored.
+ */
+gboolean alarm_list_entry_equal(const AlarmListEntry* a, const AlarmListEntry* b)
+{
+    return g_strcmp0(a->data, b->data) == 0 && g_strcmp0(a->name, b->name) == 0 && g_strcmp0(a->icon, b->icon) == 0 && g_strcmp0(a->content_type, b->content_type) == 0 && a->mtime == b->mtime;
+}
+
+void alarm_list_entry_copy_media(AlarmListEntry* dest, const AlarmListEntry* src)
+{
+    dest->playable = src->playable;
+    dest->duration = src->duration;
+
+    g_free(dest->codec);
+    dest->codec = g_strdup(src->codec);
+}
+
 AlarmListEntry* alarm_list_entry_new_file(const gchar* uri, gchar** mime_ret, GError** error)
 {
     AlarmListEntry* entry;
@@ -29,7 +62,7 @@ AlarmListEntry* alarm_list_entry_new_file(const gchar* uri, gchar** mime_ret, GE
     GFile* file;
 
     file = g_file_new_for_uri(uri);
-    info = g_file_query_info(file, "standard::content-type,standard::icon", G_FILE_QUERY_INFO_NONE, NULL, &new_error);
+    info = g_file_query_info(file, "standard::content-type,standard::icon,time::modified", G_FILE_QUERY_INFO_NONE, NULL, &new_error);
 
     if(new_error != NULL) {
         // g_warning ("Could not open uri: %s", uri);
@@ -40,10 +73,12 @@ AlarmListEntry* alarm_list_entry_new_file(const gchar* uri, gchar** mime_ret, GE
         return NULL;
     }
 
-    entry = g_new(AlarmListEntry, 1);
+    entry = g_new0(AlarmListEntry, 1);
     entry->data = g_strdup(uri);
     entry->name = g_file_get_basename(file);
     entry->icon = g_icon_to_string(g_file_info_get_icon(info));
+    entry->content_type = g_strdup(g_file_info_get_content_type(info));
+    entry->mtime = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
 
     if(mime_ret != NULL)
         *mime_ret = g_strdup(g_file_info_get_content_type(info));
@@ -66,6 +101,55 @@ static inline gboolean is_ignored(const gchar* const name, const gchar* const ig
     return FALSE;
 }
 
+/*
+ * Create an entry for a file inside the directory dir_uri.
+ *
+ * Returns NULL if the file is not a regular file of one of the supported
+ * types, or if it is ignored. info needs the standard::type,
+ * standard::content-type, standard::icon and standard::name attributes, and
+ * optionally time::modified.
+ */
+AlarmListEntry* alarm_list_entry_new_from_info(const gchar* dir_uri, GFileInfo* info, const gchar* supported_types[], const gchar* const ignore[])
+{
+    AlarmListEntry* entry;
+    const gchar* mime;
+    gboolean valid;
+    gint i;
+
+    if(g_file_info_get_file_type(info) != G_FILE_TYPE_REGULAR)
+        return NULL;
+
+    mime = g_file_info_get_content_type(info);
+    // g_debug (" [ regular file: MIME: %s ]", mime);
+
+    valid = TRUE;
+    if(supported_types != NULL) {
+        valid = FALSE;
+        for(i = 0; supported_types[i] != NULL; i++) {
+            if(mime && strstr(mime, supported_types[i]) != NULL && !is_ignored(g_file_info_get_name(info), ignore)) {
+                // MATCH
+                // g_debug (" [ MATCH ]");
+                valid = TRUE;
+                break;
+            }
+        }
+    }
+
+    if(!valid)
+        return NULL;
+
+    entry = g_new0(AlarmListEntry, 1);
+    entry->name = g_strdup(g_file_info_get_name(info));
+    entry->data = g_strdup_printf("%s/%s", dir_uri, entry->name);
+    entry->icon = g_icon_to_string(g_file_info_get_icon(info));
+    entry->content_type = g_strdup(mime);
+
+    if(g_file_info_has_attribute(info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+        entry->mtime = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+
+    return entry;
+}
+
 GList* alarm_list_entry_list_new(GList* flist, const gchar* dir_uri, const gchar* supported_types[], const gchar* const ignore[])
 {
     GError* error = NULL;
@@ -74,9 +158,6 @@ GList* alarm_list_entry_list_new(GList* flist, const gchar* dir_uri, const gchar
     GFileInfo* info;
 
     AlarmListEntry* entry;
-    const gchar* mime;
-    gboolean valid;
-    gint i;
 
     dir = g_file_new_for_uri(dir_uri);
     result = g_file_enumerate_children(dir,
@@ -94,32 +175,10 @@ GList* alarm_list_entry_list_new(GList* flist, const gchar* dir_uri, const gchar
 
     while((info = g_file_enumerator_next_file(result, NULL, NULL))) {
         // g_debug ("-- %s", g_file_info_get_name (info));
-        if(g_file_info_get_file_type(info) == G_FILE_TYPE_REGULAR) {
-            mime = g_file_info_get_content_type(info);
-            // g_debug (" [ regular file: MIME: %s ]", mime);
-
-            valid = TRUE;
-            if(supported_types != NULL) {
-                valid = FALSE;
-                for(i = 0; supported_types[i] != NULL; i++) {
-                    if(strstr(mime, supported_types[i]) != NULL && !is_ignored(g_file_info_get_name(info), ignore)) {
-                        // MATCH
-                        // g_debug (" [ MATCH ]");
-                        valid = TRUE;
-                        break;
-                    }
-                }
-            }
-
-            if(valid) {
-                entry = g_new(AlarmListEntry, 1);
-                entry->name = g_strdup(g_file_info_get_name(info));
-                entry->data = g_strdup_printf("%s/%s", dir_uri, entry->name);
-                entry->icon = g_icon_to_string(g_file_info_get_icon(info));
-
-                // g_debug ("Icon found: %s", entry->icon);
-                flist = g_list_append(flist, entry);
-            }
+        entry = alarm_list_entry_new_from_info(dir_uri, info, supported_types, ignore);
+        if(entry) {
+            // g_debug ("Icon found: %s", entry->icon);
+            flist = g_list_append(flist, entry);
         }
         g_object_unref(info);
     }
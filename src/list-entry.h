@@ -11,19 +11,41 @@
 
 #include <string.h>
 #include <glib.h>
+#include <gio/gio.h>
 
 #include "util.h"
 
 G_BEGIN_DECLS
 
+typedef enum {
+    ALARM_LIST_ENTRY_UNVERIFIED = 0,
+    ALARM_LIST_ENTRY_PLAYABLE,
+    ALARM_LIST_ENTRY_UNPLAYABLE,
+} AlarmListEntryPlayable;
+
 typedef struct {
     gchar* name;
     gchar* data;
     gchar* icon;
+    gchar* content_type;
+    guint64 mtime;
+
+    // Media details, filled in by the sound index
+    AlarmListEntryPlayable playable;
+    guint64 duration; // ns, 0 if unknown
+    gchar* codec;
 } AlarmListEntry;
 
 void alarm_list_entry_free(AlarmListEntry* e);
 
+AlarmListEntry* alarm_list_entry_copy(const AlarmListEntry* e);
+
+gboolean alarm_list_entry_equal(const AlarmListEntry* a, const AlarmListEntry* b);
+
+void alarm_list_entry_copy_media(AlarmListEntry* dest, const AlarmListEntry* src);
+
+AlarmListEntry* alarm_list_entry_new_from_info(const gchar* uri, GFileInfo* info, const gchar* supported_types[], const gchar* const ignore[]);
+
 AlarmListEntry* alarm_list_entry_new_file(const gchar* uri, gchar** mime_ret, GError** error);
 
 GList* alarm_list_entry_list_new(GList* flist, const gchar* dir_uri, const gchar* supported_types[], const gchar* const ignore[]);
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * main.c -- Alarm Clock applet entry point and command line
+ *
+ * Copyright (C) 2007-2008 Johannes H. Jensen <joh@pseudoberries.com>
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "alarm-applet.h"
+
+#include "alarm-daemon.h"
+#include "alarm-io.h"
+#include "alarm-service.h"
+#include "calendar-sync.h"
+#include "remote.h"
+#include "source-stats.h"
+#include "startup-profile.h"
+#include "trace.h"
+
+/**
+ * Cleanup
+ */
+static void alarm_applet_quit(AlarmApplet* applet)
+{
+    g_debug("AlarmApplet: Quitting...");
+
+    calendar_sync_shutdown();
+    alarm_service_unregister();
+}
+
+/**
+ * Replace this process with alarm-clock-daemon from the same directory, which
+ * doesn't have GTK and the rest loaded. Only returns if that didn't work.
+ */
+static void exec_daemon(char* argv[])
+{
+    gchar* self = g_file_read_link("/proc/self/exe", NULL);
+    gchar* dir;
+    gchar* path;
+
+    if(!self)
+        return;
+
+    dir = g_path_get_dirname(self);
+    path = g_build_filename(dir, "alarm-clock-daemon", NULL);
+
+    if(g_file_test(path, G_FILE_TEST_IS_EXECUTABLE)) {
+        char* argv0 = argv[0];
+
+        argv[0] = path;
+        execv(path, argv);
+
+        g_debug("Could not run %s: %s", path, g_strerror(errno));
+        argv[0] = argv0;
+    }
+
+    g_free(path);
+    g_free(dir);
+    g_free(self);
+}
+
+static gint handle_local_options(GApplication* application, GVariantDict* options, gpointer user_data)
+{
+    guint32 count;
+    gint status;
+    if(g_variant_dict_lookup(options, "version", "b", &count)) {
+        g_print(PACKAGE_NAME " " VERSION "\n");
+        return 0;
+    }
+
+    if(g_variant_dict_contains(options, "profile-startup"))
+        startup_profile_enable();
+
+    // Works on the settings, whether or not an instance is running
+    if(alarm_io_handle_options(options, &status))
+        return status;
+
+    return -1;
+}
+
+static gint handle_command_line(GApplication* application, GApplicationCommandLine* cmdline, gpointer user_data)
+{
+    AlarmApplet* applet = user_data;
+    gboolean stop_all = FALSE;
+    gboolean snooze_all = FALSE;
+    gboolean stats = FALSE;
+    gboolean dump_trace = FALSE;
+    gboolean timer = FALSE;
+    gint status = 0;
+
+    GVariantDict* options = g_application_command_line_get_options_dict(cmdline);
+
+    // This runs in the primary instance, and prints in the terminal of the one that was started
+    if(g_variant_dict_lookup(options, "stats", "b", &stats)) {
+        gchar* dump = source_stats_dump();
+        g_application_command_line_print(cmdline, "%s", dump);
+        g_free(dump);
+    }
+
+    if(g_variant_dict_lookup(options, "dump-trace", "b", &dump_trace)) {
+        GError* error = NULL;
+        gchar* path = trace_dump_to_file(&error);
+
+        if(path) {
+            g_application_command_line_print(cmdline, "%s\n", path);
+            g_free(path);
+        } else {
+            g_application_command_line_printerr(cmdline, "%s\n", error->message);
+            g_error_free(error);
+        }
+    }
+
+    if(g_variant_dict_lookup(options, "stop-all", "b", &stop_all))
+        g_action_activate(G_ACTION(applet->action_stop_all), NULL);
+
+    if(g_variant_dict_lookup(options, "snooze-all", "b", &snooze_all))
+        g_action_activate(G_ACTION(applet->action_snooze_all), NULL);
+
+    if(g_variant_dict_contains(options, "timer")) {
+        // Timers need the alarms loaded, but not the list window
+        if(!applet->settings_global) {
+            applet->hidden = TRUE;
+            g_application_activate(G_APPLICATION(application));
+        }
+
+        timer = alarm_service_command_line_timer(cmdline, &status);
+    }
+
+    if(!(stop_all || snooze_all || stats || dump_trace || timer))
+        g_application_activate(G_APPLICATION(application));
+
+    return status;
+}
+
+/**
+ * Alarm Clock main()
+ */
+int main(int argc, char* argv[])
+{
+    AlarmApplet* applet = NULL;
+    gint ret;
+
+    startup_profile_begin();
+
+    // Hotkeys for stop and snooze shouldn't wait for GTK to start up
+    if(remote_try_fast_path(argc, argv, &ret))
+        return ret;
+
+    // Internationalization
+    bindtextdomain(GETTEXT_PACKAGE, ALARM_CLOCK_DATADIR "/locale");
+    bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
+    textdomain(GETTEXT_PACKAGE);
+
+    // Headless mode, which must not even initialize GTK
+    if(alarm_daemon_requested(argc, argv)) {
+        exec_daemon(argv);
+        return alarm_daemon_run(argc, argv);
+    }
+
+    // Terminate on critical errors
+    // g_log_set_always_fatal (G_LOG_LEVEL_CRITICAL);
+
+    // Initialize GTK+
+    GtkApplication* application = gtk_application_new("io.github.alarm-clock-applet", G_APPLICATION_HANDLES_COMMAND_LINE);
+
+    // Initialize applet struct
+    applet = g_new0(AlarmApplet, 1);
+    applet->application = application;
+
+    g_signal_connect(application, "activate", G_CALLBACK(alarm_applet_activate), applet);
+
+    // Command line options
+    applet->hidden = FALSE; // Start hidden
+
+    GOptionEntry entries[] = {
+        { "hidden", 'h', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, &applet->hidden, _("Start hidden"), NULL },
+        { "stop-all", 's', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Stop all alarms"), NULL },
+        { "snooze-all", 'z', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Snooze all alarms"), NULL },
+        { "version", 'v', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Display version information"), NULL },
+        { "stats", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Print wakeups and CPU time per event source of the running instance"), NULL },
+        { "dump-trace", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Save the recent scheduling events of the running instance as a trace"), NULL },
+        { "profile-startup", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Print where startup time goes and save it as JSON"), NULL },
+        { "daemon", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Run the alarms without any user interface"), NULL },
+        { "timer", 't', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING, NULL, _("Start a timer that is not saved, followed by an optional message"), _("DURATION") },
+        { "export", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, NULL, _("Write all alarms to FILE, or - for standard output, one per line"), _("FILE") },
+        { "import", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, NULL, _("Create or update alarms from FILE, or - for standard input"), _("FILE") },
+        { "dry-run", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE, NULL, _("Only show what --import would change"), NULL },
+        { NULL }
+    };
+    g_application_add_main_option_entries(G_APPLICATION(application), entries);
+
+    g_signal_connect(application, "handle-local-options", G_CALLBACK(handle_local_options), NULL);
+    g_signal_connect(application, "command-line", G_CALLBACK(handle_command_line), applet);
+
+    // Run the main loop
+    ret = g_application_run(G_APPLICATION(application), argc, argv);
+
+    // Clean up
+    // FIXME: check for null?
+    alarm_applet_quit(applet);
+    g_object_unref(application);
+
+    return ret;
+}
@@ -0,0 +1,315 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * metrics.c -- Alarm latency histograms and counters
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <config.h>
+#include "metrics.h"
+#include "source-stats.h"
+
+/*
+ * Latencies are kept in HDR style histograms: every power of two is split
+ * into METRICS_SUB_COUNT linear buckets, which bounds the relative error of
+ * any quantile to 1 / METRICS_SUB_COUNT while covering microseconds to hours
+ * in a few hundred buckets.
+ *
+ * Triggers come from the scheduler thread and first audio from the audio
+ * thread, so everything is protected by metrics_lock. The exporter runs on
+ * the main thread.
+ */
+
+#define METRICS_SUB_BITS  3 // 8 buckets per power of two, at most 12.5% error
+#define METRICS_SUB_COUNT (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_BITS  36 // Up to ~19 hours
+#define METRICS_N_BUCKETS ((METRICS_MAX_BITS - METRICS_SUB_BITS + 1) * METRICS_SUB_COUNT)
+
+typedef struct {
+    guint64 counts[METRICS_N_BUCKETS];
+    guint64 count;
+    gint64 sum; // µs
+    gint64 max; // µs
+} MetricsHdr;
+
+typedef struct {
+    const gchar* name;
+    const gchar* help;
+} MetricsInfo;
+
+static const MetricsInfo counter_info[METRICS_N_COUNTERS] = {
+    [METRICS_TRIGGERS] = { "alarm_clock_triggers_total", "Number of alarms that have fired." },
+    [METRICS_SNOOZES] = { "alarm_clock_snoozes_total", "Number of times an alarm was snoozed." },
+    [METRICS_COMMAND_FAILURES] = { "alarm_clock_command_failures_total", "Number of alarm commands that could not be run or failed." },
+    [METRICS_PLAYER_ERRORS] = { "alarm_clock_player_errors_total", "Number of alarm sounds that could not be played." },
+    [METRICS_MAIN_LOOP_STALLS] = { "alarm_clock_main_loop_stalls_total", "Number of times the main loop was blocked for longer than the watchdog threshold." },
+};
+
+static const MetricsInfo histogram_info[METRICS_N_HISTOGRAMS] = {
+    [METRICS_TRIGGER_LATENCY] = { "alarm_clock_trigger_latency_seconds", "Delay between the time an alarm was due and the time it fired." },
+    [METRICS_FIRST_AUDIO_LATENCY] = { "alarm_clock_first_audio_latency_seconds", "Delay between the time an alarm was due and the time its sound started playing." },
+    [METRICS_COMMAND_START_LATENCY] = { "alarm_clock_command_start_latency_seconds", "Delay between the time an alarm was due and the time its command was launched." },
+    [METRICS_MAIN_LOOP_LATENCY] = { "alarm_clock_main_loop_latency_seconds", "Delay between a watchdog heartbeat and the time the main loop got to it." },
+};
+
+static const struct {
+    gdouble quantile;
+    const gchar* label; // Not printed with %g, which would follow the locale
+} export_quantiles[] = {
+    { 0.5, "0.5" },
+    { 0.9, "0.9" },
+    { 0.99, "0.99" },
+    { 0.999, "0.999" },
+};
+
+static GMutex metrics_lock;
+static guint64 metrics_counters[METRICS_N_COUNTERS];
+static MetricsHdr metrics_histograms[METRICS_N_HISTOGRAMS];
+
+static GSettings* metrics_settings = NULL;
+static GFile* metrics_file = NULL; // Main thread only
+static guint metrics_export_id = 0;
+static gboolean metrics_exporting = FALSE;
+static MetricsActiveAlarmsFunc metrics_active_alarms = NULL;
+static gpointer metrics_active_alarms_data = NULL;
+
+/*
+ * Histograms {{
+ */
+
+static guint metrics_hdr_index(guint64 value)
+{
+    guint msb, shift;
+
+    if(value < METRICS_SUB_COUNT)
+        return value;
+
+    value = MIN(value, (G_GUINT64_CONSTANT(1) << METRICS_MAX_BITS) - 1);
+
+    // g_bit_storage() takes a gulong, which may only be 32 bits wide
+    msb = (value >> 32) ? g_bit_storage((gulong)(value >> 32)) + 31 : g_bit_storage((gulong)value) - 1;
+    shift = msb - METRICS_SUB_BITS;
+
+    return (shift + 1) * METRICS_SUB_COUNT + (guint)((value >> shift) - METRICS_SUB_COUNT);
+}
+
+/*
+ * Highest value that falls into a bucket
+ */
+static guint64 metrics_hdr_upper(guint index)
+{
+    const guint bucket = index / METRICS_SUB_COUNT;
+    const guint sub = index % METRICS_SUB_COUNT;
+
+    if(bucket == 0)
+        return sub;
+
+    return ((guint64)(METRICS_SUB_COUNT + sub) << (bucket - 1)) + (G_GUINT64_CONSTANT(1) << (bucket - 1)) - 1;
+}
+
+/*
+ * Must be called with metrics_lock held
+ */
+static gint64 metrics_hdr_quantile(const MetricsHdr* hdr, gdouble quantile)
+{
+    guint64 rank, seen = 0;
+
+    if(hdr->count == 0)
+        return -1;
+
+    rank = MAX((guint64)(quantile * hdr->count + 0.5), 1);
+
+    for(guint i = 0; i < METRICS_N_BUCKETS; i++) {
+        seen += hdr->counts[i];
+        if(seen >= rank)
+            return MIN((gint64)metrics_hdr_upper(i), hdr->max);
+    }
+
+    return hdr->max;
+}
+
+void metrics_observe(MetricsHistogram histogram, gint64 value)
+{
+    MetricsHdr* hdr = &metrics_histograms[histogram];
+
+    value = MAX(value, 0);
+
+    g_mutex_lock(&metrics_lock);
+    hdr->counts[metrics_hdr_index(value)]++;
+    hdr->count++;
+    hdr->sum += value;
+    hdr->max = MAX(hdr->max, value);
+    g_mutex_unlock(&metrics_lock);
+}
+
+gint64 metrics_get_quantile(MetricsHistogram histogram, gdouble quantile)
+{
+    gint64 ret;
+
+    g_mutex_lock(&metrics_lock);
+    ret = metrics_hdr_quantile(&metrics_histograms[histogram], quantile);
+    g_mutex_unlock(&metrics_lock);
+
+    return ret;
+}
+
+guint64 metrics_get_count(MetricsHistogram histogram)
+{
+    guint64 ret;
+
+    g_mutex_lock(&metrics_lock);
+    ret = metrics_histograms[histogram].count;
+    g_mutex_unlock(&metrics_lock);
+
+    return ret;
+}
+
+/*
+ * }} Histograms
+ */
+
+void metrics_count(MetricsCounter counter)
+{
+    g_mutex_lock(&metrics_lock);
+    metrics_counters[counter]++;
+    g_mutex_unlock(&metrics_lock);
+}
+
+/*
+ * Exporter {{
+ */
+
+static void metrics_append_seconds(GString* out, gint64 usec)
+{
+    gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    // Always use a dot, regardless of the locale
+    g_string_append(out, g_ascii_formatd(buf, sizeof(buf), "%.6f", usec / (gdouble)G_USEC_PER_SEC));
+}
+
+static gchar* metrics_to_text(void)
+{
+    GString* out = g_string_new(NULL);
+    const guint active = metrics_active_alarms ? metrics_active_alarms(metrics_active_alarms_data) : 0;
+
+    g_mutex_lock(&metrics_lock);
+
+    for(guint i = 0; i < METRICS_N_COUNTERS; i++) {
+        g_string_append_printf(out, "# HELP %s %s\n", counter_info[i].name, counter_info[i].help);
+        g_string_append_printf(out, "# TYPE %s counter\n", counter_info[i].name);
+        g_string_append_printf(out, "%s %" G_GUINT64_FORMAT "\n", counter_info[i].name, metrics_counters[i]);
+    }
+
+    // HDR quantiles don't map onto fixed Prometheus buckets, so export them as summaries
+    for(guint i = 0; i < METRICS_N_HISTOGRAMS; i++) {
+        const MetricsHdr* hdr = &metrics_histograms[i];
+        const gchar* name = histogram_info[i].name;
+
+        g_string_append_printf(out, "# HELP %s %s\n", name, histogram_info[i].help);
+        g_string_append_printf(out, "# TYPE %s summary\n", name);
+
+        if(hdr->count > 0) {
+            for(guint q = 0; q < G_N_ELEMENTS(export_quantiles); q++) {
+                g_string_append_printf(out, "%s{quantile=\"%s\"} ", name, export_quantiles[q].label);
+                metrics_append_seconds(out, metrics_hdr_quantile(hdr, export_quantiles[q].quantile));
+                g_string_append_c(out, '\n');
+            }
+        }
+
+        g_string_append_printf(out, "%s_sum ", name);
+        metrics_append_seconds(out, hdr->sum);
+        g_string_append_printf(out, "\n%s_count %" G_GUINT64_FORMAT "\n", name, hdr->count);
+
+        g_string_append_printf(out, "# HELP %s_max Highest recorded value.\n", name);
+        g_string_append_printf(out, "# TYPE %s_max gauge\n", name);
+        g_string_append_printf(out, "%s_max ", name);
+        metrics_append_seconds(out, hdr->max);
+        g_string_append_c(out, '\n');
+    }
+
+    g_mutex_unlock(&metrics_lock);
+
+    g_string_append(out, "# HELP alarm_clock_active_alarms Number of alarms that are currently enabled.\n");
+    g_string_append(out, "# TYPE alarm_clock_active_alarms gauge\n");
+    g_string_append_printf(out, "alarm_clock_active_alarms %u\n", active);
+
+    return g_string_free(out, FALSE);
+}
+
+static void metrics_export_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    GError* error = NULL;
+
+    metrics_exporting = FALSE;
+
+    if(!g_file_replace_contents_finish(G_FILE(source_object), res, NULL, &error)) {
+        gchar* path = g_file_get_parse_name(G_FILE(source_object));
+        g_warning("Metrics: Could not write %s: %s", path, error->message);
+        g_free(path);
+        g_error_free(error);
+    }
+}
+
+static gboolean metrics_export(gpointer data)
+{
+    GBytes* bytes;
+    gchar* text;
+
+    // Don't pile up writes to a slow filesystem
+    if(!metrics_file || metrics_exporting)
+        return G_SOURCE_CONTINUE;
+
+    text = metrics_to_text();
+    bytes = g_bytes_new_take(text, strlen(text));
+
+    // Replacing goes through a temporary file, so the collector never sees a partial file
+    metrics_exporting = TRUE;
+    g_file_replace_contents_bytes_async(metrics_file, bytes, NULL, FALSE, G_FILE_CREATE_NONE, NULL, metrics_export_done, NULL);
+    g_bytes_unref(bytes);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void metrics_settings_changed(GSettings* settings, gchar* key, gpointer user_data)
+{
+    gchar* path = g_settings_get_string(settings, "metrics-file");
+
+    g_clear_object(&metrics_file);
+
+    if(metrics_export_id) {
+        g_source_remove(metrics_export_id);
+        metrics_export_id = 0;
+    }
+
+    if(path[0] != '\0') {
+        g_debug("Metrics: Exporting to %s every %d seconds", path, METRICS_EXPORT_INTERVAL);
+
+        metrics_file = g_file_new_for_path(path);
+        metrics_export(NULL);
+        metrics_export_id = source_stats_timeout_add_seconds("metrics-export", METRICS_EXPORT_INTERVAL, metrics_export, NULL);
+    }
+
+    g_free(path);
+}
+
+void metrics_init(GSettings* settings, MetricsActiveAlarmsFunc active_alarms, gpointer data)
+{
+    if(metrics_settings)
+        return;
+
+    metrics_settings = settings;
+    metrics_active_alarms = active_alarms;
+    metrics_active_alarms_data = data;
+
+    g_signal_connect(settings, "changed::metrics-file", G_CALLBACK(metrics_settings_changed), NULL);
+
+    metrics_settings_changed(settings, NULL, NULL);
+}
+
+/*
+ * }} Exporter
+ */
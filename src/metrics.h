@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * metrics.h -- Alarm latency histograms and counters
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    METRICS_TRIGGERS,
+    METRICS_SNOOZES,
+    METRICS_COMMAND_FAILURES,
+    METRICS_PLAYER_ERRORS,
+    METRICS_MAIN_LOOP_STALLS,
+    METRICS_N_COUNTERS,
+} MetricsCounter;
+
+typedef enum {
+    METRICS_TRIGGER_LATENCY,       // From the due time of an alarm until it fired
+    METRICS_FIRST_AUDIO_LATENCY,   // From the due time of an alarm until its sound started playing
+    METRICS_MAIN_LOOP_LATENCY,     // From a watchdog heartbeat until the main loop answered it
+    METRICS_COMMAND_START_LATENCY, // From the due time of an alarm until its command was launched
+    METRICS_N_HISTOGRAMS,
+} MetricsHistogram;
+
+/*
+ * How often the metrics file is written, in seconds.
+ */
+#define METRICS_EXPORT_INTERVAL 15
+
+/*
+ * Called on the main thread to get the number of active alarms.
+ */
+typedef guint (*MetricsActiveAlarmsFunc)(gpointer data);
+
+/**
+ * Read the metrics file location from settings and follow any changes.
+ *
+ * While the metrics-file key is set, the metrics are written to it in the
+ * Prometheus text format every METRICS_EXPORT_INTERVAL seconds.
+ */
+void metrics_init(GSettings* settings, MetricsActiveAlarmsFunc active_alarms, gpointer data);
+
+/**
+ * Increment a counter. May be called from any thread.
+ */
+void metrics_count(MetricsCounter counter);
+
+/**
+ * Record a latency in microseconds. May be called from any thread.
+ *
+ * Negative values are recorded as 0.
+ */
+void metrics_observe(MetricsHistogram histogram, gint64 value);
+
+/**
+ * Get a latency quantile in microseconds, or -1 if nothing was recorded.
+ */
+gint64 metrics_get_quantile(MetricsHistogram histogram, gdouble quantile);
+
+/**
+ * Get the number of latencies recorded.
+ */
+guint64 metrics_get_count(MetricsHistogram histogram);
+
+G_END_DECLS
+
+#endif /*METRICS_H_*/
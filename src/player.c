@@ -9,6 +9,342 @@
 #include <gst/gst.h>
 
 #include "player.h"
+#include "metrics.h"
+#include "source-stats.h"
+#include "wallclock.h"
+
+/*
+ * Audio thread {{
+ *
+ * Every pipeline is driven from a single audio thread which runs its own
+ * GMainContext. The main thread pushes commands onto audio_queue and wakes the
+ * audio context up. Bus messages, segment seeks for looping and EOS are
+ * handled entirely on the audio thread, and the resulting state changes and
+ * errors are sent back to the default main context.
+ *
+ * Each command and event holds a reference on the player, so that it may be
+ * freed by the main thread at any time.
+ */
+
+typedef enum {
+    AUDIO_COMMAND_START,
+    AUDIO_COMMAND_STOP,
+} AudioCommandType;
+
+typedef struct {
+    AudioCommandType type;
+    MediaPlayer* player;
+    guint generation;
+    gint64 deadline; // See media_player_set_deadline()
+} AudioCommand;
+
+typedef struct {
+    MediaPlayer* player;
+    guint generation;
+    MediaPlayerState state;
+    GError* error;
+} AudioEvent;
+
+static GMainContext* audio_context = NULL;
+static GAsyncQueue* audio_queue = NULL;
+static gchar* audio_sink = NULL; // Element factory to use instead of the default audio sink
+
+static MediaPlayer* media_player_ref(MediaPlayer* player)
+{
+    g_atomic_int_inc(&player->ref_count);
+
+    return player;
+}
+
+static void media_player_unref(MediaPlayer* player)
+{
+    if(!g_atomic_int_dec_and_test(&player->ref_count))
+        return;
+
+    g_assert(player->watch == NULL);
+
+    if(player->pending_error)
+        g_error_free(player->pending_error);
+
+    if(player->player)
+        gst_object_unref(GST_OBJECT(player->player));
+
+    g_free(player);
+}
+
+static gpointer audio_thread_func(gpointer data)
+{
+    GMainLoop* loop = g_main_loop_new(audio_context, FALSE);
+
+    g_main_context_push_thread_default(audio_context);
+    g_main_loop_run(loop);
+
+    // Not reached, the audio thread lives as long as the process
+    g_main_context_pop_thread_default(audio_context);
+    g_main_loop_unref(loop);
+
+    return NULL;
+}
+
+static void audio_thread_init(void)
+{
+    static gsize initialized = 0;
+
+    if(g_once_init_enter(&initialized)) {
+        // Initialize GStreamer
+        gst_init(NULL, NULL);
+
+        audio_context = g_main_context_new();
+        audio_queue = g_async_queue_new();
+
+        g_thread_unref(g_thread_new("audio", audio_thread_func, NULL));
+
+        g_once_init_leave(&initialized, 1);
+    }
+}
+
+/**
+ * Deliver an event on the main thread.
+ *
+ * Events from a previous run or for a freed player are dropped.
+ */
+static gboolean audio_event_dispatch(gpointer data)
+{
+    AudioEvent* event = (AudioEvent*)data;
+    MediaPlayer* player = event->player;
+
+    if(player->disposed || event->generation != player->generation)
+        return G_SOURCE_REMOVE;
+
+    if(event->error && player->error_handler) {
+        player->error_handler(player, event->error, player->error_handler_data);
+    } else if(event->error) {
+        // Nobody is listening yet, keep it for media_player_set_callbacks()
+        if(player->pending_error)
+            g_error_free(player->pending_error);
+        player->pending_error = g_error_copy(event->error);
+    }
+
+    // The error handler may have freed the player
+    if(!player->disposed)
+        media_player_set_state(player, event->state);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void audio_event_free(gpointer data)
+{
+    AudioEvent* event = (AudioEvent*)data;
+
+    if(event->error)
+        g_error_free(event->error);
+
+    media_player_unref(event->player);
+    g_free(event);
+}
+
+/**
+ * Send an event from the audio thread to the main thread.
+ */
+static void audio_event_send(MediaPlayer* player, MediaPlayerState state, const GError* error)
+{
+    AudioEvent* event = g_new0(AudioEvent, 1);
+
+    event->player = media_player_ref(player);
+    event->generation = player->bus_generation;
+    event->state = state;
+    event->error = error ? g_error_copy(error) : NULL;
+
+    source_stats_invoke(NULL, "player-event", G_PRIORITY_DEFAULT, audio_event_dispatch, event, audio_event_free);
+}
+
+/**
+ * Remove the bus watch and shut the pipeline down.
+ *
+ * Called from the audio thread.
+ */
+static void audio_player_stop(MediaPlayer* player)
+{
+    if(player->watch) {
+        g_source_destroy(player->watch);
+        g_source_unref(player->watch);
+
+        player->watch = NULL;
+    }
+
+    gst_element_set_state(player->player, GST_STATE_NULL);
+}
+
+/**
+ * Handle a message from the GST bus.
+ *
+ * Called from the audio thread.
+ */
+static gboolean media_player_bus_handle(GstBus* bus, GstMessage* message, gpointer data)
+{
+    MediaPlayer* player = (MediaPlayer*)data;
+    GstState state;
+    //	g_debug ("Got %s message\n", GST_MESSAGE_TYPE_NAME (message));
+
+    switch(GST_MESSAGE_TYPE(message)) {
+    case GST_MESSAGE_ERROR:
+    {
+        GError* err;
+        gchar* debug;
+
+        gst_message_parse_error(message, &err, &debug);
+
+        audio_event_send(player, MEDIA_PLAYER_STOPPED, err);
+        audio_player_stop(player);
+
+        g_error_free(err);
+        g_free(debug);
+
+        return G_SOURCE_REMOVE;
+    }
+    case GST_MESSAGE_STATE_CHANGED:
+        // The sound is audible once the whole pipeline is playing
+        if(player->bus_deadline && GST_MESSAGE_SRC(message) == GST_OBJECT(player->player)) {
+            gst_message_parse_state_changed(message, NULL, &state, NULL);
+            if(state == GST_STATE_PLAYING) {
+                metrics_observe(METRICS_FIRST_AUDIO_LATENCY, wallclock_now_us() - player->bus_deadline);
+                player->bus_deadline = 0;
+            }
+        }
+        break;
+    case GST_MESSAGE_ASYNC_DONE:
+        g_debug("GST_MESSAGE_ASYNC_DONE");
+        gst_element_get_state(player->player, &state, NULL, GST_CLOCK_TIME_NONE);
+        if(state == GST_STATE_PAUSED) {
+            gst_element_seek(player->player, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_SEGMENT, GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+            gst_element_set_state(player->player, GST_STATE_PLAYING);
+        }
+        break;
+    case GST_MESSAGE_SEGMENT_DONE:
+        g_debug("GST_MESSAGE_SEGMENT_DONE");
+        // End of segment. Do we loop?
+        if(g_atomic_int_get(&player->loop)) {
+            // Perform a segment seek to the beginning of the stream
+            gst_element_seek(player->player, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_SEGMENT, GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+        } else {
+            // Perform a normal seek so we reach EOS
+            gst_element_seek(player->player, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_NONE, GST_SEEK_TYPE_NONE, 0, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+        }
+
+        break;
+    case GST_MESSAGE_EOS:
+        g_debug("GST_MESSAGE_EOS");
+        // Looping was turned on for a player that skipped the segment seek
+        if(g_atomic_int_get(&player->loop)) {
+            gst_element_seek(player->player, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_SEGMENT, GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+            break;
+        }
+
+        audio_event_send(player, MEDIA_PLAYER_STOPPED, NULL);
+        audio_player_stop(player);
+
+        return G_SOURCE_REMOVE;
+    default:
+        break;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * GST bus callback.
+ *
+ * Bus watches call a GstBusFunc, so source_stats_set_callback() can't wrap it.
+ */
+static gboolean media_player_bus_cb(GstBus* bus, GstMessage* message, gpointer data)
+{
+    const gint64 begin = source_stats_begin();
+    gboolean ret = media_player_bus_handle(bus, message, data);
+
+    source_stats_end("player-bus-watch", begin);
+
+    return ret;
+}
+
+/**
+ * Run a single command on the audio thread.
+ */
+static void audio_command_run(AudioCommand* cmd)
+{
+    MediaPlayer* player = cmd->player;
+    GstBus* bus;
+
+    switch(cmd->type) {
+    case AUDIO_COMMAND_START:
+        // Restart from scratch if we're already running
+        audio_player_stop(player);
+
+        player->bus_generation = cmd->generation;
+        player->bus_deadline = cmd->deadline;
+
+        // Attach bus watcher to the audio context
+        bus = gst_pipeline_get_bus(GST_PIPELINE(player->player));
+        player->watch = gst_bus_create_watch(bus);
+        g_source_set_name(player->watch, "player-bus-watch");
+        g_source_set_callback(player->watch, (GSourceFunc)media_player_bus_cb, media_player_ref(player), (GDestroyNotify)media_player_unref);
+        g_source_attach(player->watch, audio_context);
+        gst_object_unref(bus);
+
+        // Without the segment seek, the sound simply ends with EOS
+        if(player->skip_seek && !g_atomic_int_get(&player->loop))
+            gst_element_set_state(player->player, GST_STATE_PLAYING);
+        else
+            gst_element_set_state(player->player, GST_STATE_PAUSED);
+        break;
+    case AUDIO_COMMAND_STOP:
+        audio_player_stop(player);
+        break;
+    }
+}
+
+/**
+ * Drain the command queue.
+ *
+ * Called from the audio thread.
+ */
+static gboolean audio_queue_dispatch(gpointer data)
+{
+    AudioCommand* cmd;
+
+    while((cmd = g_async_queue_try_pop(audio_queue)) != NULL) {
+        audio_command_run(cmd);
+
+        media_player_unref(cmd->player);
+        g_free(cmd);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Queue a command for the audio thread.
+ */
+static void audio_command_push(MediaPlayer* player, AudioCommandType type)
+{
+    AudioCommand* cmd = g_new0(AudioCommand, 1);
+
+    cmd->type = type;
+    cmd->player = media_player_ref(player);
+    cmd->generation = player->generation;
+    cmd->deadline = player->deadline;
+
+    g_async_queue_push(audio_queue, cmd);
+
+    source_stats_invoke(audio_context, "player-command", G_PRIORITY_HIGH, audio_queue_dispatch, NULL, NULL);
+}
+
+/*
+ * }} Audio thread
+ */
+
+/*
+ * Media player {{
+ */
 
 /**
  * Create a new media player.
@@ -26,21 +362,21 @@ MediaPlayer* media_player_new(const gchar* uri, gboolean loop, MediaPlayerStateC
 {
     MediaPlayer* player;
 
+    // Initialize GStreamer and the audio thread
+    audio_thread_init();
+
     // Initialize struct
-    player = g_new(MediaPlayer, 1);
+    player = g_new0(MediaPlayer, 1);
 
+    player->ref_count = 1;
     player->loop = loop;
     player->state = MEDIA_PLAYER_STOPPED;
-    player->watch_id = 0;
 
     player->state_changed = state_callback;
     player->state_changed_data = data;
     player->error_handler = error_handler;
     player->error_handler_data = error_data;
 
-    // Initialize GStreamer
-    gst_init(NULL, NULL);
-
     /* Set up player */
     player->player = gst_element_factory_make("playbin", "player");
 
@@ -50,23 +386,112 @@ MediaPlayer* media_player_new(const gchar* uri, gboolean loop, MediaPlayerStateC
         return NULL;
     }
 
+    if(audio_sink) {
+        GstElement* sink = gst_element_factory_make(audio_sink, NULL);
+
+        if(sink)
+            g_object_set(player->player, "audio-sink", sink, NULL);
+        else
+            g_warning("Player: Could not create audio sink %s", audio_sink);
+    }
+
     // Set uri
     g_object_set(player->player, "uri", uri, NULL);
 
     return player;
 }
 
+void media_player_set_audio_sink(const gchar* factory)
+{
+    g_free(audio_sink);
+    audio_sink = g_strdup(factory);
+}
+
+/**
+ * Set the callbacks of a player that was created without any.
+ */
+void media_player_set_callbacks(MediaPlayer* player, MediaPlayerStateChangeCallback state_callback, gpointer data, MediaPlayerErrorHandler error_handler, gpointer error_data)
+{
+    g_assert(player);
+
+    player->state_changed = state_callback;
+    player->state_changed_data = data;
+    player->error_handler = error_handler;
+    player->error_handler_data = error_data;
+
+    if(player->pending_error) {
+        GError* err = player->pending_error;
+        gboolean disposed;
+
+        player->pending_error = NULL;
+
+        // The error handler may free the player
+        media_player_ref(player);
+
+        if(player->error_handler)
+            player->error_handler(player, err, player->error_handler_data);
+
+        disposed = player->disposed;
+        media_player_unref(player);
+        g_error_free(err);
+
+        if(disposed)
+            return;
+    }
+
+    if(player->state_changed)
+        player->state_changed(player, player->state, player->state_changed_data);
+}
+
+/**
+ * Turn looping on or off.
+ *
+ * The audio thread reads it at the end of every segment.
+ */
+void media_player_set_loop(MediaPlayer* player, gboolean loop)
+{
+    g_assert(player);
+
+    g_atomic_int_set(&player->loop, loop);
+}
+
+/**
+ * Skip the initial segment seek of non-looping sounds.
+ */
+void media_player_set_skip_seek(MediaPlayer* player, gboolean skip)
+{
+    g_assert(player);
+
+    player->skip_seek = skip;
+}
+
+/**
+ * Set the due time of the next start.
+ */
+void media_player_set_deadline(MediaPlayer* player, gint64 deadline)
+{
+    g_assert(player);
+
+    player->deadline = deadline;
+}
+
 /**
  * Free a media player.
+ *
+ * The pipeline is shut down on the audio thread and released once all pending
+ * commands and events are done with it. No callbacks are invoked afterwards.
  */
 void media_player_free(MediaPlayer* player)
 {
     g_assert(player);
 
-    if(player->player)
-        gst_object_unref(GST_OBJECT(player->player));
+    player->disposed = TRUE;
+    player->state_changed = NULL;
+    player->error_handler = NULL;
 
-    g_free(player);
+    audio_command_push(player, AUDIO_COMMAND_STOP);
+
+    media_player_unref(player);
 }
 
 /**
@@ -112,100 +537,18 @@ void media_player_set_state(MediaPlayer* player, MediaPlayerState state)
 }
 
 
-/**
- * Check for errors & call error handler
- */
-static gboolean media_player_bus_check_errors(MediaPlayer* player, GstMessage* message)
-{
-    //	g_debug ("Got %s message\n", GST_MESSAGE_TYPE_NAME (message));
-
-    switch(GST_MESSAGE_TYPE(message)) {
-    case GST_MESSAGE_ERROR:
-    {
-        GError* err;
-        gchar* debug;
-
-        gst_message_parse_error(message, &err, &debug);
-
-        if(player->error_handler)
-            player->error_handler(player, err, player->error_handler_data);
-
-        g_error_free(err);
-        g_free(debug);
-
-        return FALSE;
-        break;
-    }
-    default:
-        break;
-    }
-
-    // No errors
-    return TRUE;
-}
-
-/**
- * GST bus callback.
- */
-static gboolean media_player_bus_cb(GstBus* bus, GstMessage* message, MediaPlayer* player)
-{
-    GstState state;
-    //	g_debug ("Got %s message\n", GST_MESSAGE_TYPE_NAME (message));
-
-    if(!media_player_bus_check_errors(player, message)) {
-        // There were errors
-        media_player_stop(player);
-
-        return FALSE;
-    }
-
-    switch(GST_MESSAGE_TYPE(message)) {
-    case GST_MESSAGE_ASYNC_DONE:
-        g_debug("GST_MESSAGE_ASYNC_DONE");
-        gst_element_get_state(player->player, &state, NULL, GST_CLOCK_TIME_NONE);
-        if(state == GST_STATE_PAUSED) {
-            gst_element_seek(player->player, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_SEGMENT, GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
-            gst_element_set_state(player->player, GST_STATE_PLAYING);
-        }
-        break;
-    case GST_MESSAGE_SEGMENT_DONE:
-        g_debug("GST_MESSAGE_SEGMENT_DONE");
-        // End of segment. Do we loop?
-        if(player->loop) {
-            // Perform a segment seek to the beginning of the stream
-            gst_element_seek(player->player, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_SEGMENT, GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
-        } else {
-            // Perform a normal seek so we reach EOS
-            gst_element_seek(player->player, 1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_NONE, GST_SEEK_TYPE_NONE, 0, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
-        }
-
-        break;
-    case GST_MESSAGE_EOS:
-        g_debug("GST_MESSAGE_EOS");
-        media_player_stop(player);
-        break;
-    default:
-        break;
-    }
-
-    return TRUE;
-}
-
 /**
  * Start media player
  */
 void media_player_start(MediaPlayer* player)
 {
-    GstBus* bus;
-
     g_assert(player);
 
-    // Attach bus watcher
-    bus = gst_pipeline_get_bus(GST_PIPELINE(player->player));
-    player->watch_id = gst_bus_add_watch(bus, (GstBusFunc)media_player_bus_cb, player);
-    gst_object_unref(bus);
+    // Invalidate any events still in flight from a previous run
+    player->generation++;
 
-    gst_element_set_state(player->player, GST_STATE_PAUSED);
+    audio_command_push(player, AUDIO_COMMAND_START);
+    player->deadline = 0;
     media_player_set_state(player, MEDIA_PLAYER_PLAYING);
 }
 
@@ -216,16 +559,11 @@ void media_player_stop(MediaPlayer* player)
 {
     g_assert(player);
 
-    if(player->watch_id) {
-        g_source_remove(player->watch_id);
-
-        player->watch_id = 0;
-    }
+    player->generation++;
 
-    if(player->player != NULL) {
-        gst_element_set_state(player->player, GST_STATE_NULL);
-    }
+    audio_command_push(player, AUDIO_COMMAND_STOP);
 
+    // The state change handler may free the player
     media_player_set_state(player, MEDIA_PLAYER_STOPPED);
 }
 
@@ -34,18 +34,38 @@ typedef void (*MediaPlayerStateChangeCallback)(MediaPlayer* player, MediaPlayerS
  */
 typedef void (*MediaPlayerErrorHandler)(MediaPlayer* player, GError* error, gpointer data);
 
+/*
+ * The GStreamer pipeline is controlled from a dedicated audio thread with its
+ * own GMainContext, so that looping and stopping never wait for the UI.
+ *
+ * All of the functions below must be called from the main thread. State
+ * changes and errors are always delivered on the main thread as well.
+ *
+ * The only exception is a player created without callbacks, which may be
+ * created and started from any thread and then handed over to the main thread
+ * with media_player_set_callbacks().
+ */
 struct _MediaPlayer {
     GstElement* player;
-    gboolean loop;
+    gboolean loop; // Read atomically by the audio thread
     MediaPlayerState state;
 
-    guint watch_id;
-
     MediaPlayerStateChangeCallback state_changed;
     MediaPlayerErrorHandler error_handler;
 
     gpointer state_changed_data;
     gpointer error_handler_data;
+
+    /* Private */
+    gint ref_count;
+    gboolean disposed;    // Set by media_player_free(), drops pending events
+    guint generation;     // Incremented by every media_player_start()
+    guint bus_generation; // Generation the audio thread is playing (audio thread only)
+    GSource* watch;       // Bus watch attached to the audio thread (audio thread only)
+    GError* pending_error; // Error that occurred before an error handler was set
+    gboolean skip_seek;    // No initial segment seek if not looping
+    gint64 deadline;       // Due time of the next start, for the metrics
+    gint64 bus_deadline;   // Due time of the current run, until it plays (audio thread only)
 };
 
 /**
@@ -63,6 +83,46 @@ struct _MediaPlayer {
 
 MediaPlayer* media_player_new(const gchar* uri, gboolean loop, MediaPlayerStateChangeCallback state_callback, gpointer data, MediaPlayerErrorHandler error_handler, gpointer error_data);
 
+/**
+ * Use an element from factory, such as fakesink, as the audio sink of every
+ * player created from now on. NULL goes back to the default sink.
+ *
+ * Must be called before any alarm can fire.
+ */
+void media_player_set_audio_sink(const gchar* factory);
+
+/**
+ * Set the callbacks of a player that was created without any.
+ *
+ * Any error that occurred in the meantime is delivered to error_handler, after
+ * which state_callback is notified of the current state.
+ */
+void media_player_set_callbacks(MediaPlayer* player, MediaPlayerStateChangeCallback state_callback, gpointer data, MediaPlayerErrorHandler error_handler, gpointer error_data);
+
+/**
+ * Turn looping on or off, including for a sound that is already playing.
+ */
+void media_player_set_loop(MediaPlayer* player, gboolean loop);
+
+/**
+ * Skip the initial segment seek of non-looping sounds.
+ *
+ * Players normally pre-roll in PAUSED, then do a flushing segment seek, which
+ * makes seamless looping possible but pre-rolls the pipeline a second time,
+ * and only then go to PLAYING. Sounds that are already known to play fine and
+ * don't loop are set to PLAYING right away instead. GStreamer still pre-rolls
+ * them once on the way. Takes effect on the next media_player_start().
+ */
+void media_player_set_skip_seek(MediaPlayer* player, gboolean skip);
+
+/**
+ * Set the real time in µs at which the next start of the player was due.
+ *
+ * The delay until the sound is actually playing is recorded in the metrics.
+ * Applies to the next media_player_start() only.
+ */
+void media_player_set_deadline(MediaPlayer* player, gint64 deadline);
+
 /**
  * Free a media player.
  */
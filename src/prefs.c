@@ -22,17 +22,27 @@ void autostart_monitor_changed(GFileMonitor* monitor, GFile* file, GFile* other_
 void prefs_show_label_init(AlarmApplet* applet);
 
 /**
- * Initialize preferences dialog and friends
+ * Initialize preferences
  */
 void prefs_init(AlarmApplet* applet)
 {
-    applet->prefs_dialog = GTK_DIALOG(gtk_builder_get_object(applet->ui, "preferences"));
+    prefs_autostart_init(applet);
+    prefs_show_label_init(applet);
+}
+
+/**
+ * Initialize preferences dialog
+ */
+void prefs_dialog_init(AlarmApplet* applet)
+{
+    GtkBuilder* builder = alarm_applet_ui_load("preferences.ui", applet);
+
+    applet->prefs_dialog = GTK_DIALOG(gtk_builder_get_object(builder, "preferences"));
     // ...Why?
     gtk_widget_insert_action_group(GTK_WIDGET(applet->prefs_dialog), "app", G_ACTION_GROUP(applet->application));
-    applet->prefs_autostart_check = GTK_WIDGET(gtk_builder_get_object(applet->ui, "autostart-check"));
+    applet->prefs_autostart_check = GTK_WIDGET(gtk_builder_get_object(builder, "autostart-check"));
 
-    prefs_autostart_init(applet);
-    prefs_show_label_init(applet);
+    g_object_unref(builder);
 }
 
 // Ordered list of autostart files we watch for
@@ -428,10 +438,12 @@ void prefs_show_label_update(AlarmApplet* applet)
  */
 void prefs_dialog_show(AlarmApplet* applet)
 {
-    if(gtk_widget_get_visible(GTK_WIDGET(applet->prefs_dialog))) {
-        gtk_window_present_with_time(GTK_WINDOW(applet->prefs_dialog), gtk_get_current_event_time());
+    GtkDialog* dialog = alarm_applet_prefs_dialog_get(applet);
+
+    if(gtk_widget_get_visible(GTK_WIDGET(dialog))) {
+        gtk_window_present_with_time(GTK_WINDOW(dialog), gtk_get_current_event_time());
     } else {
-        gtk_widget_show(GTK_WIDGET(applet->prefs_dialog));
+        gtk_widget_show(GTK_WIDGET(dialog));
     }
 }
 
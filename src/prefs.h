@@ -13,6 +13,8 @@
 
 void prefs_init(AlarmApplet* applet);
 
+void prefs_dialog_init(AlarmApplet* applet);
+
 void prefs_dialog_show(AlarmApplet* applet);
 
 gboolean prefs_autostart_get_state(void);
@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * remote.c -- Remote control of the running instance over D-Bus
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <string.h>
+#include <gio/gio.h>
+
+#include "remote.h"
+
+/*
+ * Stop and snooze are usually bound to hotkeys, where every millisecond until
+ * the sound goes quiet counts. Going through GtkApplication would initialize
+ * GTK and register a whole application just to forward the command line, so
+ * the actions that the running instance exports are activated directly
+ * through org.gtk.Actions instead.
+ */
+
+typedef enum {
+    REMOTE_STOP_ALL = 1 << 0,
+    REMOTE_SNOOZE_ALL = 1 << 1,
+} RemoteCommands;
+
+static gboolean remote_activate(GDBusConnection* bus, const gchar* action, GError** error)
+{
+    GVariant* params = g_variant_new("(s@av@a{sv})", action, g_variant_new_array(G_VARIANT_TYPE_VARIANT, NULL, 0), g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0));
+    GVariant* ret;
+
+    // Don't start the applet just to tell it to be quiet
+    ret = g_dbus_connection_call_sync(bus, REMOTE_BUS_NAME, REMOTE_OBJECT_PATH, "org.gtk.Actions", "Activate", params, NULL, G_DBUS_CALL_FLAGS_NO_AUTO_START, -1, NULL, error);
+    if(!ret)
+        return FALSE;
+
+    g_variant_unref(ret);
+
+    return TRUE;
+}
+
+gboolean remote_try_fast_path(int argc, char* argv[], gint* status)
+{
+    RemoteCommands commands = 0;
+    GDBusConnection* bus;
+    GError* error = NULL;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--stop-all") == 0)
+            commands |= REMOTE_STOP_ALL;
+        else if(strcmp(argv[i], "-z") == 0 || strcmp(argv[i], "--snooze-all") == 0)
+            commands |= REMOTE_SNOOZE_ALL;
+        else
+            return FALSE;
+    }
+
+    if(!commands)
+        return FALSE;
+
+    bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    if(!bus) {
+        g_debug("Remote: No session bus: %s", error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    // Same order as the regular command line handler
+    if(commands & REMOTE_STOP_ALL && !remote_activate(bus, "stop_all", &error))
+        goto failed;
+
+    if(commands & REMOTE_SNOOZE_ALL && !remote_activate(bus, "snooze_all", &error))
+        goto failed;
+
+    g_object_unref(bus);
+
+    *status = 0;
+    return TRUE;
+
+failed:
+    g_object_unref(bus);
+
+    // Nothing is running, so nothing can be ringing either
+    if(g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN) || g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_NAME_HAS_NO_OWNER)) {
+        g_error_free(error);
+        *status = 0;
+        return TRUE;
+    }
+
+    g_debug("Remote: Falling back to the regular path: %s", error->message);
+    g_error_free(error);
+
+    return FALSE;
+}
@@ -0,0 +1,33 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * remote.h -- Remote control of the running instance over D-Bus
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef REMOTE_H_
+#define REMOTE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Object path of the application, derived from its ID by GApplication
+ */
+#define REMOTE_BUS_NAME    "io.github.alarm-clock-applet"
+#define REMOTE_OBJECT_PATH "/io/github/alarm_clock_applet"
+
+/**
+ * Handle a command line that only consists of --stop-all and --snooze-all by
+ * activating the actions of the running instance directly, without setting up
+ * GTK or a GApplication first.
+ *
+ * Returns TRUE and sets status if the command line was handled, FALSE if it
+ * has to go through the regular path.
+ */
+gboolean remote_try_fast_path(int argc, char* argv[], gint* status);
+
+G_END_DECLS
+
+#endif /*REMOTE_H_*/
@@ -0,0 +1,453 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * sound-cache.c -- Local cache for sounds on remote filesystems
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include <config.h>
+#include "sound-cache.h"
+#include "source-stats.h"
+
+/*
+ * Sounds on non-native (smb://, sftp://, ...) or remote (gvfs/FUSE, NFS)
+ * filesystems are copied to $XDG_CACHE_HOME/alarm-clock-applet/sounds/ ahead
+ * of time, so that triggering an alarm never waits for the network.
+ *
+ * Cached files are named after a hash of the URI, its modification time and
+ * its etag, which means that a changed source file simply results in a new
+ * cache entry. The old one is evicted eventually.
+ *
+ * Lookups may come from any thread. The entry table and the state of each
+ * entry are protected by cache_lock, while validation and copying always run
+ * on the main context.
+ */
+
+typedef enum {
+    SOUND_CACHE_UNKNOWN = 0,
+    SOUND_CACHE_DIRECT, // Local file, play it directly
+    SOUND_CACHE_VALID,  // Cached copy exists and is up to date
+    SOUND_CACHE_FAILED, // Could not validate or copy
+} SoundCacheState;
+
+typedef struct {
+    gchar* uri;
+    gchar* path; // Location of the cached copy, if any
+    SoundCacheState state;
+    gboolean busy; // Validation or copy in progress
+} SoundCacheEntry;
+
+typedef struct {
+    gchar* dir;
+    GHashTable* protected; // Basenames that must not be evicted, including copies in progress
+} SoundCacheEvictData;
+
+static GMutex cache_lock;
+static gchar* cache_dir = NULL;
+static GHashTable* cache_entries = NULL; // uri -> SoundCacheEntry
+static guint cache_hits = 0;
+static guint cache_misses = 0;
+static gboolean evicting = FALSE;
+static gboolean evict_again = FALSE;
+
+static void sound_cache_evict(void);
+
+/*
+ * Eviction {{
+ */
+
+typedef struct {
+    gchar* path;
+    gint64 mtime;
+    goffset size;
+} SoundCacheFile;
+
+static void sound_cache_file_free(SoundCacheFile* f)
+{
+    g_free(f->path);
+    g_free(f);
+}
+
+static gint sound_cache_file_newest_first(gconstpointer a, gconstpointer b)
+{
+    const SoundCacheFile* f1 = a;
+    const SoundCacheFile* f2 = b;
+
+    return (f1->mtime < f2->mtime) - (f1->mtime > f2->mtime);
+}
+
+static void sound_cache_evict_data_free(SoundCacheEvictData* data)
+{
+    g_free(data->dir);
+    g_hash_table_unref(data->protected);
+    g_free(data);
+}
+
+static void sound_cache_evict_thread(GTask* task, gpointer source_object, gpointer task_data, GCancellable* cancellable)
+{
+    SoundCacheEvictData* data = task_data;
+    GError* error = NULL;
+    GList* files = NULL;
+    GFileInfo* info;
+    const gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+
+    GFile* dir = g_file_new_for_path(data->dir);
+    GFileEnumerator* e = g_file_enumerate_children(dir, G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_TIME_MODIFIED, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL, &error);
+    g_object_unref(dir);
+
+    if(!e) {
+        g_debug("SoundCache: Could not enumerate %s: %s", data->dir, error->message);
+        g_error_free(error);
+        g_task_return_boolean(task, FALSE);
+        return;
+    }
+
+    while((info = g_file_enumerator_next_file(e, NULL, NULL))) {
+        const gchar* name = g_file_info_get_name(info);
+        SoundCacheFile* f = g_new(SoundCacheFile, 1);
+        f->path = g_build_filename(data->dir, name, NULL);
+        f->mtime = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+        f->size = g_file_info_get_size(info);
+
+        // Never evict anything that is referenced by an alarm right now
+        if(g_hash_table_contains(data->protected, name))
+            f->mtime = G_MAXINT64;
+
+        files = g_list_prepend(files, f);
+        g_object_unref(info);
+    }
+
+    g_file_enumerator_close(e, NULL, NULL);
+    g_object_unref(e);
+
+    // Keep the most recently used files within the size budget
+    files = g_list_sort(files, sound_cache_file_newest_first);
+
+    goffset total = 0;
+    for(GList* l = files; l; l = l->next) {
+        SoundCacheFile* f = l->data;
+        total += f->size;
+
+        if(f->mtime == G_MAXINT64)
+            continue;
+
+        if(total > SOUND_CACHE_MAX_SIZE || now - f->mtime > SOUND_CACHE_MAX_AGE) {
+            g_debug("SoundCache: Evicting %s", f->path);
+            g_unlink(f->path);
+            total -= f->size;
+        }
+    }
+
+    g_list_free_full(files, (GDestroyNotify)sound_cache_file_free);
+    g_task_return_boolean(task, TRUE);
+}
+
+static void sound_cache_evict_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    evicting = FALSE;
+
+    if(evict_again) {
+        evict_again = FALSE;
+        sound_cache_evict();
+    }
+}
+
+static void sound_cache_evict(void)
+{
+    if(evicting) {
+        evict_again = TRUE;
+        return;
+    }
+
+    SoundCacheEvictData* data = g_new(SoundCacheEvictData, 1);
+    data->dir = g_strdup(cache_dir);
+    data->protected = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    GHashTableIter iter;
+    SoundCacheEntry* entry;
+    g_mutex_lock(&cache_lock);
+    g_hash_table_iter_init(&iter, cache_entries);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer*)&entry)) {
+        if(!entry->path)
+            continue;
+
+        gchar* name = g_path_get_basename(entry->path);
+
+        // A copy in progress is renamed into place once it's done
+        if(entry->busy)
+            g_hash_table_add(data->protected, g_strconcat(name, ".part", NULL));
+
+        g_hash_table_add(data->protected, name);
+    }
+    g_mutex_unlock(&cache_lock);
+
+    evicting = TRUE;
+
+    GTask* task = g_task_new(NULL, NULL, sound_cache_evict_done, NULL);
+    g_task_set_task_data(task, data, (GDestroyNotify)sound_cache_evict_data_free);
+    g_task_run_in_thread(task, sound_cache_evict_thread);
+    g_object_unref(task);
+}
+
+/*
+ * }} Eviction
+ */
+
+/*
+ * Validation & copying {{
+ */
+
+static void sound_cache_copy_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    SoundCacheEntry* entry = user_data;
+    GError* error = NULL;
+
+    // Only the main context ever replaces entry->path
+    gchar* part = g_strconcat(entry->path, ".part", NULL);
+
+    if(!g_file_copy_finish(G_FILE(source_object), res, &error)) {
+        g_warning("SoundCache: Could not copy '%s': %s", entry->uri, error->message);
+        g_error_free(error);
+        g_unlink(part);
+        g_free(part);
+
+        g_mutex_lock(&cache_lock);
+        entry->state = SOUND_CACHE_FAILED;
+        entry->busy = FALSE;
+        g_mutex_unlock(&cache_lock);
+        return;
+    }
+
+    if(g_rename(part, entry->path) != 0) {
+        g_warning("SoundCache: Could not rename '%s'", part);
+        g_unlink(part);
+        g_free(part);
+
+        g_mutex_lock(&cache_lock);
+        entry->state = SOUND_CACHE_FAILED;
+        entry->busy = FALSE;
+        g_mutex_unlock(&cache_lock);
+        return;
+    }
+
+    g_free(part);
+
+    g_debug("SoundCache: Cached '%s' as %s", entry->uri, entry->path);
+
+    g_mutex_lock(&cache_lock);
+    entry->state = SOUND_CACHE_VALID;
+    entry->busy = FALSE;
+    g_mutex_unlock(&cache_lock);
+
+    // Make room for the new file
+    sound_cache_evict();
+}
+
+static void sound_cache_info_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    SoundCacheEntry* entry = user_data;
+    GFile* file = G_FILE(source_object);
+    GError* error = NULL;
+
+    GFileInfo* info = g_file_query_info_finish(file, res, &error);
+    if(!info) {
+        // Keep using an older copy if the source is unreachable right now
+        g_debug("SoundCache: Could not validate '%s': %s", entry->uri, error->message);
+        g_error_free(error);
+
+        g_mutex_lock(&cache_lock);
+        if(entry->path && g_file_test(entry->path, G_FILE_TEST_IS_REGULAR))
+            entry->state = SOUND_CACHE_VALID;
+        else
+            entry->state = SOUND_CACHE_FAILED;
+
+        entry->busy = FALSE;
+        g_mutex_unlock(&cache_lock);
+        return;
+    }
+
+    const guint64 mtime = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+    const gchar* etag = g_file_info_get_etag(info);
+
+    gchar* key_str = g_strdup_printf("%s\n%" G_GUINT64_FORMAT "\n%s", entry->uri, mtime, etag ? etag : "");
+    gchar* key = g_compute_checksum_for_string(G_CHECKSUM_SHA256, key_str, -1);
+    g_free(key_str);
+    g_object_unref(info);
+
+    gchar* path = g_build_filename(cache_dir, key, NULL);
+    g_free(key);
+
+    const gboolean exists = g_file_test(path, G_FILE_TEST_IS_REGULAR);
+
+    g_mutex_lock(&cache_lock);
+    g_free(entry->path);
+    entry->path = path;
+
+    if(exists) {
+        // Up to date
+        entry->state = SOUND_CACHE_VALID;
+        entry->busy = FALSE;
+        g_mutex_unlock(&cache_lock);
+        return;
+    }
+
+    // A stale copy must not be used while the new one is being fetched
+    entry->state = SOUND_CACHE_UNKNOWN;
+    g_mutex_unlock(&cache_lock);
+
+    g_debug("SoundCache: Fetching '%s'", entry->uri);
+
+    gchar* part = g_strconcat(entry->path, ".part", NULL);
+    GFile* dest = g_file_new_for_path(part);
+    g_file_copy_async(file, dest, G_FILE_COPY_OVERWRITE, G_PRIORITY_LOW, NULL, NULL, NULL, sound_cache_copy_done, entry);
+    g_object_unref(dest);
+    g_free(part);
+}
+
+static void sound_cache_validate(SoundCacheEntry* entry, GFile* file)
+{
+    g_file_query_info_async(file, G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_ETAG_VALUE, G_FILE_QUERY_INFO_NONE, G_PRIORITY_LOW, NULL, sound_cache_info_done, entry);
+}
+
+static void sound_cache_fs_info_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    SoundCacheEntry* entry = user_data;
+    GFile* file = G_FILE(source_object);
+
+    GFileInfo* info = g_file_query_filesystem_info_finish(file, res, NULL);
+    const gboolean remote = info && g_file_info_get_attribute_boolean(info, G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE);
+    g_clear_object(&info);
+
+    if(!remote) {
+        g_mutex_lock(&cache_lock);
+        entry->state = SOUND_CACHE_DIRECT;
+        entry->busy = FALSE;
+        g_mutex_unlock(&cache_lock);
+        return;
+    }
+
+    sound_cache_validate(entry, file);
+}
+
+/*
+ * }} Validation & copying
+ */
+
+void sound_cache_init(void)
+{
+    if(cache_entries)
+        return;
+
+    cache_dir = g_build_filename(g_get_user_cache_dir(), PACKAGE, "sounds", NULL);
+    if(g_mkdir_with_parents(cache_dir, 0700) != 0)
+        g_warning("SoundCache: Could not create %s", cache_dir);
+
+    g_mutex_lock(&cache_lock);
+    cache_entries = g_hash_table_new(g_str_hash, g_str_equal);
+    g_mutex_unlock(&cache_lock);
+
+    sound_cache_evict();
+}
+
+void sound_cache_prefetch(const gchar* uri)
+{
+    g_assert(cache_entries != NULL);
+
+    if(!uri || !*uri)
+        return;
+
+    g_mutex_lock(&cache_lock);
+
+    SoundCacheEntry* entry = g_hash_table_lookup(cache_entries, uri);
+    if(!entry) {
+        entry = g_new0(SoundCacheEntry, 1);
+        entry->uri = g_strdup(uri);
+        g_hash_table_insert(cache_entries, entry->uri, entry);
+    }
+
+    if(entry->busy || entry->state == SOUND_CACHE_DIRECT) {
+        g_mutex_unlock(&cache_lock);
+        return;
+    }
+
+    entry->busy = TRUE;
+
+    g_mutex_unlock(&cache_lock);
+
+    GFile* file = g_file_new_for_uri(uri);
+
+    // Native files only need caching if they live on a network filesystem
+    if(g_file_is_native(file))
+        g_file_query_filesystem_info_async(file, G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE, G_PRIORITY_LOW, NULL, sound_cache_fs_info_done, entry);
+    else
+        sound_cache_validate(entry, file);
+
+    g_object_unref(file);
+}
+
+static gboolean sound_cache_prefetch_idle(gpointer data)
+{
+    sound_cache_prefetch((const gchar*)data);
+
+    return G_SOURCE_REMOVE;
+}
+
+gchar* sound_cache_lookup(const gchar* uri)
+{
+    gchar* ret = NULL;
+
+    g_assert(cache_entries != NULL);
+
+    if(!uri || !*uri)
+        return NULL;
+
+    g_mutex_lock(&cache_lock);
+
+    SoundCacheEntry* entry = g_hash_table_lookup(cache_entries, uri);
+
+    if(entry && entry->state == SOUND_CACHE_DIRECT) {
+        g_mutex_unlock(&cache_lock);
+        return NULL;
+    }
+
+    if(entry && entry->state == SOUND_CACHE_VALID && g_file_test(entry->path, G_FILE_TEST_IS_REGULAR)) {
+        cache_hits++;
+        g_debug("SoundCache: Hit for '%s' (%u hits, %u misses)", uri, cache_hits, cache_misses);
+
+        // Mark as recently used
+        g_utime(entry->path, NULL);
+
+        ret = g_filename_to_uri(entry->path, NULL, NULL);
+        g_mutex_unlock(&cache_lock);
+
+        return ret;
+    }
+
+    // Whether a native file needs caching is not known until it's been prefetched
+    if(entry || !g_str_has_prefix(uri, "file://")) {
+        cache_misses++;
+        g_debug("SoundCache: Miss for '%s' (%u hits, %u misses)", uri, cache_hits, cache_misses);
+    }
+
+    g_mutex_unlock(&cache_lock);
+
+    // Validation must happen on the main context, even if we're called from another thread
+    source_stats_invoke(NULL, "sound-cache-prefetch", G_PRIORITY_DEFAULT, sound_cache_prefetch_idle, g_strdup(uri), g_free);
+
+    return NULL;
+}
+
+void sound_cache_get_stats(guint* hits, guint* misses)
+{
+    g_mutex_lock(&cache_lock);
+    if(hits)
+        *hits = cache_hits;
+    if(misses)
+        *misses = cache_misses;
+    g_mutex_unlock(&cache_lock);
+}
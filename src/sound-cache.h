@@ -0,0 +1,49 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * sound-cache.h -- Local cache for sounds on remote filesystems
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef SOUND_CACHE_H_
+#define SOUND_CACHE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Maximum size of the cache directory and maximum age of an unused entry.
+ * Anything above either limit is evicted, least recently used first.
+ */
+#define SOUND_CACHE_MAX_SIZE (64 * 1024 * 1024)
+#define SOUND_CACHE_MAX_AGE  (30 * 24 * 60 * 60)
+
+/**
+ * Initialize the sound cache and evict stale entries in the background.
+ */
+void sound_cache_init(void);
+
+/**
+ * Make sure a local copy of uri exists and is up to date.
+ *
+ * Local files are ignored. Validation and copying happen asynchronously.
+ */
+void sound_cache_prefetch(const gchar* uri);
+
+/**
+ * Get the URI of the cached copy of uri.
+ *
+ * Returns NULL if uri does not need to be cached, or if there is no valid
+ * copy yet. In the latter case a prefetch is started. Free with g_free().
+ */
+gchar* sound_cache_lookup(const gchar* uri);
+
+/**
+ * Get the number of cache hits and misses since startup.
+ */
+void sound_cache_get_stats(guint* hits, guint* misses);
+
+G_END_DECLS
+
+#endif /*SOUND_CACHE_H_*/
@@ -0,0 +1,951 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * sound-index.c -- Persistent index of available sounds
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <gst/gst.h>
+#include <gst/pbutils/pbutils.h>
+
+#include <config.h>
+#include "sound-index.h"
+#include "source-stats.h"
+
+/*
+ * The stock sounds and the custom sounds of all alarms are kept in
+ * $XDG_CACHE_HOME/alarm-clock-applet/sounds.index, so that the sounds list is
+ * available right away at startup. The stock directories and the custom
+ * sounds are then revalidated asynchronously, and the index is updated and
+ * saved if anything changed.
+ *
+ * Each sound is a group named after its URI:
+ *
+ *   [file:///usr/share/sounds/freedesktop/stereo/bell.oga]
+ *   name=bell.oga
+ *   icon=audio-x-generic
+ *   content-type=audio/x-vorbis+ogg
+ *   mtime=1650000000
+ *   order=3
+ *   playable=true
+ *   duration=1213424000
+ *   codec=Vorbis
+ *
+ * Stock sounds have an order, custom sounds don't. The media details are
+ * filled in by a GstDiscoverer pass in the background, and are missing until
+ * a file has been checked. Any change to the file's mtime drops them.
+ */
+
+#define SOUND_INDEX_VERSION    2
+#define SOUND_INDEX_GROUP      "Index"
+#define SOUND_INDEX_SAVE_DELAY 2 // s
+
+#define SOUND_INDEX_DISCOVER_THREADS 2
+#define SOUND_INDEX_DISCOVER_TIMEOUT (10 * GST_SECOND)
+
+#define SOUND_INDEX_ATTRIBUTES "standard::type,standard::content-type,standard::icon,standard::name,time::modified"
+
+// Must be NULL terminated
+static const gchar* const sound_notification_paths[] = {
+    "sounds/mate/default/alerts",
+    "sounds/gnome/default/alerts",
+    "sounds/ubuntu/notifications",
+    NULL
+};
+
+static const gchar* const freedesktop_sound_path[] = {
+    "sounds/freedesktop/stereo",
+    NULL
+};
+
+static const gchar* const freedesktop_sound_ignore[] = {
+    "audio-channel",
+    "network",
+    "phone",
+    "device",
+    "trash",
+    "suspend",
+    "dialog",
+    "power",
+    "screen-capture",
+    "window-question",
+    "onboard",
+    NULL
+};
+
+static const gchar* supported_sound_mime_types[] = {
+    "audio",
+    "video",
+    "application/ogg",
+    NULL,
+};
+
+typedef struct {
+    GPtrArray* dirs; // Sorted SoundIndexScanItem lists, one per directory
+    guint pending;   // Directories still being enumerated
+    gboolean fallback;
+    gboolean serial; // All directories in turn on a single worker
+    gboolean sync;   // For sound_index_scan_sync(), leaves the index alone
+    gboolean done;
+    GList* stock;    // Result of a sync scan
+    gint64 start_time;
+} SoundIndexScan;
+
+typedef struct {
+    SoundIndexScan* scan;
+    guint slot;
+    gchar* uri;
+    const gchar* const* ignore;
+    GList* items; // SoundIndexScanItem
+} SoundIndexDirScan;
+
+static gchar* index_path = NULL;
+static GList* index_stock = NULL;         // AlarmListEntry, in display order
+static GHashTable* index_custom = NULL;   // uri -> AlarmListEntry
+static GHashTable* index_probing = NULL;  // uris with a probe in flight
+static GHashTable* index_discovering = NULL; // uris with a discovery in flight
+static gboolean index_scanning = FALSE;
+static guint index_save_id = 0;
+static SoundIndexChangedFunc index_changed_func = NULL;
+static gpointer index_changed_data = NULL;
+
+static void sound_index_scan_run(SoundIndexScan* scan);
+static void sound_index_discover_all(void);
+static const AlarmListEntry* sound_index_lookup_stock(const gchar* uri);
+
+/*
+ * Persistence {{
+ */
+
+static void sound_index_save_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    GError* error = NULL;
+
+    if(!g_file_replace_contents_finish(G_FILE(source_object), res, NULL, &error)) {
+        g_warning("SoundIndex: Could not save %s: %s", index_path, error->message);
+        g_error_free(error);
+    }
+}
+
+static void sound_index_save_entry(GKeyFile* kf, const AlarmListEntry* entry, gint order)
+{
+    const gchar* group = entry->data;
+
+    g_key_file_set_string(kf, group, "name", entry->name);
+    if(entry->icon)
+        g_key_file_set_string(kf, group, "icon", entry->icon);
+    if(entry->content_type)
+        g_key_file_set_string(kf, group, "content-type", entry->content_type);
+    g_key_file_set_uint64(kf, group, "mtime", entry->mtime);
+    if(order >= 0)
+        g_key_file_set_integer(kf, group, "order", order);
+
+    if(entry->playable != ALARM_LIST_ENTRY_UNVERIFIED)
+        g_key_file_set_boolean(kf, group, "playable", entry->playable == ALARM_LIST_ENTRY_PLAYABLE);
+    if(entry->duration)
+        g_key_file_set_uint64(kf, group, "duration", entry->duration);
+    if(entry->codec)
+        g_key_file_set_string(kf, group, "codec", entry->codec);
+}
+
+static gboolean sound_index_save(gpointer data)
+{
+    GKeyFile* kf = g_key_file_new();
+    GHashTableIter iter;
+    AlarmListEntry* entry;
+    GBytes* bytes;
+    GFile* file;
+    gchar* contents;
+    gsize length;
+    gint order = 0;
+
+    index_save_id = 0;
+
+    g_key_file_set_integer(kf, SOUND_INDEX_GROUP, "version", SOUND_INDEX_VERSION);
+
+    for(const GList* l = index_stock; l; l = l->next)
+        sound_index_save_entry(kf, l->data, order++);
+
+    g_hash_table_iter_init(&iter, index_custom);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer*)&entry))
+        sound_index_save_entry(kf, entry, -1);
+
+    contents = g_key_file_to_data(kf, &length, NULL);
+    g_key_file_free(kf);
+
+    bytes = g_bytes_new_take(contents, length);
+    file = g_file_new_for_path(index_path);
+    g_file_replace_contents_bytes_async(file, bytes, NULL, FALSE, G_FILE_CREATE_REPLACE_DESTINATION, NULL, sound_index_save_done, NULL);
+    g_object_unref(file);
+    g_bytes_unref(bytes);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Record a change: save the index in a moment and tell the listener
+ */
+static void sound_index_changed(void)
+{
+    if(index_save_id == 0)
+        index_save_id = source_stats_timeout_add_seconds("sound-index-save", SOUND_INDEX_SAVE_DELAY, sound_index_save, NULL);
+
+    if(index_changed_func)
+        index_changed_func(index_changed_data);
+}
+
+static gint sound_index_compare_order(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+    GHashTable* order = user_data;
+    const gint oa = GPOINTER_TO_INT(g_hash_table_lookup(order, ((const AlarmListEntry*)a)->data));
+    const gint ob = GPOINTER_TO_INT(g_hash_table_lookup(order, ((const AlarmListEntry*)b)->data));
+
+    return (oa > ob) - (oa < ob);
+}
+
+static void sound_index_load(void)
+{
+    GKeyFile* kf = g_key_file_new();
+    GHashTable* order;
+    gchar** groups;
+
+    if(!g_key_file_load_from_file(kf, index_path, G_KEY_FILE_NONE, NULL) || g_key_file_get_integer(kf, SOUND_INDEX_GROUP, "version", NULL) != SOUND_INDEX_VERSION) {
+        // Nothing usable, the first scan will fill it in
+        g_key_file_free(kf);
+        return;
+    }
+
+    order = g_hash_table_new(g_str_hash, g_str_equal);
+    groups = g_key_file_get_groups(kf, NULL);
+
+    for(gchar** g = groups; *g; g++) {
+        AlarmListEntry* entry;
+
+        if(strcmp(*g, SOUND_INDEX_GROUP) == 0)
+            continue;
+
+        entry = g_new0(AlarmListEntry, 1);
+        entry->data = g_strdup(*g);
+        entry->name = g_key_file_get_string(kf, *g, "name", NULL);
+        entry->icon = g_key_file_get_string(kf, *g, "icon", NULL);
+        entry->content_type = g_key_file_get_string(kf, *g, "content-type", NULL);
+        entry->mtime = g_key_file_get_uint64(kf, *g, "mtime", NULL);
+        entry->duration = g_key_file_get_uint64(kf, *g, "duration", NULL);
+        entry->codec = g_key_file_get_string(kf, *g, "codec", NULL);
+
+        if(g_key_file_has_key(kf, *g, "playable", NULL))
+            entry->playable = g_key_file_get_boolean(kf, *g, "playable", NULL) ? ALARM_LIST_ENTRY_PLAYABLE : ALARM_LIST_ENTRY_UNPLAYABLE;
+
+        if(!entry->name) {
+            alarm_list_entry_free(entry);
+            continue;
+        }
+
+        if(g_key_file_has_key(kf, *g, "order", NULL)) {
+            // Offset by one so that 0 means "no order"
+            g_hash_table_insert(order, entry->data, GINT_TO_POINTER(g_key_file_get_integer(kf, *g, "order", NULL) + 1));
+            index_stock = g_list_prepend(index_stock, entry);
+        } else {
+            g_hash_table_insert(index_custom, entry->data, entry);
+        }
+    }
+
+    index_stock = g_list_sort_with_data(index_stock, sound_index_compare_order, order);
+
+    g_debug("SoundIndex: Loaded %u stock and %u custom sounds from %s", g_list_length(index_stock), g_hash_table_size(index_custom), index_path);
+
+    g_strfreev(groups);
+    g_hash_table_unref(order);
+    g_key_file_free(kf);
+}
+
+/*
+ * }} Persistence
+ */
+
+/*
+ * Stock sound scanning {{
+ *
+ * Every directory is enumerated synchronously by its own GTask on the GIO
+ * worker pool and sorted there. Once all directories are done, the sorted
+ * lists are merged on the main thread. A serial scan goes through the same
+ * directories on a single worker, so that the benchmarks can compare the two.
+ */
+
+typedef struct {
+    gchar* key; // Collation key of the name
+    AlarmListEntry* entry;
+} SoundIndexScanItem;
+
+static gint sound_index_scan_item_compare(gconstpointer a, gconstpointer b)
+{
+    return strcmp(((const SoundIndexScanItem*)a)->key, ((const SoundIndexScanItem*)b)->key);
+}
+
+static void sound_index_scan_item_free(SoundIndexScanItem* item)
+{
+    if(item->entry)
+        alarm_list_entry_free(item->entry);
+
+    g_free(item->key);
+    g_free(item);
+}
+
+/*
+ * Merge the sorted per-directory lists. Equal names keep the directory order.
+ */
+static GList* sound_index_scan_merge(SoundIndexScan* scan)
+{
+    GList* stock = NULL;
+
+    for(;;) {
+        SoundIndexScanItem* best = NULL;
+        GList** best_head = NULL;
+
+        for(guint i = 0; i < scan->dirs->len; i++) {
+            GList** head = (GList**)&g_ptr_array_index(scan->dirs, i);
+
+            if(*head && (!best || sound_index_scan_item_compare((*head)->data, best) < 0)) {
+                best = (*head)->data;
+                best_head = head;
+            }
+        }
+
+        if(!best)
+            break;
+
+        *best_head = g_list_delete_link(*best_head, *best_head);
+
+        stock = g_list_prepend(stock, best->entry);
+        best->entry = NULL;
+        sound_index_scan_item_free(best);
+    }
+
+    return g_list_reverse(stock);
+}
+
+static void sound_index_scan_finish(SoundIndexScan* scan)
+{
+    GList* stock = sound_index_scan_merge(scan);
+    gboolean changed;
+
+    g_ptr_array_free(scan->dirs, TRUE);
+
+    // If none of the preferred sound directories were found, try to load the freedesktop ones
+    if(!stock && !scan->fallback) {
+        scan->fallback = TRUE;
+        sound_index_scan_run(scan);
+        return;
+    }
+
+    g_debug("SoundIndex: Scanned %u sounds in %" G_GINT64_FORMAT " us", g_list_length(stock), g_get_monotonic_time() - scan->start_time);
+
+    if(scan->sync) {
+        scan->stock = stock;
+        scan->done = TRUE;
+        return;
+    }
+
+    g_free(scan);
+    index_scanning = FALSE;
+
+    if(!stock)
+        g_warning("SoundIndex: Could not locate sounds!");
+
+    // Compare with what we've had so far
+    changed = g_list_length(stock) != g_list_length(index_stock);
+    for(GList *a = stock, *b = index_stock; !changed && a; a = a->next, b = b->next)
+        changed = !alarm_list_entry_equal(a->data, b->data);
+
+    if(!changed) {
+        g_list_free_full(stock, (GDestroyNotify)alarm_list_entry_free);
+        sound_index_discover_all();
+        return;
+    }
+
+    g_debug("SoundIndex: Stock sounds changed, now %u", g_list_length(stock));
+
+    // Keep the media details of files that haven't changed
+    for(GList* l = stock; l; l = l->next) {
+        AlarmListEntry* entry = l->data;
+        const AlarmListEntry* old = sound_index_lookup_stock(entry->data);
+
+        if(old && old->mtime == entry->mtime)
+            alarm_list_entry_copy_media(entry, old);
+    }
+
+    g_list_free_full(index_stock, (GDestroyNotify)alarm_list_entry_free);
+    index_stock = stock;
+
+    sound_index_changed();
+    sound_index_discover_all();
+}
+
+static void sound_index_dir_scan(SoundIndexDirScan* dir, GCancellable* cancellable)
+{
+    GError* error = NULL;
+    GFileEnumerator* e;
+    GFileInfo* info;
+    GFile* file;
+
+    file = g_file_new_for_uri(dir->uri);
+    e = g_file_enumerate_children(file, SOUND_INDEX_ATTRIBUTES, G_FILE_QUERY_INFO_NONE, cancellable, &error);
+    g_object_unref(file);
+
+    if(!e) {
+        // Most of the directories don't exist on any given system
+        if(!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+            g_debug("SoundIndex: Could not open %s: %s", dir->uri, error->message);
+
+        g_error_free(error);
+        return;
+    }
+
+    while((info = g_file_enumerator_next_file(e, cancellable, NULL))) {
+        AlarmListEntry* entry = alarm_list_entry_new_from_info(dir->uri, info, supported_sound_mime_types, dir->ignore);
+
+        if(entry) {
+            SoundIndexScanItem* item = g_new(SoundIndexScanItem, 1);
+            item->key = g_utf8_collate_key_for_filename(entry->name, -1);
+            item->entry = entry;
+            dir->items = g_list_prepend(dir->items, item);
+        }
+
+        g_object_unref(info);
+    }
+
+    g_file_enumerator_close(e, NULL, NULL);
+    g_object_unref(e);
+
+    dir->items = g_list_sort(dir->items, sound_index_scan_item_compare);
+}
+
+static void sound_index_dir_scan_thread(GTask* task, gpointer source_object, gpointer task_data, GCancellable* cancellable)
+{
+    sound_index_dir_scan(task_data, cancellable);
+    g_task_return_boolean(task, TRUE);
+}
+
+static void sound_index_dir_scan_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    SoundIndexDirScan* dir = g_task_get_task_data(G_TASK(res));
+    SoundIndexScan* scan = dir->scan;
+
+    g_ptr_array_index(scan->dirs, dir->slot) = dir->items;
+    dir->items = NULL;
+
+    if(--scan->pending == 0)
+        sound_index_scan_finish(scan);
+}
+
+static void sound_index_dir_scan_free(SoundIndexDirScan* dir)
+{
+    g_list_free_full(dir->items, (GDestroyNotify)sound_index_scan_item_free);
+    g_free(dir->uri);
+    g_free(dir);
+}
+
+static void sound_index_serial_scan_thread(GTask* task, gpointer source_object, gpointer task_data, GCancellable* cancellable)
+{
+    GPtrArray* dirs = task_data;
+
+    for(guint i = 0; i < dirs->len; i++)
+        sound_index_dir_scan(g_ptr_array_index(dirs, i), cancellable);
+
+    g_task_return_boolean(task, TRUE);
+}
+
+static void sound_index_serial_scan_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    GPtrArray* dirs = g_task_get_task_data(G_TASK(res));
+    SoundIndexScan* scan = user_data;
+
+    for(guint i = 0; i < dirs->len; i++) {
+        SoundIndexDirScan* dir = g_ptr_array_index(dirs, i);
+
+        g_ptr_array_index(scan->dirs, dir->slot) = dir->items;
+        dir->items = NULL;
+    }
+
+    scan->pending = 0;
+    sound_index_scan_finish(scan);
+}
+
+static SoundIndexScan* sound_index_scan_new(void)
+{
+    SoundIndexScan* scan = g_new0(SoundIndexScan, 1);
+
+    scan->start_time = g_get_monotonic_time();
+
+    return scan;
+}
+
+static void sound_index_scan_run(SoundIndexScan* scan)
+{
+    const gchar* const* sysdirs = g_get_system_data_dirs();
+    const gchar* const* paths = scan->fallback ? freedesktop_sound_path : sound_notification_paths;
+    GPtrArray* serial_dirs = NULL;
+    GTask* task;
+
+    scan->dirs = g_ptr_array_new();
+    scan->pending = 0;
+
+    // Count first, so that the scan can't finish before all directories were started
+    for(gint i = 0; sysdirs[i] != NULL; i++)
+        for(gint j = 0; paths[j] != NULL; j++)
+            scan->pending++;
+
+    g_ptr_array_set_size(scan->dirs, scan->pending);
+
+    if(scan->pending == 0) {
+        sound_index_scan_finish(scan);
+        return;
+    }
+
+    if(scan->serial)
+        serial_dirs = g_ptr_array_new_with_free_func((GDestroyNotify)sound_index_dir_scan_free);
+
+    for(gint i = 0, slot = 0; sysdirs[i] != NULL; i++) {
+        for(gint j = 0; paths[j] != NULL; j++, slot++) {
+            SoundIndexDirScan* dir = g_new0(SoundIndexDirScan, 1);
+            gchar* path = g_build_filename(sysdirs[i], paths[j], NULL);
+
+            dir->scan = scan;
+            dir->slot = slot;
+            dir->uri = g_strdup_printf("file://%s", path);
+            dir->ignore = scan->fallback ? freedesktop_sound_ignore : NULL;
+
+            g_free(path);
+
+            if(serial_dirs) {
+                g_ptr_array_add(serial_dirs, dir);
+                continue;
+            }
+
+            task = g_task_new(NULL, NULL, sound_index_dir_scan_done, NULL);
+            g_task_set_priority(task, G_PRIORITY_LOW);
+            g_task_set_task_data(task, dir, (GDestroyNotify)sound_index_dir_scan_free);
+            g_task_run_in_thread(task, sound_index_dir_scan_thread);
+            g_object_unref(task);
+        }
+    }
+
+    if(serial_dirs) {
+        task = g_task_new(NULL, NULL, sound_index_serial_scan_done, scan);
+        g_task_set_priority(task, G_PRIORITY_LOW);
+        g_task_set_task_data(task, serial_dirs, (GDestroyNotify)g_ptr_array_unref);
+        g_task_run_in_thread(task, sound_index_serial_scan_thread);
+        g_object_unref(task);
+    }
+}
+
+guint sound_index_scan_sync(gboolean serial)
+{
+    SoundIndexScan* scan = sound_index_scan_new();
+    guint count;
+
+    scan->serial = serial;
+    scan->sync = TRUE;
+    sound_index_scan_run(scan);
+
+    while(!scan->done)
+        g_main_context_iteration(NULL, TRUE);
+
+    count = g_list_length(scan->stock);
+
+    g_list_free_full(scan->stock, (GDestroyNotify)alarm_list_entry_free);
+    g_free(scan);
+
+    return count;
+}
+
+/*
+ * }} Stock sound scanning
+ */
+
+/*
+ * Custom sound probing {{
+ *
+ * Probes are collected until the main loop is idle, deduplicated, and then
+ * run as a single batch on the GIO worker pool.
+ */
+
+typedef struct {
+    gchar* uri;
+    AlarmListEntry* entry; // NULL if the file could not be queried
+} SoundIndexProbe;
+
+static GPtrArray* index_probe_queue = NULL; // SoundIndexProbe, not started yet
+static guint index_probe_id = 0;
+
+static void sound_index_probe_free(SoundIndexProbe* probe)
+{
+    if(probe->entry)
+        alarm_list_entry_free(probe->entry);
+
+    g_free(probe->uri);
+    g_free(probe);
+}
+
+static void sound_index_probe_thread(GTask* task, gpointer source_object, gpointer task_data, GCancellable* cancellable)
+{
+    GPtrArray* probes = task_data;
+
+    for(guint i = 0; i < probes->len; i++) {
+        SoundIndexProbe* probe = g_ptr_array_index(probes, i);
+        GFile* file = g_file_new_for_uri(probe->uri);
+        GFileInfo* info = g_file_query_info(file, SOUND_INDEX_ATTRIBUTES, G_FILE_QUERY_INFO_NONE, cancellable, NULL);
+
+        if(info) {
+            probe->entry = g_new0(AlarmListEntry, 1);
+            probe->entry->data = g_strdup(probe->uri);
+            probe->entry->name = g_file_get_basename(file);
+            probe->entry->icon = g_icon_to_string(g_file_info_get_icon(info));
+            probe->entry->content_type = g_strdup(g_file_info_get_content_type(info));
+            probe->entry->mtime = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+            g_object_unref(info);
+        }
+
+        g_object_unref(file);
+    }
+
+    g_task_return_boolean(task, TRUE);
+}
+
+static void sound_index_probe_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    GPtrArray* probes = g_task_get_task_data(G_TASK(res));
+    gboolean changed = FALSE;
+
+    for(guint i = 0; i < probes->len; i++) {
+        SoundIndexProbe* probe = g_ptr_array_index(probes, i);
+        AlarmListEntry* old = g_hash_table_lookup(index_custom, probe->uri);
+
+        g_hash_table_remove(index_probing, probe->uri);
+
+        if(!probe->entry && !old) {
+            // Still not there
+        } else if(!probe->entry) {
+            g_debug("SoundIndex: Dropping '%s'", probe->uri);
+            g_hash_table_remove(index_custom, probe->uri);
+            changed = TRUE;
+        } else if(old && alarm_list_entry_equal(old, probe->entry)) {
+            // Up to date
+        } else {
+            g_debug("SoundIndex: Updating '%s'", probe->uri);
+            if(old && old->mtime == probe->entry->mtime)
+                alarm_list_entry_copy_media(probe->entry, old);
+            g_hash_table_replace(index_custom, probe->entry->data, probe->entry);
+            probe->entry = NULL;
+            changed = TRUE;
+        }
+    }
+
+    // Tell the listener once per batch
+    if(changed)
+        sound_index_changed();
+
+    sound_index_discover_all();
+}
+
+static gboolean sound_index_probe_flush(gpointer data)
+{
+    GTask* task;
+
+    index_probe_id = 0;
+
+    task = g_task_new(NULL, NULL, sound_index_probe_done, NULL);
+    g_task_set_priority(task, G_PRIORITY_LOW);
+    g_task_set_task_data(task, index_probe_queue, (GDestroyNotify)g_ptr_array_unref);
+    g_task_run_in_thread(task, sound_index_probe_thread);
+    g_object_unref(task);
+
+    index_probe_queue = NULL;
+
+    return G_SOURCE_REMOVE;
+}
+
+void sound_index_probe(const gchar* uri)
+{
+    SoundIndexProbe* probe;
+
+    // Any number of alarms may share a sound, query it only once
+    if(!uri || !*uri || g_hash_table_contains(index_probing, uri))
+        return;
+
+    g_hash_table_add(index_probing, g_strdup(uri));
+
+    if(!index_probe_queue)
+        index_probe_queue = g_ptr_array_new_with_free_func((GDestroyNotify)sound_index_probe_free);
+
+    probe = g_new0(SoundIndexProbe, 1);
+    probe->uri = g_strdup(uri);
+    g_ptr_array_add(index_probe_queue, probe);
+
+    if(index_probe_id == 0)
+        index_probe_id = source_stats_idle_add("sound-index-probe", G_PRIORITY_LOW, sound_index_probe_flush, NULL);
+}
+
+/*
+ * }} Custom sound probing
+ */
+
+/*
+ * Media discovery {{
+ *
+ * Sounds that haven't been checked yet are run through GstDiscoverer on a
+ * small thread pool. Each pool thread keeps its own discoverer, and the
+ * results are handed back to the main thread.
+ */
+
+typedef struct {
+    gchar* uri;
+    guint64 mtime;
+
+    // Filled in by the pool thread
+    AlarmListEntryPlayable playable;
+    guint64 duration;
+    gchar* codec;
+} SoundIndexDiscovery;
+
+static GThreadPool* index_discover_pool = NULL;
+static GPrivate index_discoverer = G_PRIVATE_INIT(g_object_unref); // GstDiscoverer of the current pool thread
+static gboolean index_discover_changed = FALSE;
+
+static void sound_index_discovery_free(SoundIndexDiscovery* d)
+{
+    g_free(d->uri);
+    g_free(d->codec);
+    g_free(d);
+}
+
+static AlarmListEntry* sound_index_find(const gchar* uri)
+{
+    AlarmListEntry* entry = (AlarmListEntry*)sound_index_lookup_stock(uri);
+
+    return entry ? entry : g_hash_table_lookup(index_custom, uri);
+}
+
+static gboolean sound_index_discover_done(gpointer data)
+{
+    SoundIndexDiscovery* d = data;
+    AlarmListEntry* entry = sound_index_find(d->uri);
+
+    g_hash_table_remove(index_discovering, d->uri);
+
+    // Drop results for files that were changed or removed in the meantime
+    if(entry && entry->mtime == d->mtime && d->playable != ALARM_LIST_ENTRY_UNVERIFIED) {
+        if(d->playable == ALARM_LIST_ENTRY_UNPLAYABLE)
+            g_warning("SoundIndex: '%s' cannot be played", d->uri);
+
+        entry->playable = d->playable;
+        entry->duration = d->duration;
+        g_free(entry->codec);
+        entry->codec = d->codec;
+        d->codec = NULL;
+
+        index_discover_changed = TRUE;
+    }
+
+    // Tell the listener once the queue has drained
+    if(index_discover_changed && g_hash_table_size(index_discovering) == 0) {
+        index_discover_changed = FALSE;
+        sound_index_changed();
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void sound_index_discover_thread(gpointer data, gpointer user_data)
+{
+    SoundIndexDiscovery* d = data;
+    GstDiscoverer* discoverer = g_private_get(&index_discoverer);
+    GstDiscovererInfo* info;
+    GError* error = NULL;
+
+    if(!discoverer) {
+        discoverer = gst_discoverer_new(SOUND_INDEX_DISCOVER_TIMEOUT, &error);
+        if(!discoverer) {
+            g_warning("SoundIndex: Could not create discoverer: %s", error->message);
+            g_error_free(error);
+
+            // Leave it unverified
+            source_stats_invoke(NULL, "sound-index-discover", G_PRIORITY_LOW, sound_index_discover_done, d, (GDestroyNotify)sound_index_discovery_free);
+            return;
+        }
+
+        g_private_set(&index_discoverer, discoverer);
+    }
+
+    info = gst_discoverer_discover_uri(discoverer, d->uri, &error);
+
+    if(info && gst_discoverer_info_get_result(info) == GST_DISCOVERER_OK) {
+        GList* streams = gst_discoverer_info_get_audio_streams(info);
+
+        if(streams) {
+            GstCaps* caps = gst_discoverer_stream_info_get_caps(streams->data);
+
+            d->playable = ALARM_LIST_ENTRY_PLAYABLE;
+            if(GST_CLOCK_TIME_IS_VALID(gst_discoverer_info_get_duration(info)))
+                d->duration = gst_discoverer_info_get_duration(info);
+
+            if(caps) {
+                d->codec = gst_pb_utils_get_codec_description(caps);
+                gst_caps_unref(caps);
+            }
+        } else {
+            // Nothing we could hear
+            d->playable = ALARM_LIST_ENTRY_UNPLAYABLE;
+        }
+
+        gst_discoverer_stream_info_list_free(streams);
+    } else if(info && gst_discoverer_info_get_result(info) == GST_DISCOVERER_TIMEOUT) {
+        // Slow storage isn't a reason to reject a sound, try again next time
+        g_debug("SoundIndex: Timed out discovering '%s'", d->uri);
+    } else {
+        g_debug("SoundIndex: Could not discover '%s': %s", d->uri, error ? error->message : "unknown error");
+        d->playable = ALARM_LIST_ENTRY_UNPLAYABLE;
+    }
+
+    g_clear_error(&error);
+    if(info)
+        g_object_unref(info);
+
+    source_stats_invoke(NULL, "sound-index-discover", G_PRIORITY_LOW, sound_index_discover_done, d, (GDestroyNotify)sound_index_discovery_free);
+}
+
+static void sound_index_discover(const AlarmListEntry* entry)
+{
+    SoundIndexDiscovery* d;
+
+    if(entry->playable != ALARM_LIST_ENTRY_UNVERIFIED || g_hash_table_contains(index_discovering, entry->data))
+        return;
+
+    if(!index_discover_pool) {
+        gst_init(NULL, NULL);
+        gst_pb_utils_init();
+
+        index_discover_pool = g_thread_pool_new(sound_index_discover_thread, NULL, SOUND_INDEX_DISCOVER_THREADS, FALSE, NULL);
+    }
+
+    g_hash_table_add(index_discovering, g_strdup(entry->data));
+
+    d = g_new0(SoundIndexDiscovery, 1);
+    d->uri = g_strdup(entry->data);
+    d->mtime = entry->mtime;
+
+    g_thread_pool_push(index_discover_pool, d, NULL);
+}
+
+/*
+ * Check every sound that hasn't been checked yet
+ */
+static void sound_index_discover_all(void)
+{
+    GHashTableIter iter;
+    AlarmListEntry* entry;
+
+    for(const GList* l = index_stock; l; l = l->next)
+        sound_index_discover(l->data);
+
+    g_hash_table_iter_init(&iter, index_custom);
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer*)&entry))
+        sound_index_discover(entry);
+}
+
+/*
+ * }} Media discovery
+ */
+
+void sound_index_init(SoundIndexChangedFunc func, gpointer data)
+{
+    gchar* dir;
+
+    if(index_path)
+        return;
+
+    index_changed_func = func;
+    index_changed_data = data;
+
+    dir = g_build_filename(g_get_user_cache_dir(), PACKAGE, NULL);
+    g_mkdir_with_parents(dir, 0700);
+    index_path = g_build_filename(dir, "sounds.index", NULL);
+    g_free(dir);
+
+    index_custom = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)alarm_list_entry_free);
+    index_probing = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    index_discovering = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    sound_index_load();
+}
+
+const GList* sound_index_get_stock(void)
+{
+    return index_stock;
+}
+
+static const AlarmListEntry* sound_index_lookup_stock(const gchar* uri)
+{
+    for(const GList* l = index_stock; l; l = l->next) {
+        const AlarmListEntry* entry = l->data;
+        if(strcmp(entry->data, uri) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+const AlarmListEntry* sound_index_lookup(const gchar* uri)
+{
+    const AlarmListEntry* entry;
+
+    if(!uri || !index_custom)
+        return NULL;
+
+    if((entry = sound_index_lookup_stock(uri)))
+        return entry;
+
+    return g_hash_table_lookup(index_custom, uri);
+}
+
+void sound_index_revalidate(const gchar* const* uris)
+{
+    GHashTable* keep = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTableIter iter;
+    const gchar* uri;
+    gboolean dropped = FALSE;
+
+    for(gint i = 0; uris && uris[i]; i++)
+        g_hash_table_add(keep, (gpointer)uris[i]);
+
+    // Forget about sounds no alarm uses anymore
+    g_hash_table_iter_init(&iter, index_custom);
+    while(g_hash_table_iter_next(&iter, (gpointer*)&uri, NULL)) {
+        if(!g_hash_table_contains(keep, uri)) {
+            g_hash_table_iter_remove(&iter);
+            dropped = TRUE;
+        }
+    }
+
+    if(dropped)
+        sound_index_changed();
+
+    if(!index_scanning) {
+        index_scanning = TRUE;
+        sound_index_scan_run(sound_index_scan_new());
+    }
+
+    // Each sound once, however many alarms use it
+    g_hash_table_iter_init(&iter, keep);
+    while(g_hash_table_iter_next(&iter, (gpointer*)&uri, NULL)) {
+        // Stock sounds are covered by the scan
+        if(!sound_index_lookup_stock(uri))
+            sound_index_probe(uri);
+    }
+
+    g_hash_table_unref(keep);
+}
@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * sound-index.h -- Persistent index of available sounds
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef SOUND_INDEX_H_
+#define SOUND_INDEX_H_
+
+#include <glib.h>
+
+#include "list-entry.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Called on the main thread whenever the index has changed.
+ */
+typedef void (*SoundIndexChangedFunc)(gpointer data);
+
+/**
+ * Load the index from disk.
+ *
+ * func is called whenever a scan or probe has changed the index.
+ */
+void sound_index_init(SoundIndexChangedFunc func, gpointer data);
+
+/**
+ * Get the stock sounds, in display order.
+ *
+ * The list and its entries belong to the index.
+ */
+const GList* sound_index_get_stock(void);
+
+/**
+ * Look up a stock or custom sound.
+ *
+ * The media details of the entry are filled in once the file has been checked
+ * in the background. Returns NULL if uri has not been indexed (yet).
+ */
+const AlarmListEntry* sound_index_lookup(const gchar* uri);
+
+/**
+ * Add or refresh a custom sound in the background.
+ */
+void sound_index_probe(const gchar* uri);
+
+/**
+ * Rescan the stock sound directories and refresh the given custom sounds in
+ * the background. Custom sounds not in uris are dropped from the index.
+ */
+void sound_index_revalidate(const gchar* const* uris);
+
+/**
+ * Scan the stock sound directories from scratch and wait for the result,
+ * without touching the index. Returns the number of sounds found.
+ *
+ * With serial, all directories are enumerated one after another by a single
+ * worker rather than each by its own. Only meant for the benchmarks.
+ */
+guint sound_index_scan_sync(gboolean serial);
+
+G_END_DECLS
+
+#endif /*SOUND_INDEX_H_*/
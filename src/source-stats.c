@@ -0,0 +1,261 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * source-stats.c -- Wakeup and CPU time accounting for event sources
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <time.h>
+#include <glib.h>
+
+#include "source-stats.h"
+
+/*
+ * Sources are accounted by wrapping their callback, which counts a wakeup per
+ * dispatch and adds up the CPU time of the calling thread while it runs. The
+ * audio and scheduler threads account their wakeups too, so the table is
+ * protected by stats_lock.
+ *
+ * The name of the source being dispatched on the main thread is also kept
+ * around, so the watchdog can tell which one is blocking the main loop.
+ */
+
+typedef struct {
+    const gchar* name;
+    guint64 wakeups;
+    gint64 cpu_time; // µs
+} SourceStats;
+
+typedef struct {
+    const gchar* name;
+    GSourceFunc func;
+    gpointer data;
+    GDestroyNotify notify;
+} SourceStatsClosure;
+
+static GMutex stats_lock;
+static GHashTable* stats_table = NULL; // name -> SourceStats
+static gint64 stats_start_time = 0;
+static const gchar* stats_main_current = NULL; // Atomic
+
+/*
+ * CPU time of the calling thread in µs
+ */
+static gint64 source_stats_thread_cpu_time(void)
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+
+    if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+#endif
+    // Better than nothing
+    return g_get_monotonic_time();
+}
+
+/*
+ * Must be called with stats_lock held
+ */
+static GHashTable* source_stats_table(void)
+{
+    if(!stats_table) {
+        stats_table = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+        stats_start_time = g_get_monotonic_time();
+    }
+
+    return stats_table;
+}
+
+gint64 source_stats_begin(void)
+{
+    return source_stats_thread_cpu_time();
+}
+
+void source_stats_end(const gchar* name, gint64 begin)
+{
+    const gint64 cpu_time = source_stats_thread_cpu_time() - begin;
+    SourceStats* stats;
+
+    g_mutex_lock(&stats_lock);
+
+    stats = g_hash_table_lookup(source_stats_table(), name);
+    if(!stats) {
+        stats = g_new0(SourceStats, 1);
+        stats->name = name;
+        g_hash_table_insert(stats_table, (gpointer)name, stats);
+    }
+
+    stats->wakeups++;
+    stats->cpu_time += cpu_time;
+
+    g_mutex_unlock(&stats_lock);
+}
+
+static gboolean source_stats_dispatch(gpointer data)
+{
+    SourceStatsClosure* closure = (SourceStatsClosure*)data;
+    const gint64 begin = source_stats_begin();
+    const gboolean on_main = g_main_context_is_owner(g_main_context_default());
+    const gchar* prev = NULL;
+    gboolean ret;
+
+    // Sources may be dispatched from nested main loops, such as gtk_dialog_run()
+    if(on_main) {
+        prev = g_atomic_pointer_get(&stats_main_current);
+        g_atomic_pointer_set(&stats_main_current, closure->name);
+    }
+
+    ret = closure->func(closure->data);
+
+    if(on_main)
+        g_atomic_pointer_set(&stats_main_current, prev);
+
+    // GLib keeps the closure alive while dispatching, even if the source was removed
+    source_stats_end(closure->name, begin);
+
+    return ret;
+}
+
+static void source_stats_closure_free(gpointer data)
+{
+    SourceStatsClosure* closure = (SourceStatsClosure*)data;
+
+    if(closure->notify)
+        closure->notify(closure->data);
+
+    g_free(closure);
+}
+
+void source_stats_set_callback(GSource* source, const gchar* name, GSourceFunc func, gpointer data, GDestroyNotify notify)
+{
+    SourceStatsClosure* closure = g_new0(SourceStatsClosure, 1);
+
+    closure->name = name;
+    closure->func = func;
+    closure->data = data;
+    closure->notify = notify;
+
+    // Rates are relative to the first source
+    g_mutex_lock(&stats_lock);
+    source_stats_table();
+    g_mutex_unlock(&stats_lock);
+
+    g_source_set_name(source, name);
+    g_source_set_callback(source, source_stats_dispatch, closure, source_stats_closure_free);
+}
+
+static guint source_stats_attach(GSource* source, const gchar* name, GSourceFunc func, gpointer data)
+{
+    guint id;
+
+    source_stats_set_callback(source, name, func, data, NULL);
+    id = g_source_attach(source, NULL);
+    g_source_unref(source);
+
+    return id;
+}
+
+guint source_stats_timeout_add(const gchar* name, guint interval, GSourceFunc func, gpointer data)
+{
+    return source_stats_attach(g_timeout_source_new(interval), name, func, data);
+}
+
+guint source_stats_timeout_add_seconds(const gchar* name, guint interval, GSourceFunc func, gpointer data)
+{
+    return source_stats_attach(g_timeout_source_new_seconds(interval), name, func, data);
+}
+
+guint source_stats_idle_add(const gchar* name, gint priority, GSourceFunc func, gpointer data)
+{
+    GSource* source = g_idle_source_new();
+
+    g_source_set_priority(source, priority);
+
+    return source_stats_attach(source, name, func, data);
+}
+
+void source_stats_invoke(GMainContext* context, const gchar* name, gint priority, GSourceFunc func, gpointer data, GDestroyNotify notify)
+{
+    GSource* source;
+
+    if(!context)
+        context = g_main_context_default();
+
+    // Already in the right thread, same as g_main_context_invoke_full()
+    if(g_main_context_is_owner(context)) {
+        const gint64 begin = source_stats_begin();
+
+        while(func(data))
+            ;
+
+        source_stats_end(name, begin);
+
+        if(notify)
+            notify(data);
+        return;
+    }
+
+    source = g_idle_source_new();
+    g_source_set_priority(source, priority);
+    source_stats_set_callback(source, name, func, data, notify);
+    g_source_attach(source, context);
+    g_source_unref(source);
+}
+
+const gchar* source_stats_get_main_current(void)
+{
+    return g_atomic_pointer_get(&stats_main_current);
+}
+
+static gint source_stats_compare(gconstpointer a, gconstpointer b)
+{
+    const SourceStats* sa = *(const SourceStats* const*)a;
+    const SourceStats* sb = *(const SourceStats* const*)b;
+
+    // Busiest first
+    if(sa->wakeups != sb->wakeups)
+        return sa->wakeups < sb->wakeups ? 1 : -1;
+
+    return g_strcmp0(sa->name, sb->name);
+}
+
+gchar* source_stats_dump(void)
+{
+    GString* out = g_string_new(NULL);
+    GPtrArray* sorted = g_ptr_array_new();
+    GHashTableIter iter;
+    SourceStats* stats;
+    gdouble elapsed;
+    guint64 total_wakeups = 0;
+    gint64 total_cpu_time = 0;
+
+    g_mutex_lock(&stats_lock);
+
+    g_hash_table_iter_init(&iter, source_stats_table());
+    while(g_hash_table_iter_next(&iter, NULL, (gpointer*)&stats))
+        g_ptr_array_add(sorted, stats);
+
+    g_ptr_array_sort(sorted, source_stats_compare);
+
+    elapsed = MAX(g_get_monotonic_time() - stats_start_time, 1) / (gdouble)G_USEC_PER_SEC;
+
+    g_string_append_printf(out, "%-32s %12s %10s %12s\n", "Source", "Wakeups", "Wakeups/s", "CPU ms");
+
+    for(guint i = 0; i < sorted->len; i++) {
+        stats = g_ptr_array_index(sorted, i);
+
+        g_string_append_printf(out, "%-32s %12" G_GUINT64_FORMAT " %10.3f %12.3f\n", stats->name, stats->wakeups, stats->wakeups / elapsed, stats->cpu_time / 1000.0);
+
+        total_wakeups += stats->wakeups;
+        total_cpu_time += stats->cpu_time;
+    }
+
+    g_string_append_printf(out, "%-32s %12" G_GUINT64_FORMAT " %10.3f %12.3f\n", "Total", total_wakeups, total_wakeups / elapsed, total_cpu_time / 1000.0);
+    g_string_append_printf(out, "Over the last %.0f seconds\n", elapsed);
+
+    g_mutex_unlock(&stats_lock);
+
+    g_ptr_array_free(sorted, TRUE);
+
+    return g_string_free(out, FALSE);
+}
@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * source-stats.h -- Wakeup and CPU time accounting for event sources
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef SOURCE_STATS_H_
+#define SOURCE_STATS_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Every source is accounted under a name, which must be a string literal.
+ * Sources with the same name are added up.
+ */
+
+/**
+ * Like g_timeout_add(), with accounting.
+ */
+guint source_stats_timeout_add(const gchar* name, guint interval, GSourceFunc func, gpointer data);
+
+/**
+ * Like g_timeout_add_seconds(), with accounting.
+ */
+guint source_stats_timeout_add_seconds(const gchar* name, guint interval, GSourceFunc func, gpointer data);
+
+/**
+ * Like g_idle_add_full(), with accounting.
+ */
+guint source_stats_idle_add(const gchar* name, gint priority, GSourceFunc func, gpointer data);
+
+/**
+ * Like g_source_set_callback(), with accounting. Also names the source.
+ */
+void source_stats_set_callback(GSource* source, const gchar* name, GSourceFunc func, gpointer data, GDestroyNotify notify);
+
+/**
+ * Like g_main_context_invoke_full(), with accounting.
+ */
+void source_stats_invoke(GMainContext* context, const gchar* name, gint priority, GSourceFunc func, gpointer data, GDestroyNotify notify);
+
+/**
+ * Name of the source currently being dispatched on the main thread, or NULL
+ * if none or if it isn't accounted. May be called from any thread.
+ */
+const gchar* source_stats_get_main_current(void);
+
+/**
+ * Account for a wakeup that isn't a GSource, such as a thread waiting on a
+ * condition. Call source_stats_begin() when woken up, and pass its result to
+ * source_stats_end() when about to sleep again. May be called from any thread.
+ */
+gint64 source_stats_begin(void);
+
+void source_stats_end(const gchar* name, gint64 begin);
+
+/**
+ * Format the wakeups and CPU time of every source as a table.
+ *
+ * Free with g_free().
+ */
+gchar* source_stats_dump(void);
+
+G_END_DECLS
+
+#endif /*SOURCE_STATS_H_*/
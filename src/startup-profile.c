@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * startup-profile.c -- Per phase timing of application startup
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <config.h>
+#include "startup-profile.h"
+
+/*
+ * Every mark stores the monotonic time and the number of bytes allocated on
+ * the heap at that point. The phase ending at a mark is the difference to the
+ * previous one. Marks only ever happen on the main thread, during startup.
+ * The resident set size is only read once, when startup is finished.
+ */
+
+#define STARTUP_PROFILE_MAX_MARKS 32
+
+typedef struct {
+    const gchar* name;
+    gint64 time; // µs, monotonic
+    gint64 heap; // Bytes in use, -1 if unknown
+} StartupProfileMark;
+
+static StartupProfileMark profile_marks[STARTUP_PROFILE_MAX_MARKS];
+static guint profile_n_marks = 0;
+static gboolean profile_enabled = FALSE;
+static gint64 profile_rss = -1; // Bytes resident at the last mark, -1 if unknown
+
+static gint64 startup_profile_heap(void)
+{
+#ifdef __GLIBC__
+#if __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 mi = mallinfo2();
+    return (gint64)(mi.uordblks + mi.hblkhd);
+#else
+    struct mallinfo mi = mallinfo();
+    return (gint64)(guint)mi.uordblks + (guint)mi.hblkhd;
+#endif
+#else
+    return -1;
+#endif
+}
+
+static gint64 startup_profile_rss(void)
+{
+    gchar* statm = NULL;
+    guint64 pages = 0;
+    gint64 rss = -1;
+
+    // Second field: resident pages
+    if(g_file_get_contents("/proc/self/statm", &statm, NULL, NULL) && sscanf(statm, "%*u %" G_GUINT64_FORMAT, &pages) == 1)
+        rss = (gint64)pages * sysconf(_SC_PAGESIZE);
+
+    g_free(statm);
+    return rss;
+}
+
+static void startup_profile_record(const gchar* name)
+{
+    StartupProfileMark* mark;
+
+    if(profile_n_marks == STARTUP_PROFILE_MAX_MARKS) {
+        g_warning("StartupProfile: Too many marks, dropping '%s'", name);
+        return;
+    }
+
+    mark = &profile_marks[profile_n_marks++];
+    mark->name = name;
+    mark->time = g_get_monotonic_time();
+    mark->heap = startup_profile_heap();
+}
+
+void startup_profile_begin(void)
+{
+    profile_n_marks = 0;
+    startup_profile_record("start");
+}
+
+void startup_profile_enable(void)
+{
+    profile_enabled = TRUE;
+}
+
+gboolean startup_profile_enabled(void)
+{
+    return profile_enabled;
+}
+
+void startup_profile_mark(const gchar* name)
+{
+    if(!profile_enabled)
+        return;
+
+    startup_profile_record(name);
+}
+
+static void startup_profile_print(void)
+{
+    const StartupProfileMark* first = &profile_marks[0];
+    const StartupProfileMark* last = &profile_marks[profile_n_marks - 1];
+
+    g_print("%-24s %10s %10s %12s\n", "Phase", "ms", "Total ms", "Heap KiB");
+
+    for(guint i = 1; i < profile_n_marks; i++) {
+        const StartupProfileMark* prev = &profile_marks[i - 1];
+        const StartupProfileMark* mark = &profile_marks[i];
+
+        g_print("%-24s %10.2f %10.2f %+12.1f\n", mark->name, (mark->time - prev->time) / 1000.0, (mark->time - first->time) / 1000.0,
+                (mark->heap < 0 || prev->heap < 0) ? 0.0 : (mark->heap - prev->heap) / 1024.0);
+    }
+
+    g_print("%-24s %10s %10.2f %12.1f\n", "Total", "", (last->time - first->time) / 1000.0, last->heap < 0 ? 0.0 : last->heap / 1024.0);
+
+    if(profile_rss >= 0)
+        g_print("%-24s %10s %10s %12.1f\n", "Resident KiB", "", "", profile_rss / 1024.0);
+}
+
+static gchar* startup_profile_to_json(guint n_alarms)
+{
+    const StartupProfileMark* first = &profile_marks[0];
+    const StartupProfileMark* last = &profile_marks[profile_n_marks - 1];
+    GString* json = g_string_new("{\n");
+
+    // Phase names are literals from our own code, so they need no escaping
+    g_string_append_printf(json, "  \"version\": \"%s\",\n", VERSION);
+    g_string_append_printf(json, "  \"alarms\": %u,\n", n_alarms);
+    g_string_append_printf(json, "  \"total_us\": %" G_GINT64_FORMAT ",\n", last->time - first->time);
+    g_string_append_printf(json, "  \"heap_bytes\": %" G_GINT64_FORMAT ",\n", last->heap);
+    g_string_append_printf(json, "  \"rss_bytes\": %" G_GINT64_FORMAT ",\n", profile_rss);
+    g_string_append(json, "  \"phases\": [\n");
+
+    for(guint i = 1; i < profile_n_marks; i++) {
+        const StartupProfileMark* prev = &profile_marks[i - 1];
+        const StartupProfileMark* mark = &profile_marks[i];
+
+        g_string_append_printf(json,
+                               "    { \"name\": \"%s\", \"start_us\": %" G_GINT64_FORMAT ", \"duration_us\": %" G_GINT64_FORMAT
+                               ", \"heap_bytes\": %" G_GINT64_FORMAT ", \"heap_delta\": %" G_GINT64_FORMAT " }%s\n",
+                               mark->name, prev->time - first->time, mark->time - prev->time, mark->heap,
+                               (mark->heap < 0 || prev->heap < 0) ? 0 : mark->heap - prev->heap, i + 1 < profile_n_marks ? "," : "");
+    }
+
+    g_string_append(json, "  ]\n}\n");
+
+    return g_string_free(json, FALSE);
+}
+
+void startup_profile_finish(const gchar* name, guint n_alarms)
+{
+    GError* error = NULL;
+    gchar *dir, *path, *json;
+
+    if(!profile_enabled)
+        return;
+
+    startup_profile_record(name);
+    profile_rss = startup_profile_rss();
+    profile_enabled = FALSE;
+
+    startup_profile_print();
+
+    dir = g_build_filename(g_get_user_cache_dir(), PACKAGE, NULL);
+    g_mkdir_with_parents(dir, 0700);
+    path = g_build_filename(dir, "startup-profile.json", NULL);
+    g_free(dir);
+
+    json = startup_profile_to_json(n_alarms);
+
+    if(g_file_set_contents(path, json, -1, &error)) {
+        g_print("Startup profile saved to %s\n", path);
+    } else {
+        g_warning("StartupProfile: Could not save %s: %s", path, error->message);
+        g_error_free(error);
+    }
+
+    g_free(json);
+    g_free(path);
+}
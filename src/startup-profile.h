@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * startup-profile.h -- Per phase timing of application startup
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef STARTUP_PROFILE_H_
+#define STARTUP_PROFILE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * Remember when the process started. Call first thing in main().
+ */
+void startup_profile_begin(void);
+
+/**
+ * Record phases from now on, as requested with --profile-startup.
+ */
+void startup_profile_enable(void);
+
+gboolean startup_profile_enabled(void);
+
+/**
+ * Record the end of a phase, which started at the previous mark.
+ *
+ * name must be a string literal. Does nothing unless enabled.
+ */
+void startup_profile_mark(const gchar* name);
+
+/**
+ * Record the last phase, print the breakdown and save it as JSON to
+ * $XDG_CACHE_HOME/alarm-clock-applet/startup-profile.json.
+ *
+ * n_alarms is saved along with the phases, as is the resident set size at
+ * this point where /proc is available. Does nothing unless enabled.
+ */
+void startup_profile_finish(const gchar* name, guint n_alarms);
+
+G_END_DECLS
+
+#endif /*STARTUP_PROFILE_H_*/
@@ -0,0 +1,205 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * trace.c -- In-process ring buffer of scheduling events
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <signal.h>
+#include <glib.h>
+#include <glib-unix.h>
+
+#include <config.h>
+#include "trace.h"
+
+/*
+ * Events are written into a fixed ring, overwriting the oldest ones. Writers
+ * claim a slot by atomically incrementing trace_head, and publish it by
+ * setting its sequence number last. The reader copies a slot and only keeps
+ * it if the sequence number was the expected one both before and after, so
+ * nobody ever waits for a lock and slots overwritten mid-read are dropped.
+ */
+
+typedef struct {
+    gint seq; // Index of the event + 1, 0 while being written
+    gint type;
+    gint alarm_id;
+    gint tid;
+    gint64 time;       // µs, monotonic
+    gint64 arg;        // Duration for spans
+    const gchar* name; // Spans only
+} TraceSlot;
+
+typedef struct {
+    const gchar* name;
+    const gchar* cat;
+    const gchar* arg; // Name of the argument, NULL if unused
+    gboolean span;    // Has a duration and a name instead of an argument
+} TraceEventInfo;
+
+static const TraceEventInfo event_info[TRACE_N_EVENTS] = {
+    [TRACE_ALARM_ARM] = { "arm", "scheduler", "timestamp" },
+    [TRACE_ALARM_REARM] = { "re-arm", "scheduler", "timestamp" },
+    [TRACE_ALARM_DISARM] = { "disarm", "scheduler", NULL },
+    [TRACE_ALARM_FIRE] = { "fire", "scheduler", "timestamp" },
+    [TRACE_ALARM_SNOOZE] = { "snooze", "alarm", "seconds" },
+    [TRACE_ALARM_CLEAR] = { "clear", "alarm", NULL },
+    [TRACE_ALARM_TIMESTAMP] = { "timestamp", "alarm", "timestamp" },
+    [TRACE_PLAYER_STATE] = { "player state", "player", "state" },
+    [TRACE_COMMAND_SPAWN] = { "command spawn", "command", "result" },
+    [TRACE_COMMAND_EXIT] = { "command exit", "command", "status" },
+    [TRACE_MAIN_LOOP_STALL] = { "main loop stall", "watchdog", NULL, TRUE },
+};
+
+static TraceSlot trace_ring[TRACE_RING_SIZE];
+static gint trace_head = 0;     // Number of events recorded, wraps around
+static gint trace_next_tid = 0; // Last thread id handed out
+static GPrivate trace_tid;
+
+G_STATIC_ASSERT((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0);
+
+static gint trace_thread_id(void)
+{
+    gint tid = GPOINTER_TO_INT(g_private_get(&trace_tid));
+
+    if(tid == 0) {
+        tid = g_atomic_int_add(&trace_next_tid, 1) + 1;
+        g_private_set(&trace_tid, GINT_TO_POINTER(tid));
+    }
+
+    return tid;
+}
+
+static void trace_record(TraceEventType type, gint alarm_id, const gchar* name, gint64 time, gint64 arg)
+{
+    const guint index = (guint)g_atomic_int_add(&trace_head, 1);
+    TraceSlot* slot = &trace_ring[index & (TRACE_RING_SIZE - 1)];
+
+    g_atomic_int_set(&slot->seq, 0);
+
+    slot->type = type;
+    slot->alarm_id = alarm_id;
+    slot->tid = trace_thread_id();
+    slot->time = time;
+    slot->arg = arg;
+    slot->name = name;
+
+    g_atomic_int_set(&slot->seq, (gint)(index + 1));
+}
+
+void trace_event(TraceEventType type, gint alarm_id, gint64 arg)
+{
+    trace_record(type, alarm_id, NULL, g_get_monotonic_time(), arg);
+}
+
+void trace_span(TraceEventType type, const gchar* name, gint64 start, gint64 duration)
+{
+    trace_record(type, -1, name, start, duration);
+}
+
+gchar* trace_dump_json(void)
+{
+    const guint head = (guint)g_atomic_int_get(&trace_head);
+    const guint start = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+    GString* json = g_string_new(NULL);
+
+    g_string_append(json, "{\"traceEvents\":[\n");
+    g_string_append_printf(json, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"%s\"}}", PACKAGE);
+
+    for(guint i = start; i != head; i++) {
+        const TraceSlot* slot = &trace_ring[i & (TRACE_RING_SIZE - 1)];
+        const gint seq = (gint)(i + 1);
+        const TraceEventInfo* info;
+        gboolean first = TRUE;
+        TraceSlot copy;
+
+        if(g_atomic_int_get(&slot->seq) != seq)
+            continue;
+
+        copy = *slot;
+
+        // Overwritten while copying
+        if(g_atomic_int_get(&slot->seq) != seq || copy.type < 0 || copy.type >= TRACE_N_EVENTS)
+            continue;
+
+        info = &event_info[copy.type];
+
+        if(info->span) {
+            g_string_append_printf(json, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ",\"pid\":1,\"tid\":%d,\"args\":{\"source\":\"%s\"}}",
+                                   info->name, info->cat, copy.time, copy.arg, copy.tid, copy.name ? copy.name : "unknown");
+            continue;
+        }
+
+        g_string_append_printf(json, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" G_GINT64_FORMAT ",\"pid\":1,\"tid\":%d,\"args\":{", info->name, info->cat,
+                               copy.time, copy.tid);
+
+        if(copy.alarm_id >= 0) {
+            g_string_append_printf(json, "\"alarm\":%d", copy.alarm_id);
+            first = FALSE;
+        }
+        if(info->arg)
+            g_string_append_printf(json, "%s\"%s\":%" G_GINT64_FORMAT, first ? "" : ",", info->arg, copy.arg);
+
+        g_string_append(json, "}}");
+    }
+
+    // Lets the monotonic timestamps be matched to the wall clock
+    g_string_append_printf(json, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"version\":\"%s\",\"monotonic_us\":%" G_GINT64_FORMAT ",\"real_us\":%" G_GINT64_FORMAT "}}\n", VERSION,
+                           g_get_monotonic_time(), g_get_real_time());
+
+    return g_string_free(json, FALSE);
+}
+
+gchar* trace_dump_to_file(GError** error)
+{
+    GDateTime* now = g_date_time_new_now_local();
+    gchar* stamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+    gchar* name = g_strdup_printf("trace-%s.json", stamp);
+    gchar* dir = g_build_filename(g_get_user_cache_dir(), PACKAGE, NULL);
+    gchar* path = g_build_filename(dir, name, NULL);
+    gchar* json = trace_dump_json();
+
+    g_mkdir_with_parents(dir, 0700);
+
+    if(!g_file_set_contents(path, json, -1, error)) {
+        g_free(path);
+        path = NULL;
+    }
+
+    g_free(json);
+    g_free(dir);
+    g_free(name);
+    g_free(stamp);
+    g_date_time_unref(now);
+
+    return path;
+}
+
+static gboolean trace_signal_cb(gpointer data)
+{
+    GError* error = NULL;
+    gchar* path = trace_dump_to_file(&error);
+
+    if(path) {
+        g_print("Trace written to %s\n", path);
+        g_free(path);
+    } else {
+        g_warning("Trace: Could not write trace: %s", error->message);
+        g_error_free(error);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+void trace_init(void)
+{
+    static gboolean initialized = FALSE;
+
+    if(initialized)
+        return;
+
+    initialized = TRUE;
+
+    // This runs from the main loop, not the signal handler
+    g_source_set_name_by_id(g_unix_signal_add(SIGUSR1, trace_signal_cb, NULL), "trace-signal");
+}
@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * trace.h -- In-process ring buffer of scheduling events
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+    TRACE_ALARM_ARM,       // arg: timestamp
+    TRACE_ALARM_REARM,     // arg: timestamp
+    TRACE_ALARM_DISARM,
+    TRACE_ALARM_FIRE,      // arg: timestamp
+    TRACE_ALARM_SNOOZE,    // arg: seconds
+    TRACE_ALARM_CLEAR,
+    TRACE_ALARM_TIMESTAMP, // arg: new timestamp
+    TRACE_PLAYER_STATE,    // arg: MediaPlayerState
+    TRACE_COMMAND_SPAWN,   // arg: 0, or -1 if it could not be launched
+    TRACE_COMMAND_EXIT,    // arg: exit status, or -signal
+    TRACE_MAIN_LOOP_STALL, // Span, named after the blocking source
+    TRACE_N_EVENTS,
+} TraceEventType;
+
+/*
+ * Number of events kept, must be a power of two
+ */
+#define TRACE_RING_SIZE 4096
+
+/**
+ * Record an event. alarm_id is -1 for events that don't belong to an alarm.
+ *
+ * Lock-free and cheap enough to call from any thread at any time.
+ */
+void trace_event(TraceEventType type, gint alarm_id, gint64 arg);
+
+/**
+ * Record an event that lasted from start for duration µs, on the monotonic
+ * clock. name must be a string literal, or at least outlive the program.
+ */
+void trace_span(TraceEventType type, const gchar* name, gint64 start, gint64 duration);
+
+/**
+ * Format the recorded events as Chrome trace JSON, which Perfetto and
+ * chrome://tracing can open.
+ *
+ * Free with g_free().
+ */
+gchar* trace_dump_json(void);
+
+/**
+ * Write the recorded events to
+ * $XDG_CACHE_HOME/alarm-clock-applet/trace-<time>.json.
+ *
+ * Returns the path, free with g_free(), or NULL on error.
+ */
+gchar* trace_dump_to_file(GError** error);
+
+/**
+ * Dump the recorded events to a file whenever SIGUSR1 is received.
+ */
+void trace_init(void);
+
+G_END_DECLS
+
+#endif /*TRACE_H_*/
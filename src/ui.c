@@ -8,22 +8,27 @@
 
 #include <time.h>
 #include <string.h>
-#include <libnotify/notify.h>
 
 #include "alarm-applet.h"
 #include "alarm-actions.h"
+#include "source-stats.h"
 #include "ui.h"
 
 enum {
     GICON_COL,
     TEXT_COL,
+    KEY_COL,
+    KIND_COL,
     N_COLUMNS,
 };
 
 static void alarm_applet_status_init(AlarmApplet* applet);
 
 /*
- * Load a user interface by name
+ * Load a user interface definition
+ *
+ * Each window has its own file and builder, so that only what's about to be
+ * shown has to be parsed and constructed.
  */
 GtkBuilder* alarm_applet_ui_load(const char* name, AlarmApplet* applet)
 {
@@ -67,84 +72,214 @@ void display_error_dialog(const gchar* message, const gchar* secondary_text, Gtk
     gtk_widget_destroy(dialog);
 }
 
-static gboolean is_separator(GtkTreeModel* model, GtkTreeIter* iter, gpointer sep_index)
+/*
+ * Combo box models {{
+ *
+ * The sounds and apps combo boxes share one long-lived GtkListStore each. The
+ * item rows are followed by a separator and a "custom" row, and are kept in
+ * sync with the applet's lists by only touching the rows that changed. Each
+ * store keeps an index of its item rows by key, so that finding the row of a
+ * sound or command doesn't need to walk the model.
+ */
+
+#define COMBO_MODEL_INDEX "combo-model-index"
+
+typedef struct {
+    const gchar* key; // Sound URI or command
+    gchar* text;
+    GIcon* icon;
+} ComboModelRow;
+
+static GHashTable* combo_icons = NULL; // icon string -> GIcon
+
+static GIcon* combo_icon_lookup(const gchar* name)
+{
+    GIcon* icon;
+
+    if(!name)
+        return NULL;
+
+    if(!combo_icons)
+        combo_icons = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+
+    if(!(icon = g_hash_table_lookup(combo_icons, name))) {
+        icon = g_icon_new_for_string(name, NULL);
+        if(icon)
+            g_hash_table_insert(combo_icons, g_strdup(name), icon);
+    }
+
+    return icon;
+}
+
+static gboolean is_separator(GtkTreeModel* model, GtkTreeIter* iter, gpointer data)
+{
+    gint kind;
+
+    gtk_tree_model_get(model, iter, KIND_COL, &kind, -1);
+
+    return kind == COMBO_ROW_SEPARATOR;
+}
+
+static GtkListStore* combo_model_new(const gchar* custom_label)
 {
-    GtkTreePath* path;
-    gboolean result;
+    GtkListStore* store = gtk_list_store_new(N_COLUMNS, G_TYPE_ICON, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INT);
+
+    g_object_set_data_full(G_OBJECT(store), COMBO_MODEL_INDEX, g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)gtk_tree_iter_free), (GDestroyNotify)g_hash_table_unref);
 
-    path = gtk_tree_model_get_path(model, iter);
-    result = gtk_tree_path_get_indices(path)[0] == GPOINTER_TO_INT(sep_index);
-    gtk_tree_path_free(path);
+    gtk_list_store_insert_with_values(store, NULL, -1, KIND_COL, COMBO_ROW_SEPARATOR, -1);
+    gtk_list_store_insert_with_values(store, NULL, -1, TEXT_COL, custom_label, KIND_COL, COMBO_ROW_CUSTOM, -1);
 
-    return result;
+    return store;
+}
+
+static void combo_model_set_row(GtkListStore* store, GtkTreeIter* iter, const ComboModelRow* row)
+{
+    GtkTreeModel* model = GTK_TREE_MODEL(store);
+    GIcon* icon;
+    gchar* text;
+
+    gtk_tree_model_get(model, iter, GICON_COL, &icon, TEXT_COL, &text, -1);
+
+    if(icon != row->icon || g_strcmp0(text, row->text) != 0)
+        gtk_list_store_set(store, iter, GICON_COL, row->icon, TEXT_COL, row->text, -1);
+
+    if(icon)
+        g_object_unref(icon);
+    g_free(text);
 }
 
 /*
- * Shamelessly stolen from gnome-da-capplet.c
+ * Bring the item rows of store in line with rows, in order
  */
-void fill_combo_box(GtkComboBox* combo_box, GList* list, const gchar* custom_label)
+static void combo_model_sync(GtkListStore* store, GPtrArray* rows)
 {
-    GList* l;
-    GtkTreeModel* model;
-    GtkCellRenderer* renderer;
+    GtkTreeModel* model = GTK_TREE_MODEL(store);
+    GHashTable* index = g_object_get_data(G_OBJECT(store), COMBO_MODEL_INDEX);
+    GHashTable* wanted = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTable* placed = g_hash_table_new(g_str_hash, g_str_equal);
     GtkTreeIter iter;
+    gchar* key;
+    gint kind;
 
-    g_debug("fill_combo_box... %d", g_list_length(list));
+    for(guint i = 0; i < rows->len; i++)
+        g_hash_table_add(wanted, (gpointer)((ComboModelRow*)g_ptr_array_index(rows, i))->key);
 
-    gtk_combo_box_set_row_separator_func(combo_box, is_separator, GINT_TO_POINTER(g_list_length(list)), NULL);
+    // The separator always follows the items, so iter is always valid here
+    gtk_tree_model_get_iter_first(model, &iter);
 
-    model = GTK_TREE_MODEL(gtk_list_store_new(2, G_TYPE_ICON, G_TYPE_STRING));
-    gtk_combo_box_set_model(combo_box, model);
+    for(guint i = 0; i < rows->len; i++) {
+        const ComboModelRow* row = g_ptr_array_index(rows, i);
+        GtkTreeIter* existing;
 
-    gtk_cell_layout_clear(GTK_CELL_LAYOUT(combo_box));
+        // Only the first row with a given key is shown
+        if(!g_hash_table_add(placed, (gpointer)row->key))
+            continue;
 
-    renderer = gtk_cell_renderer_pixbuf_new();
+        // Drop rows that are gone
+        for(;;) {
+            gtk_tree_model_get(model, &iter, KEY_COL, &key, KIND_COL, &kind, -1);
 
-    /* not all cells have a pixbuf, this prevents the combo box from shrinking */
-    gtk_cell_renderer_set_fixed_size(renderer, -1, 22);
-    gtk_cell_layout_pack_start(GTK_CELL_LAYOUT(combo_box), renderer, FALSE);
-    gtk_cell_layout_set_attributes(GTK_CELL_LAYOUT(combo_box), renderer, "gicon", GICON_COL, NULL);
+            if(kind != COMBO_ROW_ITEM || g_hash_table_contains(wanted, key))
+                break;
 
-    renderer = gtk_cell_renderer_text_new();
-    gtk_cell_layout_pack_start(GTK_CELL_LAYOUT(combo_box), renderer, TRUE);
-    gtk_cell_layout_set_attributes(GTK_CELL_LAYOUT(combo_box), renderer, "text", TEXT_COL, NULL);
+            g_hash_table_remove(index, key);
+            gtk_list_store_remove(store, &iter);
+            g_free(key);
+        }
 
-    for(l = list; l != NULL; l = g_list_next(l)) {
-        void* entry = l->data;
+        if(kind == COMBO_ROW_ITEM && strcmp(key, row->key) == 0) {
+            // Already in place
+            combo_model_set_row(store, &iter, row);
+            gtk_tree_model_iter_next(model, &iter);
+        } else if((existing = g_hash_table_lookup(index, row->key))) {
+            // Moved up
+            gtk_list_store_move_before(store, existing, &iter);
+            combo_model_set_row(store, existing, row);
+        } else {
+            GtkTreeIter added;
+
+            gtk_list_store_insert_before(store, &added, &iter);
+            gtk_list_store_set(store, &added, GICON_COL, row->icon, TEXT_COL, row->text, KEY_COL, row->key, KIND_COL, COMBO_ROW_ITEM, -1);
+            g_hash_table_insert(index, g_strdup(row->key), gtk_tree_iter_copy(&added));
+        }
 
-        gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-        if(G_IS_APP_INFO(entry))
-            gtk_list_store_set(GTK_LIST_STORE(model), &iter, GICON_COL, g_app_info_get_icon(entry), TEXT_COL, g_app_info_get_display_name(entry), -1);
-        else
-            g_error("Unknown data type in fill_combo_box");
+        g_free(key);
     }
 
-    gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-    gtk_list_store_set(GTK_LIST_STORE(model), &iter, -1);
-    gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-    gtk_list_store_set(GTK_LIST_STORE(model), &iter, GICON_COL, NULL, TEXT_COL, custom_label, -1);
+    // Drop whatever is left before the separator
+    for(;;) {
+        gtk_tree_model_get(model, &iter, KEY_COL, &key, KIND_COL, &kind, -1);
+
+        if(kind != COMBO_ROW_ITEM) {
+            g_free(key);
+            break;
+        }
+
+        g_hash_table_remove(index, key);
+        gtk_list_store_remove(store, &iter);
+        g_free(key);
+    }
+
+    g_hash_table_unref(placed);
+    g_hash_table_unref(wanted);
 }
 
-void fill_combo_box_custom_list(GtkComboBox* combo_box, GList* list, const gchar* custom_label)
+static void combo_model_row_free(ComboModelRow* row)
+{
+    g_free(row->text);
+    g_free(row);
+}
+
+/*
+ * Find the item row of key in a shared model
+ */
+gboolean combo_model_find(GtkTreeModel* model, const gchar* key, GtkTreeIter* iter)
+{
+    GHashTable* index = g_object_get_data(G_OBJECT(model), COMBO_MODEL_INDEX);
+    GtkTreeIter* found;
+
+    if(!key || !(found = g_hash_table_lookup(index, key)))
+        return FALSE;
+
+    *iter = *found;
+
+    return TRUE;
+}
+
+/*
+ * Get the kind and key of the active row of a combo box with a shared model.
+ *
+ * key may be NULL. Free *key with g_free().
+ */
+ComboRowKind combo_box_get_active_row(GtkComboBox* combo_box, gchar** key)
 {
-    GList* l;
-    GtkTreeModel* model;
-    GtkCellRenderer* renderer;
     GtkTreeIter iter;
-    AlarmListEntry* entry;
+    gint kind = COMBO_ROW_NONE;
+
+    if(key)
+        *key = NULL;
+
+    if(gtk_combo_box_get_active_iter(combo_box, &iter))
+        gtk_tree_model_get(gtk_combo_box_get_model(combo_box), &iter, KIND_COL, &kind, key ? KEY_COL : -1, key, -1);
 
-    g_debug("fill_combo_box... %d", g_list_length(list));
+    return kind;
+}
 
-    gtk_combo_box_set_row_separator_func(combo_box, is_separator, GINT_TO_POINTER(g_list_length(list)), NULL);
+/*
+ * Attach a shared model to a combo box
+ */
+void combo_box_set_shared_model(GtkComboBox* combo_box, GtkListStore* store)
+{
+    GtkCellRenderer* renderer;
 
-    model = GTK_TREE_MODEL(gtk_list_store_new(2, G_TYPE_ICON, G_TYPE_STRING));
-    gtk_combo_box_set_model(combo_box, model);
+    gtk_combo_box_set_row_separator_func(combo_box, is_separator, NULL, NULL);
+    gtk_combo_box_set_model(combo_box, GTK_TREE_MODEL(store));
 
     gtk_cell_layout_clear(GTK_CELL_LAYOUT(combo_box));
 
     renderer = gtk_cell_renderer_pixbuf_new();
 
-    /* not all cells have a pixbuf, this prevents the combo box to shrink */
+    /* not all cells have a pixbuf, this prevents the combo box from shrinking */
     gtk_cell_renderer_set_fixed_size(renderer, -1, 22);
     gtk_cell_layout_pack_start(GTK_CELL_LAYOUT(combo_box), renderer, FALSE);
     gtk_cell_layout_set_attributes(GTK_CELL_LAYOUT(combo_box), renderer, "gicon", GICON_COL, NULL);
@@ -152,68 +287,270 @@ void fill_combo_box_custom_list(GtkComboBox* combo_box, GList* list, const gchar
     renderer = gtk_cell_renderer_text_new();
     gtk_cell_layout_pack_start(GTK_CELL_LAYOUT(combo_box), renderer, TRUE);
     gtk_cell_layout_set_attributes(GTK_CELL_LAYOUT(combo_box), renderer, "text", TEXT_COL, NULL);
+}
 
-    for(l = list; l != NULL; l = g_list_next(l)) {
-        GIcon* icon;
+/*
+ * Update the shared sounds model, if it has been created
+ */
+void alarm_applet_sounds_model_update(AlarmApplet* applet)
+{
+    GPtrArray* rows;
+
+    if(!applet->sounds_model)
+        return;
 
-        entry = (AlarmListEntry*)l->data;
-        icon = g_icon_new_for_string(entry->icon, NULL);
+    rows = g_ptr_array_new_with_free_func((GDestroyNotify)combo_model_row_free);
 
-        gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-        gtk_list_store_set(GTK_LIST_STORE(model), &iter, GICON_COL, icon, TEXT_COL, entry->name, -1);
+    for(GList* l = applet->sounds; l != NULL; l = l->next) {
+        AlarmListEntry* entry = (AlarmListEntry*)l->data;
+        ComboModelRow* row = g_new0(ComboModelRow, 1);
 
-        g_object_unref(icon);
+        row->key = entry->data;
+
+        // Flag sounds that won't play, and show the length of those that will
+        if(entry->playable == ALARM_LIST_ENTRY_UNPLAYABLE) {
+            row->icon = combo_icon_lookup("dialog-warning");
+            row->text = g_strdup_printf(_("%s (cannot be played)"), entry->name);
+        } else if(entry->duration >= GST_SECOND) {
+            const guint64 secs = entry->duration / GST_SECOND;
+
+            row->icon = combo_icon_lookup(entry->icon);
+            row->text = g_strdup_printf("%s (%" G_GUINT64_FORMAT ":%02u)", entry->name, secs / 60, (guint)(secs % 60));
+        } else {
+            row->icon = combo_icon_lookup(entry->icon);
+            row->text = g_strdup(entry->name);
+        }
+
+        g_ptr_array_add(rows, row);
     }
 
-    gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-    gtk_list_store_set(GTK_LIST_STORE(model), &iter, -1);
-    gtk_list_store_append(GTK_LIST_STORE(model), &iter);
-    gtk_list_store_set(GTK_LIST_STORE(model), &iter, GICON_COL, NULL, TEXT_COL, custom_label, -1);
+    combo_model_sync(applet->sounds_model, rows);
+
+    g_ptr_array_unref(rows);
 }
 
-/**
- * Show a notification
+/*
+ * Update the shared apps model, if it has been created
  */
-void alarm_applet_notification_show(AlarmApplet* applet, const gchar* summary, const gchar* body, const gchar* icon)
+void alarm_applet_apps_model_update(AlarmApplet* applet)
+{
+    GPtrArray* rows;
+
+    if(!applet->apps_model)
+        return;
+
+    rows = g_ptr_array_new_with_free_func((GDestroyNotify)combo_model_row_free);
+
+    for(GList* l = applet->apps; l != NULL; l = l->next) {
+        GAppInfo* app = G_APP_INFO(l->data);
+        const gchar* command = ALARM_APPLET_GET_APP_INFO_COMMAND(app);
+        ComboModelRow* row = g_new0(ComboModelRow, 1);
+
+        row->key = command;
+        row->icon = g_app_info_get_icon(app);
+        row->text = g_strdup(g_app_info_get_display_name(app));
 
+        g_ptr_array_add(rows, row);
+    }
+
+    combo_model_sync(applet->apps_model, rows);
+
+    g_ptr_array_unref(rows);
+}
+
+/*
+ * Get the shared sounds model, creating it on first use
+ */
+GtkListStore* alarm_applet_sounds_model_get(AlarmApplet* applet)
 {
-    NotifyNotification* n;
+    if(!applet->sounds_model) {
+        applet->sounds_model = combo_model_new(_("Select sound file..."));
+        alarm_applet_sounds_model_update(applet);
+    }
+
+    return applet->sounds_model;
+}
+
+/*
+ * Get the shared apps model, creating it on first use
+ */
+GtkListStore* alarm_applet_apps_model_get(AlarmApplet* applet)
+{
+    if(!applet->apps_model) {
+        applet->apps_model = combo_model_new(_("Custom command..."));
+        alarm_applet_apps_model_update(applet);
+    }
+
+    return applet->apps_model;
+}
+
+/*
+ * }} Combo box models
+ */
+
+/*
+ * Notifications {{
+ *
+ * Alarms that go off within NOTIFY_BATCH_INTERVAL of each other are collected
+ * into a single notification, which is updated in place until it is closed.
+ * The notification server is called asynchronously on the main context, one
+ * call at a time, since each call needs the ID returned by the previous one.
+ */
+
+#define NOTIFY_BATCH_INTERVAL 250 // ms
+#define NOTIFY_MAX_MESSAGES   5   // Messages listed in the notification body
+
+#define NOTIFY_BUS_NAME  "org.freedesktop.Notifications"
+#define NOTIFY_PATH      "/org/freedesktop/Notifications"
+#define NOTIFY_INTERFACE "org.freedesktop.Notifications"
+
+static void alarm_applet_notification_flush(AlarmApplet* applet);
+
+static void alarm_applet_notification_closed(GDBusConnection* connection, const gchar* sender_name, const gchar* object_path, const gchar* interface_name, const gchar* signal_name, GVariant* parameters, gpointer data)
+{
+    AlarmApplet* applet = (AlarmApplet*)data;
+    guint32 id;
+
+    g_variant_get(parameters, "(uu)", &id, NULL);
+
+    if(id == 0 || id != applet->notify_id)
+        return;
+
+    // Start over with the next alarm
+    applet->notify_id = 0;
+    g_ptr_array_set_size(applet->notify_messages, 0);
+    applet->notify_count = 0;
+}
+
+static void alarm_applet_notification_show_done(GObject* source_object, GAsyncResult* res, gpointer user_data)
+{
+    AlarmApplet* applet = (AlarmApplet*)user_data;
     GError* error = NULL;
+    GVariant* ret;
 
-    n = notify_notification_new(summary, body, icon);
+    ret = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
 
-    if(!notify_notification_show(n, &error)) {
+    if(ret) {
+        g_variant_get(ret, "(u)", &applet->notify_id);
+        g_variant_unref(ret);
+    } else {
         g_warning("Failed to send notification: %s", error->message);
         g_error_free(error);
     }
 
-    g_object_unref(G_OBJECT(n));
+    applet->notify_in_flight = FALSE;
+
+    if(applet->notify_dirty)
+        alarm_applet_notification_flush(applet);
 }
 
-void alarm_applet_label_update(AlarmApplet* applet)
+/*
+ * Update the notification with all alarms so far and show it
+ */
+static void alarm_applet_notification_flush(AlarmApplet* applet)
 {
-    GList* l;
-    Alarm* a;
-    Alarm* next_alarm = NULL;
-    struct tm tm;
-    gchar* tmp;
+    GDBusConnection* connection;
+    GString* body;
+    gchar* summary;
+    const gchar* icon;
 
-    GVariant* state = g_action_get_state(G_ACTION(applet->action_toggle_show_label));
-    if(!state)
+    if(applet->notify_in_flight) {
+        // The ID to replace isn't known until the server has replied
+        applet->notify_dirty = TRUE;
         return;
+    }
 
-    gboolean show_label = g_variant_get_boolean(state);
-    g_variant_unref(state);
+    applet->notify_dirty = FALSE;
 
+    if(applet->notify_count == 0)
+        return;
 
-    if(!show_label) {
-        app_indicator_set_label(applet->app_indicator, NULL, NULL);
+    connection = g_application_get_dbus_connection(G_APPLICATION(applet->application));
+    if(!connection) {
+        g_critical("Could not show a notification without a session bus!");
         return;
     }
 
-    //
-    // Show countdown
-    //
+    /* Follow the notification being closed from the first one on */
+    if(!applet->notify_closed_id)
+        applet->notify_closed_id = g_dbus_connection_signal_subscribe(connection, NOTIFY_BUS_NAME, NOTIFY_INTERFACE, "NotificationClosed", NOTIFY_PATH, NULL, G_DBUS_SIGNAL_FLAGS_NONE, alarm_applet_notification_closed, applet, NULL);
+
+    body = g_string_new(NULL);
+
+    if(applet->notify_count == 1) {
+        summary = g_strdup(g_ptr_array_index(applet->notify_messages, 0));
+    } else {
+        summary = g_strdup_printf(ngettext("%u alarm", "%u alarms", applet->notify_count), applet->notify_count);
+
+        for(guint i = 0; i < applet->notify_messages->len; i++)
+            g_string_append_printf(body, "%s\n", (const gchar*)g_ptr_array_index(applet->notify_messages, i));
+
+        if(applet->notify_count > applet->notify_messages->len) {
+            const guint more = applet->notify_count - applet->notify_messages->len;
+            g_string_append_printf(body, ngettext("and %u more\n", "and %u more\n", more), more);
+        }
+
+        g_string_append_c(body, '\n');
+    }
+
+    g_string_append(body, _("You can snooze or stop alarms from the Alarm Clock menu."));
+    icon = applet->notify_timers_only ? TIMER_ICON : ALARM_ICON;
+
+    applet->notify_in_flight = TRUE;
+
+    g_dbus_connection_call(connection, NOTIFY_BUS_NAME, NOTIFY_PATH, NOTIFY_INTERFACE, "Notify",
+                           g_variant_new("(susssasa{sv}i)", PACKAGE_NAME, applet->notify_id, icon, summary, body->str, NULL, NULL, -1),
+                           G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL, alarm_applet_notification_show_done, applet);
+
+    g_free(summary);
+    g_string_free(body, TRUE);
+}
+
+static gboolean alarm_applet_notification_batch_timeout(gpointer data)
+{
+    AlarmApplet* applet = (AlarmApplet*)data;
+
+    applet->notify_batch_id = 0;
+    alarm_applet_notification_flush(applet);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * Queue a notification for a triggered alarm
+ */
+void alarm_applet_notification_queue(AlarmApplet* applet, Alarm* alarm)
+{
+    if(!applet->notify_messages)
+        applet->notify_messages = g_ptr_array_new_with_free_func(g_free);
+
+    if(applet->notify_count == 0)
+        applet->notify_timers_only = TRUE;
+
+    applet->notify_count++;
+    applet->notify_timers_only &= (alarm->type == ALARM_TYPE_TIMER);
+
+    if(applet->notify_messages->len < NOTIFY_MAX_MESSAGES)
+        g_ptr_array_add(applet->notify_messages, g_strdup(alarm->message && *alarm->message ? alarm->message : _("Alarm!")));
+
+    if(applet->notify_batch_id == 0)
+        applet->notify_batch_id = source_stats_timeout_add("notification-batch", NOTIFY_BATCH_INTERVAL, alarm_applet_notification_batch_timeout, applet);
+}
+
+/*
+ * }} Notifications
+ */
+
+/*
+ * Countdown to the next active alarm, or NULL if there is none
+ */
+gchar* alarm_applet_label_get(AlarmApplet* applet)
+{
+    GList* l;
+    Alarm* a;
+    Alarm* next_alarm = NULL;
+    struct tm tm;
+
     for(l = applet->alarms; l; l = l->next) {
         a = ALARM(l->data);
         if(!a->active)
@@ -224,14 +561,34 @@ void alarm_applet_label_update(AlarmApplet* applet)
         }
     }
 
-    if(!next_alarm) {
-        // No upcoming alarms
+    if(!next_alarm)
+        return NULL;
+
+    alarm_get_remain(next_alarm, &tm);
+    return g_strdup_printf("%02d:%02d:%02d", tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+void alarm_applet_label_update(AlarmApplet* applet)
+{
+    gchar* tmp;
+
+    GVariant* state = g_action_get_state(G_ACTION(applet->action_toggle_show_label));
+    if(!state)
+        return;
+
+    gboolean show_label = g_variant_get_boolean(state);
+    g_variant_unref(state);
+
+
+    if(!show_label) {
         app_indicator_set_label(applet->app_indicator, NULL, NULL);
         return;
     }
 
-    alarm_get_remain(next_alarm, &tm);
-    tmp = g_strdup_printf("%02d:%02d:%02d", tm.tm_hour, tm.tm_min, tm.tm_sec);
+    //
+    // Show countdown, or nothing if there are no upcoming alarms
+    //
+    tmp = alarm_applet_label_get(applet);
     app_indicator_set_label(applet->app_indicator, tmp, NULL);
     g_free(tmp);
 }
@@ -251,25 +608,36 @@ static gboolean alarm_applet_ui_update(AlarmApplet* applet)
 
 void alarm_applet_ui_init(AlarmApplet* applet)
 {
-    /* Load UI with GtkBuilder */
-    applet->ui = alarm_applet_ui_load("alarm-clock.ui", applet);
+    /* Load status menu UI with GtkBuilder, windows are loaded on first use */
+    applet->ui = alarm_applet_ui_load("status-menu.ui", applet);
 
 
     /* Initialize status icon */
     alarm_applet_status_init(applet);
 
-    /* Initialize libnotify */
-    if(!notify_init(PACKAGE_NAME)) {
-        g_critical("Could not intialize libnotify!");
-    }
+    /* Initialize actions */
+    alarm_applet_actions_init(applet);
 
-    /* Initialize alarm list window */
-    applet->list_window = alarm_list_window_new(applet);
+    /* Initialize preferences */
+    prefs_init(applet);
 
-    /* Initialize alarm settings dialog */
-    applet->settings_dialog = alarm_settings_dialog_new(applet);
+    /* Set up UI updater */
+    alarm_applet_ui_update(applet);
+    source_stats_timeout_add_seconds("ui-update", 1, (GSourceFunc)alarm_applet_ui_update, applet);
+}
+
+/*
+ * Load CSS, once the first window is about to be shown
+ */
+static void alarm_applet_css_init(void)
+{
+    static gboolean loaded = FALSE;
+
+    if(loaded)
+        return;
+
+    loaded = TRUE;
 
-    /* Load CSS */
     GtkCssProvider* css = gtk_css_provider_new();
     gchar* css_filename = alarm_applet_get_data_path("alarm-clock.css");
 
@@ -279,19 +647,58 @@ void alarm_applet_ui_init(AlarmApplet* applet)
     css_filename = NULL;
 
     gtk_style_context_add_provider_for_screen(gdk_screen_get_default(), GTK_STYLE_PROVIDER(css), GTK_STYLE_PROVIDER_PRIORITY_USER);
+    g_object_unref(css);
+}
 
-    /* Connect signals */
-    // gtk_builder_connect_signals (applet->ui, applet);
+/**
+ * Get the alarm list window, building it on first use
+ */
+AlarmListWindow* alarm_applet_list_window_get(AlarmApplet* applet)
+{
+    if(applet->list_window)
+        return applet->list_window;
 
-    /* Initialize actions */
-    alarm_applet_actions_init(applet);
+    alarm_applet_css_init();
+
+    /* Initialize alarm list window */
+    applet->list_window = alarm_list_window_new(applet);
+
+    /* Initialize actions on the window */
+    alarm_applet_actions_win_init(applet);
+
+    return applet->list_window;
+}
+
+/**
+ * Get the alarm settings dialog, building it on first use
+ */
+AlarmSettingsDialog* alarm_applet_settings_dialog_get(AlarmApplet* applet)
+{
+    if(applet->settings_dialog)
+        return applet->settings_dialog;
+
+    alarm_applet_css_init();
+
+    /* Initialize alarm settings dialog */
+    applet->settings_dialog = alarm_settings_dialog_new(applet);
+
+    return applet->settings_dialog;
+}
+
+/**
+ * Get the preferences dialog, building it on first use
+ */
+GtkDialog* alarm_applet_prefs_dialog_get(AlarmApplet* applet)
+{
+    if(applet->prefs_dialog)
+        return applet->prefs_dialog;
+
+    alarm_applet_css_init();
 
     /* Initialize preferences dialog */
-    prefs_init(applet);
+    prefs_dialog_init(applet);
 
-    /* Set up UI updater */
-    alarm_applet_ui_update(applet);
-    g_timeout_add_seconds(1, (GSourceFunc)alarm_applet_ui_update, applet);
+    return applet->prefs_dialog;
 }
 
 /*
@@ -327,7 +734,7 @@ void alarm_applet_status_menu_edit_cb(GtkMenuItem* menuitem, gpointer user_data)
 {
     AlarmApplet* applet = (AlarmApplet*)user_data;
 
-    alarm_list_window_show(applet->list_window);
+    alarm_list_window_show(alarm_applet_list_window_get(applet));
 }
 
 void alarm_applet_status_menu_prefs_cb(GtkMenuItem* menuitem, gpointer user_data)
@@ -343,7 +750,17 @@ void alarm_applet_status_menu_about_cb(GtkMenuItem* menuitem, gpointer user_data
     gchar* title;
 
     gboolean visible;
-    GtkAboutDialog* dialog = GTK_ABOUT_DIALOG(gtk_builder_get_object(applet->ui, "about-dialog"));
+    GtkAboutDialog* dialog;
+
+    if(!applet->about_dialog) {
+        GtkBuilder* builder = alarm_applet_ui_load("about-dialog.ui", applet);
+
+        alarm_applet_css_init();
+        applet->about_dialog = GTK_ABOUT_DIALOG(gtk_builder_get_object(builder, "about-dialog"));
+        g_object_unref(builder);
+    }
+
+    dialog = applet->about_dialog;
 
     g_object_get(dialog, "visible", &visible, NULL);
 
@@ -418,8 +835,6 @@ void alarm_applet_alarm_changed(GObject* object, GParamSpec* pspec, gpointer dat
 void alarm_applet_alarm_triggered(Alarm* alarm, gpointer data)
 {
     AlarmApplet* applet = (AlarmApplet*)data;
-    gchar *summary, *body;
-    const gchar* icon;
 
     g_debug("AlarmApplet: Alarm '%s' triggered", alarm->message);
 
@@ -427,13 +842,7 @@ void alarm_applet_alarm_triggered(Alarm* alarm, gpointer data)
     applet->n_triggered++;
 
     // Show notification
-    summary = g_strdup_printf("%s", alarm->message);
-    body = g_strdup_printf(_("You can snooze or stop alarms from the Alarm Clock menu."));
-    icon = (alarm->type == ALARM_TYPE_TIMER) ? TIMER_ICON : ALARM_ICON;
-    alarm_applet_notification_show(applet, summary, body, icon);
-
-    g_free(summary);
-    g_free(body);
+    alarm_applet_notification_queue(applet, alarm);
 
     // Update status icon
     alarm_applet_status_update(applet);
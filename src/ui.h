@@ -15,22 +15,47 @@
 
 void display_error_dialog(const gchar* message, const gchar* secondary_text, GtkWindow* parent);
 
+gchar* alarm_applet_label_get(AlarmApplet* applet);
+
 void alarm_applet_label_update(AlarmApplet* applet);
 
 void alarm_applet_update_tooltip(AlarmApplet* applet);
 
 void alarm_applet_icon_update(AlarmApplet* applet);
 
-void fill_combo_box(GtkComboBox* combo_box, GList* list, const gchar* custom_label);
+typedef enum {
+    COMBO_ROW_NONE = -1,
+    COMBO_ROW_ITEM,
+    COMBO_ROW_SEPARATOR,
+    COMBO_ROW_CUSTOM,
+} ComboRowKind;
+
+void combo_box_set_shared_model(GtkComboBox* combo_box, GtkListStore* store);
+
+ComboRowKind combo_box_get_active_row(GtkComboBox* combo_box, gchar** key);
+
+gboolean combo_model_find(GtkTreeModel* model, const gchar* key, GtkTreeIter* iter);
+
+GtkListStore* alarm_applet_sounds_model_get(AlarmApplet* applet);
 
-void fill_combo_box_custom_list(GtkComboBox* combo_box, GList* list, const gchar* custom_label);
+void alarm_applet_sounds_model_update(AlarmApplet* applet);
 
-void alarm_applet_notification_show(AlarmApplet* applet, const gchar* summary, const gchar* body, const gchar* icon);
+GtkListStore* alarm_applet_apps_model_get(AlarmApplet* applet);
+
+void alarm_applet_apps_model_update(AlarmApplet* applet);
+
+void alarm_applet_notification_queue(AlarmApplet* applet, Alarm* alarm);
 
 void alarm_applet_ui_init(AlarmApplet* applet);
 
 GtkBuilder* alarm_applet_ui_load(const char* name, AlarmApplet* applet);
 
+AlarmListWindow* alarm_applet_list_window_get(AlarmApplet* applet);
+
+AlarmSettingsDialog* alarm_applet_settings_dialog_get(AlarmApplet* applet);
+
+GtkDialog* alarm_applet_prefs_dialog_get(AlarmApplet* applet);
+
 void alarm_applet_alarm_changed(GObject* object, GParamSpec* pspec, gpointer data);
 
 void alarm_applet_alarm_triggered(Alarm* alarm, gpointer data);
@@ -11,6 +11,7 @@
 #include <glib.h>
 #include <glib-object.h>
 #include "util.h"
+#include "wallclock.h"
 
 /**
  * Calculates the alarm timestamp given hour, min and secs.
@@ -20,7 +21,7 @@ time_t get_alarm_timestamp(guint hour, guint minute, guint second)
     time_t now;
     struct tm tm;
 
-    time(&now);
+    now = wallclock_now();
     tzset();
     if(!localtime_r(&now, &tm)) {
         memset(&tm, 0, sizeof(tm));
@@ -166,6 +167,61 @@ guint unblock_signal_handlers_by_name(gpointer instance, const gchar* signal_nam
     return g_signal_handlers_unblock_matched(instance, G_SIGNAL_MATCH_ID, signal_id, 0, NULL, NULL, NULL);
 }
 
+/**
+ * Parse a duration such as "90", "90s", "5m" or "1h30m" into seconds.
+ * A number without a unit is in seconds.
+ */
+gboolean parse_duration(const gchar* str, gint64* seconds)
+{
+    gint64 total = 0;
+
+    if(!str || !*str)
+        return FALSE;
+
+    while(*str) {
+        gchar* end;
+        guint64 n;
+        gint64 unit;
+
+        if(!g_ascii_isdigit(*str))
+            return FALSE;
+
+        n = g_ascii_strtoull(str, &end, 10);
+
+        switch(*end) {
+        case 'h':
+            unit = 3600;
+            end++;
+            break;
+        case 'm':
+            unit = 60;
+            end++;
+            break;
+        case 's':
+            end++;
+            /* fall through */
+        case '\0':
+            unit = 1;
+            break;
+        default:
+            return FALSE;
+        }
+
+        // Way beyond anything time_t can be set to
+        if(n > G_MAXINT32 || total + (gint64)n * unit > G_MAXINT32)
+            return FALSE;
+
+        total += n * unit;
+        str = end;
+    }
+
+    if(total == 0)
+        return FALSE;
+
+    *seconds = total;
+    return TRUE;
+}
+
 guint block_list(GList* instances, gpointer func)
 {
     guint blocked = 0;
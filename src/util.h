@@ -38,6 +38,11 @@ guint block_signal_handlers_by_name(gpointer instance, const gchar* signal_name)
 
 guint unblock_signal_handlers_by_name(gpointer instance, const gchar* signal_name);
 
+/**
+ * Parse a duration such as "90", "90s", "5m" or "1h30m" into seconds.
+ */
+gboolean parse_duration(const gchar* str, gint64* seconds);
+
 guint block_list(GList* instances, gpointer func);
 
 guint unblock_list(GList* instances, gpointer func);
@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * wallclock.c -- Wall clock used for scheduling, real or virtual
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include "wallclock.h"
+
+/*
+ * Everything that decides when an alarm fires reads the time from here, so
+ * tests and benchmarks can swap in a virtual clock and run through days of
+ * alarms, snoozes and DST changes without waiting for them. Time zone rules
+ * still come from the C library, so set TZ to simulate DST transitions.
+ */
+
+typedef struct {
+    WallclockNotifyFunc func;
+    gpointer data;
+} WallclockNotify;
+
+static gint wallclock_virtual = FALSE; // Atomic, checked before taking the lock
+static GMutex wallclock_lock;
+static gint64 wallclock_virtual_now = 0; // µs, protected by wallclock_lock
+static GArray* wallclock_notifies = NULL; // WallclockNotify, protected by wallclock_lock
+
+gint64 wallclock_now_us(void)
+{
+    gint64 now;
+
+    if(!g_atomic_int_get(&wallclock_virtual))
+        return g_get_real_time();
+
+    g_mutex_lock(&wallclock_lock);
+    now = wallclock_virtual_now;
+    g_mutex_unlock(&wallclock_lock);
+
+    return now;
+}
+
+time_t wallclock_now(void)
+{
+    if(!g_atomic_int_get(&wallclock_virtual))
+        return time(NULL);
+
+    return wallclock_now_us() / G_USEC_PER_SEC;
+}
+
+static void wallclock_notify(void)
+{
+    GArray* notifies;
+
+    // Listeners may read the clock, so call them without the lock
+    g_mutex_lock(&wallclock_lock);
+    if(wallclock_notifies) {
+        notifies = g_array_sized_new(FALSE, FALSE, sizeof(WallclockNotify), wallclock_notifies->len);
+        g_array_append_vals(notifies, wallclock_notifies->data, wallclock_notifies->len);
+    } else {
+        notifies = NULL;
+    }
+    g_mutex_unlock(&wallclock_lock);
+
+    if(!notifies)
+        return;
+
+    for(guint i = 0; i < notifies->len; i++) {
+        const WallclockNotify* notify = &g_array_index(notifies, WallclockNotify, i);
+        notify->func(notify->data);
+    }
+
+    g_array_unref(notifies);
+}
+
+void wallclock_set_virtual(gint64 now_us)
+{
+    g_mutex_lock(&wallclock_lock);
+    wallclock_virtual_now = now_us;
+    g_atomic_int_set(&wallclock_virtual, TRUE);
+    g_mutex_unlock(&wallclock_lock);
+
+    g_debug("Wallclock: Virtual time set to %" G_GINT64_FORMAT, now_us / G_USEC_PER_SEC);
+
+    wallclock_notify();
+}
+
+void wallclock_advance(gint64 delta_us)
+{
+    if(!g_atomic_int_get(&wallclock_virtual)) {
+        g_warning("Wallclock: Can not advance the real clock");
+        return;
+    }
+
+    g_mutex_lock(&wallclock_lock);
+    wallclock_virtual_now += delta_us;
+    g_mutex_unlock(&wallclock_lock);
+
+    wallclock_notify();
+}
+
+void wallclock_set_real(void)
+{
+    g_atomic_int_set(&wallclock_virtual, FALSE);
+
+    wallclock_notify();
+}
+
+gboolean wallclock_is_virtual(void)
+{
+    return g_atomic_int_get(&wallclock_virtual);
+}
+
+void wallclock_add_notify(WallclockNotifyFunc func, gpointer data)
+{
+    WallclockNotify notify = { func, data };
+
+    g_mutex_lock(&wallclock_lock);
+
+    if(!wallclock_notifies)
+        wallclock_notifies = g_array_new(FALSE, FALSE, sizeof(WallclockNotify));
+
+    g_array_append_val(wallclock_notifies, notify);
+
+    g_mutex_unlock(&wallclock_lock);
+}
@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * wallclock.h -- Wall clock used for scheduling, real or virtual
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef WALLCLOCK_H_
+#define WALLCLOCK_H_
+
+#include <time.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Called whenever the virtual clock is set or advanced, from the thread that
+ * did so.
+ */
+typedef void (*WallclockNotifyFunc)(gpointer data);
+
+/**
+ * Current time in seconds since the epoch. Use instead of time(NULL).
+ *
+ * May be called from any thread.
+ */
+time_t wallclock_now(void);
+
+/**
+ * Current time in µs since the epoch. Use instead of g_get_real_time().
+ *
+ * May be called from any thread.
+ */
+gint64 wallclock_now_us(void);
+
+/**
+ * Switch to a virtual clock that stands still at now_us, until advanced.
+ * Calling it again jumps the virtual clock to now_us.
+ */
+void wallclock_set_virtual(gint64 now_us);
+
+/**
+ * Move the virtual clock forward by delta_us. Does nothing on the real clock.
+ */
+void wallclock_advance(gint64 delta_us);
+
+/**
+ * Go back to the real clock.
+ */
+void wallclock_set_real(void);
+
+gboolean wallclock_is_virtual(void);
+
+/**
+ * Get notified when the virtual clock changes, so that anyone sleeping until
+ * a deadline can wake up.
+ */
+void wallclock_add_notify(WallclockNotifyFunc func, gpointer data);
+
+G_END_DECLS
+
+#endif /*WALLCLOCK_H_*/
@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * watchdog.c -- Main loop stall detector
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#include <glib.h>
+
+#include "watchdog.h"
+#include "metrics.h"
+#include "source-stats.h"
+#include "trace.h"
+
+/*
+ * The watchdog thread queues a high priority heartbeat on the main loop every
+ * WATCHDOG_INTERVAL and waits for it to be answered. If that takes longer than
+ * WATCHDOG_THRESHOLD, the main loop is stuck in a dispatch, so the watchdog
+ * looks up which source is being dispatched while it still is. The stall is
+ * recorded once the heartbeat finally gets through.
+ *
+ * The heartbeats wake up both threads, so the watchdog is off unless enabled
+ * in the settings. A disabled watchdog thread just sleeps.
+ */
+
+static GMutex watchdog_lock;
+static GCond watchdog_cond;
+static gint64 watchdog_answered = 0; // Time the last heartbeat was answered, protected by watchdog_lock
+static gboolean watchdog_enabled = FALSE; // Protected by watchdog_lock
+
+static gboolean watchdog_heartbeat(gpointer data)
+{
+    g_mutex_lock(&watchdog_lock);
+    watchdog_answered = g_get_monotonic_time();
+    g_cond_signal(&watchdog_cond);
+    g_mutex_unlock(&watchdog_lock);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gpointer watchdog_thread(gpointer data)
+{
+    g_mutex_lock(&watchdog_lock);
+
+    for(;;) {
+        const gchar* source = NULL;
+        gboolean stalled = FALSE;
+        gint64 sent, latency, next;
+
+        while(!watchdog_enabled)
+            g_cond_wait(&watchdog_cond, &watchdog_lock);
+
+        sent = g_get_monotonic_time();
+        watchdog_answered = 0;
+
+        g_mutex_unlock(&watchdog_lock);
+        source_stats_invoke(NULL, "watchdog-heartbeat", G_PRIORITY_HIGH, watchdog_heartbeat, NULL, NULL);
+        g_mutex_lock(&watchdog_lock);
+
+        while(!watchdog_answered) {
+            if(stalled) {
+                g_cond_wait(&watchdog_cond, &watchdog_lock);
+            } else if(!g_cond_wait_until(&watchdog_cond, &watchdog_lock, sent + WATCHDOG_THRESHOLD * 1000) && !watchdog_answered) {
+                // Still stuck, catch the culprit in the act
+                source = source_stats_get_main_current();
+                stalled = TRUE;
+            }
+        }
+
+        latency = watchdog_answered - sent;
+        metrics_observe(METRICS_MAIN_LOOP_LATENCY, latency);
+
+        if(stalled) {
+            g_debug("Watchdog: Main loop blocked for %" G_GINT64_FORMAT " ms in %s", latency / 1000, source ? source : "an unknown source");
+
+            metrics_count(METRICS_MAIN_LOOP_STALLS);
+            trace_span(TRACE_MAIN_LOOP_STALL, source, sent, latency);
+        }
+
+        // Wait out the rest of the interval
+        next = sent + WATCHDOG_INTERVAL * 1000;
+        while(g_get_monotonic_time() < next)
+            g_cond_wait_until(&watchdog_cond, &watchdog_lock, next);
+    }
+
+    return NULL;
+}
+
+static void watchdog_settings_changed(GSettings* settings, gchar* key, gpointer user_data)
+{
+    static gboolean started = FALSE;
+    const gboolean enabled = g_settings_get_boolean(settings, "watchdog");
+
+    g_mutex_lock(&watchdog_lock);
+    watchdog_enabled = enabled;
+    g_cond_signal(&watchdog_cond);
+    g_mutex_unlock(&watchdog_lock);
+
+    if(enabled && !started) {
+        started = TRUE;
+        g_thread_unref(g_thread_new("watchdog", watchdog_thread, NULL));
+    }
+}
+
+void watchdog_init(GSettings* settings)
+{
+    g_signal_connect(settings, "changed::watchdog", G_CALLBACK(watchdog_settings_changed), NULL);
+
+    watchdog_settings_changed(settings, NULL, NULL);
+}
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * watchdog.h -- Main loop stall detector
+ *
+ * Copyright (C) 2022 Tasos Sahanidis <code@tasossah.com>
+ */
+
+#ifndef WATCHDOG_H_
+#define WATCHDOG_H_
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/*
+ * How often the main loop is sent a heartbeat, in milliseconds.
+ */
+#define WATCHDOG_INTERVAL 1000
+
+/*
+ * Heartbeats answered later than this count as a stall, in milliseconds.
+ */
+#define WATCHDOG_THRESHOLD 250
+
+/**
+ * Run the watchdog thread while the watchdog key is set, and follow any
+ * changes.
+ *
+ * Stalls are logged, recorded in the trace buffer along with the source that
+ * was being dispatched, and counted in the metrics.
+ */
+void watchdog_init(GSettings* settings);
+
+G_END_DECLS
+
+#endif /*WATCHDOG_H_*/